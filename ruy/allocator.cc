@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "ruy/allocator.h"
 
+#include "ruy/check_macros.h"
 #include "ruy/system_aligned_alloc.h"
 
 namespace ruy {
@@ -55,4 +56,27 @@ void Allocator::FreeAll() {
   fallback_blocks_total_size_ = 0;
 }
 
+void Allocator::Reserve(std::ptrdiff_t num_bytes) {
+  RUY_DCHECK_EQ(current_, 0);
+  RUY_DCHECK(fallback_blocks_.empty());
+  const std::ptrdiff_t rounded_num_bytes =
+      round_up_pot(num_bytes, detail::kMinimumBlockAlignment);
+  if (rounded_num_bytes <= size_) {
+    return;
+  }
+  detail::SystemAlignedFree(ptr_);
+  ptr_ = detail::SystemAlignedAlloc(rounded_num_bytes);
+  size_ = rounded_num_bytes;
+}
+
+void Allocator::Prefault() {
+  // The smallest page size of the platforms that we care about. Touching
+  // larger pages more than once is harmless.
+  static constexpr std::ptrdiff_t kPageSize = 4096;
+  volatile char* p = static_cast<volatile char*>(ptr_);
+  for (std::ptrdiff_t offset = 0; offset < size_; offset += kPageSize) {
+    p[offset] = 0;
+  }
+}
+
 }  // namespace ruy
@@ -83,6 +83,19 @@ class Allocator final {
 
   void FreeAll();
 
+  // Makes the internal buffer at least num_bytes large, so that a later
+  // sequence of allocations totalling up to that size doesn't need to call
+  // into the system allocator. Must be called while nothing is allocated,
+  // i.e. right after construction or FreeAll.
+  void Reserve(std::ptrdiff_t num_bytes);
+
+  // Writes to every page of the internal buffer, so that the page faults
+  // that the operating system defers to the first access to freshly
+  // allocated memory happen now rather than in the middle of a later
+  // computation. This also places the pages on the NUMA node of the calling
+  // thread, under the usual first-touch policy.
+  void Prefault();
+
  private:
   void operator=(const Allocator&) = delete;
   void* AllocateSlow(std::ptrdiff_t num_bytes);
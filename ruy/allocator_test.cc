@@ -15,7 +15,11 @@ limitations under the License.
 
 #include "ruy/allocator.h"
 
+#include <cstddef>
+
 #include "ruy/gtest_wrapper.h"
+#include "ruy/size_util.h"
+#include "ruy/system_aligned_alloc.h"
 
 namespace ruy {
 namespace {
@@ -94,6 +98,33 @@ TEST(AllocatorTest, DestructorHandlesFallbackBlocks) {
   allocator.AllocateBytes(1);
 }
 
+TEST(AllocatorTest, ReserveAvoidsFallbackBlocks) {
+  // This is a white-box test.
+  Allocator allocator;
+  constexpr int kAllocationSize = 1000;
+  constexpr int kNumAllocations = 10;
+  const std::ptrdiff_t rounded_size =
+      round_up_pot(kAllocationSize, detail::kMinimumBlockAlignment);
+  allocator.Reserve(kNumAllocations * rounded_size);
+  allocator.Prefault();
+  // With enough room reserved, all the allocations are bump-ptr allocations
+  // out of the same buffer, so they are consecutive.
+  char *first;
+  allocator.Allocate(kAllocationSize, &first);
+  for (int i = 1; i < kNumAllocations; i++) {
+    char *p;
+    allocator.Allocate(kAllocationSize, &p);
+    EXPECT_EQ(p, first + i * rounded_size);
+  }
+  allocator.FreeAll();
+  // Reserving less than the current size keeps the existing buffer.
+  allocator.Reserve(kAllocationSize);
+  char *p;
+  allocator.Allocate(kAllocationSize, &p);
+  EXPECT_EQ(p, first);
+  allocator.FreeAll();
+}
+
 }  // namespace
 }  // namespace ruy
 
@@ -24,8 +24,9 @@ limitations under the License.
 namespace ruy {
 
 // Applies the quantized multiplier to the `*accum` accumulator value, if
-// applicable, that is, if AccumScalar==int32 and DstScalar!=int32. Otherwise,
-// does nothing.
+// applicable, that is, if AccumScalar==int32 and DstScalar is neither int32
+// nor floating-point. Otherwise, does nothing. Dequantizing to a
+// floating-point destination uses the float_multiplier of MulParams instead.
 //
 // This is slow, portable, 'reference' code. It should only be used in
 // ReferenceMul and in Path::kStandardCpp. There isn't a point in optimizing it,
@@ -63,12 +64,15 @@ std::int32_t MultiplyByQuantizedMultiplier(std::int32_t x,
 
 // Helper to apply a fixed-point multiplier.  Only 'applicable' if AccumScalar
 // is int32 (i.e. in all cases except floating-point) and if the destination is
-// not int32 (i.e. unless the user wants to get raw accumulators).
+// not int32 (i.e. unless the user wants to get raw accumulators) nor
+// floating-point (i.e. unless the user wants dequantized values).
 template <typename MulParamsType,
-          bool IsApplicable = std::is_same<typename MulParamsType::AccumScalar,
-                                           std::int32_t>::value &&
-                              !std::is_same<typename MulParamsType::DstScalar,
-                                            std::int32_t>::value>
+          bool IsApplicable =
+              std::is_same<typename MulParamsType::AccumScalar,
+                           std::int32_t>::value &&
+              !std::is_same<typename MulParamsType::DstScalar,
+                            std::int32_t>::value &&
+              !std::is_floating_point<typename MulParamsType::DstScalar>::value>
 struct ApplyMultiplierImpl {};
 
 // Specialization in non-applicable case: do nothing, just check that values
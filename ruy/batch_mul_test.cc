@@ -0,0 +1,251 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "ruy/context.h"
+#include "ruy/context_get_ctx.h"
+#include "ruy/ctx.h"
+#include "ruy/gtest_wrapper.h"
+#include "ruy/matrix.h"
+#include "ruy/mul_params.h"
+#include "ruy/ruy.h"
+
+namespace ruy {
+namespace {
+
+struct Shape {
+  int rows;
+  int depth;
+  int cols;
+};
+
+// Storage for the operands of one Mul, plus a second destination buffer
+// receiving the result of an individual ruy::Mul, for comparison.
+struct Operands {
+  std::vector<std::int8_t> lhs_data;
+  std::vector<std::int8_t> rhs_data;
+  std::vector<std::int32_t> dst_data;
+  std::vector<std::int32_t> expected_data;
+  Matrix<std::int8_t> lhs;
+  Matrix<std::int8_t> rhs;
+  Matrix<std::int32_t> dst;
+  Matrix<std::int32_t> expected;
+};
+
+void MakeOperands(const Shape& shape, Order dst_order, std::mt19937* generator,
+                  Operands* operands) {
+  std::uniform_int_distribution<int> dist(-128, 127);
+  operands->lhs_data.resize(shape.rows * shape.depth);
+  operands->rhs_data.resize(shape.depth * shape.cols);
+  operands->dst_data.assign(shape.rows * shape.cols, 0);
+  operands->expected_data.assign(shape.rows * shape.cols, 0);
+  for (auto& x : operands->lhs_data) x = dist(*generator);
+  for (auto& x : operands->rhs_data) x = dist(*generator);
+  MakeSimpleLayout(shape.rows, shape.depth, Order::kRowMajor,
+                   operands->lhs.mutable_layout());
+  MakeSimpleLayout(shape.depth, shape.cols, Order::kColMajor,
+                   operands->rhs.mutable_layout());
+  MakeSimpleLayout(shape.rows, shape.cols, dst_order,
+                   operands->dst.mutable_layout());
+  MakeSimpleLayout(shape.rows, shape.cols, dst_order,
+                   operands->expected.mutable_layout());
+  operands->lhs.set_data(operands->lhs_data.data());
+  operands->rhs.set_data(operands->rhs_data.data());
+  operands->dst.set_data(operands->dst_data.data());
+  operands->expected.set_data(operands->expected_data.data());
+}
+
+// Tests BatchMul against individual Mul's. When `prepacked_cache_bytes` is
+// nonzero, the Context's prepacked cache is given that budget, and the LHS
+// matrices get the given cache policy.
+void TestBatchMul(const std::vector<Shape>& shapes, int max_num_threads,
+                  CachePolicy lhs_cache_policy = CachePolicy::kNeverCache,
+                  int prepacked_cache_bytes = 0) {
+  using MulParamsType = MulParams<std::int32_t, std::int32_t>;
+  using Item =
+      BatchMulItem<std::int8_t, std::int8_t, std::int32_t, MulParamsType>;
+
+  std::mt19937 generator(1);
+  const int batch_size = shapes.size();
+  std::vector<Operands> operands(batch_size);
+  std::vector<Item> items(batch_size);
+  MulParamsType mul_params;
+  for (int i = 0; i < batch_size; i++) {
+    const Order dst_order = i % 3 == 2 ? Order::kRowMajor : Order::kColMajor;
+    MakeOperands(shapes[i], dst_order, &generator, &operands[i]);
+    operands[i].lhs.set_cache_policy(lhs_cache_policy);
+    items[i].lhs = &operands[i].lhs;
+    items[i].rhs = &operands[i].rhs;
+    items[i].mul_params = &mul_params;
+    items[i].dst = &operands[i].dst;
+  }
+
+  Context context;
+  context.set_max_num_threads(max_num_threads);
+  if (prepacked_cache_bytes) {
+    get_ctx(&context)->ResetPrepackedCache(prepacked_cache_bytes);
+  }
+  BatchMul(items.data(), batch_size, &context);
+  for (int i = 0; i < batch_size; i++) {
+    operands[i].lhs.set_cache_policy(CachePolicy::kNeverCache);
+    Mul(operands[i].lhs, operands[i].rhs, mul_params, &context,
+        &operands[i].expected);
+    EXPECT_EQ(operands[i].dst_data, operands[i].expected_data)
+        << "batch item " << i;
+  }
+}
+
+void TestStridedBatchMul(const Shape& shape, int batch_size,
+                         int rhs_batch_stride, Order dst_order,
+                         CachePolicy lhs_cache_policy, int max_num_threads) {
+  using MulParamsType = MulParams<std::int32_t, std::int32_t>;
+  std::mt19937 generator(1);
+  std::uniform_int_distribution<int> dist(-128, 127);
+  const int dst_batch_stride = shape.rows * shape.cols + 3;
+  std::vector<std::int8_t> lhs_data(shape.rows * shape.depth);
+  std::vector<std::int8_t> rhs_data(rhs_batch_stride * (batch_size - 1) +
+                                    shape.depth * shape.cols);
+  std::vector<std::int32_t> dst_data(dst_batch_stride * batch_size, 0);
+  std::vector<std::int32_t> expected_data(dst_data.size(), 0);
+  for (auto& x : lhs_data) x = dist(generator);
+  for (auto& x : rhs_data) x = dist(generator);
+
+  Matrix<std::int8_t> lhs;
+  MakeSimpleLayout(shape.rows, shape.depth, Order::kRowMajor,
+                   lhs.mutable_layout());
+  lhs.set_data(lhs_data.data());
+  lhs.set_cache_policy(lhs_cache_policy);
+  Matrix<std::int8_t> rhs;
+  MakeSimpleLayout(shape.depth, shape.cols, Order::kColMajor,
+                   rhs.mutable_layout());
+  rhs.set_data(rhs_data.data());
+  Matrix<std::int32_t> dst;
+  MakeSimpleLayout(shape.rows, shape.cols, dst_order, dst.mutable_layout());
+  dst.set_data(dst_data.data());
+
+  Context context;
+  context.set_max_num_threads(max_num_threads);
+  MulParamsType mul_params;
+  // Run twice, to exercise the case where the packed LHS is already cached.
+  for (int repeat = 0; repeat < 2; repeat++) {
+    StridedBatchMul(lhs, rhs, rhs_batch_stride, mul_params, batch_size,
+                    &context, &dst, dst_batch_stride);
+  }
+
+  lhs.set_cache_policy(CachePolicy::kNeverCache);
+  for (int i = 0; i < batch_size; i++) {
+    Matrix<std::int8_t> item_rhs = rhs;
+    item_rhs.set_data(rhs_data.data() + i * rhs_batch_stride);
+    Matrix<std::int32_t> item_dst = dst;
+    item_dst.set_data(expected_data.data() + i * dst_batch_stride);
+    Mul(lhs, item_rhs, mul_params, &context, &item_dst);
+  }
+  EXPECT_EQ(dst_data, expected_data);
+}
+
+std::vector<Shape> SmallShapes() {
+  std::vector<Shape> shapes;
+  for (int i = 0; i < 100; i++) {
+    shapes.push_back(Shape{1 + i % 17, 1 + i % 23, 1 + i % 13});
+  }
+  return shapes;
+}
+
+TEST(BatchMulTest, EmptyBatch) {
+  Context context;
+  BatchMul<std::int8_t, std::int8_t, std::int32_t,
+           MulParams<std::int32_t, std::int32_t>>(nullptr, 0, &context);
+}
+
+TEST(BatchMulTest, SmallItemsSingleThreaded) {
+  TestBatchMul(SmallShapes(), 1);
+}
+
+TEST(BatchMulTest, SmallItemsMultiThreaded) {
+  TestBatchMul(SmallShapes(), 4);
+}
+
+TEST(BatchMulTest, MixedSizes) {
+  std::vector<Shape> shapes = SmallShapes();
+  shapes.insert(shapes.begin() + 10, Shape{300, 200, 100});
+  shapes.push_back(Shape{64, 1000, 64});
+  for (int max_num_threads : {1, 4}) {
+    TestBatchMul(shapes, max_num_threads);
+  }
+}
+
+TEST(BatchMulTest, CachedLhsOverBudget) {
+  // Each packed LHS takes a few kilobytes, so the cache can hold only one of
+  // them, yet all must stay valid until the batch is done.
+  std::vector<Shape> shapes(8, Shape{40, 64, 4});
+  for (int max_num_threads : {1, 4}) {
+    TestBatchMul(shapes, max_num_threads, CachePolicy::kAlwaysCache, 4096);
+  }
+  shapes.insert(shapes.begin() + 3, Shape{300, 200, 100});
+  for (int max_num_threads : {1, 4}) {
+    TestBatchMul(shapes, max_num_threads, CachePolicy::kAlwaysCache, 4096);
+  }
+}
+
+TEST(StridedBatchMulTest, EmptyBatch) {
+  TestStridedBatchMul(Shape{10, 20, 30}, 0, 600, Order::kColMajor,
+                      CachePolicy::kNeverCache, 1);
+}
+
+TEST(StridedBatchMulTest, Small) {
+  for (int max_num_threads : {1, 4}) {
+    TestStridedBatchMul(Shape{7, 13, 5}, 50, 65, Order::kColMajor,
+                        CachePolicy::kNeverCache, max_num_threads);
+    TestStridedBatchMul(Shape{7, 13, 5}, 50, 70, Order::kRowMajor,
+                        CachePolicy::kNeverCache, max_num_threads);
+  }
+}
+
+TEST(StridedBatchMulTest, Large) {
+  for (int max_num_threads : {1, 4}) {
+    TestStridedBatchMul(Shape{150, 130, 70}, 5, 130 * 70 + 11,
+                        Order::kColMajor, CachePolicy::kNeverCache,
+                        max_num_threads);
+    TestStridedBatchMul(Shape{150, 130, 70}, 5, 130 * 70, Order::kRowMajor,
+                        CachePolicy::kNeverCache, max_num_threads);
+  }
+}
+
+TEST(StridedBatchMulTest, OverlappingRhs) {
+  // Each RHS starts one column after the previous one, as happens when
+  // sliding a window over a sequence.
+  TestStridedBatchMul(Shape{40, 30, 8}, 20, 30, Order::kColMajor,
+                      CachePolicy::kNeverCache, 4);
+}
+
+TEST(StridedBatchMulTest, CachedLhs) {
+  for (int max_num_threads : {1, 4}) {
+    TestStridedBatchMul(Shape{64, 200, 1}, 30, 200, Order::kColMajor,
+                        CachePolicy::kAlwaysCache, max_num_threads);
+    TestStridedBatchMul(Shape{150, 130, 70}, 4, 130 * 70, Order::kColMajor,
+                        CachePolicy::kAlwaysCache, max_num_threads);
+  }
+}
+
+}  // namespace
+}  // namespace ruy
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -13,11 +13,28 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <limits>
 #include <string>
+#include <vector>
 
+#include "ruy/block_map.h"
+#include "ruy/block_scheduling.h"
+#include "ruy/context.h"
+#include "ruy/context_get_ctx.h"
+#include "ruy/cpu_cache_size.h"
+#include "ruy/cpu_topology.h"
+#include "ruy/ctx.h"
+#include "ruy/quantize.h"
+#include "ruy/side_pair.h"
+#include "ruy/size_util.h"
 #include "ruy/test.h"
+#include "ruy/time.h"
+#include "ruy/warm_up.h"
 
 namespace ruy {
 
@@ -38,14 +55,22 @@ struct BenchmarkShape {
 
 template <typename TestSetType>
 std::vector<std::unique_ptr<TestResult<DstScalar>>> BenchmarkRCC(
-    const BenchmarkShape& shape) {
+    const BenchmarkShape& shape, int max_num_threads,
+    BlockScheduling block_scheduling) {
   TestSetType test_set;
+  test_set.max_num_threads = max_num_threads;
+  test_set.block_scheduling = block_scheduling;
   test_set.rows = shape.rows;
   test_set.depth = shape.depth;
   test_set.cols = shape.cols;
   test_set.lhs_order = Order::kRowMajor;
-  test_set.rhs_order = Order::kColMajor;
-  test_set.dst_order = Order::kColMajor;
+  // By default, this benchmarks the RCC case (row-major LHS, column-major RHS
+  // and destination). The RHS and destination orders can be overridden to
+  // measure the other storage orders.
+  test_set.rhs_order = GetBoolEnvVarOrFalse("ROW_MAJOR_RHS") ? Order::kRowMajor
+                                                             : Order::kColMajor;
+  test_set.dst_order = GetBoolEnvVarOrFalse("ROW_MAJOR_DST") ? Order::kRowMajor
+                                                             : Order::kColMajor;
   test_set.layout_style = LayoutStyle::kUnstridedLinear;
   test_set.benchmark = true;
   const int asymmetry_lhs = shape.symm_lhs ? 0 : 1;
@@ -81,10 +106,340 @@ std::vector<int> ParseCommaSeparatedInts(
   return result;
 }
 
+const char* BlockSchedulingName(BlockScheduling block_scheduling) {
+  switch (block_scheduling) {
+    case BlockScheduling::kSharedCounter:
+      return "shared-counter";
+    case BlockScheduling::kWorkStealing:
+      return "work-stealing";
+    case BlockScheduling::kTapered:
+      return "tapered";
+  }
+  return "?";
+}
+
+BlockScheduling GetBlockSchedulingFromEnv() {
+  const char* env = getenv("BLOCK_SCHEDULING");
+  if (!env || std::string(env) == BlockSchedulingName(
+                                      BlockScheduling::kSharedCounter)) {
+    return BlockScheduling::kSharedCounter;
+  }
+  if (std::string(env) ==
+      BlockSchedulingName(BlockScheduling::kWorkStealing)) {
+    return BlockScheduling::kWorkStealing;
+  }
+  if (std::string(env) == BlockSchedulingName(BlockScheduling::kTapered)) {
+    return BlockScheduling::kTapered;
+  }
+  fprintf(stderr,
+          "BLOCK_SCHEDULING must be \"shared-counter\", \"work-stealing\" "
+          "or \"tapered\".\n");
+  exit(EXIT_FAILURE);
+}
+
+// Thread-scaling mode: for each shape, measures each block scheduling
+// policy at each thread count from RUY_BENCHMARK_THREADS_LIST (default
+// 1,2,4,...,64). Thread counts above the number of hardware threads are
+// still run, as oversubscription is part of what is being measured. Thread
+// counts that are not powers of two, e.g. RUY_BENCHMARK_THREADS_LIST=3,6,12,24,
+// are measured both with and without non-power-of-two block grids (see
+// Context::set_non_pot_block_grids).
+void BenchmarkScaling(const std::vector<BenchmarkShape>& shapes) {
+  Ctx* ctx = get_ctx(&GlobalContext());
+  std::vector<int> thread_counts;
+  const char* threads_list_env = getenv("RUY_BENCHMARK_THREADS_LIST");
+  if (threads_list_env) {
+    thread_counts = ParseCommaSeparatedInts(threads_list_env);
+  } else {
+    for (int i = 1; i <= 64; i *= 2) {
+      thread_counts.push_back(i);
+    }
+  }
+  printf("path,shape,threads,scheduling,grid,Gop/s\n");
+  fflush(stdout);
+  for (const auto& shape : shapes) {
+    for (int thread_count : thread_counts) {
+      for (BlockScheduling block_scheduling :
+           {BlockScheduling::kSharedCounter, BlockScheduling::kWorkStealing,
+            BlockScheduling::kTapered}) {
+        for (bool non_pot_block_grids : {false, true}) {
+          if (non_pot_block_grids && is_pot(thread_count)) {
+            continue;
+          }
+          ctx->set_non_pot_block_grids(non_pot_block_grids);
+          const auto& results =
+              BenchmarkRCC<TestSetType>(shape, thread_count, block_scheduling);
+          for (const auto& result : results) {
+            printf("%s,%dx%dx%d,%d,%s,%s,%.4g\n", PathName(*result).c_str(),
+                   shape.rows, shape.depth, shape.cols, thread_count,
+                   BlockSchedulingName(block_scheduling),
+                   non_pot_block_grids ? "non-pot" : "pot",
+                   2.0e-9 * shape.rows * shape.cols * shape.depth /
+                       result->latency);
+          }
+          fflush(stdout);
+        }
+      }
+    }
+  }
+  ctx->set_non_pot_block_grids(true);
+}
+
+// Per-call overhead mode: for each shape, measures the latency of one Mul,
+// single-threaded and with up to max_num_threads threads. This is meant for
+// small shapes, where the time spent deciding how to run a Mul, and handing
+// it to the thread pool, is significant compared to the arithmetic, e.g.
+// RUY_BENCHMARK_CUBIC_LIST=4,8,16,32,64 THREADS=4.
+void BenchmarkOverhead(const std::vector<BenchmarkShape>& shapes,
+                       int max_num_threads, BlockScheduling block_scheduling) {
+  std::vector<int> thread_counts = {1};
+  if (max_num_threads > 1) {
+    thread_counts.push_back(max_num_threads);
+  }
+  printf("path,shape,threads,latency_us\n");
+  fflush(stdout);
+  for (const auto& shape : shapes) {
+    for (int thread_count : thread_counts) {
+      const auto& results =
+          BenchmarkRCC<TestSetType>(shape, thread_count, block_scheduling);
+      for (const auto& result : results) {
+        printf("%s,%dx%dx%d,%d,%.4g\n", PathName(*result).c_str(), shape.rows,
+               shape.depth, shape.cols, thread_count, 1.0e6 * result->latency);
+      }
+      fflush(stdout);
+    }
+  }
+}
+
+// Runs one Mul of the given shape on the given context, returning its
+// latency in seconds. The contents of the matrices don't matter here.
+float TimeOneMul(const BenchmarkShape& shape, Context* context) {
+  std::vector<LhsScalar> lhs_data(shape.rows * shape.depth);
+  std::vector<RhsScalar> rhs_data(shape.depth * shape.cols);
+  std::vector<DstScalar> dst_data(shape.rows * shape.cols);
+  Matrix<LhsScalar> lhs;
+  MakeSimpleLayout(shape.rows, shape.depth, Order::kRowMajor,
+                   lhs.mutable_layout());
+  lhs.set_data(lhs_data.data());
+  Matrix<RhsScalar> rhs;
+  MakeSimpleLayout(shape.depth, shape.cols, Order::kColMajor,
+                   rhs.mutable_layout());
+  rhs.set_data(rhs_data.data());
+  Matrix<DstScalar> dst;
+  MakeSimpleLayout(shape.rows, shape.cols, Order::kColMajor,
+                   dst.mutable_layout());
+  dst.set_data(dst_data.data());
+  MulParams<AccumScalar, DstScalar> mul_params;
+  const TimePoint start = Now();
+  Mul(lhs, rhs, mul_params, context, &dst);
+  return ToFloatSeconds(Now() - start);
+}
+
+float Median(std::vector<float> values) {
+  std::nth_element(values.begin(), values.begin() + values.size() / 2,
+                   values.end());
+  return values[values.size() / 2];
+}
+
+// First-call mode: for each shape, measures the latency of the first Mul on
+// a fresh Context, with and without a preceding Context::WarmUp sized for
+// that shape, against the steady-state latency of the following Muls. Each
+// is the median over several fresh Contexts, since first calls are noisy.
+void BenchmarkFirstCall(const std::vector<BenchmarkShape>& shapes,
+                        int max_num_threads) {
+  static constexpr int kRepeats = 5;
+  static constexpr int kSteadyStateIters = 10;
+  const bool prefault = !GetBoolEnvVarOrFalse("NO_PREFAULT");
+  printf(
+      "shape,threads,first_call_us,warm_up_us,first_call_after_warm_up_us,"
+      "steady_state_us\n");
+  fflush(stdout);
+  for (const auto& shape : shapes) {
+    std::vector<float> first_call, warm_up, first_call_after_warm_up,
+        steady_state;
+    for (int r = 0; r < kRepeats; r++) {
+      {
+        Context context;
+        context.set_max_num_threads(max_num_threads);
+        first_call.push_back(TimeOneMul(shape, &context));
+      }
+      Context context;
+      context.set_max_num_threads(max_num_threads);
+      WarmUpParams warm_up_params;
+      warm_up_params.max_rows = shape.rows;
+      warm_up_params.max_depth = shape.depth;
+      warm_up_params.max_cols = shape.cols;
+      warm_up_params.scalar_size =
+          static_cast<int>(std::max(sizeof(LhsScalar), sizeof(RhsScalar)));
+      warm_up_params.prefault_arenas = prefault;
+      const TimePoint start = Now();
+      context.WarmUp(warm_up_params);
+      warm_up.push_back(ToFloatSeconds(Now() - start));
+      first_call_after_warm_up.push_back(TimeOneMul(shape, &context));
+      std::vector<float> iters;
+      for (int i = 0; i < kSteadyStateIters; i++) {
+        iters.push_back(TimeOneMul(shape, &context));
+      }
+      steady_state.push_back(Median(iters));
+    }
+    printf("%dx%dx%d,%d,%.4g,%.4g,%.4g,%.4g\n", shape.rows, shape.depth,
+           shape.cols, max_num_threads, 1.0e6 * Median(first_call),
+           1.0e6 * Median(warm_up), 1.0e6 * Median(first_call_after_warm_up),
+           1.0e6 * Median(steady_state));
+    fflush(stdout);
+  }
+}
+
+// Returns the median latency in seconds of the given function, over enough
+// calls to take about 0.2 s, after a first call to warm up.
+template <typename Fn>
+float MedianLatency(Fn fn) {
+  fn();
+  std::vector<float> latencies;
+  float total = 0;
+  while (total < 0.2f || latencies.size() < 5) {
+    const TimePoint start = Now();
+    fn();
+    latencies.push_back(ToFloatSeconds(Now() - start));
+    total += latencies.back();
+  }
+  return Median(latencies);
+}
+
+// Hybrid mode: for each shape, compares a dynamically quantized
+// multiplication of int8 weights by float activations as a single Mul with a
+// float RHS and a float destination, against the three passes it replaces:
+// quantizing the RHS to int8, an int8 Mul to int32 accumulators, and
+// dequantizing those to float. The LHS is cached in both cases, as weights
+// would be. This does not depend on the types that the benchmark is built for.
+void BenchmarkHybrid(const std::vector<BenchmarkShape>& shapes,
+                     int max_num_threads) {
+  printf("shape,threads,three_pass_us,fused_us,speedup\n");
+  fflush(stdout);
+  for (const auto& shape : shapes) {
+    std::vector<std::int8_t> lhs_data(shape.rows * shape.depth, 1);
+    std::vector<float> rhs_data(shape.depth * shape.cols);
+    for (int i = 0; i < static_cast<int>(rhs_data.size()); i++) {
+      rhs_data[i] = std::sin(0.1f * i);
+    }
+    std::vector<float> row_scales(shape.rows, 0.01f);
+    Matrix<std::int8_t> lhs;
+    MakeSimpleLayout(shape.rows, shape.depth, Order::kRowMajor,
+                     lhs.mutable_layout());
+    lhs.set_data(lhs_data.data());
+    lhs.set_cache_policy(CachePolicy::kAlwaysCache);
+    Matrix<float> rhs;
+    MakeSimpleLayout(shape.depth, shape.cols, Order::kColMajor,
+                     rhs.mutable_layout());
+    rhs.set_data(rhs_data.data());
+    std::vector<float> dst_data(shape.rows * shape.cols);
+    Matrix<float> dst;
+    MakeSimpleLayout(shape.rows, shape.cols, Order::kColMajor,
+                     dst.mutable_layout());
+    dst.set_data(dst_data.data());
+
+    // Buffers of the three-pass baseline.
+    std::vector<std::int8_t> quantized_rhs_data(rhs_data.size());
+    std::vector<float> rhs_scales(shape.cols);
+    std::vector<std::int32_t> accum_data(dst_data.size());
+    Matrix<std::int8_t> quantized_rhs;
+    MakeSimpleLayout(shape.depth, shape.cols, Order::kColMajor,
+                     quantized_rhs.mutable_layout());
+    quantized_rhs.set_data(quantized_rhs_data.data());
+    Matrix<std::int32_t> accum;
+    MakeSimpleLayout(shape.rows, shape.cols, Order::kColMajor,
+                     accum.mutable_layout());
+    accum.set_data(accum_data.data());
+
+    Context context;
+    context.set_max_num_threads(max_num_threads);
+    // As in the other modes, PATHS restricts the paths that both sides use.
+    const Path paths = static_cast<Path>(GetHexIntEnvVarOrZero("PATHS"));
+    if (paths != Path::kNone) {
+      get_ctx(&context)->SetRuntimeEnabledPaths(paths);
+    }
+    const float three_pass = MedianLatency([&]() {
+      for (int c = 0; c < shape.cols; c++) {
+        const float* src = rhs_data.data() + c * shape.depth;
+        float max_abs = 0;
+        for (int d = 0; d < shape.depth; d++) {
+          max_abs = std::max(max_abs, std::abs(src[d]));
+        }
+        rhs_scales[c] = DynamicQuantScale(max_abs);
+        const float inv_scale = 1.f / rhs_scales[c];
+        for (int d = 0; d < shape.depth; d++) {
+          quantized_rhs_data[c * shape.depth + d] =
+              DynamicQuantize(src[d], inv_scale);
+        }
+      }
+      Mul(lhs, quantized_rhs, MulParams<std::int32_t, std::int32_t>(),
+          &context, &accum);
+      for (int c = 0; c < shape.cols; c++) {
+        for (int r = 0; r < shape.rows; r++) {
+          const int i = r + c * shape.rows;
+          dst_data[i] = accum_data[i] * row_scales[r] * rhs_scales[c];
+        }
+      }
+    });
+    MulParams<std::int32_t, float> mul_params;
+    mul_params.set_float_multiplier_perchannel(row_scales.data());
+    const float fused = MedianLatency(
+        [&]() { Mul(lhs, rhs, mul_params, &context, &dst); });
+    printf("%dx%dx%d,%d,%.4g,%.4g,%.3g\n", shape.rows, shape.depth,
+           shape.cols, max_num_threads, 1.0e6 * three_pass, 1.0e6 * fused,
+           three_pass / fused);
+    fflush(stdout);
+  }
+}
+
+const char* TraversalOrderName(BlockMapTraversalOrder traversal_order) {
+  switch (traversal_order) {
+    case BlockMapTraversalOrder::kLinear:
+      return "linear";
+    case BlockMapTraversalOrder::kFractalZ:
+      return "fractal-z";
+    case BlockMapTraversalOrder::kFractalU:
+      return "fractal-u";
+    case BlockMapTraversalOrder::kFractalHilbert:
+      return "fractal-hilbert";
+  }
+  return "?";
+}
+
+// Prints to stderr the BlockMap that would be used for the given shape with
+// the given data cache sizes, and with depth blocking as set on the global
+// context. The kernel layout depends on the Path; a representative 8x8 kernel
+// is assumed here.
+void PrintBlockMap(const BenchmarkShape& shape, int max_num_threads,
+                   const char* label, int local_data_cache_size,
+                   int shared_data_cache_size) {
+  static constexpr int kKernelSize = 8;
+  const int rows = round_up_pot(shape.rows, kKernelSize);
+  const int cols = round_up_pot(shape.cols, kKernelSize);
+  BlockMapOverrides overrides;
+  overrides.allow_depth_blocking = get_ctx(&GlobalContext())->depth_blocking();
+  BlockMap block_map;
+  MakeBlockMap(rows, cols, shape.depth, kKernelSize, kKernelSize,
+               sizeof(LhsScalar), sizeof(RhsScalar), max_num_threads,
+               local_data_cache_size, shared_data_cache_size, overrides,
+               &block_map);
+  fprintf(stderr,
+          "%dx%dx%d, %s cache sizes (local=%dk, shared=%dk): traversal=%s, "
+          "blocks=%dx%d of about %dx%d, depth_block_size=%d\n",
+          shape.rows, shape.depth, shape.cols, label,
+          local_data_cache_size >> 10, shared_data_cache_size >> 10,
+          TraversalOrderName(block_map.traversal_order),
+          NumBlocksPerSide(Side::kLhs, block_map),
+          NumBlocksPerSide(Side::kRhs, block_map),
+          block_map.small_block_dims[Side::kLhs],
+          block_map.small_block_dims[Side::kRhs],
+          block_map.depth_block_size);
+}
+
 void Benchmark() {
-  const bool symm_lhs = std::is_floating_point<LhsScalar>::value ||
+  const bool symm_lhs = !std::numeric_limits<LhsScalar>::is_integer ||
                         GetBoolEnvVarOrFalse("SYMM_LHS");
-  const bool symm_rhs = std::is_floating_point<RhsScalar>::value ||
+  const bool symm_rhs = !std::numeric_limits<RhsScalar>::is_integer ||
                         GetBoolEnvVarOrFalse("SYMM_RHS");
   const bool benchmark_cubic = GetBoolEnvVarOrFalse("RUY_BENCHMARK_CUBIC") ||
                                GetBoolEnvVarOrFalse("RUY_BENCHMARK_CUBIC_LIST");
@@ -92,6 +447,49 @@ void Benchmark() {
   const int explicit_cols = GetIntEnvVarOrZero("COLS");
   const int explicit_depth = GetIntEnvVarOrZero("DEPTH");
 
+  // By default, ruy uses data cache sizes detected at runtime. CACHE_SIZES
+  // overrides them, either with "default" for the hard-coded defaults from
+  // cpu_cache_size.h, or with explicit "local,shared" sizes in bytes.
+  Ctx* ctx = get_ctx(&GlobalContext());
+  const char* cache_sizes_env = getenv("CACHE_SIZES");
+  if (cache_sizes_env) {
+    if (std::string(cache_sizes_env) == "default") {
+      ctx->SetDataCacheSizes(LocalDataCacheSize(), SharedDataCacheSize());
+    } else {
+      const std::vector<int> sizes = ParseCommaSeparatedInts(cache_sizes_env);
+      if (sizes.size() != 2) {
+        fprintf(stderr,
+                "CACHE_SIZES must be \"default\" or \"local,shared\".\n");
+        exit(EXIT_FAILURE);
+      }
+      ctx->SetDataCacheSizes(sizes[0], sizes[1]);
+    }
+  }
+  const bool print_block_maps = GetBoolEnvVarOrFalse("RUY_BENCHMARK_BLOCK_MAP");
+
+  // NUMA_AWARE and PIN_THREADS set the corresponding Context options.
+  // SIMULATED_NUMA_NODES=n replaces the detected topology with n nodes of one
+  // CPU each, to measure the overhead of the NUMA-aware code path on a
+  // single-node machine.
+  ctx->set_numa_aware(GetBoolEnvVarOrFalse("NUMA_AWARE"));
+  ctx->set_pin_threads(GetBoolEnvVarOrFalse("PIN_THREADS"));
+  // NO_SPLIT_DEPTH disables splitting the depth dimension among threads, for
+  // comparison, e.g. with ROWS=64 COLS=64 DEPTH=16384.
+  ctx->set_split_depth(!GetBoolEnvVarOrFalse("NO_SPLIT_DEPTH"));
+  // DEPTH_BLOCKING enables tiling the depth dimension into slabs that fit in
+  // the local data cache, see Context::set_depth_blocking.
+  ctx->set_depth_blocking(GetBoolEnvVarOrFalse("DEPTH_BLOCKING"));
+  // TUNED_PLANS loads a file of tuned plans written by tune_tool.
+  const char* tuned_plans_env = getenv("TUNED_PLANS");
+  if (tuned_plans_env && !GlobalContext().LoadTunedPlans(tuned_plans_env)) {
+    fprintf(stderr, "Failed to load tuned plans from %s.\n", tuned_plans_env);
+    exit(EXIT_FAILURE);
+  }
+  const int simulated_numa_nodes = GetIntEnvVarOrZero("SIMULATED_NUMA_NODES");
+  if (simulated_numa_nodes) {
+    ctx->SetCpuTopology(MakeSimulatedCpuTopology(simulated_numa_nodes, 1));
+  }
+
   std::vector<BenchmarkShape> shapes;
 
   if (benchmark_cubic) {
@@ -122,6 +520,25 @@ void Benchmark() {
       shape.symm_rhs = symm_rhs;
       shapes.push_back(shape);
     }
+  } else if (getenv("RUY_BENCHMARK_DEPTH_LIST")) {
+    // Sweep over the depth with fixed ROWS and COLS, e.g. to find the depth
+    // from which depth blocking (see BlockMap::depth_block_size) pays off, by
+    // comparing runs with and without DEPTH_BLOCKING.
+    if (!explicit_rows || !explicit_cols) {
+      fprintf(stderr,
+              "RUY_BENCHMARK_DEPTH_LIST requires ROWS and COLS to be set.\n");
+      exit(1);
+    }
+    for (int depth :
+         ParseCommaSeparatedInts(getenv("RUY_BENCHMARK_DEPTH_LIST"))) {
+      BenchmarkShape shape;
+      shape.rows = explicit_rows;
+      shape.cols = explicit_cols;
+      shape.depth = depth;
+      shape.symm_lhs = symm_lhs;
+      shape.symm_rhs = symm_rhs;
+      shapes.push_back(shape);
+    }
   } else {
     BenchmarkShape shape;
     shape.rows = explicit_rows;
@@ -138,9 +555,36 @@ void Benchmark() {
     shapes.push_back(shape);
   }
 
+  if (GetBoolEnvVarOrFalse("RUY_BENCHMARK_SCALING")) {
+    BenchmarkScaling(shapes);
+    return;
+  }
+
+  const int max_num_threads = GetIntEnvVarOrZero("THREADS");
+  const BlockScheduling block_scheduling = GetBlockSchedulingFromEnv();
+  if (GetBoolEnvVarOrFalse("RUY_BENCHMARK_OVERHEAD")) {
+    BenchmarkOverhead(shapes, max_num_threads, block_scheduling);
+    return;
+  }
+  if (GetBoolEnvVarOrFalse("RUY_BENCHMARK_FIRST_CALL")) {
+    BenchmarkFirstCall(shapes, std::max(1, max_num_threads));
+    return;
+  }
+  if (GetBoolEnvVarOrFalse("RUY_BENCHMARK_HYBRID")) {
+    BenchmarkHybrid(shapes, std::max(1, max_num_threads));
+    return;
+  }
   for (int i = 0; i < static_cast<int>(shapes.size()); i++) {
     const auto& shape = shapes[i];
-    const auto& results = BenchmarkRCC<TestSetType>(shape);
+    if (print_block_maps) {
+      PrintBlockMap(shape, std::max(1, max_num_threads), "default",
+                    LocalDataCacheSize(), SharedDataCacheSize());
+      PrintBlockMap(shape, std::max(1, max_num_threads), "context",
+                    ctx->GetLocalDataCacheSize(),
+                    ctx->GetSharedDataCacheSize());
+    }
+    const auto& results =
+        BenchmarkRCC<TestSetType>(shape, max_num_threads, block_scheduling);
     if (i == 0) {
       if (benchmark_cubic) {
         printf("size");
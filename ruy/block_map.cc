@@ -17,10 +17,10 @@ limitations under the License.
 
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 
 #ifdef RUY_MAKEBLOCKMAP_DEBUG
 #include <cstdio>
-#include <cstdlib>
 #include <string>
 #endif
 
@@ -86,11 +86,135 @@ void DecodeTraversalFractalHilbert(int size_log2, std::uint32_t square_index,
   (*local_pos)[Side::kRhs] = x;
 }
 
+int Sign(int x) { return (x > 0) - (x < 0); }
+
+// Division by 2 rounding towards negative infinity.
+int FloorHalf(int x) { return x >= 0 ? x / 2 : -((1 - x) / 2); }
+
+// Generalized Hilbert curve over a grid of arbitrary size, following the
+// recursive construction of
+//   https://github.com/jakubcerveny/gilbert
+// Each step of the recursion splits the current rectangle, given by its
+// origin (x, y), its major axis (ax, ay) and its minor axis (bx, by), into two
+// or three sub-rectangles traversed one after the other. Rather than
+// generating the whole curve, this only descends into the sub-rectangle that
+// contains the index-th cell, so it takes a logarithmic number of steps.
+// When one of the dimensions of the grid is odd, the curve may have to take
+// a diagonal step somewhere.
+void DecodeTraversalGeneralizedHilbert(const SidePair<int>& num_blocks,
+                                       int index, SidePair<int>* pos) {
+  // The major axis is initially along the larger dimension.
+  const int width = num_blocks[Side::kLhs];
+  const int height = num_blocks[Side::kRhs];
+  int x = 0;
+  int y = 0;
+  int ax = width >= height ? width : 0;
+  int ay = width >= height ? 0 : height;
+  int bx = width >= height ? 0 : width;
+  int by = width >= height ? height : 0;
+  while (true) {
+    const int w = std::abs(ax + ay);
+    const int h = std::abs(bx + by);
+    const int dax = Sign(ax);
+    const int day = Sign(ay);
+    const int dbx = Sign(bx);
+    const int dby = Sign(by);
+    if (h == 1) {
+      x += index * dax;
+      y += index * day;
+      break;
+    }
+    if (w == 1) {
+      x += index * dbx;
+      y += index * dby;
+      break;
+    }
+    int ax2 = FloorHalf(ax);
+    int ay2 = FloorHalf(ay);
+    int bx2 = FloorHalf(bx);
+    int by2 = FloorHalf(by);
+    if (2 * w > 3 * h) {
+      // Long rectangle: split it in two halves along its major axis, of even
+      // lengths if possible.
+      if ((std::abs(ax2 + ay2) & 1) && w > 2) {
+        ax2 += dax;
+        ay2 += day;
+      }
+      const int area = std::abs(ax2 + ay2) * h;
+      if (index < area) {
+        ax = ax2;
+        ay = ay2;
+      } else {
+        index -= area;
+        x += ax2;
+        y += ay2;
+        ax -= ax2;
+        ay -= ay2;
+      }
+    } else {
+      // Go up the first half of the minor axis, across the whole major axis,
+      // then back down.
+      if ((std::abs(bx2 + by2) & 1) && h > 2) {
+        bx2 += dbx;
+        by2 += dby;
+      }
+      const int w2 = std::abs(ax2 + ay2);
+      const int h2 = std::abs(bx2 + by2);
+      const int first_area = w2 * h2;
+      const int second_area = w * (h - h2);
+      if (index < first_area) {
+        ax = bx2;
+        ay = by2;
+        bx = ax2;
+        by = ay2;
+      } else if (index < first_area + second_area) {
+        index -= first_area;
+        x += bx2;
+        y += by2;
+        bx -= bx2;
+        by -= by2;
+      } else {
+        index -= first_area + second_area;
+        x += (ax - dax) + (bx2 - dbx);
+        y += (ay - day) + (by2 - dby);
+        const int new_bx = -(ax - ax2);
+        const int new_by = -(ay - ay2);
+        ax = -bx2;
+        ay = -by2;
+        bx = new_bx;
+        by = new_by;
+      }
+    }
+  }
+  (*pos)[Side::kLhs] = x;
+  (*pos)[Side::kRhs] = y;
+}
+
+bool IsPotGrid(const BlockMap& block_map) {
+  for (Side side : {Side::kLhs, Side::kRhs}) {
+    if (block_map.num_blocks[side] !=
+        1 << (block_map.num_blocks_base_log2 +
+              block_map.rectangularness_log2[side])) {
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // end anonymous namespace
 
 void GetBlockByIndex(const BlockMap& block_map, int index,
                      SidePair<int>* block) {
   profiler::ScopeLabel label("GetBlockByIndex");
+  if (!IsPotGrid(block_map)) {
+    if (block_map.traversal_order == BlockMapTraversalOrder::kLinear) {
+      (*block)[Side::kLhs] = index % block_map.num_blocks[Side::kLhs];
+      (*block)[Side::kRhs] = index / block_map.num_blocks[Side::kLhs];
+    } else {
+      DecodeTraversalGeneralizedHilbert(block_map.num_blocks, index, block);
+    }
+    return;
+  }
   const std::uint32_t index_u32 = index;
 
   const std::uint32_t num_blocks_per_local_curve =
@@ -313,12 +437,95 @@ int GetKernelAmortizationScore(int block_size_log2, int rows, int cols,
   }
 }
 
+// Minimum depth of a depth slab. Each slab costs an extra pass over the
+// block's accumulators, and the epilogue has to be applied separately once
+// the last slab is done, so thinner slabs don't pay for themselves.
+constexpr int kMinDepthBlockSize = 512;
+
+// Returns the depth_block_size of a BlockMap whose largest blocks have the
+// given dimensions: a multiple of kDepthBlockGranularity such that the LHS and
+// RHS data of a block over a slab of that depth fits in the local data cache,
+// or the whole depth if that already fits, or if slabs would be thinner than
+// kMinDepthBlockSize, or if depth blocking is not allowed.
+int GetDepthBlockSize(int depth, int block_rows, int block_cols,
+                      int lhs_scalar_size, int rhs_scalar_size,
+                      int local_data_cache_size, bool allow_depth_blocking) {
+  if (!RUY_OPT(DEPTH_BLOCKING) || !allow_depth_blocking) {
+    return depth;
+  }
+  const int bytes_per_depth_level =
+      lhs_scalar_size * block_rows + rhs_scalar_size * block_cols;
+  if (static_cast<std::int64_t>(bytes_per_depth_level) * depth <=
+      local_data_cache_size) {
+    return depth;
+  }
+  const int max_depth_block_size = round_down_pot(
+      local_data_cache_size / bytes_per_depth_level, kDepthBlockGranularity);
+  if (max_depth_block_size < kMinDepthBlockSize ||
+      max_depth_block_size >= depth) {
+    return depth;
+  }
+  // Balance the depth among slabs, rather than leaving a thin last one.
+  const int num_depth_blocks =
+      (depth + max_depth_block_size - 1) / max_depth_block_size;
+  return round_up_pot((depth + num_depth_blocks - 1) / num_depth_blocks,
+                      kDepthBlockGranularity);
+}
+
+// For BlockMapOverrides::allow_non_pot_grid: given the power-of-two grid
+// num_blocks, tries to make the number of blocks a multiple of thread_count by
+// resizing the grid along its larger dimension. Writing thread_count as
+// odd_factor * 2^k, that dimension is scaled by odd_factor /
+// 2^ceil_log2(odd_factor), making blocks larger along it. If that dimension
+// has too few blocks for that, it is instead scaled up to odd_factor blocks,
+// as far as the kernel dims allow. Leaves num_blocks unchanged if none of that
+// gives a multiple of thread_count.
+void FitGridToThreadCount(int thread_count, const SidePair<int>& dims,
+                          const SidePair<int>& kernel_dims,
+                          SidePair<int>* num_blocks) {
+  if (thread_count <= 1 || is_pot(thread_count)) {
+    return;
+  }
+  int odd_factor = thread_count;
+  while (!(odd_factor & 1)) {
+    odd_factor >>= 1;
+  }
+  const int odd_factor_ceil_log2 = ceil_log2(odd_factor);
+  const Side side = (*num_blocks)[Side::kLhs] >= (*num_blocks)[Side::kRhs]
+                        ? Side::kLhs
+                        : Side::kRhs;
+  const int num_blocks_log2 = pot_log2((*num_blocks)[side]);
+  int scaled_num_blocks = 0;
+  if (num_blocks_log2 >= odd_factor_ceil_log2) {
+    scaled_num_blocks = odd_factor
+                        << (num_blocks_log2 - odd_factor_ceil_log2);
+  } else if (num_blocks_log2 + 1 == odd_factor_ceil_log2 &&
+             odd_factor * kernel_dims[side] <= dims[side]) {
+    scaled_num_blocks = odd_factor;
+  } else {
+    return;
+  }
+  if ((scaled_num_blocks * (*num_blocks)[Other(side)]) % thread_count == 0) {
+    (*num_blocks)[side] = scaled_num_blocks;
+  }
+}
+
 }  // namespace
 
 void MakeBlockMap(int rows, int cols, int depth, int kernel_rows,
                   int kernel_cols, int lhs_scalar_size, int rhs_scalar_size,
                   int tentative_thread_count, int local_data_cache_size,
                   int shared_data_cache_size, BlockMap* block_map) {
+  MakeBlockMap(rows, cols, depth, kernel_rows, kernel_cols, lhs_scalar_size,
+               rhs_scalar_size, tentative_thread_count, local_data_cache_size,
+               shared_data_cache_size, BlockMapOverrides(), block_map);
+}
+
+void MakeBlockMap(int rows, int cols, int depth, int kernel_rows,
+                  int kernel_cols, int lhs_scalar_size, int rhs_scalar_size,
+                  int tentative_thread_count, int local_data_cache_size,
+                  int shared_data_cache_size,
+                  const BlockMapOverrides& overrides, BlockMap* block_map) {
   profiler::ScopeLabel label("MakeBlockMap");
 
 #ifdef RUY_MAKEBLOCKMAP_DEBUG
@@ -344,8 +551,11 @@ void MakeBlockMap(int rows, int cols, int depth, int kernel_rows,
   RUY_DCHECK_EQ(cols % kernel_cols, 0);
 
   block_map->traversal_order =
-      GetTraversalOrder(rows, cols, depth, lhs_scalar_size, rhs_scalar_size,
-                        local_data_cache_size, shared_data_cache_size);
+      overrides.has_traversal_order
+          ? overrides.traversal_order
+          : GetTraversalOrder(rows, cols, depth, lhs_scalar_size,
+                              rhs_scalar_size, local_data_cache_size,
+                              shared_data_cache_size);
 
   int rows_rectangularness_log2 = 0;
   int cols_rectangularness_log2 = 0;
@@ -375,10 +585,18 @@ void MakeBlockMap(int rows, int cols, int depth, int kernel_rows,
   static constexpr int kMaxKernelsPerBlockLog2 = 6;
   const int max_block_size_log2 =
       std::min(size_log2, kernel_size_log2 + kMaxKernelsPerBlockLog2);
+  // An overridden block_size_log2 is the only candidate.
+  int min_candidate_log2 = kernel_size_log2;
+  int max_candidate_log2 = max_block_size_log2;
+  if (overrides.block_size_log2 >= 0) {
+    min_candidate_log2 = max_candidate_log2 =
+        std::min(std::max(overrides.block_size_log2, kernel_size_log2),
+                 max_block_size_log2);
+  }
   int best_score = std::numeric_limits<int>::min();
   int best_score_block_size_log2 = -1;
-  for (int block_size_log2 = kernel_size_log2;
-       block_size_log2 <= max_block_size_log2; block_size_log2++) {
+  for (int block_size_log2 = min_candidate_log2;
+       block_size_log2 <= max_candidate_log2; block_size_log2++) {
     const int multithreading_score = GetMultithreadingScore(
         block_size_log2, rows, cols, tentative_thread_count);
     const int cache_locality_score = GetCacheLocalityScore(
@@ -418,26 +636,31 @@ void MakeBlockMap(int rows, int cols, int depth, int kernel_rows,
               best_score_block_size_log2);
     }
   }
-  firsttime = false;
 #endif
 
-  int num_blocks_base_log2 = size_log2 - best_score_block_size_log2;
+  const int block_size_log2 =
+      std::max(kernel_size_log2,
+               best_score_block_size_log2 - overrides.subdivision_log2);
+  int num_blocks_base_log2 = size_log2 - block_size_log2;
   RUY_DCHECK_GE(num_blocks_base_log2, 0);
 
-  const int num_blocks_of_rows_log2 =
-      num_blocks_base_log2 + rows_rectangularness_log2;
-  const int num_blocks_of_cols_log2 =
-      num_blocks_base_log2 + cols_rectangularness_log2;
+  SidePair<int> num_blocks(
+      1 << (num_blocks_base_log2 + rows_rectangularness_log2),
+      1 << (num_blocks_base_log2 + cols_rectangularness_log2));
+  if (overrides.allow_non_pot_grid) {
+    FitGridToThreadCount(tentative_thread_count, SidePair<int>(rows, cols),
+                         SidePair<int>(kernel_rows, kernel_cols), &num_blocks);
+  }
+  const int num_blocks_of_rows = num_blocks[Side::kLhs];
+  const int num_blocks_of_cols = num_blocks[Side::kRhs];
 
-  const int smallr =
-      round_down_pot(rows >> num_blocks_of_rows_log2, kernel_rows);
-  const int smallc =
-      round_down_pot(cols >> num_blocks_of_cols_log2, kernel_cols);
+  const int smallr = round_down_pot(rows / num_blocks_of_rows, kernel_rows);
+  const int smallc = round_down_pot(cols / num_blocks_of_cols, kernel_cols);
   const int missr =
-      round_up_pot(rows - (smallr << num_blocks_of_rows_log2), kernel_rows) >>
+      round_up_pot(rows - smallr * num_blocks_of_rows, kernel_rows) >>
       pot_log2(kernel_rows);
   const int missc =
-      round_up_pot(cols - (smallc << num_blocks_of_cols_log2), kernel_cols) >>
+      round_up_pot(cols - smallc * num_blocks_of_cols, kernel_cols) >>
       pot_log2(kernel_cols);
 
   block_map->dims[Side::kLhs] = rows;
@@ -447,15 +670,48 @@ void MakeBlockMap(int rows, int cols, int depth, int kernel_rows,
   block_map->num_blocks_base_log2 = num_blocks_base_log2;
   block_map->rectangularness_log2[Side::kLhs] = rows_rectangularness_log2;
   block_map->rectangularness_log2[Side::kRhs] = cols_rectangularness_log2;
+  block_map->num_blocks = num_blocks;
   block_map->small_block_dims[Side::kLhs] = smallr;
   block_map->small_block_dims[Side::kRhs] = smallc;
   block_map->large_blocks[Side::kLhs] = missr;
   block_map->large_blocks[Side::kRhs] = missc;
+  block_map->depth_block_size = GetDepthBlockSize(
+      depth, smallr + (missr ? kernel_rows : 0),
+      smallc + (missc ? kernel_cols : 0), lhs_scalar_size, rhs_scalar_size,
+      local_data_cache_size, overrides.allow_depth_blocking);
+  block_map->subdivision_log2 =
+      std::max(0, best_score_block_size_log2 - block_size_log2);
+#ifdef RUY_MAKEBLOCKMAP_DEBUG
+  if (firsttime || debug_everytime) {
+    fprintf(stderr, "depth_block_size=%d\n", block_map->depth_block_size);
+  }
+  firsttime = false;
+#endif
   // Done last: NumBlocks needs some of the block_map fields to be already set.
   block_map->thread_count =
       std::min(tentative_thread_count, NumBlocks(*block_map));
 }
 
+int GetTaperedChunkSize(const BlockMap& block_map, int begin, int num_blocks,
+                        int thread_count) {
+  // Each chunk is at most this fraction of the blocks left per thread.
+  static constexpr int kChunkDivisor = 2;
+  RUY_DCHECK_LT(begin, num_blocks);
+  if (!IsPotGrid(block_map)) {
+    return 1;
+  }
+  const int target_size = (num_blocks - begin) / (kChunkDivisor * thread_count);
+  int size_log4 = block_map.subdivision_log2;
+  while (size_log4 > 0) {
+    const int size = 1 << (2 * size_log4);
+    if (size <= target_size && begin % size == 0) {
+      break;
+    }
+    size_log4--;
+  }
+  return 1 << (2 * size_log4);
+}
+
 void GetBlockMatrixCoords(Side side, const BlockMap& block_map, int block,
                           int* start, int* end) {
   profiler::ScopeLabel label("GetBlockMatrixCoords");
@@ -70,6 +70,15 @@ enum class BlockMapTraversalOrder {
 //
 // Either rows_rectangularness_log2 or cols_rectangularness_log2 must be zero.
 //
+// When the number of threads is not a power of two, such a grid cannot give
+// every thread the same number of blocks. MakeBlockMap may then resize the
+// grid along one dimension to a non-power-of-two number of blocks, so that the
+// number of blocks is a multiple of the number of threads, see
+// BlockMapOverrides::allow_non_pot_grid. The actual numbers of blocks along
+// each dimension are given by num_blocks. A non-power-of-two grid is
+// traversed as a whole, either linearly or along a generalized Hilbert curve
+// for the fractal traversal orders.
+//
 // Finally, this BlockMap is designed to operate under alignment constraints:
 // two fields, kernel_rows and kernel_cols, describe the requested alignment
 // of the effective grid in both dimensions. The idea is to feed matrix
@@ -91,6 +100,10 @@ struct BlockMap {
   int num_blocks_base_log2;
   // Log2 of the additional subdivision of the rows/columns axis.
   SidePair<int> rectangularness_log2;
+  // Number of subdivisions of the grid along the rows/columns axis. This is
+  // 2^(num_blocks_base_log2 + rectangularness_log2), except in
+  // non-power-of-two grids.
+  SidePair<int> num_blocks;
   // Requested alignment of the subdivisions of the grid along the rows/columns
   // axis.
   SidePair<int> kernel_dims;
@@ -100,8 +113,22 @@ struct BlockMap {
   // their size in that dimension be given by (small_block_dims + kernel_dims)
   // instead of just small_block_dims.
   SidePair<int> large_blocks;
+  // Third level of subdivision, along the depth dimension: when the LHS and
+  // RHS data of a block would overflow the local data cache, the depth is
+  // tiled into slabs of this many levels, carrying the accumulators from one
+  // slab to the next. This is a multiple of kDepthBlockGranularity. When it
+  // is not less than the depth, there is no depth blocking.
+  int depth_block_size;
+  // Log2 of the factor by which the blocks were made smaller along each side
+  // than MakeBlockMap's heuristics would have made them, see
+  // BlockMapOverrides::subdivision_log2, after clamping to the kernel dims.
+  int subdivision_log2;
 };
 
+// Depth slabs (see BlockMap::depth_block_size) start at multiples of this,
+// which must be a multiple of the kernel layouts' depth granularity.
+constexpr int kDepthBlockGranularity = 64;
+
 // Returns the traversal order to be used for the given matrix multiplication
 // parameters.
 BlockMapTraversalOrder GetTraversalOrder(int rows, int cols, int depth,
@@ -110,6 +137,30 @@ BlockMapTraversalOrder GetTraversalOrder(int rows, int cols, int depth,
                                          int local_data_cache_size,
                                          int shared_data_cache_size);
 
+// Decisions that MakeBlockMap takes as given instead of making them by its
+// heuristics, e.g. as found by benchmarking, see tuned_plans.h.
+struct BlockMapOverrides {
+  // Log2 of the size of the blocks along the smaller of the two dimensions,
+  // or -1 to let MakeBlockMap choose. It is clamped to the range of values
+  // that MakeBlockMap would consider.
+  int block_size_log2 = -1;
+  // Whether traversal_order overrides GetTraversalOrder.
+  bool has_traversal_order = false;
+  BlockMapTraversalOrder traversal_order = BlockMapTraversalOrder::kLinear;
+  // Log2 of the factor by which to further divide the block size, after it
+  // has been chosen, as far as the kernel dims allow. See
+  // BlockScheduling::kTapered.
+  int subdivision_log2 = 0;
+  // Whether the grid may be resized along one dimension to a number of
+  // blocks that is not a power of two, when that makes the number of blocks a
+  // multiple of a tentative_thread_count that is not a power of two.
+  bool allow_non_pot_grid = true;
+  // Whether the depth may be tiled into slabs, see
+  // BlockMap::depth_block_size. Otherwise depth_block_size is the whole depth.
+  // Off by default, as in Context::set_depth_blocking.
+  bool allow_depth_blocking = false;
+};
+
 // Create a BlockMap suitable for tiling the destination matrix in a
 // matrix multiplication with the given parameters.
 void MakeBlockMap(int rows, int cols, int depth, int kernel_rows,
@@ -117,6 +168,13 @@ void MakeBlockMap(int rows, int cols, int depth, int kernel_rows,
                   int tentative_thread_count, int local_data_cache_size,
                   int shared_data_cache_size, BlockMap* block_map);
 
+// Same as above, with some decisions taken from overrides.
+void MakeBlockMap(int rows, int cols, int depth, int kernel_rows,
+                  int kernel_cols, int lhs_scalar_size, int rhs_scalar_size,
+                  int tentative_thread_count, int local_data_cache_size,
+                  int shared_data_cache_size,
+                  const BlockMapOverrides& overrides, BlockMap* block_map);
+
 // Maps an integer index to a block position in the grid.
 void GetBlockByIndex(const BlockMap& block_map, int index,
                      SidePair<int>* block);
@@ -137,21 +195,27 @@ void GetBlockMatrixCoords(const BlockMap& block_map, const SidePair<int>& block,
 // Returns the number of grid subdivisions along the rows dimension (if
 // side == kLhs) or columns dimension (if side == kRhs).
 inline int NumBlocksPerSide(Side side, const BlockMap& block_map) {
-  return 1 << (block_map.num_blocks_base_log2 +
-               block_map.rectangularness_log2[side]);
+  return block_map.num_blocks[side];
 }
 
+// For BlockScheduling::kTapered: returns how many consecutive blocks, starting
+// at the block index `begin` out of num_blocks (which may span several items
+// of a strided batch), to hand out together to one of thread_count threads,
+// as one larger block. That is a power of 4 that `begin` is a multiple of, so
+// that in a power-of-two grid these blocks form a rectangle, and that is at
+// most 4^subdivision_log2, so that this rectangle is at most a block of the
+// size that MakeBlockMap's heuristics chose. Below that, it is a fraction of
+// the blocks left per thread: larger blocks are handed out at the start of
+// the traversal, and smaller ones towards the end, so that threads finish at
+// about the same time. Non-power-of-two grids are handed out block by block.
+int GetTaperedChunkSize(const BlockMap& block_map, int begin, int num_blocks,
+                        int thread_count);
+
 // Returns the overall number of blocks in
 // the BlockMap. The valid index values to pass to GetBlockByIndex are the
 // integers from 0 to N-1 where N is the value returned here.
-//
-// Note that it is always true that
-//   NumBlocks == NumBlocksOfRows * NumBlocksOfCols
-// because either rows_rectangularness_log2 or cols_rectangularness_log2 is 0.
 inline int NumBlocks(const BlockMap& block_map) {
-  return 1 << (2 * block_map.num_blocks_base_log2 +
-               block_map.rectangularness_log2[Side::kLhs] +
-               block_map.rectangularness_log2[Side::kRhs]);
+  return block_map.num_blocks[Side::kLhs] * block_map.num_blocks[Side::kRhs];
 }
 
 }  // namespace ruy
@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "ruy/block_map.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
@@ -23,8 +24,10 @@ limitations under the License.
 
 #include "ruy/cpu_cache_size.h"
 #include "ruy/gtest_wrapper.h"
+#include "ruy/opt_set.h"
 #include "ruy/path.h"
 #include "ruy/side_pair.h"
+#include "ruy/size_util.h"
 
 namespace ruy {
 namespace {
@@ -163,6 +166,7 @@ void GetBlockByIndexSquareTest(int num_blocks_base_log2,
   for (Side side : {Side::kLhs, Side::kRhs}) {
     block_map.dims[side] = 1 << size_log2;
     block_map.rectangularness_log2[side] = 0;
+    block_map.num_blocks[side] = 1 << num_blocks_base_log2;
     block_map.kernel_dims[side] = 1 << kKernelSizeLog2;
     block_map.small_block_dims[side] = block_map.kernel_dims[side];
     block_map.large_blocks[side] = 0;
@@ -254,6 +258,278 @@ TEST(BlockMapTest, GetBlockByIndexSquare) {
   }
 }
 
+void GetBlockByIndexNonPotTest(int num_blocks_of_rows, int num_blocks_of_cols,
+                               BlockMapTraversalOrder traversal_order) {
+  BlockMap block_map;
+  block_map.thread_count = 1;
+  block_map.traversal_order = traversal_order;
+  block_map.num_blocks_base_log2 = 0;
+  block_map.num_blocks = SidePair<int>(num_blocks_of_rows, num_blocks_of_cols);
+  for (Side side : {Side::kLhs, Side::kRhs}) {
+    block_map.rectangularness_log2[side] = 0;
+    block_map.kernel_dims[side] = 8;
+    block_map.dims[side] = 8 * block_map.num_blocks[side];
+    block_map.small_block_dims[side] = 8;
+    block_map.large_blocks[side] = 0;
+  }
+  const int num_blocks = num_blocks_of_rows * num_blocks_of_cols;
+  ASSERT_EQ(num_blocks, NumBlocks(block_map));
+
+  std::vector<int> block_hit_counts(num_blocks);
+  SidePair<int> previous_block_coords(0, 0);
+  int max_l1_distance = 0;
+  for (int block_index = 0; block_index < num_blocks; block_index++) {
+    SidePair<int> block_coords;
+    GetBlockByIndex(block_map, block_index, &block_coords);
+    ASSERT_GE(block_coords[Side::kLhs], 0);
+    ASSERT_LT(block_coords[Side::kLhs], num_blocks_of_rows);
+    ASSERT_GE(block_coords[Side::kRhs], 0);
+    ASSERT_LT(block_coords[Side::kRhs], num_blocks_of_cols);
+    ++block_hit_counts[block_coords[Side::kLhs] +
+                       num_blocks_of_rows * block_coords[Side::kRhs]];
+    max_l1_distance = std::max(
+        max_l1_distance, L1Distance(block_coords, previous_block_coords));
+    previous_block_coords = block_coords;
+  }
+
+  // Verify that each block was traversed exactly once.
+  for (int hit_count : block_hit_counts) {
+    EXPECT_EQ(hit_count, 1);
+  }
+  // The generalized Hilbert curve moves to an adjacent block at each step,
+  // except for at most a diagonal step when a dimension is odd.
+  if (traversal_order != BlockMapTraversalOrder::kLinear) {
+    EXPECT_LE(max_l1_distance, 2);
+  }
+}
+
+TEST(BlockMapTest, GetBlockByIndexNonPot) {
+  for (int num_blocks_of_rows = 1; num_blocks_of_rows <= 25;
+       num_blocks_of_rows++) {
+    for (int num_blocks_of_cols = 1; num_blocks_of_cols <= 25;
+         num_blocks_of_cols++) {
+      if (is_pot(num_blocks_of_rows) && is_pot(num_blocks_of_cols)) {
+        continue;
+      }
+      for (BlockMapTraversalOrder traversal_order :
+           {BlockMapTraversalOrder::kLinear,
+            BlockMapTraversalOrder::kFractalHilbert}) {
+        GetBlockByIndexNonPotTest(num_blocks_of_rows, num_blocks_of_cols,
+                                  traversal_order);
+      }
+    }
+  }
+}
+
+TEST(BlockMapTest, NonPotGrid) {
+  const int shapes[][2] = {{512, 512}, {1024, 128}, {96, 1000}, {64, 64}};
+  for (const auto& shape : shapes) {
+    for (int thread_count : {3, 5, 6, 7, 12, 24}) {
+      for (bool allow_non_pot_grid : {false, true}) {
+        BlockMapOverrides overrides;
+        overrides.allow_non_pot_grid = allow_non_pot_grid;
+        BlockMap block_map;
+        MakeBlockMap(shape[0], shape[1], 512, 8, 8, 1, 1, thread_count,
+                     LocalDataCacheSize(), SharedDataCacheSize(), overrides,
+                     &block_map);
+        const int num_blocks = NumBlocks(block_map);
+        if (allow_non_pot_grid) {
+          // Each shape has enough room for a grid of at least 4x4 blocks,
+          // which can always be resized to a multiple of these thread counts.
+          EXPECT_EQ(num_blocks % thread_count, 0);
+        } else {
+          EXPECT_TRUE(is_pot(num_blocks));
+        }
+        // The blocks tile the whole destination matrix.
+        std::int64_t total_area = 0;
+        for (int index = 0; index < num_blocks; index++) {
+          SidePair<int> block, start, end;
+          GetBlockByIndex(block_map, index, &block);
+          GetBlockMatrixCoords(block_map, block, &start, &end);
+          total_area += static_cast<std::int64_t>(end[Side::kLhs] -
+                                                  start[Side::kLhs]) *
+                        (end[Side::kRhs] - start[Side::kRhs]);
+        }
+        EXPECT_EQ(total_area, static_cast<std::int64_t>(shape[0]) * shape[1]);
+      }
+    }
+  }
+}
+
+TEST(BlockMapTest, Overrides) {
+  // 256x256 destination, 8x8 kernel: block sizes range from 2^3 to 2^8.
+  for (int block_size_log2 = 0; block_size_log2 <= 10; block_size_log2++) {
+    BlockMapOverrides overrides;
+    overrides.block_size_log2 = block_size_log2;
+    overrides.has_traversal_order = true;
+    overrides.traversal_order = BlockMapTraversalOrder::kFractalU;
+    BlockMap block_map;
+    MakeBlockMap(256, 256, 256, 8, 8, 1, 1, /* tentative_thread_count */ 4,
+                 LocalDataCacheSize(), SharedDataCacheSize(),
+                 overrides, &block_map);
+    EXPECT_EQ(block_map.traversal_order, BlockMapTraversalOrder::kFractalU);
+    EXPECT_EQ(block_map.num_blocks_base_log2,
+              8 - std::min(std::max(block_size_log2, 3), 8));
+  }
+}
+
+// Makes a block map with 8x8 kernels and blocks made 4x smaller along each
+// side than 32x32, as for BlockScheduling::kTapered.
+void MakeTaperedBlockMap(BlockMapTraversalOrder traversal_order, int rows,
+                         int cols, BlockMap* block_map) {
+  BlockMapOverrides overrides;
+  overrides.block_size_log2 = 5;
+  overrides.subdivision_log2 = 2;
+  overrides.allow_non_pot_grid = false;
+  overrides.has_traversal_order = true;
+  overrides.traversal_order = traversal_order;
+  MakeBlockMap(rows, cols, 256, 8, 8, 1, 1, /* tentative_thread_count */ 4,
+               LocalDataCacheSize(), SharedDataCacheSize(), overrides,
+               block_map);
+}
+
+TEST(BlockMapTest, TaperedChunksFormRectangles) {
+  for (BlockMapTraversalOrder traversal_order :
+       {BlockMapTraversalOrder::kLinear, BlockMapTraversalOrder::kFractalZ,
+        BlockMapTraversalOrder::kFractalU,
+        BlockMapTraversalOrder::kFractalHilbert}) {
+    for (int cols : {1024, 256}) {
+      BlockMap block_map;
+      MakeTaperedBlockMap(traversal_order, 1024, cols, &block_map);
+      EXPECT_EQ(block_map.subdivision_log2, 2);
+      const int num_blocks = NumBlocks(block_map);
+      int prev_size = 16;
+      for (int begin = 0; begin < num_blocks;) {
+        const int size =
+            GetTaperedChunkSize(block_map, begin, num_blocks, /* threads */ 4);
+        // Sizes are powers of 4, at most 16, and only decrease.
+        EXPECT_TRUE(size == 1 || size == 4 || size == 16);
+        EXPECT_LE(size, prev_size);
+        EXPECT_EQ(begin % size, 0);
+        // The chunk of blocks is a rectangle.
+        SidePair<int> min_block(num_blocks, num_blocks);
+        SidePair<int> max_block(-1, -1);
+        for (int index = begin; index < begin + size; index++) {
+          SidePair<int> block;
+          GetBlockByIndex(block_map, index, &block);
+          for (Side side : {Side::kLhs, Side::kRhs}) {
+            min_block[side] = std::min(min_block[side], block[side]);
+            max_block[side] = std::max(max_block[side], block[side]);
+          }
+        }
+        EXPECT_EQ((max_block[Side::kLhs] - min_block[Side::kLhs] + 1) *
+                      (max_block[Side::kRhs] - min_block[Side::kRhs] + 1),
+                  size);
+        prev_size = size;
+        begin += size;
+      }
+      // The last blocks are handed out one by one.
+      EXPECT_EQ(prev_size, 1);
+    }
+  }
+}
+
+// Simulates threads processing the given numbers of blocks of block_map per
+// unit of time, each taking, once done with its previous chunk, the next
+// chunk of chunk_size(begin) blocks from a shared counter. Returns the
+// longest time that a thread waits for the last one to finish.
+template <typename ChunkSizeFn>
+double SimulateMaxIdleTime(const BlockMap& block_map,
+                           const std::vector<double>& speeds,
+                           ChunkSizeFn chunk_size) {
+  const int num_blocks = NumBlocks(block_map);
+  std::vector<double> end_times(speeds.size(), 0.);
+  for (int begin = 0; begin < num_blocks;) {
+    const int thread =
+        std::min_element(end_times.begin(), end_times.end()) -
+        end_times.begin();
+    const int size = chunk_size(begin);
+    end_times[thread] += size / speeds[thread];
+    begin += size;
+  }
+  return *std::max_element(end_times.begin(), end_times.end()) -
+         *std::min_element(end_times.begin(), end_times.end());
+}
+
+TEST(BlockMapTest, TaperedChunksReduceImbalance) {
+  BlockMap block_map;
+  MakeTaperedBlockMap(BlockMapTraversalOrder::kFractalHilbert, 1024, 1024,
+                      &block_map);
+  const int num_blocks = NumBlocks(block_map);
+  // Threads of uneven speeds, e.g. on big and little cores, or sharing their
+  // cores with other processes.
+  for (const std::vector<double>& speeds :
+       std::vector<std::vector<double>>{{1., 1., 1., .6},
+                                        {1., .9, .8, .7, .6, .5},
+                                        {1., .3, 1., .3}}) {
+    const int thread_count = speeds.size();
+    const double min_speed = *std::min_element(speeds.begin(), speeds.end());
+    // Handing out blocks of the size that MakeBlockMap's heuristics chose,
+    // 16 of the finer blocks.
+    const double uniform_idle_time = SimulateMaxIdleTime(
+        block_map, speeds, [](int) { return 16; });
+    const double tapered_idle_time =
+        SimulateMaxIdleTime(block_map, speeds, [&](int begin) {
+          return GetTaperedChunkSize(block_map, begin, num_blocks,
+                                     thread_count);
+        });
+    EXPECT_LT(tapered_idle_time, uniform_idle_time);
+    // Threads finish within about a single fine block of each other.
+    EXPECT_LE(tapered_idle_time, 1 / min_speed);
+  }
+}
+
+#if RUY_OPT(DEPTH_BLOCKING)
+
+// Checks the depth_block_size of the BlockMap for the given shape, with 8-bit
+// operands and 8x8 kernels, and returns it.
+int MakeBlockMapDepthBlockSizeTest(int rows, int cols, int depth,
+                                   int local_data_cache_size) {
+  BlockMapOverrides overrides;
+  overrides.allow_depth_blocking = true;
+  BlockMap block_map;
+  MakeBlockMap(rows, cols, depth, 8, 8, 1, 1, /* tentative_thread_count */ 1,
+               local_data_cache_size, 1 << 21, overrides, &block_map);
+  const int depth_block_size = block_map.depth_block_size;
+  if (depth_block_size >= depth) {
+    EXPECT_EQ(depth_block_size, depth);
+    return depth_block_size;
+  }
+  EXPECT_EQ(depth_block_size % kDepthBlockGranularity, 0);
+  // The LHS and RHS data of the largest blocks over one depth slab must fit
+  // in the local data cache.
+  SidePair<int> max_block_dims;
+  for (Side side : {Side::kLhs, Side::kRhs}) {
+    max_block_dims[side] =
+        block_map.small_block_dims[side] +
+        (block_map.large_blocks[side] ? block_map.kernel_dims[side] : 0);
+  }
+  EXPECT_LE(
+      (max_block_dims[Side::kLhs] + max_block_dims[Side::kRhs]) *
+          depth_block_size,
+      local_data_cache_size);
+  return depth_block_size;
+}
+
+TEST(BlockMapTest, DepthBlockSize) {
+  static constexpr int kLocalDataCacheSize = 1 << 17;
+  // Shallow enough for whole blocks to fit in the local data cache.
+  EXPECT_EQ(MakeBlockMapDepthBlockSizeTest(256, 256, 128, kLocalDataCacheSize),
+            128);
+  EXPECT_EQ(MakeBlockMapDepthBlockSizeTest(1000, 8, 300, kLocalDataCacheSize),
+            300);
+  // Deep enough to require depth blocking.
+  for (int depth : {4096, 5000, 16384}) {
+    EXPECT_LT(
+        MakeBlockMapDepthBlockSizeTest(256, 256, depth, kLocalDataCacheSize),
+        depth);
+  }
+  // Depth slabs would be too thin.
+  EXPECT_EQ(MakeBlockMapDepthBlockSizeTest(256, 256, 16384, 1 << 12), 16384);
+}
+
+#endif
+
 }  // namespace
 }  // namespace ruy
 
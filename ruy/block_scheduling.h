@@ -0,0 +1,51 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef RUY_RUY_BLOCK_SCHEDULING_H_
+#define RUY_RUY_BLOCK_SCHEDULING_H_
+
+#include <cstdint>
+
+namespace ruy {
+
+// How multi-threaded TrMul distributes the blocks of the destination matrix
+// (see block_map.h) over threads.
+enum class BlockScheduling : std::uint8_t {
+  // All threads take the next block in the traversal order from a single
+  // shared atomic counter. This is the default. It balances load perfectly,
+  // but at high thread counts the counter becomes a contention point, and
+  // consecutive blocks, which share packed LHS/RHS data, are handled by
+  // different threads.
+  kSharedCounter,
+  // Each thread starts with its own contiguous range of the traversal order,
+  // and only once that is exhausted steals blocks from the end of the ranges
+  // of other threads. Since the traversal order is a space-filling curve,
+  // each thread mostly works on a compact area of the destination matrix,
+  // reusing the same packed LHS/RHS blocks.
+  kWorkStealing,
+  // Blocks whose size tapers off towards the end of the traversal order: the
+  // block map is made finer than it would otherwise be (see
+  // BlockMapOverrides::subdivision_log2), and threads take from a shared
+  // counter groups of consecutive blocks that form a rectangle, each handled
+  // as one block. At the start of the traversal order, these groups amount to
+  // the usual blocks, then they shrink, with the blocks left per thread, down
+  // to single small blocks, so that threads finish at about the same time. See
+  // GetTaperedChunkSize.
+  kTapered,
+};
+
+}  // namespace ruy
+
+#endif  // RUY_RUY_BLOCK_SCHEDULING_H_
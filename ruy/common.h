@@ -59,10 +59,12 @@ void* ToVoidPtr(T* p) {
 
 template <typename Scalar>
 Scalar SymmetricZeroPoint() {
-  if (std::is_floating_point<Scalar>::value) {
+  // Testing numeric_limits rather than std::is_floating_point and
+  // std::is_signed also covers ruy::bfloat16, ruy::float16 and ruy::int4.
+  if (!std::numeric_limits<Scalar>::is_integer) {
     return 0;
   }
-  if (std::is_signed<Scalar>::value) {
+  if (std::numeric_limits<Scalar>::is_signed) {
     return 0;
   }
   return std::numeric_limits<Scalar>::max() / 2 + 1;
@@ -15,12 +15,14 @@ limitations under the License.
 
 #include "ruy/context.h"
 
+#include "ruy/block_scheduling.h"
 #include "ruy/ctx.h"
 #include "ruy/ctx_impl.h"
 #include "ruy/path.h"
 #include "ruy/prepacked_cache.h"
 #include "ruy/thread_pool.h"
 #include "ruy/tune.h"
+#include "ruy/tuned_plans.h"
 
 namespace ruy {
 
@@ -43,7 +45,64 @@ int Context::max_num_threads() const { return ctx().max_num_threads(); }
 void Context::set_max_num_threads(int value) {
   mutable_ctx()->set_max_num_threads(value);
 }
+bool Context::auto_num_threads() const { return ctx().auto_num_threads(); }
+void Context::set_auto_num_threads(bool value) {
+  mutable_ctx()->set_auto_num_threads(value);
+}
+
+BlockScheduling Context::block_scheduling() const {
+  return ctx().block_scheduling();
+}
+void Context::set_block_scheduling(BlockScheduling value) {
+  mutable_ctx()->set_block_scheduling(value);
+}
+bool Context::numa_aware() const { return ctx().numa_aware(); }
+void Context::set_numa_aware(bool value) {
+  mutable_ctx()->set_numa_aware(value);
+}
+bool Context::pin_threads() const { return ctx().pin_threads(); }
+void Context::set_pin_threads(bool value) {
+  mutable_ctx()->set_pin_threads(value);
+}
+bool Context::split_depth() const { return ctx().split_depth(); }
+void Context::set_split_depth(bool value) {
+  mutable_ctx()->set_split_depth(value);
+}
+bool Context::non_pot_block_grids() const {
+  return ctx().non_pot_block_grids();
+}
+void Context::set_non_pot_block_grids(bool value) {
+  mutable_ctx()->set_non_pot_block_grids(value);
+}
+bool Context::depth_blocking() const { return ctx().depth_blocking(); }
+void Context::set_depth_blocking(bool value) {
+  mutable_ctx()->set_depth_blocking(value);
+}
+SharedPrepackedCache* Context::shared_prepacked_cache() const {
+  return ctx().shared_prepacked_cache();
+}
+void Context::set_shared_prepacked_cache(SharedPrepackedCache* value) {
+  mutable_ctx()->set_shared_prepacked_cache(value);
+}
 
 void Context::ClearPrepackedCache() { mutable_ctx()->ClearPrepackedCache(); }
 
+bool Context::LoadTunedPlans(const std::string& filename) {
+  TunedPlans plans;
+  if (ctx().tuned_plans()) {
+    plans = *ctx().tuned_plans();
+  }
+  if (!plans.Load(filename)) {
+    return false;
+  }
+  mutable_ctx()->SetTunedPlans(plans);
+  return true;
+}
+
+void Context::ClearTunedPlans() { mutable_ctx()->ClearTunedPlans(); }
+
+void Context::WarmUp(const WarmUpParams& params) {
+  mutable_ctx()->WarmUp(params);
+}
+
 }  // namespace ruy
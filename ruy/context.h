@@ -19,14 +19,19 @@ limitations under the License.
 #define RUY_RUY_CONTEXT_H_
 
 #include <cstdint>
+#include <string>
+
+#include "ruy/warm_up.h"
 
 namespace ruy {
 
 class Ctx;
 class CtxImpl;
 class ThreadPool;
+class SharedPrepackedCache;
 enum class Path : std::uint8_t;
 enum class Tuning;
+enum class BlockScheduling : std::uint8_t;
 
 // A Context holds runtime information used by Ruy. It holds runtime resources
 // such as the workers thread pool and the allocator (which holds buffers for
@@ -44,10 +49,82 @@ class Context final {
   const ThreadPool& thread_pool() const;
   ThreadPool* mutable_thread_pool();
   int max_num_threads() const;
+  // Setting max_num_threads turns off auto_num_threads.
   void set_max_num_threads(int value);
-
+  // When set, max_num_threads is derived automatically from the number of
+  // CPUs that the process can actually use: the smaller of its CPU affinity
+  // mask and of its cgroup (v1 or v2) CPU quota, see cpu_quota.h. This is
+  // re-detected about once per second, at the start of a multiplication, as
+  // these limits may change while the process runs. In containers,
+  // std::thread::hardware_concurrency typically reports all the CPUs of the
+  // machine, and that many threads far oversubscribe the quota. Off by
+  // default.
+  bool auto_num_threads() const;
+  void set_auto_num_threads(bool value);
+  // See the BlockScheduling enum in block_scheduling.h. Only matters when
+  // multi-threading.
+  BlockScheduling block_scheduling() const;
+  void set_block_scheduling(BlockScheduling value);
+  // When NUMA-aware, multi-threaded multiplications on machines with several
+  // NUMA nodes split their work into one share per node. Each node packs its
+  // own copy of the data it needs, in memory local to that node. This is most
+  // effective together with pin_threads. Off by default.
+  bool numa_aware() const;
+  void set_numa_aware(bool value);
+  // Pins worker threads to CPUs, spreading them over NUMA nodes the same way
+  // as NUMA-aware multiplications assign work to them. The calling thread is
+  // never pinned. Off by default. Only implemented on Linux.
+  bool pin_threads() const;
+  void set_pin_threads(bool value);
+  // Allows multi-threaded multiplications whose destination matrix is too
+  // small to give work to every thread to also split the depth dimension
+  // among threads, each accumulating into its own buffer, followed by a
+  // reduction. On by default.
+  bool split_depth() const;
+  void set_split_depth(bool value);
+  // Allows multi-threaded multiplications to tile the destination matrix into
+  // a grid of blocks whose size is not a power of two along one dimension,
+  // so that a number of threads that is not a power of two, e.g. 6 or 12,
+  // gets the same number of blocks in each thread. On by default.
+  bool non_pot_block_grids() const;
+  void set_non_pot_block_grids(bool value);
+  // Allows single multiplications whose blocks' LHS and RHS data overflow the
+  // local data cache to tile the depth dimension into slabs that fit in it,
+  // accumulating across slabs. Off by default: on the machines measured so
+  // far it was neutral within noise.
+  bool depth_blocking() const;
+  void set_depth_blocking(bool value);
+
+  // Attaches a SharedPrepackedCache (see prepacked_cache.h), which is then
+  // used instead of this Context's own cache for matrices whose CachePolicy
+  // asks for caching. Several Contexts, used concurrently from different
+  // threads, may share the same SharedPrepackedCache, which must outlive them.
+  // Passing nullptr reverts to this Context's own cache.
+  SharedPrepackedCache* shared_prepacked_cache() const;
+  void set_shared_prepacked_cache(SharedPrepackedCache* value);
+
+  // Clears this Context's own cache. Does not affect any attached
+  // SharedPrepackedCache.
   void ClearPrepackedCache();
 
+  // Loads a file of tuned plans, as written by tune_tool (see tuned_plans.h).
+  // Multiplications whose shape has a tuned plan then use its number of
+  // threads and blocking instead of the default heuristics. Loading several
+  // files merges them. Returns false if the file can't be read or is
+  // malformed, in which case nothing is loaded.
+  bool LoadTunedPlans(const std::string& filename);
+  void ClearTunedPlans();
+
+  // Does up front the work that otherwise makes the first multiplications on
+  // this Context much slower than the following ones: spawns the worker
+  // threads, up to max_num_threads(); detects the CPU features, cache sizes
+  // and topology, and resolves the tuning of each thread; and sizes the
+  // internal arenas for the largest multiplication described by params (see
+  // warm_up.h), optionally pre-faulting their pages. Call it again after
+  // raising max_num_threads(). The arenas used for NUMA-local buffers when
+  // numa_aware() is set are not pre-sized.
+  void WarmUp(const WarmUpParams& params);
+
  private:
   CtxImpl* const impl_;
 
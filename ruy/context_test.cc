@@ -18,7 +18,9 @@ limitations under the License.
 #include "ruy/gtest_wrapper.h"
 #include "ruy/path.h"
 #include "ruy/prepacked_cache.h"
+#include "ruy/thread_pool.h"
 #include "ruy/tune.h"
+#include "ruy/warm_up.h"
 
 namespace ruy {
 namespace {
@@ -36,6 +38,26 @@ TEST(ContextTest, ContextClassSanity) {
   EXPECT_EQ(context.max_num_threads(), 2);
 }
 
+TEST(ContextTest, WarmUpRunsOnAllThreads) {
+  Context context;
+  // The idle times recorded by the thread pool have one entry per task of
+  // the last Execute, which tells how many threads WarmUp ran on.
+  context.mutable_thread_pool()->set_record_idle_times(true);
+  for (int max_num_threads : {2, 5}) {
+    context.set_max_num_threads(max_num_threads);
+    WarmUpParams params;
+    params.max_rows = 100;
+    params.max_depth = 200;
+    params.max_cols = 50;
+    params.main_arena_bytes = 1 << 20;
+    params.prefault_arenas = true;
+    context.WarmUp(params);
+    EXPECT_EQ(
+        static_cast<int>(context.thread_pool().last_idle_times().size()),
+        max_num_threads);
+  }
+}
+
 }  // namespace
 }  // namespace ruy
 
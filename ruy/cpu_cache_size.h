@@ -34,8 +34,9 @@ namespace ruy {
 // LocalDataCacheSize should return 128k and SharedDataCacheSize
 // should return 1M.
 //
-// Ideally these values would be queried at runtime, and we should probably
-// do that on x86, but that is hard to do on ARM.
+// These are only defaults: the values actually used are queried at runtime
+// when possible, see CpuInfo::LocalDataCacheSize() and
+// Ctx::GetLocalDataCacheSize().
 #if RUY_PLATFORM_ARM_64
 inline int LocalDataCacheSize() { return 1 << 15; }
 inline int SharedDataCacheSize() { return 1 << 19; }
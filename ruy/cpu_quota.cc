@@ -0,0 +1,223 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "ruy/cpu_quota.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "ruy/cpu_topology.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace ruy {
+
+namespace {
+
+int CpuCountFromQuota(long long quota, long long period) {
+  if (quota <= 0 || period <= 0) {
+    return 0;
+  }
+  return static_cast<int>((quota + period - 1) / period);
+}
+
+// Reads the first line of a file into buf. Returns false if the file can't
+// be read.
+bool ReadFirstLine(const std::string& path, char* buf, int size) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (!f) {
+    return false;
+  }
+  const bool success = fgets(buf, size, f) != nullptr;
+  fclose(f);
+  return success;
+}
+
+// Returns the smaller of two CPU counts, either of which may be 0 meaning
+// unknown or unlimited.
+int MinKnownCpuCount(int a, int b) {
+  if (!a || !b) {
+    return std::max(a, b);
+  }
+  return std::min(a, b);
+}
+
+// Returns the smallest quota read by read_quota from dir/cgroup_path and each
+// of its ancestors up to dir itself. Directories that don't exist are
+// skipped: without a cgroup namespace, the path of the process's cgroup may
+// be one of the host that doesn't exist in a container's mount.
+template <typename ReadQuotaFunc>
+int ReadHierarchyCpuQuota(const std::string& dir, std::string cgroup_path,
+                          ReadQuotaFunc read_quota) {
+  int result = 0;
+  while (true) {
+    while (!cgroup_path.empty() && cgroup_path.back() == '/') {
+      cgroup_path.pop_back();
+    }
+    result = MinKnownCpuCount(result, read_quota(dir + cgroup_path));
+    if (cgroup_path.empty()) {
+      return result;
+    }
+    // A path without any '/', which /proc/self/cgroup should not contain,
+    // has only dir itself left as an ancestor.
+    const std::size_t last_slash = cgroup_path.rfind('/');
+    cgroup_path.erase(last_slash == std::string::npos ? 0 : last_slash);
+  }
+}
+
+}  // namespace
+
+int ReadCgroupV2CpuMax(const std::string& path) {
+  char buf[256];
+  if (!ReadFirstLine(path, buf, sizeof(buf))) {
+    return 0;
+  }
+  long long quota, period;
+  if (sscanf(buf, "%lld %lld", &quota, &period) != 2) {
+    // Includes the "max $PERIOD" case.
+    return 0;
+  }
+  return CpuCountFromQuota(quota, period);
+}
+
+int ReadCgroupV1CpuQuota(const std::string& dir) {
+  char quota_buf[64], period_buf[64];
+  long long quota, period;
+  if (!ReadFirstLine(dir + "/cpu.cfs_quota_us", quota_buf, sizeof(quota_buf)) ||
+      !ReadFirstLine(dir + "/cpu.cfs_period_us", period_buf,
+                     sizeof(period_buf)) ||
+      sscanf(quota_buf, "%lld", &quota) != 1 ||
+      sscanf(period_buf, "%lld", &period) != 1) {
+    return 0;
+  }
+  return CpuCountFromQuota(quota, period);
+}
+
+int ReadCgroupCpuQuota(const std::string& proc_cgroup,
+                       const std::string& cgroup_root) {
+  FILE* f = fopen(proc_cgroup.c_str(), "r");
+  if (!f) {
+    return 0;
+  }
+  int result = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), f)) {
+    // Each line is "hierarchy-id:controller-list:cgroup-path".
+    char* first_colon = strchr(line, ':');
+    char* second_colon = first_colon ? strchr(first_colon + 1, ':') : nullptr;
+    if (!second_colon) {
+      continue;
+    }
+    std::string cgroup_path(second_colon + 1);
+    while (!cgroup_path.empty() && cgroup_path.back() == '\n') {
+      cgroup_path.pop_back();
+    }
+    const std::string controllers(first_colon + 1, second_colon);
+    if (controllers.empty()) {
+      // The cgroup v2 unified hierarchy, mounted at the root itself.
+      result = MinKnownCpuCount(
+          result, ReadHierarchyCpuQuota(
+                      cgroup_root, cgroup_path, [](const std::string& dir) {
+                        return ReadCgroupV2CpuMax(dir + "/cpu.max");
+                      }));
+      continue;
+    }
+    // A cgroup v1 hierarchy, mounted at a directory named after its
+    // controllers, e.g. "cpu,cpuacct", and usually also at "cpu".
+    bool has_cpu_controller = false;
+    for (std::size_t pos = 0; pos <= controllers.size();) {
+      std::size_t end = controllers.find(',', pos);
+      if (end == std::string::npos) {
+        end = controllers.size();
+      }
+      if (controllers.compare(pos, end - pos, "cpu") == 0) {
+        has_cpu_controller = true;
+      }
+      pos = end + 1;
+    }
+    if (!has_cpu_controller) {
+      continue;
+    }
+    for (const std::string& mount : {controllers, std::string("cpu")}) {
+      const int quota =
+          ReadHierarchyCpuQuota(cgroup_root + "/" + mount, cgroup_path,
+                                ReadCgroupV1CpuQuota);
+      if (quota) {
+        result = MinKnownCpuCount(result, quota);
+        break;
+      }
+    }
+  }
+  fclose(f);
+  return result;
+}
+
+int ReadCpusAllowedCount(const std::string& proc_status) {
+  FILE* f = fopen(proc_status.c_str(), "r");
+  if (!f) {
+    return 0;
+  }
+  static constexpr char kPrefix[] = "Cpus_allowed_list:";
+  int result = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, kPrefix, strlen(kPrefix)) == 0) {
+      const char* list = line + strlen(kPrefix);
+      while (*list == ' ' || *list == '\t') {
+        list++;
+      }
+      std::vector<int> cpus;
+      if (ParseCpuList(list, &cpus)) {
+        result = static_cast<int>(cpus.size());
+      }
+      break;
+    }
+  }
+  fclose(f);
+  return result;
+}
+
+int GetAffinityCpuCount() {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    return 0;
+  }
+  return CPU_COUNT(&cpu_set);
+#else
+  return 0;
+#endif
+}
+
+int DetectAvailableCpuCount(const CpuQuotaSources& sources) {
+  const int affinity_count = sources.proc_status.empty()
+                                 ? GetAffinityCpuCount()
+                                 : ReadCpusAllowedCount(sources.proc_status);
+  int result = MinKnownCpuCount(
+      affinity_count,
+      ReadCgroupCpuQuota(sources.proc_cgroup, sources.cgroup_root));
+  if (!result) {
+    result = static_cast<int>(std::thread::hardware_concurrency());
+  }
+  return std::max(1, result);
+}
+
+}  // namespace ruy
@@ -0,0 +1,78 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Detection of how many CPUs this process can actually use, which in
+// containers is often much less than the number of CPUs of the machine: the
+// CPU affinity mask may exclude some, and a cgroup CPU quota may limit the
+// CPU time to the equivalent of a few CPUs. Running more threads than that
+// only adds contention, see Context::set_auto_num_threads.
+
+#ifndef RUY_RUY_CPU_QUOTA_H_
+#define RUY_RUY_CPU_QUOTA_H_
+
+#include <string>
+
+namespace ruy {
+
+// Where DetectAvailableCpuCount reads from. The defaults are the actual
+// sources for this process; tests point them at fake files.
+struct CpuQuotaSources final {
+  // A file laid out like /proc/self/status, whose Cpus_allowed_list line
+  // gives the CPUs that the process may run on. When empty, the default,
+  // these CPUs are obtained from sched_getaffinity instead.
+  std::string proc_status;
+  // A file laid out like /proc/self/cgroup, giving the cgroup of the process
+  // in each hierarchy.
+  std::string proc_cgroup = "/proc/self/cgroup";
+  // The directory under which the cgroup file systems are mounted: the
+  // unified (v2) hierarchy itself, or a directory per v1 hierarchy.
+  std::string cgroup_root = "/sys/fs/cgroup";
+};
+
+// Reads a cgroup v2 cpu.max file, of the form "$MAX $PERIOD". Returns the
+// quota as a number of CPUs, rounded up, or 0 if there is no limit ("max")
+// or the file can't be read.
+int ReadCgroupV2CpuMax(const std::string& path);
+
+// Reads the cpu.cfs_quota_us and cpu.cfs_period_us files of a cgroup v1
+// directory. Returns the quota as a number of CPUs, rounded up, or 0 if there
+// is no limit (a quota of -1) or the files can't be read.
+int ReadCgroupV1CpuQuota(const std::string& dir);
+
+// Returns the CPU quota of the cgroup of the process, as a number of CPUs,
+// given its /proc/self/cgroup file and the cgroup mount root. Since a
+// cgroup's quota also applies to all its descendants, this is the smallest
+// quota of the cgroup and its ancestors. Both cgroup v2 and the v1 "cpu"
+// controller are handled. Returns 0 if there is no quota.
+int ReadCgroupCpuQuota(const std::string& proc_cgroup,
+                       const std::string& cgroup_root);
+
+// Returns the number of CPUs in the Cpus_allowed_list line of a file laid
+// out like /proc/self/status, or 0 if there is no such line.
+int ReadCpusAllowedCount(const std::string& proc_status);
+
+// Returns the number of CPUs in the affinity mask of the calling thread.
+// Currently only implemented on Linux, returns 0 elsewhere.
+int GetAffinityCpuCount();
+
+// Returns the number of CPUs that this process can use: the smaller of the
+// size of its affinity mask and of its cgroup CPU quota, whichever are known.
+// When neither is, falls back to std::thread::hardware_concurrency. Always
+// at least 1.
+int DetectAvailableCpuCount(const CpuQuotaSources& sources);
+
+}  // namespace ruy
+
+#endif  // RUY_RUY_CPU_QUOTA_H_
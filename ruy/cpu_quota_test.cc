@@ -0,0 +1,186 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "ruy/cpu_quota.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "ruy/check_macros.h"
+#include "ruy/gtest_wrapper.h"
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ruy {
+namespace {
+
+TEST(CpuQuotaTest, DetectIsAtLeastOne) {
+  EXPECT_GE(DetectAvailableCpuCount(CpuQuotaSources()), 1);
+#ifdef __linux__
+  EXPECT_GE(GetAffinityCpuCount(), 1);
+#endif
+}
+
+#ifdef __linux__
+// A temporary directory of fake files, removed on destruction.
+class FakeFiles final {
+ public:
+  FakeFiles() {
+    const char* tmpdir = getenv("TEST_TMPDIR");
+    dir_ = std::string(tmpdir ? tmpdir : "/tmp") + "/ruy_cpu_quotaXXXXXX";
+    RUY_CHECK(mkdtemp(&dir_[0]));
+  }
+  ~FakeFiles() {
+    for (auto it = files_.rbegin(); it != files_.rend(); ++it) {
+      unlink(it->c_str());
+    }
+    for (auto it = dirs_.rbegin(); it != dirs_.rend(); ++it) {
+      rmdir(it->c_str());
+    }
+    rmdir(dir_.c_str());
+  }
+
+  const std::string& dir() const { return dir_; }
+
+  // Writes the file at the given path relative to dir(), creating the
+  // missing directories along it. Returns its full path.
+  std::string Write(const std::string& relative_path, const char* contents) {
+    for (std::size_t pos = relative_path.find('/'); pos != std::string::npos;
+         pos = relative_path.find('/', pos + 1)) {
+      const std::string subdir = dir_ + "/" + relative_path.substr(0, pos);
+      if (mkdir(subdir.c_str(), 0700) == 0) {
+        dirs_.push_back(subdir);
+      }
+    }
+    const std::string path = dir_ + "/" + relative_path;
+    FILE* f = fopen(path.c_str(), "w");
+    RUY_CHECK(f);
+    fputs(contents, f);
+    fclose(f);
+    files_.push_back(path);
+    return path;
+  }
+
+ private:
+  std::string dir_;
+  std::vector<std::string> dirs_;
+  std::vector<std::string> files_;
+};
+
+TEST(CpuQuotaTest, CgroupV2CpuMax) {
+  FakeFiles files;
+  EXPECT_EQ(ReadCgroupV2CpuMax(files.Write("a", "max 100000\n")), 0);
+  EXPECT_EQ(ReadCgroupV2CpuMax(files.Write("b", "400000 100000\n")), 4);
+  EXPECT_EQ(ReadCgroupV2CpuMax(files.Write("c", "150000 100000\n")), 2);
+  EXPECT_EQ(ReadCgroupV2CpuMax(files.Write("d", "50000 100000\n")), 1);
+  EXPECT_EQ(ReadCgroupV2CpuMax(files.dir() + "/nonexistent"), 0);
+}
+
+TEST(CpuQuotaTest, CgroupV1CpuQuota) {
+  FakeFiles files;
+  files.Write("unlimited/cpu.cfs_quota_us", "-1\n");
+  files.Write("unlimited/cpu.cfs_period_us", "100000\n");
+  EXPECT_EQ(ReadCgroupV1CpuQuota(files.dir() + "/unlimited"), 0);
+  files.Write("limited/cpu.cfs_quota_us", "250000\n");
+  files.Write("limited/cpu.cfs_period_us", "100000\n");
+  EXPECT_EQ(ReadCgroupV1CpuQuota(files.dir() + "/limited"), 3);
+  EXPECT_EQ(ReadCgroupV1CpuQuota(files.dir() + "/nonexistent"), 0);
+}
+
+TEST(CpuQuotaTest, CgroupV2Hierarchy) {
+  // A pod limited to 4 CPUs, in a parent limited to 8, with an unlimited
+  // container cgroup inside: the smallest quota along the path applies.
+  FakeFiles files;
+  files.Write("cgroup/cpu.max", "max 100000\n");
+  files.Write("cgroup/kubepods/cpu.max", "800000 100000\n");
+  files.Write("cgroup/kubepods/pod/cpu.max", "400000 100000\n");
+  files.Write("cgroup/kubepods/pod/ctr/cpu.max", "max 100000\n");
+  const std::string root = files.dir() + "/cgroup";
+  EXPECT_EQ(ReadCgroupCpuQuota(files.Write("self1", "0::/kubepods/pod/ctr\n"),
+                               root),
+            4);
+  EXPECT_EQ(ReadCgroupCpuQuota(files.Write("self2", "0::/kubepods\n"), root),
+            8);
+  EXPECT_EQ(ReadCgroupCpuQuota(files.Write("self3", "0::/\n"), root), 0);
+  // A cgroup path that doesn't exist under the mount, as seen from a
+  // container without a cgroup namespace: only the root is read.
+  files.Write("cgroup2/cpu.max", "200000 100000\n");
+  EXPECT_EQ(ReadCgroupCpuQuota(files.Write("self4", "0::/host/path\n"),
+                               files.dir() + "/cgroup2"),
+            2);
+  EXPECT_EQ(ReadCgroupCpuQuota(files.dir() + "/nonexistent", root), 0);
+  // A malformed cgroup path without a leading '/': only the root is read.
+  EXPECT_EQ(ReadCgroupCpuQuota(files.Write("self5", "0::kubepods\n"),
+                               files.dir() + "/cgroup2"),
+            2);
+}
+
+TEST(CpuQuotaTest, CgroupV1Hierarchy) {
+  FakeFiles files;
+  files.Write("cgroup/cpu,cpuacct/docker/abc/cpu.cfs_quota_us", "200000\n");
+  files.Write("cgroup/cpu,cpuacct/docker/abc/cpu.cfs_period_us", "100000\n");
+  files.Write("cgroup/cpu,cpuacct/cpu.cfs_quota_us", "-1\n");
+  files.Write("cgroup/cpu,cpuacct/cpu.cfs_period_us", "100000\n");
+  const std::string self = files.Write(
+      "self", "5:memory:/docker/abc\n4:cpu,cpuacct:/docker/abc\n0::/\n");
+  EXPECT_EQ(ReadCgroupCpuQuota(self, files.dir() + "/cgroup"), 2);
+}
+
+TEST(CpuQuotaTest, CpusAllowedList) {
+  FakeFiles files;
+  EXPECT_EQ(ReadCpusAllowedCount(files.Write(
+                "status",
+                "Name:\tfoo\nCpus_allowed:\t0000017f\n"
+                "Cpus_allowed_list:\t0-5,8\nMems_allowed_list:\t0\n")),
+            7);
+  EXPECT_EQ(ReadCpusAllowedCount(files.Write("no_list", "Name:\tfoo\n")), 0);
+}
+
+TEST(CpuQuotaTest, DetectFromFakeFiles) {
+  FakeFiles files;
+  CpuQuotaSources sources;
+  sources.proc_status = files.Write("status", "Cpus_allowed_list:\t0-95\n");
+  sources.proc_cgroup = files.Write("cgroup", "0::/pod\n");
+  sources.cgroup_root = files.dir() + "/root";
+  // No quota: the affinity mask applies.
+  EXPECT_EQ(DetectAvailableCpuCount(sources), 96);
+  // A quota of 4 CPUs on a 96-CPU affinity mask.
+  files.Write("root/pod/cpu.max", "400000 100000\n");
+  EXPECT_EQ(DetectAvailableCpuCount(sources), 4);
+  // An affinity mask smaller than the quota.
+  sources.proc_status = files.Write("status2", "Cpus_allowed_list:\t2,3\n");
+  EXPECT_EQ(DetectAvailableCpuCount(sources), 2);
+  // Neither is known.
+  sources.proc_status = files.dir() + "/nonexistent";
+  sources.proc_cgroup = files.dir() + "/nonexistent";
+  EXPECT_EQ(DetectAvailableCpuCount(sources),
+            std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+}
+#endif  // __linux__
+
+}  // namespace
+}  // namespace ruy
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,112 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "ruy/cpu_topology.h"
+
+#include <cstdio>
+
+#include "ruy/check_macros.h"
+
+namespace ruy {
+
+bool ParseCpuList(const char* list, std::vector<int>* cpus) {
+  cpus->clear();
+  const char* ptr = list;
+  while (*ptr && *ptr != '\n') {
+    int first, last, chars;
+    if (sscanf(ptr, "%d-%d%n", &first, &last, &chars) == 2) {
+      if (first < 0 || last < first) {
+        return false;
+      }
+    } else if (sscanf(ptr, "%d%n", &first, &chars) == 1) {
+      if (first < 0) {
+        return false;
+      }
+      last = first;
+    } else {
+      return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+    ptr += chars;
+    if (*ptr == ',') {
+      ptr++;
+    }
+  }
+  return true;
+}
+
+CpuTopology ReadCpuTopologyFromSysfs(const std::string& node_dir) {
+  CpuTopology topology;
+  // Node ids may have gaps, e.g. when nodes are offline. Stop after a run of
+  // missing ids.
+  static constexpr int kMaxMissingNodes = 8;
+  for (int node = 0, missing = 0; missing < kMaxMissingNodes; node++) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/node%d/cpulist", node_dir.c_str(), node);
+    FILE* f = fopen(path, "r");
+    if (!f) {
+      missing++;
+      continue;
+    }
+    missing = 0;
+    char buf[1024];
+    std::vector<int> cpus;
+    const bool success = fgets(buf, sizeof(buf), f) && ParseCpuList(buf, &cpus);
+    fclose(f);
+    // Memory-only nodes have an empty CPU list.
+    if (success && !cpus.empty()) {
+      topology.node_cpus.push_back(cpus);
+    }
+  }
+  return topology;
+}
+
+CpuTopology DetectCpuTopology() {
+#ifdef __linux__
+  return ReadCpuTopologyFromSysfs("/sys/devices/system/node");
+#else
+  return CpuTopology();
+#endif
+}
+
+CpuTopology MakeSimulatedCpuTopology(int num_nodes, int cpus_per_node) {
+  RUY_DCHECK_GE(num_nodes, 1);
+  RUY_DCHECK_GE(cpus_per_node, 1);
+  CpuTopology topology;
+  topology.node_cpus.resize(num_nodes);
+  for (int node = 0; node < num_nodes; node++) {
+    for (int i = 0; i < cpus_per_node; i++) {
+      topology.node_cpus[node].push_back(node * cpus_per_node + i);
+    }
+  }
+  return topology;
+}
+
+int NumaNodeForThread(const CpuTopology& topology, int thread_index) {
+  return topology.num_nodes() ? thread_index % topology.num_nodes() : 0;
+}
+
+int CpuForThread(const CpuTopology& topology, int thread_index) {
+  if (!topology.num_nodes()) {
+    return -1;
+  }
+  const std::vector<int>& cpus =
+      topology.node_cpus[NumaNodeForThread(topology, thread_index)];
+  return cpus[(thread_index / topology.num_nodes()) % cpus.size()];
+}
+
+}  // namespace ruy
@@ -0,0 +1,63 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef RUY_RUY_CPU_TOPOLOGY_H_
+#define RUY_RUY_CPU_TOPOLOGY_H_
+
+#include <string>
+#include <vector>
+
+namespace ruy {
+
+// Describes how the CPUs of the machine are grouped into NUMA nodes, i.e.
+// sockets (or parts of sockets) with their own local memory.
+struct CpuTopology final {
+  // The CPU ids belonging to each NUMA node. Nodes without CPUs are omitted.
+  // Empty if the topology is unknown, which is handled like a single node.
+  std::vector<std::vector<int>> node_cpus;
+
+  int num_nodes() const { return static_cast<int>(node_cpus.size()); }
+};
+
+// Parses a Linux CPU list such as "0-3,8-11". Returns false if malformed.
+bool ParseCpuList(const char* list, std::vector<int>* cpus);
+
+// Reads the topology from a directory laid out like /sys/devices/system/node,
+// i.e. with a node<N>/cpulist file for each node. Returns an empty topology if
+// there is no such node directory.
+CpuTopology ReadCpuTopologyFromSysfs(const std::string& node_dir);
+
+// Detects the topology of this machine. Currently only implemented on Linux,
+// returns an empty topology elsewhere.
+CpuTopology DetectCpuTopology();
+
+// Returns a made-up topology of num_nodes nodes of cpus_per_node CPUs each,
+// numbered consecutively. This allows exercising the NUMA-aware code paths on
+// a single-node machine.
+CpuTopology MakeSimulatedCpuTopology(int num_nodes, int cpus_per_node);
+
+// Assignment of the threads of a ThreadPool to NUMA nodes. The thread running
+// task i of ThreadPool::Execute is assigned to node (i % num_nodes), so that
+// any prefix of the threads is spread evenly over nodes.
+int NumaNodeForThread(const CpuTopology& topology, int thread_index);
+
+// Returns the CPU that the thread running task thread_index should be pinned
+// to: successive threads assigned to the same node cycle through its CPUs.
+// Returns -1 if the topology is empty.
+int CpuForThread(const CpuTopology& topology, int thread_index);
+
+}  // namespace ruy
+
+#endif  // RUY_RUY_CPU_TOPOLOGY_H_
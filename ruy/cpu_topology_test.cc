@@ -0,0 +1,121 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "ruy/cpu_topology.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "ruy/gtest_wrapper.h"
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ruy {
+namespace {
+
+TEST(CpuTopologyTest, ParseCpuList) {
+  std::vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("0", &cpus));
+  EXPECT_EQ(cpus, std::vector<int>({0}));
+  EXPECT_TRUE(ParseCpuList("0-3,8-9,12\n", &cpus));
+  EXPECT_EQ(cpus, std::vector<int>({0, 1, 2, 3, 8, 9, 12}));
+  EXPECT_TRUE(ParseCpuList("", &cpus));
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_FALSE(ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("a", &cpus));
+}
+
+TEST(CpuTopologyTest, SimulatedTopology) {
+  const CpuTopology topology = MakeSimulatedCpuTopology(2, 3);
+  ASSERT_EQ(topology.num_nodes(), 2);
+  EXPECT_EQ(topology.node_cpus[0], std::vector<int>({0, 1, 2}));
+  EXPECT_EQ(topology.node_cpus[1], std::vector<int>({3, 4, 5}));
+}
+
+TEST(CpuTopologyTest, ThreadAssignment) {
+  const CpuTopology topology = MakeSimulatedCpuTopology(2, 2);
+  const int expected_nodes[] = {0, 1, 0, 1, 0, 1};
+  const int expected_cpus[] = {0, 2, 1, 3, 0, 2};
+  for (int i = 0; i < 6; i++) {
+    EXPECT_EQ(NumaNodeForThread(topology, i), expected_nodes[i]);
+    EXPECT_EQ(CpuForThread(topology, i), expected_cpus[i]);
+  }
+  const CpuTopology empty;
+  EXPECT_EQ(NumaNodeForThread(empty, 3), 0);
+  EXPECT_EQ(CpuForThread(empty, 3), -1);
+}
+
+TEST(CpuTopologyTest, DetectDoesNotCrash) {
+  const CpuTopology topology = DetectCpuTopology();
+  for (const auto& cpus : topology.node_cpus) {
+    EXPECT_FALSE(cpus.empty());
+  }
+}
+
+#ifdef __linux__
+void WriteFile(const std::string& path, const char* contents) {
+  FILE* f = fopen(path.c_str(), "w");
+  ASSERT_NE(f, nullptr);
+  fputs(contents, f);
+  fclose(f);
+}
+
+TEST(CpuTopologyTest, ReadFromSysfs) {
+  // Lay out a fake /sys/devices/system/node: two nodes with CPUs, a
+  // memory-only node, and a gap in the node ids.
+  const char* tmpdir = getenv("TEST_TMPDIR");
+  std::string dir = std::string(tmpdir ? tmpdir : "/tmp") + "/ruy_nodeXXXXXX";
+  ASSERT_NE(mkdtemp(&dir[0]), nullptr);
+  const char* node_cpulists[][2] = {{"node0", "0-3,8-11\n"},
+                                    {"node1", "4-7,12-15\n"},
+                                    {"node2", "\n"},
+                                    {"node5", "16\n"}};
+  for (const auto& node : node_cpulists) {
+    const std::string node_dir = dir + "/" + node[0];
+    ASSERT_EQ(mkdir(node_dir.c_str(), 0700), 0);
+    WriteFile(node_dir + "/cpulist", node[1]);
+  }
+
+  const CpuTopology topology = ReadCpuTopologyFromSysfs(dir);
+  ASSERT_EQ(topology.num_nodes(), 3);
+  EXPECT_EQ(topology.node_cpus[0],
+            std::vector<int>({0, 1, 2, 3, 8, 9, 10, 11}));
+  EXPECT_EQ(topology.node_cpus[1],
+            std::vector<int>({4, 5, 6, 7, 12, 13, 14, 15}));
+  EXPECT_EQ(topology.node_cpus[2], std::vector<int>({16}));
+
+  EXPECT_EQ(ReadCpuTopologyFromSysfs(dir + "/nonexistent").num_nodes(), 0);
+
+  for (const auto& node : node_cpulists) {
+    const std::string node_dir = dir + "/" + node[0];
+    unlink((node_dir + "/cpulist").c_str());
+    rmdir(node_dir.c_str());
+  }
+  rmdir(dir.c_str());
+}
+#endif  // __linux__
+
+}  // namespace
+}  // namespace ruy
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
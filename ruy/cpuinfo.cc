@@ -1,7 +1,18 @@
 #include "ruy/cpuinfo.h"
 
+#include <algorithm>
+#include <cstdio>
+
 #include "ruy/platform.h"
 
+#if RUY_PLATFORM_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
 #define RUY_HAVE_CPUINFO (!(RUY_PLATFORM_PPC || RUY_PLATFORM_FUCHSIA))
 
 #if RUY_HAVE_CPUINFO
@@ -59,3 +70,224 @@ bool CpuInfo::AvxVnni() { return false; }
 }  // namespace ruy
 
 #endif
+
+// Runtime detection of data cache sizes. This does not use the cpuinfo
+// library, so that it is available on all platforms where the information can
+// be obtained from CPUID or sysfs.
+
+namespace ruy {
+
+namespace {
+
+// Description of one data or unified cache.
+struct CacheInfo {
+  int level = 0;
+  int size = 0;
+  // Number of logical CPUs sharing this cache, or 0 if unknown.
+  int sharing_cpus = 0;
+};
+
+constexpr int kMaxCaches = 8;
+
+// Derives the local and shared data cache sizes, as defined in
+// cpu_cache_size.h, from a list of caches. The local cache is the largest L1
+// or L2 cache that is not shared with other cores, i.e. shared by no more
+// logical CPUs than the L1 cache is (which accounts for SMT). The shared
+// cache is the largest cache overall.
+void ComputeLocalAndSharedCacheSizes(const CacheInfo* caches, int count,
+                                     int* local, int* shared) {
+  int l1_sharing_cpus = 0;
+  for (int i = 0; i < count; i++) {
+    if (caches[i].level == 1) {
+      l1_sharing_cpus = std::max(l1_sharing_cpus, caches[i].sharing_cpus);
+    }
+  }
+  *local = 0;
+  *shared = 0;
+  for (int i = 0; i < count; i++) {
+    const CacheInfo& cache = caches[i];
+    const bool is_per_core =
+        cache.level <= 2 && cache.sharing_cpus <= l1_sharing_cpus;
+    if (is_per_core) {
+      *local = std::max(*local, cache.size);
+    }
+    *shared = std::max(*shared, cache.size);
+  }
+}
+
+#if RUY_PLATFORM_X86
+
+void Cpuid(unsigned leaf, unsigned subleaf, unsigned* eax, unsigned* ebx,
+           unsigned* ecx, unsigned* edx) {
+#ifdef _MSC_VER
+  int regs[4];
+  __cpuidex(regs, leaf, subleaf);
+  *eax = regs[0];
+  *ebx = regs[1];
+  *ecx = regs[2];
+  *edx = regs[3];
+#else
+  __cpuid_count(leaf, subleaf, *eax, *ebx, *ecx, *edx);
+#endif
+}
+
+// Enumerates caches with CPUID leaf 4 (Intel) or its AMD equivalent,
+// leaf 0x8000001D, which uses the same register layout.
+int DetectCachesWithCpuid(CacheInfo* caches) {
+  unsigned eax, ebx, ecx, edx;
+  Cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+  const unsigned max_leaf = eax;
+  // The vendor string is EBX, EDX, ECX. We only need to tell AMD and Hygon
+  // ("AuthenticAMD", "HygonGenuine") apart, by the first 4 characters.
+  const bool is_amd = ebx == 0x68747541 /* "Auth" */ ||
+                      ebx == 0x6f677948 /* "Hygo" */;
+  unsigned cache_leaf = 4;
+  if (is_amd) {
+    Cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x8000001D) {
+      return 0;
+    }
+    // Bit 22 of ECX: topology extensions, which leaf 0x8000001D requires.
+    Cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & (1u << 22))) {
+      return 0;
+    }
+    cache_leaf = 0x8000001D;
+  } else if (max_leaf < 4) {
+    return 0;
+  }
+  int count = 0;
+  for (unsigned subleaf = 0; count < kMaxCaches; subleaf++) {
+    Cpuid(cache_leaf, subleaf, &eax, &ebx, &ecx, &edx);
+    const unsigned type = eax & 0x1f;
+    if (type == 0) {
+      // No more caches.
+      break;
+    }
+    if (type == 2) {
+      // Instruction cache.
+      continue;
+    }
+    CacheInfo& cache = caches[count++];
+    cache.level = (eax >> 5) & 0x7;
+    cache.sharing_cpus = ((eax >> 14) & 0xfff) + 1;
+    const int ways = ((ebx >> 22) & 0x3ff) + 1;
+    const int partitions = ((ebx >> 12) & 0x3ff) + 1;
+    const int line_size = (ebx & 0xfff) + 1;
+    const int sets = ecx + 1;
+    cache.size = ways * partitions * line_size * sets;
+  }
+  return count;
+}
+
+#endif  // RUY_PLATFORM_X86
+
+#ifdef __linux__
+
+// Reads the first whitespace-delimited token of a sysfs file. Returns false on
+// failure.
+bool ReadSysfsToken(const char* dir, const char* file, char* buf,
+                    int buf_size) {
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    return false;
+  }
+  char format[16];
+  snprintf(format, sizeof(format), "%%%ds", buf_size - 1);
+  const bool success = fscanf(f, format, buf) == 1;
+  fclose(f);
+  return success;
+}
+
+// Counts the CPUs in a sysfs CPU list such as "0-3,8-11".
+int CountCpusInList(const char* list) {
+  int count = 0;
+  const char* ptr = list;
+  while (*ptr) {
+    int first, last, chars;
+    if (sscanf(ptr, "%d-%d%n", &first, &last, &chars) == 2) {
+      count += last - first + 1;
+    } else if (sscanf(ptr, "%d%n", &first, &chars) == 1) {
+      count++;
+    } else {
+      return 0;
+    }
+    ptr += chars;
+    if (*ptr == ',') {
+      ptr++;
+    }
+  }
+  return count;
+}
+
+// Enumerates the caches of CPU 0 as described in sysfs.
+int DetectCachesWithSysfs(CacheInfo* caches) {
+  int count = 0;
+  for (int index = 0; count < kMaxCaches; index++) {
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/sys/devices/system/cpu/cpu0/cache/index%d",
+             index);
+    char buf[256];
+    if (!ReadSysfsToken(dir, "type", buf, sizeof(buf))) {
+      break;
+    }
+    if (buf[0] == 'I') {
+      // Instruction cache.
+      continue;
+    }
+    CacheInfo cache;
+    if (!ReadSysfsToken(dir, "level", buf, sizeof(buf)) ||
+        sscanf(buf, "%d", &cache.level) != 1) {
+      continue;
+    }
+    int size;
+    char unit = 0;
+    if (!ReadSysfsToken(dir, "size", buf, sizeof(buf)) ||
+        sscanf(buf, "%d%c", &size, &unit) < 1) {
+      continue;
+    }
+    cache.size = unit == 'K' ? size << 10 : unit == 'M' ? size << 20 : size;
+    if (ReadSysfsToken(dir, "shared_cpu_list", buf, sizeof(buf))) {
+      cache.sharing_cpus = CountCpusInList(buf);
+    }
+    caches[count++] = cache;
+  }
+  return count;
+}
+
+#endif  // __linux__
+
+}  // namespace
+
+void CpuInfo::EnsureDataCacheSizesDetected() {
+  if (data_cache_sizes_detected_) {
+    return;
+  }
+  data_cache_sizes_detected_ = true;
+  CacheInfo caches[kMaxCaches];
+  int count = 0;
+#if RUY_PLATFORM_X86
+  count = DetectCachesWithCpuid(caches);
+#endif
+#ifdef __linux__
+  if (count == 0) {
+    count = DetectCachesWithSysfs(caches);
+  }
+#endif
+  ComputeLocalAndSharedCacheSizes(caches, count, &local_data_cache_size_,
+                                  &shared_data_cache_size_);
+}
+
+int CpuInfo::LocalDataCacheSize() {
+  EnsureDataCacheSizesDetected();
+  return local_data_cache_size_;
+}
+
+int CpuInfo::SharedDataCacheSize() {
+  EnsureDataCacheSizesDetected();
+  return shared_data_cache_size_;
+}
+
+}  // namespace ruy
@@ -33,6 +33,12 @@ class CpuInfo final {
   bool Avx512();
   bool AvxVnni();
 
+  // Data cache sizes in bytes, detected at runtime from CPUID on x86 and from
+  // sysfs on Linux, or 0 if unknown. See cpu_cache_size.h for what local and
+  // shared mean.
+  int LocalDataCacheSize();
+  int SharedDataCacheSize();
+
  private:
   enum class InitStatus {
     kNotYetAttempted,
@@ -41,6 +47,12 @@ class CpuInfo final {
   };
   InitStatus init_status_ = InitStatus::kNotYetAttempted;
   bool EnsureInitialized();
+  // Cache size detection does not depend on the cpuinfo library, so it has
+  // its own initialization status.
+  bool data_cache_sizes_detected_ = false;
+  int local_data_cache_size_ = 0;
+  int shared_data_cache_size_ = 0;
+  void EnsureDataCacheSizesDetected();
   CpuInfo(const CpuInfo&) = delete;
 };
 
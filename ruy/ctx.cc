@@ -15,15 +15,36 @@ limitations under the License.
 
 #include "ruy/ctx.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <vector>
 
+#include "ruy/allocator.h"
+#include "ruy/block_map.h"
+#include "ruy/block_scheduling.h"
 #include "ruy/check_macros.h"
+#include "ruy/cpu_cache_size.h"
+#include "ruy/cpu_quota.h"
+#include "ruy/cpu_topology.h"
 #include "ruy/cpuinfo.h"
 #include "ruy/ctx_impl.h"
 #include "ruy/have_built_path_for.h"
+#include "ruy/kernel.h"
+#include "ruy/mat.h"
+#include "ruy/mul_params.h"
+#include "ruy/opt_set.h"
 #include "ruy/path.h"
 #include "ruy/platform.h"
 #include "ruy/prepacked_cache.h"
+#include "ruy/side_pair.h"
+#include "ruy/size_util.h"
+#include "ruy/thread_pool.h"
+#include "ruy/time.h"
+#include "ruy/tune.h"
+#include "ruy/tuned_plans.h"
+#include "ruy/warm_up.h"
 
 namespace ruy {
 
@@ -40,6 +61,38 @@ ThreadPool* Ctx::mutable_thread_pool() { return &mutable_impl()->thread_pool_; }
 int Ctx::max_num_threads() const { return impl().max_num_threads_; }
 void Ctx::set_max_num_threads(int value) {
   mutable_impl()->max_num_threads_ = value;
+  mutable_impl()->auto_num_threads_ = false;
+}
+bool Ctx::auto_num_threads() const { return impl().auto_num_threads_; }
+void Ctx::set_auto_num_threads(bool value) {
+  mutable_impl()->auto_num_threads_ = value;
+  mutable_impl()->auto_num_threads_time_ = TimePoint();
+  UpdateAutoNumThreads();
+}
+
+BlockScheduling Ctx::block_scheduling() const {
+  return impl().block_scheduling_;
+}
+void Ctx::set_block_scheduling(BlockScheduling value) {
+  mutable_impl()->block_scheduling_ = value;
+}
+
+bool Ctx::numa_aware() const { return impl().numa_aware_; }
+void Ctx::set_numa_aware(bool value) { mutable_impl()->numa_aware_ = value; }
+bool Ctx::pin_threads() const { return impl().pin_threads_; }
+void Ctx::set_pin_threads(bool value) {
+  mutable_impl()->pin_threads_ = value;
+  UpdateThreadPinning();
+}
+bool Ctx::split_depth() const { return impl().split_depth_; }
+void Ctx::set_split_depth(bool value) { mutable_impl()->split_depth_ = value; }
+bool Ctx::non_pot_block_grids() const { return impl().non_pot_block_grids_; }
+void Ctx::set_non_pot_block_grids(bool value) {
+  mutable_impl()->non_pot_block_grids_ = value;
+}
+bool Ctx::depth_blocking() const { return impl().depth_blocking_; }
+void Ctx::set_depth_blocking(bool value) {
+  mutable_impl()->depth_blocking_ = value;
 }
 
 void Ctx::SetRuntimeEnabledPaths(Path paths) {
@@ -129,6 +182,77 @@ Path Ctx::SelectPath(Path compiled_paths) {
              GetMostSignificantPath(compiled_paths & GetRuntimeEnabledPaths());
 }
 
+int Ctx::GetLocalDataCacheSize() {
+  if (impl().local_data_cache_size_) {
+    return impl().local_data_cache_size_;
+  }
+  const int detected = mutable_cpuinfo()->LocalDataCacheSize();
+  return detected ? detected : LocalDataCacheSize();
+}
+
+int Ctx::GetSharedDataCacheSize() {
+  if (impl().shared_data_cache_size_) {
+    return impl().shared_data_cache_size_;
+  }
+  const int detected = mutable_cpuinfo()->SharedDataCacheSize();
+  return detected ? detected : SharedDataCacheSize();
+}
+
+void Ctx::SetDataCacheSizes(int local_data_cache_size,
+                            int shared_data_cache_size) {
+  mutable_impl()->local_data_cache_size_ = local_data_cache_size;
+  mutable_impl()->shared_data_cache_size_ = shared_data_cache_size;
+}
+
+const CpuTopology& Ctx::GetCpuTopology() {
+  if (!impl().cpu_topology_) {
+    mutable_impl()->cpu_topology_.reset(
+        new CpuTopology(DetectCpuTopology()));
+  }
+  return *impl().cpu_topology_;
+}
+
+void Ctx::SetCpuTopology(const CpuTopology& topology) {
+  mutable_impl()->cpu_topology_.reset(new CpuTopology(topology));
+  UpdateThreadPinning();
+}
+
+void Ctx::UpdateThreadPinning() {
+  if (!pin_threads()) {
+    mutable_thread_pool()->set_cpu_affinity(nullptr);
+    return;
+  }
+  const CpuTopology topology = GetCpuTopology();
+  mutable_thread_pool()->set_cpu_affinity(
+      [topology](int thread_index) {
+        return CpuForThread(topology, thread_index);
+      });
+}
+
+void Ctx::UpdateAutoNumThreads() {
+  if (!impl().auto_num_threads_) {
+    return;
+  }
+  // Re-reading the affinity and cgroup files takes some tens of
+  // microseconds, too much to do for every small multiplication.
+  static constexpr float kRefreshSeconds = 1.f;
+  const TimePoint now = CoarseNow();
+  if (impl().auto_num_threads_time_ != TimePoint() &&
+      now - impl().auto_num_threads_time_ <
+          DurationFromSeconds(kRefreshSeconds)) {
+    return;
+  }
+  mutable_impl()->auto_num_threads_time_ = now;
+  mutable_impl()->max_num_threads_ = DetectAvailableCpuCount(
+      impl().cpu_quota_sources_ ? *impl().cpu_quota_sources_
+                                : CpuQuotaSources());
+}
+
+void Ctx::SetCpuQuotaSources(const CpuQuotaSources& sources) {
+  mutable_impl()->cpu_quota_sources_.reset(new CpuQuotaSources(sources));
+  mutable_impl()->auto_num_threads_time_ = TimePoint();
+}
+
 void Ctx::EnsureThreadSpecificResources(int thread_count) {
   auto& resources = mutable_impl()->thread_specific_resources_;
   while (thread_count > static_cast<int>(resources.size())) {
@@ -156,6 +280,14 @@ Allocator* Ctx::GetMainAllocator() {
   return impl().main_allocator_.get();
 }
 
+Allocator* Ctx::GetNumaNodeAllocator(int node) {
+  auto& allocators = mutable_impl()->numa_node_allocators_;
+  while (node >= static_cast<int>(allocators.size())) {
+    allocators.emplace_back(new Allocator);
+  }
+  return allocators[node].get();
+}
+
 PrepackedCache* Ctx::GetPrepackedCache() {
   if (!impl().prepacked_cache_) {
     mutable_impl()->prepacked_cache_.reset(new PrepackedCache);
@@ -163,6 +295,14 @@ PrepackedCache* Ctx::GetPrepackedCache() {
   return impl().prepacked_cache_.get();
 }
 
+SharedPrepackedCache* Ctx::shared_prepacked_cache() const {
+  return impl().shared_prepacked_cache_;
+}
+
+void Ctx::set_shared_prepacked_cache(SharedPrepackedCache* value) {
+  mutable_impl()->shared_prepacked_cache_ = value;
+}
+
 Tuning Ctx::GetMainThreadTuning() {
   EnsureThreadSpecificResources(1);
   TuningResolver* tuning_resolver = GetThreadSpecificTuningResolver(0);
@@ -172,4 +312,193 @@ Tuning Ctx::GetMainThreadTuning() {
 
 void Ctx::ClearPrepackedCache() { mutable_impl()->prepacked_cache_ = nullptr; }
 
+void Ctx::ResetPrepackedCache(int max_buffers_bytes) {
+  mutable_impl()->prepacked_cache_.reset(
+      new PrepackedCache(max_buffers_bytes));
+}
+
+const TunedPlans* Ctx::tuned_plans() const { return impl().tuned_plans_.get(); }
+
+void Ctx::SetTunedPlans(const TunedPlans& plans) {
+  mutable_impl()->tuned_plans_.reset(new TunedPlans(plans));
+}
+
+void Ctx::ClearTunedPlans() {
+  mutable_impl()->tuned_plans_ = nullptr;
+}
+
+namespace {
+
+// Slack for the small allocations that TrMul makes besides the large
+// buffers estimated below: atomics, tasks, per-block flags.
+constexpr std::ptrdiff_t kWarmUpArenaSlackBytes = 4096;
+
+// Returns the kernel layouts that a Mul on ThePath packs to: float operands
+// if scalar_size is 4, 8-bit ones otherwise.
+template <Path ThePath>
+SidePair<KernelLayout> GetWarmUpKernelLayouts(int scalar_size) {
+  using FloatKernel =
+      Kernel<ThePath, float, float, float, MulParams<float, float>>;
+  using Int8Kernel = Kernel<ThePath, std::int8_t, std::int8_t, std::int8_t,
+                            MulParams<std::int32_t, std::int8_t>>;
+  if (scalar_size == 4) {
+    return SidePair<KernelLayout>(
+        ToKernelLayout<typename FloatKernel::LhsLayout>(),
+        ToKernelLayout<typename FloatKernel::RhsLayout>());
+  }
+  return SidePair<KernelLayout>(
+      ToKernelLayout<typename Int8Kernel::LhsLayout>(),
+      ToKernelLayout<typename Int8Kernel::RhsLayout>());
+}
+
+SidePair<KernelLayout> GetWarmUpKernelLayouts(Path path, int scalar_size) {
+  switch (path) {
+#if RUY_PLATFORM_NEON
+    case Path::kNeon:
+      return GetWarmUpKernelLayouts<Path::kNeon>(scalar_size);
+    case Path::kNeonDotprod:
+      return GetWarmUpKernelLayouts<Path::kNeonDotprod>(scalar_size);
+#elif RUY_PLATFORM_X86
+    case Path::kSse42:
+      return GetWarmUpKernelLayouts<Path::kSse42>(scalar_size);
+    case Path::kAvx2:
+      return GetWarmUpKernelLayouts<Path::kAvx2>(scalar_size);
+    case Path::kAvx512:
+      return GetWarmUpKernelLayouts<Path::kAvx512>(scalar_size);
+    case Path::kAvxVnni:
+      return GetWarmUpKernelLayouts<Path::kAvxVnni>(scalar_size);
+#endif
+    default:
+      return GetWarmUpKernelLayouts<Path::kStandardCpp>(scalar_size);
+  }
+}
+
+// Estimates the size of a packed matrix of the given width (rows of the LHS,
+// columns of the RHS) and its sums, padded the way CreatePackedLayout pads
+// it for the given kernel layout.
+std::ptrdiff_t EstimatePackedBytes(int width, int depth, int scalar_size,
+                                   const KernelLayout& kernel_layout) {
+  const std::ptrdiff_t padded_width = round_up_pot(width, kernel_layout.cols);
+  std::ptrdiff_t stride = round_up_pot(depth, kernel_layout.rows);
+  if (RUY_OPT(AVOID_ALIASING) && (stride * scalar_size) % 1024 == 0) {
+    stride += 64;
+  }
+  return padded_width * stride * scalar_size +
+         padded_width * static_cast<std::ptrdiff_t>(sizeof(std::int32_t));
+}
+
+// Estimates the size of the raw accumulators that each thread allocates from
+// its own arena for the largest shape of params: those of the whole
+// destination matrix if it would be split along the depth, see
+// GetSplitDepthSliceCount in trmul.cc, those of one block if its depth would
+// be tiled into slabs, see BlockMap::depth_block_size, or none.
+std::ptrdiff_t EstimateThreadAccumBytes(
+    Ctx* ctx, const WarmUpParams& params,
+    const SidePair<KernelLayout>& kernel_layouts, int thread_count) {
+  if (params.max_rows <= 0 || params.max_depth <= 0 || params.max_cols <= 0) {
+    return 0;
+  }
+  const std::ptrdiff_t accum_size = sizeof(std::int32_t);
+  BlockMapOverrides overrides;
+  overrides.allow_non_pot_grid = ctx->non_pot_block_grids();
+  overrides.allow_depth_blocking = ctx->depth_blocking();
+  BlockMap block_map;
+  MakeBlockMap(round_up_pot(params.max_rows, kernel_layouts[Side::kLhs].cols),
+               round_up_pot(params.max_cols, kernel_layouts[Side::kRhs].cols),
+               round_up_pot(params.max_depth, kernel_layouts[Side::kLhs].rows),
+               kernel_layouts[Side::kLhs].cols, kernel_layouts[Side::kRhs].cols,
+               params.scalar_size, params.scalar_size, thread_count,
+               ctx->GetLocalDataCacheSize(), ctx->GetSharedDataCacheSize(),
+               overrides, &block_map);
+  if (ctx->split_depth() && NumBlocks(block_map) < thread_count) {
+    return static_cast<std::ptrdiff_t>(params.max_rows) * params.max_cols *
+           accum_size;
+  }
+  if (block_map.depth_block_size < params.max_depth) {
+    return static_cast<std::ptrdiff_t>(block_map.small_block_dims[Side::kLhs] +
+                                       block_map.kernel_dims[Side::kLhs]) *
+           (block_map.small_block_dims[Side::kRhs] +
+            block_map.kernel_dims[Side::kRhs]) *
+           accum_size;
+  }
+  return 0;
+}
+
+// Task run by every thread of the thread pool during WarmUp: it resolves the
+// tuning of the thread, which may involve a benchmark on some CPUs, and sizes
+// the thread's own allocator.
+struct WarmUpTask final : Task {
+  WarmUpTask(TuningResolver* tuning_resolver_, Allocator* allocator_,
+             std::ptrdiff_t arena_bytes_, bool prefault_)
+      : tuning_resolver(tuning_resolver_),
+        allocator(allocator_),
+        arena_bytes(arena_bytes_),
+        prefault(prefault_) {}
+
+  void Run() override {
+    tuning_resolver->Resolve();
+    allocator->Reserve(arena_bytes);
+    if (prefault) {
+      allocator->Prefault();
+    }
+  }
+
+  TuningResolver* tuning_resolver;
+  Allocator* allocator;
+  std::ptrdiff_t arena_bytes;
+  bool prefault;
+};
+
+}  // namespace
+
+void Ctx::WarmUp(const WarmUpParams& params) {
+  UpdateAutoNumThreads();
+  // Detect, and store on this context, everything that the first TrMul
+  // would otherwise detect.
+  GetRuntimeEnabledPaths();
+  GetLocalDataCacheSize();
+  GetSharedDataCacheSize();
+  GetCpuTopology();
+
+  // Size the packed matrices for the path that Mul would select, without
+  // recording it as the last used path.
+  const SidePair<KernelLayout> kernel_layouts = GetWarmUpKernelLayouts(
+      GetMostSignificantPath(kDefaultPaths & GetRuntimeEnabledPaths()),
+      params.scalar_size);
+  const std::ptrdiff_t main_arena_bytes = std::max(
+      params.main_arena_bytes,
+      EstimatePackedBytes(params.max_rows, params.max_depth,
+                          params.scalar_size, kernel_layouts[Side::kLhs]) +
+          EstimatePackedBytes(params.max_cols, params.max_depth,
+                              params.scalar_size, kernel_layouts[Side::kRhs]) +
+          kWarmUpArenaSlackBytes);
+  const int thread_count = std::max(1, max_num_threads());
+  const std::ptrdiff_t thread_arena_bytes = std::max(
+      params.thread_arena_bytes,
+      EstimateThreadAccumBytes(this, params, kernel_layouts, thread_count) +
+          kWarmUpArenaSlackBytes);
+
+  Allocator* main_allocator = GetMainAllocator();
+  main_allocator->Reserve(main_arena_bytes);
+  if (params.prefault_arenas) {
+    main_allocator->Prefault();
+  }
+
+  // Running a task on every thread creates the worker threads, and lets
+  // each of them do its own initialization, in particular touch its own
+  // arena from the thread that will use it.
+  EnsureThreadSpecificResources(thread_count);
+  // The tasks are not allocated from the main allocator, as TrMul does,
+  // since that was just reserved and must stay empty.
+  std::vector<WarmUpTask> tasks;
+  tasks.reserve(thread_count);
+  for (int i = 0; i < thread_count; i++) {
+    TuningResolver* tuning_resolver = GetThreadSpecificTuningResolver(i);
+    tuning_resolver->SetTuning(explicit_tuning());
+    tasks.emplace_back(tuning_resolver, GetThreadSpecificAllocator(i),
+                       thread_arena_bytes, params.prefault_arenas);
+  }
+  mutable_thread_pool()->Execute(thread_count, tasks.data());
+}
+
 }  // namespace ruy
@@ -28,9 +28,15 @@ class ThreadPool;
 class Allocator;
 class TuningResolver;
 class PrepackedCache;
+class TunedPlans;
+class SharedPrepackedCache;
 class CpuInfo;
+struct CpuTopology;
+struct CpuQuotaSources;
+struct WarmUpParams;
 enum class Path : std::uint8_t;
 enum class Tuning;
+enum class BlockScheduling : std::uint8_t;
 
 // Ctx is the internal context class used throughout ruy code. Whereas Context
 // is exposed to users, Ctx is internal to ruy. As many of ruy's internal
@@ -48,6 +54,20 @@ class Ctx /* not final, subclassed by CtxImpl */ {
   ThreadPool* mutable_thread_pool();
   int max_num_threads() const;
   void set_max_num_threads(int value);
+  bool auto_num_threads() const;
+  void set_auto_num_threads(bool value);
+  BlockScheduling block_scheduling() const;
+  void set_block_scheduling(BlockScheduling value);
+  bool numa_aware() const;
+  void set_numa_aware(bool value);
+  bool pin_threads() const;
+  void set_pin_threads(bool value);
+  bool split_depth() const;
+  void set_split_depth(bool value);
+  bool non_pot_block_grids() const;
+  void set_non_pot_block_grids(bool value);
+  bool depth_blocking() const;
+  void set_depth_blocking(bool value);
   CpuInfo* mutable_cpuinfo();
 
   // Returns the set of Path's that are available. By default, this is based on
@@ -68,18 +88,69 @@ class Ctx /* not final, subclassed by CtxImpl */ {
   void SetRuntimeEnabledPaths(Path paths);
 
   Path SelectPath(Path compiled_paths);
+
+  // Returns the data cache sizes used for blocking decisions, see
+  // cpu_cache_size.h. By default, they are detected at runtime by CpuInfo, with
+  // a fallback to the defaults from cpu_cache_size.h. Detection results are
+  // stored on the context object so that subsequent calls are fast.
+  int GetLocalDataCacheSize();
+  int GetSharedDataCacheSize();
+  // Overrides the above. Passing 0 reverts to the default behavior.
+  void SetDataCacheSizes(int local_data_cache_size,
+                         int shared_data_cache_size);
+
+  // Returns the NUMA topology of the machine. By default, it is detected at
+  // runtime, see DetectCpuTopology. Detection results are stored on the
+  // context object so that subsequent calls are fast. This is overridden by
+  // SetCpuTopology, e.g. to simulate a multi-node topology in tests.
+  const CpuTopology& GetCpuTopology();
+  void SetCpuTopology(const CpuTopology& topology);
+
+  // When auto_num_threads() is set, sets max_num_threads to the number of
+  // CPUs available to the process, see DetectAvailableCpuCount, re-detecting
+  // it if the last detection is older than a refresh period, as quotas and
+  // affinity may change while the process runs. Called at the start of each
+  // multiplication, so it must be cheap when there is nothing to do.
+  // A change of max_num_threads invalidates nothing: no cache is keyed on
+  // it, tuned plans are capped by it at lookup, and the thread pool and
+  // thread-specific resources only grow, so threads and arenas created for
+  // a larger count are kept and reused if the count goes back up.
+  void UpdateAutoNumThreads();
+  // Overrides where UpdateAutoNumThreads reads from, e.g. to point it at fake
+  // files in tests, and forces the next call to re-detect.
+  void SetCpuQuotaSources(const CpuQuotaSources& sources);
+
   void EnsureThreadSpecificResources(int thread_count);
   TuningResolver* GetThreadSpecificTuningResolver(int thread_index) const;
   Allocator* GetThreadSpecificAllocator(int thread_index) const;
   Allocator* GetMainAllocator();
+  // Allocator for buffers holding data that is mostly accessed by threads on
+  // the given NUMA node, see TrMul. Like the main allocator, it must only be
+  // used by the main thread.
+  Allocator* GetNumaNodeAllocator(int node);
   PrepackedCache* GetPrepackedCache();
+  // When not null, used instead of GetPrepackedCache(). Not owned.
+  SharedPrepackedCache* shared_prepacked_cache() const;
+  void set_shared_prepacked_cache(SharedPrepackedCache* value);
   Tuning GetMainThreadTuning();
   void ClearPrepackedCache();
+  // Replaces GetPrepackedCache() by an empty cache with the given budget, e.g.
+  // to exercise ejection in tests.
+  void ResetPrepackedCache(int max_buffers_bytes);
+  // Returns the tuned plans set by SetTunedPlans, or nullptr if none.
+  const TunedPlans* tuned_plans() const;
+  void SetTunedPlans(const TunedPlans& plans);
+  void ClearTunedPlans();
+  // See Context::WarmUp.
+  void WarmUp(const WarmUpParams& params);
 
  private:
   // Downcast helpers.
   const CtxImpl& impl() const;
   CtxImpl* mutable_impl();
+
+  // Passes the current pinning settings on to the thread pool.
+  void UpdateThreadPinning();
 };
 
 }  // namespace ruy
@@ -24,12 +24,17 @@ limitations under the License.
 #include <vector>
 
 #include "ruy/allocator.h"
+#include "ruy/block_scheduling.h"
+#include "ruy/cpu_quota.h"
+#include "ruy/cpu_topology.h"
 #include "ruy/cpuinfo.h"
 #include "ruy/ctx.h"
 #include "ruy/path.h"
 #include "ruy/prepacked_cache.h"
 #include "ruy/thread_pool.h"
+#include "ruy/time.h"
 #include "ruy/tune.h"
+#include "ruy/tuned_plans.h"
 
 namespace ruy {
 
@@ -61,17 +66,45 @@ class CtxImpl final : public Ctx {
   Tuning explicit_tuning_ = Tuning::kAuto;
   ThreadPool thread_pool_;
   int max_num_threads_ = 1;
+  // See Context::set_auto_num_threads.
+  bool auto_num_threads_ = false;
+  // When max_num_threads_ was last detected by UpdateAutoNumThreads. The
+  // default value means never.
+  TimePoint auto_num_threads_time_;
+  // Set by SetCpuQuotaSources. Null means the default sources.
+  std::unique_ptr<CpuQuotaSources> cpu_quota_sources_;
+  BlockScheduling block_scheduling_ = BlockScheduling::kSharedCounter;
+  bool numa_aware_ = false;
+  bool pin_threads_ = false;
+  bool split_depth_ = true;
+  bool non_pot_block_grids_ = true;
+  bool depth_blocking_ = false;
   // Allocator for main thread work before invoking the threadpool.
   // Our simple Allocator does not allow reserving/allocating more blocks
   // while it's already in committed state, so the main thread needs both
   // this allocator, and its per-thread allocator.
   std::unique_ptr<Allocator> main_allocator_;
+  // Allocators for buffers local to each NUMA node. Since memory pages are
+  // placed on the node of the thread that first touches them, reusing the
+  // same allocator for the same node keeps the buffers on that node.
+  std::vector<std::unique_ptr<Allocator>> numa_node_allocators_;
   std::unique_ptr<PrepackedCache> prepacked_cache_;
+  // See Context::set_shared_prepacked_cache. Not owned.
+  SharedPrepackedCache* shared_prepacked_cache_ = nullptr;
+  // See Context::LoadTunedPlans. Null if none.
+  std::unique_ptr<TunedPlans> tuned_plans_;
   // Set of Paths enabled at runtime. By default, that is based on runtime
   // detection, but may be overridden. The initial value kNone
   // means that detection has not yet been performed.
   Path runtime_enabled_paths_ = Path::kNone;
   CpuInfo cpuinfo_;
+  // NUMA topology, either detected or set by SetCpuTopology. Null until
+  // either happens.
+  std::unique_ptr<CpuTopology> cpu_topology_;
+  // Data cache sizes set by SetDataCacheSizes, overriding detection. 0 means
+  // no override.
+  int local_data_cache_size_ = 0;
+  int shared_data_cache_size_ = 0;
   // State for each thread in the thread pool. Entry 0 is the main thread.
   std::vector<std::unique_ptr<ThreadSpecificResource>>
       thread_specific_resources_;
@@ -13,6 +13,7 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include "ruy/cpu_quota.h"
 #include "ruy/ctx_impl.h"
 #include "ruy/gtest_wrapper.h"
 #include "ruy/path.h"
@@ -67,6 +68,44 @@ TEST(ContextInternalTest, ThreadSpecificResources) {
   }
 }
 
+TEST(ContextInternalTest, DataCacheSizes) {
+  CtxImpl ctx;
+  const int local = ctx.GetLocalDataCacheSize();
+  const int shared = ctx.GetSharedDataCacheSize();
+  EXPECT_GT(local, 0);
+  EXPECT_GE(shared, local);
+  EXPECT_EQ(ctx.GetLocalDataCacheSize(), local);
+  EXPECT_EQ(ctx.GetSharedDataCacheSize(), shared);
+  ctx.SetDataCacheSizes(1 << 12, 1 << 13);
+  EXPECT_EQ(ctx.GetLocalDataCacheSize(), 1 << 12);
+  EXPECT_EQ(ctx.GetSharedDataCacheSize(), 1 << 13);
+  ctx.SetDataCacheSizes(0, 0);
+  EXPECT_EQ(ctx.GetLocalDataCacheSize(), local);
+  EXPECT_EQ(ctx.GetSharedDataCacheSize(), shared);
+}
+
+TEST(ContextInternalTest, AutoNumThreads) {
+  CtxImpl ctx;
+  EXPECT_FALSE(ctx.auto_num_threads());
+  // With no affinity or quota to read, the automatic thread count falls back
+  // to the number of hardware threads. See cpu_quota_test for the detection
+  // itself.
+  CpuQuotaSources sources;
+  sources.proc_status = "/nonexistent";
+  sources.proc_cgroup = "/nonexistent";
+  ctx.SetCpuQuotaSources(sources);
+  ctx.set_auto_num_threads(true);
+  EXPECT_TRUE(ctx.auto_num_threads());
+  EXPECT_EQ(ctx.max_num_threads(), DetectAvailableCpuCount(sources));
+  ctx.UpdateAutoNumThreads();
+  EXPECT_EQ(ctx.max_num_threads(), DetectAvailableCpuCount(sources));
+  // An explicit thread count turns the automatic one off.
+  ctx.set_max_num_threads(3);
+  EXPECT_FALSE(ctx.auto_num_threads());
+  ctx.UpdateAutoNumThreads();
+  EXPECT_EQ(ctx.max_num_threads(), 3);
+}
+
 }  // namespace
 }  // namespace ruy
 
@@ -31,13 +31,20 @@ limitations under the License.
 #define RUY_RUY_DISPATCH_H_
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <limits>  // IWYU pragma: keep
+#include <memory>
+#include <new>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "ruy/allocator.h"
 #include "ruy/check_macros.h"
 #include "ruy/common.h"
 #include "ruy/ctx.h"
+#include "ruy/gemv.h"
 #include "ruy/kernel.h"
 #include "ruy/kernel_common.h"
 #include "ruy/mat.h"
@@ -46,6 +53,7 @@ limitations under the License.
 #include "ruy/opt_set.h"
 #include "ruy/pack.h"
 #include "ruy/pack_common.h"
+#include "ruy/packed_matrix.h"
 #include "ruy/path.h"
 #include "ruy/prepacked_cache.h"
 #include "ruy/profiler/instrumentation.h"
@@ -77,7 +85,7 @@ bool IsSymmetricZeroPoint(Scalar zero_point) {
 
 template <typename MulParamsType, typename Scalar>
 void CheckZeroPoint(Scalar zero_point) {
-  if (std::is_floating_point<Scalar>::value ||
+  if (!std::numeric_limits<Scalar>::is_integer ||
       MulParamsType::kZeroPointSupport == ZeroPointSupport::kSymmetric) {
     RUY_DCHECK(IsSymmetricZeroPoint(zero_point));
   }
@@ -111,6 +119,16 @@ void EnforceDstSpecSupport(const MulParamsType& mul_params,
                            DstScalar dst_zero_point) {
   static_assert(
       std::is_same<typename MulParamsType::DstScalar, DstScalar>::value, "");
+  if (IsDequantizing<MulParamsType>()) {
+    // Dequantizing to a floating-point destination is done by the
+    // float_multiplier fields, not by the fixed-point ones.
+    RUY_DCHECK_EQ(dst_zero_point, 0);
+    RUY_DCHECK_EQ(mul_params.multiplier_fixedpoint(), 0);
+    RUY_DCHECK_EQ(mul_params.multiplier_exponent(), 0);
+    RUY_DCHECK_EQ(mul_params.multiplier_fixedpoint_perchannel(), nullptr);
+    RUY_DCHECK_EQ(mul_params.multiplier_exponent_perchannel(), nullptr);
+    return;
+  }
   if (!std::is_same<typename MulParamsType::DstScalar, std::int32_t>::value)
     return;
 
@@ -127,12 +145,6 @@ void EnforceDstSpecSupport(const MulParamsType& mul_params,
   RUY_DCHECK_EQ(mul_params.multiplier_exponent_perchannel(), nullptr);
 }
 
-inline bool IsColMajorTrMul(const TrMulParams& params) {
-  return IsColMajor(params.src[Side::kLhs].layout) &&
-         IsColMajor(params.src[Side::kRhs].layout) &&
-         IsColMajor(params.dst.layout);
-}
-
 inline void CreatePackedLayout(const MatLayout& src, const Type& scalar,
                                const KernelLayout& kernel_layout,
                                PMatLayout* packed) {
@@ -156,10 +168,11 @@ void CreatePackedMatrix(Side side, const KernelLayout& kernel_layout,
   // matrix multiplication, so we would like to always use std::int32_t
   // unconditionally for SumsType.
   // However, for floating point types, we still need a reasonable type here to
-  // avoid tripping assertions elsewhere in the code.
-  using SumsType =
-      typename std::conditional<std::is_floating_point<Scalar>::value, Scalar,
-                                std::int32_t>::type;
+  // avoid tripping assertions elsewhere in the code. This is based on the
+  // packed type, since 16-bit floating-point types are packed as float.
+  using SumsType = typename std::conditional<
+      std::is_floating_point<PackedScalar>::value, PackedScalar,
+      std::int32_t>::type;
 
   const EMat& src = params->src[side];
   PEMat* packed = &params->packed[side];
@@ -167,33 +180,216 @@ void CreatePackedMatrix(Side side, const KernelLayout& kernel_layout,
   packed->sums_type = Type::Create<SumsType>();
   CreatePackedLayout(src.layout, packed->data_type, kernel_layout,
                      &packed->layout);
-  packed->zero_point = Pack<PackedScalar, Scalar>(src.zero_point);
+  // An integer matrix packed as float is dequantized by packing, zero
+  // point included, see PackDequantizedToFloat, and so is an int4 matrix
+  // expanded to int8, see PackInt4ToInt8.
+  const bool packing_applies_zero_points =
+      (std::is_floating_point<PackedScalar>::value &&
+       !std::is_floating_point<Scalar>::value) ||
+      std::is_same<Scalar, int4>::value;
+  packed->zero_point = packing_applies_zero_points
+                           ? 0
+                           : Pack<PackedScalar, Scalar>(src.zero_point);
+  // A float matrix packed as int8 is quantized by packing, see
+  // PackQuantizedToInt8.
+  packed->has_scales = std::is_same<Scalar, float>::value &&
+                       std::is_same<PackedScalar, std::int8_t>::value;
 }
 
-template <Path ThePath, typename LhsScalar, typename RhsScalar,
-          typename DstScalar, typename MulParamsType>
-void PopulateTrMulParams(TrMulParams* params) {
-  // The optimized code paths don't handle the full generality of Ruy's API.
-  // Fall back to Path::kStandardCpp if necessary.
-  bool fallback_to_standard_cpp = false;
-  if (ThePath != Path::kStandardCpp) {
-    // The optimized code paths currently only handle the case of all matrices
-    // being column major.
-    if (!IsColMajorTrMul(*params)) {
-      fallback_to_standard_cpp = true;
-    }
+// Sets the packing entry point of TrMulParams for the LHS, given whether it
+// is an int4 matrix expanded to int8 by packing. See PopulateTrMulParams.
+template <bool kExpandsInt4Lhs>
+struct PopulateLhsPackParams {
+  template <Path ThePath, typename LhsKernelLayout, typename LhsScalar,
+            typename PackedLhsScalar>
+  static void Run(TrMulParams* params) {
+    params->run_pack[Side::kLhs] =
+        &RunPack<ThePath, LhsKernelLayout, LhsScalar, PackedLhsScalar>;
   }
+};
 
-  if (fallback_to_standard_cpp) {
-    PopulateTrMulParams<Path::kStandardCpp, LhsScalar, RhsScalar, DstScalar,
-                        MulParamsType>(params);
-    return;
+template <>
+struct PopulateLhsPackParams<true> {
+  template <Path ThePath, typename LhsKernelLayout, typename LhsScalar,
+            typename PackedLhsScalar>
+  static void Run(TrMulParams* params) {
+    params->run_pack[Side::kLhs] =
+        &RunInt4ExpandingPack<ThePath, LhsKernelLayout>;
   }
+};
+
+// Sets the packing entry point of TrMulParams for the RHS, given whether it
+// is quantized by packing. See PopulateTrMulParams.
+template <bool kQuantizesRhs>
+struct PopulateRhsPackParams {
+  template <Path ThePath, typename RhsKernelLayout, typename RhsScalar,
+            typename PackedRhsScalar>
+  static void Run(TrMulParams* params) {
+    params->run_pack[Side::kRhs] =
+        &RunPack<ThePath, RhsKernelLayout, RhsScalar, PackedRhsScalar>;
+  }
+};
+
+template <>
+struct PopulateRhsPackParams<true> {
+  template <Path ThePath, typename RhsKernelLayout, typename RhsScalar,
+            typename PackedRhsScalar>
+  static void Run(TrMulParams* params) {
+    params->run_pack[Side::kRhs] = &RunQuantizingPack<ThePath, RhsKernelLayout>;
+  }
+};
+
+// Sets the kernel entry point of TrMulParams, given whether the kernel only
+// computes raw accumulators for RunDequantizingKernel to dequantize. See
+// PopulateTrMulParams.
+template <bool kDequantizesTiles>
+struct PopulateKernelParams {
+  template <Path ThePath, typename PackedLhsScalar, typename PackedRhsScalar,
+            typename DstScalar, typename MulParamsType>
+  static void Run(TrMulParams* params) {
+    params->run_kernel = &RunKernel<ThePath, PackedLhsScalar, PackedRhsScalar,
+                                    DstScalar, MulParamsType>;
+  }
+};
+
+template <>
+struct PopulateKernelParams<true> {
+  template <Path ThePath, typename PackedLhsScalar, typename PackedRhsScalar,
+            typename DstScalar, typename MulParamsType>
+  static void Run(TrMulParams* params) {
+    params->run_kernel =
+        &RunDequantizingKernel<ThePath, PackedLhsScalar, PackedRhsScalar,
+                               DstScalar, MulParamsType>;
+  }
+};
 
-  using PackedLhsScalar = PackedType<ThePath, LhsScalar>;
-  using PackedRhsScalar = PackedType<ThePath, RhsScalar>;
-  using Kernel = Kernel<ThePath, PackedLhsScalar, PackedRhsScalar, DstScalar,
-                        MulParamsType>;
+// Sets the GEMV entry points of TrMulParams, if kHasGemv. See
+// PopulateTrMulParams.
+template <bool kHasGemv>
+struct PopulateGemvParams {
+  template <Path ThePath, typename RhsScalar, typename PackedLhsScalar,
+            typename PackedRhsScalar, typename DstScalar,
+            typename MulParamsType>
+  static void Run(TrMulParams*) {}
+
+  // See PopulateGroupScaledParams.
+  template <Path ThePath, typename PackedLhsScalar, typename PackedRhsScalar,
+            typename DstScalar, typename MulParamsType>
+  static void RunGroupScaled(TrMulParams* params) {
+    params->run_gemv = nullptr;
+  }
+};
+
+template <>
+struct PopulateGemvParams<true> {
+  template <Path ThePath, typename RhsScalar, typename PackedLhsScalar,
+            typename PackedRhsScalar, typename DstScalar,
+            typename MulParamsType>
+  static void Run(TrMulParams* params) {
+    params->run_gemv = &RunGemv<ThePath, PackedLhsScalar, PackedRhsScalar,
+                                DstScalar, MulParamsType>;
+    params->prepare_gemv_rhs = &PrepareGemvRhs<RhsScalar, PackedRhsScalar>;
+  }
+
+  template <Path ThePath, typename PackedLhsScalar, typename PackedRhsScalar,
+            typename DstScalar, typename MulParamsType>
+  static void RunGroupScaled(TrMulParams* params) {
+    params->run_gemv =
+        &RunGroupScaledGemv<ThePath, PackedLhsScalar, PackedRhsScalar,
+                            DstScalar, MulParamsType>;
+  }
+};
+
+// If kHasGroupScales and the MulParams have lhs_scales, which is only known
+// at runtime, replaces the kernel and GEMV entry points of TrMulParams by
+// those applying group-wise LHS scales. See PopulateTrMulParams.
+template <bool kHasGroupScales, bool kHasGemv>
+struct PopulateGroupScaledParams {
+  template <Path ThePath, typename PackedLhsScalar, typename PackedRhsScalar,
+            typename DstScalar, typename MulParamsType>
+  static void Run(TrMulParams*) {}
+};
+
+template <bool kHasGemv>
+struct PopulateGroupScaledParams<true, kHasGemv> {
+  template <Path ThePath, typename PackedLhsScalar, typename PackedRhsScalar,
+            typename DstScalar, typename MulParamsType>
+  static void Run(TrMulParams* params) {
+    const MulParamsType& mul_params =
+        *static_cast<const MulParamsType*>(params->mul_params);
+    if (!mul_params.lhs_scales()) {
+      return;
+    }
+    // The kernels take the zero-point corrections of each group from the
+    // sums of each group, computed by packing.
+    for (Side side : {Side::kLhs, Side::kRhs}) {
+      params->packed[side].group_size = mul_params.lhs_group_size();
+    }
+    params->run_kernel =
+        &RunGroupScaledKernel<ThePath, PackedLhsScalar, PackedRhsScalar,
+                              DstScalar, MulParamsType>;
+    // Split-depth TrMul and depth blocking would add up raw accumulators
+    // across groups.
+    params->run_accum_kernel = nullptr;
+    params->run_split_depth_epilogue = nullptr;
+    PopulateGemvParams<kHasGemv>::template RunGroupScaled<
+        ThePath, PackedLhsScalar, PackedRhsScalar, DstScalar, MulParamsType>(
+        params);
+  }
+};
+
+template <Path ThePath, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void PopulateTrMulParams(TrMulParams* params) {
+  // All paths handle any combination of row-major and column-major matrices:
+  // the packing code reads both storage orders of its source matrix, and
+  // RunKernelTyped takes care of row-major destination matrices, so there
+  // is no need to fall back to Path::kStandardCpp here.
+  using AccumScalar = typename MulParamsType::AccumScalar;
+  // A float RHS multiplied by an 8-bit or int4 LHS with integer accumulators
+  // is quantized to int8 by packing, one scale per column, see
+  // PackQuantizedToInt8. The scales are applied by the dequantization to the
+  // floating-point destination.
+  static constexpr bool kQuantizesRhs =
+      IsDequantizing<MulParamsType>() &&
+      std::is_same<RhsScalar, float>::value &&
+      (std::is_same<LhsScalar, std::int8_t>::value ||
+       std::is_same<LhsScalar, std::uint8_t>::value ||
+       std::is_same<LhsScalar, int4>::value);
+  // Kernels of the other paths only store integer destinations from integer
+  // accumulators, so dequantizing multiplications run them for raw
+  // accumulators, see RunDequantizingKernel.
+  static constexpr bool kDequantizesTiles =
+      IsDequantizing<MulParamsType>() && !KernelStoresDequantizedDst(ThePath);
+  // An int8 LHS with float accumulators holds weights quantized with the
+  // MulParams::lhs_scales, which packing dequantizes to float, see
+  // PackDequantizedToFloat. The rest is a float multiplication.
+  static constexpr bool kDequantizesLhs =
+      std::is_same<AccumScalar, float>::value &&
+      std::is_same<LhsScalar, std::int8_t>::value;
+  // An int4 LHS is expanded to int8 by packing, see PackInt4ToInt8, and then
+  // multiplied by the 8-bit kernels.
+  static constexpr bool kExpandsInt4Lhs = std::is_same<LhsScalar, int4>::value;
+  static_assert(!kExpandsInt4Lhs ||
+                    (std::is_same<AccumScalar, std::int32_t>::value &&
+                     (std::is_same<RhsScalar, std::int8_t>::value ||
+                      std::is_same<RhsScalar, std::uint8_t>::value ||
+                      kQuantizesRhs)),
+                "An int4 LHS requires an 8-bit integer RHS, or a float RHS "
+                "with a float destination, and int32 accumulators.");
+  using PackedLhsScalar =
+      typename std::conditional<kDequantizesLhs, float,
+                                PackedType<ThePath, LhsScalar>>::type;
+  using PackedRhsScalar = PackedType<
+      ThePath,
+      typename std::conditional<kQuantizesRhs, std::int8_t, RhsScalar>::type>;
+  using KernelMulParamsType =
+      typename std::conditional<kDequantizesTiles,
+                                MulParams<AccumScalar, AccumScalar>,
+                                MulParamsType>::type;
+  using Kernel = Kernel<ThePath, PackedLhsScalar, PackedRhsScalar,
+                        typename KernelMulParamsType::DstScalar,
+                        KernelMulParamsType>;
   using LhsKernelLayout = typename Kernel::LhsLayout;
   using RhsKernelLayout = typename Kernel::RhsLayout;
 
@@ -206,12 +402,58 @@ void PopulateTrMulParams(TrMulParams* params) {
       Side::kLhs, ToKernelLayout<LhsKernelLayout>(), params);
   CreatePackedMatrix<RhsScalar, PackedRhsScalar>(
       Side::kRhs, ToKernelLayout<RhsKernelLayout>(), params);
-  params->run_pack[Side::kLhs] =
-      &RunPack<ThePath, LhsKernelLayout, LhsScalar, PackedLhsScalar>;
-  params->run_pack[Side::kRhs] =
-      &RunPack<ThePath, RhsKernelLayout, RhsScalar, PackedRhsScalar>;
-  params->run_kernel = &RunKernel<ThePath, PackedLhsScalar, PackedRhsScalar,
-                                  DstScalar, MulParamsType>;
+  PopulateLhsPackParams<kExpandsInt4Lhs>::template Run<
+      ThePath, LhsKernelLayout, LhsScalar, PackedLhsScalar>(params);
+  PopulateRhsPackParams<kQuantizesRhs>::template Run<
+      ThePath, RhsKernelLayout, RhsScalar, PackedRhsScalar>(params);
+  PopulateKernelParams<kDequantizesTiles>::template Run<
+      ThePath, PackedLhsScalar, PackedRhsScalar, DstScalar, MulParamsType>(
+      params);
+
+  // Split-depth TrMul and depth blocking run the kernel for raw accumulators
+  // on the same packed matrices, so they are only possible if that kernel uses
+  // the same layouts, which may not be the case with a custom
+  // StandardCppKernelLhsLayout. Nor is split-depth TrMul possible with an RHS
+  // quantized by packing, as it packs each depth slice separately, which
+  // would give each its own scales.
+  using AccumKernel =
+      ruy::Kernel<ThePath, PackedLhsScalar, PackedRhsScalar, AccumScalar,
+                  MulParams<AccumScalar, AccumScalar>>;
+  if (!kQuantizesRhs &&
+      std::is_same<typename AccumKernel::LhsLayout, LhsKernelLayout>::value &&
+      std::is_same<typename AccumKernel::RhsLayout, RhsKernelLayout>::value) {
+    params->run_accum_kernel =
+        &RunAccumKernel<ThePath, PackedLhsScalar, PackedRhsScalar,
+                        AccumScalar>;
+    params->run_split_depth_epilogue =
+        &RunSplitDepthEpilogue<PackedLhsScalar, PackedRhsScalar, DstScalar,
+                               MulParamsType>;
+    params->accum_type = Type::Create<AccumScalar>();
+  }
+
+  // Matrix*vector products can use a GemvImpl reading the same packed LHS as
+  // the kernel, if there is one for this path.
+  using Gemv = GemvImpl<ThePath, PackedLhsScalar, PackedRhsScalar>;
+  static constexpr bool kHasGemv =
+      std::is_same<typename Gemv::LhsLayout, LhsKernelLayout>::value &&
+      std::is_same<typename Gemv::AccumScalar, AccumScalar>::value;
+  PopulateGemvParams<kHasGemv>::template Run<
+      ThePath, RhsScalar, PackedLhsScalar, PackedRhsScalar, DstScalar,
+      MulParamsType>(params);
+
+  // Group-wise LHS scales with integer accumulators (see
+  // MulParams::lhs_scales) go through RunGroupScaledKernel, which runs the
+  // same kernel for raw accumulators as depth blocking, on the depth slice of
+  // each group.
+  static constexpr bool kHasGroupScales =
+      IsDequantizing<MulParamsType>() &&
+      (std::is_same<PackedLhsScalar, std::int8_t>::value ||
+       std::is_same<PackedLhsScalar, std::uint8_t>::value) &&
+      std::is_same<typename AccumKernel::LhsLayout, LhsKernelLayout>::value &&
+      std::is_same<typename AccumKernel::RhsLayout, RhsKernelLayout>::value;
+  PopulateGroupScaledParams<kHasGroupScales, kHasGemv>::template Run<
+      ThePath, PackedLhsScalar, PackedRhsScalar, DstScalar, MulParamsType>(
+      params);
 }
 
 // PopulateTrMulParamsAllCompiledPaths calls into one of multiple
@@ -327,6 +569,32 @@ void CreateTrMulParams(const Mat<LhsScalar>& lhs, const Mat<RhsScalar>& rhs,
   params->src[Side::kRhs] = EraseType(rhs);
   params->dst = EraseType(*dst);
   params->mul_params = ToVoidPtr(&mul_params);
+  // Only used by packing if it dequantizes the LHS to float or expands it
+  // from int4, see PopulateTrMulParams.
+  static constexpr bool kFloatAccum =
+      std::is_same<typename MulParamsType::AccumScalar, float>::value;
+  static constexpr bool kHasLhsZeroPoints =
+      std::is_same<LhsScalar, int4>::value ||
+      (kFloatAccum && std::is_same<LhsScalar, std::int8_t>::value);
+  // Group-wise scales with integer accumulators, see RunGroupScaledKernel.
+  // They replace the int32 bias, which would need a scale of its own.
+  static constexpr bool kHasGroupScales =
+      IsDequantizing<MulParamsType>() &&
+      (std::is_same<LhsScalar, std::int8_t>::value ||
+       std::is_same<LhsScalar, std::uint8_t>::value ||
+       std::is_same<LhsScalar, int4>::value);
+  RUY_DCHECK(kHasLhsZeroPoints || !mul_params.lhs_zero_points());
+  RUY_DCHECK(kFloatAccum || kHasGroupScales || !mul_params.lhs_scales());
+  // See MulParams::lhs_scales for these requirements of group-wise scales
+  // with integer accumulators, which no type enforces.
+  RUY_CHECK(kFloatAccum || !mul_params.lhs_scales() || !mul_params.bias());
+  RUY_CHECK(kFloatAccum || !mul_params.lhs_scales() ||
+            mul_params.lhs_group_size() % 16 == 0);
+  RUY_DCHECK(!mul_params.lhs_zero_points() || lhs.zero_point == 0);
+  RUY_DCHECK_GE(mul_params.lhs_group_size(), 0);
+  params->src[Side::kLhs].scales = mul_params.lhs_scales();
+  params->src[Side::kLhs].zero_points = mul_params.lhs_zero_points();
+  params->src[Side::kLhs].group_size = mul_params.lhs_group_size();
 
   // Create inner loops and packed matrices based on the Path.
   PopulateTrMulParamsAllCompiledPaths<CompiledPaths, LhsScalar, RhsScalar,
@@ -343,6 +611,15 @@ void CreateTrMulParams(const Mat<LhsScalar>& lhs, const Mat<RhsScalar>& rhs,
 // a large fraction of the overall work, so a heuristic would typically
 // decide in favor of caching, if permitted at all by the cache_policy.
 inline bool ShouldCache(const TrMulParams& params, Side side) {
+  // In a strided batch, the RHS data pointer only identifies the first batch
+  // item, so it can't be used as a cache key.
+  if (side == Side::kRhs && params.batch_size > 1) {
+    return false;
+  }
+  // The scales of a side quantized by packing are not kept by the caches.
+  if (params.packed[side].has_scales) {
+    return false;
+  }
   const CachePolicy cache_policy = params.src[side].cache_policy;
   // The width that matters is that of the other side, it is what determines
   // the amortization of the packing work done on the present side.
@@ -371,20 +648,73 @@ inline bool ShouldCache(const TrMulParams& params, Side side) {
   }
 }
 
+// Looks up in the prepacked cache the sides of the TrMul that ShouldCache, and
+// packs those that are missing from it. That packing of the entire matrix is
+// spread over the thread pool, see PackMatrices.
 inline void HandlePrepackedCaching(TrMulParams* params, Ctx* ctx) {
   for (Side side : {Side::kLhs, Side::kRhs}) {
-    if (ShouldCache(*params, side)) {
+    if (!ShouldCache(*params, side)) {
+      continue;
+    }
+    if (auto* shared_cache = ctx->shared_prepacked_cache()) {
+      std::shared_ptr<SharedPrepackedCache::Entry> entry;
+      auto action = shared_cache->Get(params->src[side].data,
+                                      &params->packed[side], &entry);
+      if (action == PrepackedCache::Action::kInsertedNewEntry) {
+        PackMatrices(params, 1, side, ctx);
+        shared_cache->MarkPacked(entry.get());
+      }
+      params->prepacked_cache_entry[side] = std::move(entry);
+    } else {
       auto* cache = ctx->GetPrepackedCache();
       auto action = cache->Get(params->src[side].data, &params->packed[side]);
       if (action == PrepackedCache::Action::kInsertedNewEntry) {
-        params->RunPack(side, ctx->GetMainThreadTuning(), 0,
-                        params->packed[side].layout.cols);
+        PackMatrices(params, 1, side, ctx);
       }
-      params->is_prepacked[side] = true;
     }
+    params->is_prepacked[side] = true;
+  }
+}
+
+// Checks the arguments of one Mul and sets up the TrMulParams for it, given
+// the already selected Path, except for the prepacked cache lookups, see
+// PrepareTrMul.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void SetUpTrMul(const Mat<LhsScalar>& lhs, const Mat<RhsScalar>& rhs,
+                const MulParamsType& mul_params, Path the_path, Ctx* ctx,
+                Mat<DstScalar>* dst, TrMulParams* params) {
+  EnforceLayoutSupport<MulParamsType>(lhs.layout, rhs.layout, dst->layout);
+  EnforceZeroPointSupport<MulParamsType>(lhs.zero_point, rhs.zero_point,
+                                         dst->zero_point);
+  EnforceDstSpecSupport<MulParamsType>(mul_params, dst->zero_point);
+
+  // As described in the comment at the top of this file, Ruy internally
+  // converts Mul into TrMul. We handle that here.
+  Mat<LhsScalar> transposed_lhs(lhs);
+  Transpose(&transposed_lhs);
+  CreateTrMulParams<CompiledPaths>(transposed_lhs, rhs, mul_params, dst,
+                                   the_path, params);
+  if (!params->local_data_cache_size) {
+    params->local_data_cache_size = ctx->GetLocalDataCacheSize();
+  }
+  if (!params->shared_data_cache_size) {
+    params->shared_data_cache_size = ctx->GetSharedDataCacheSize();
   }
 }
 
+// Checks the arguments of one Mul and sets up the TrMulParams for it, given
+// the already selected Path, getting its prepacked sides from the cache. This
+// is the part of DispatchMul that is shared with the other Dispatch functions.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void PrepareTrMul(const Mat<LhsScalar>& lhs, const Mat<RhsScalar>& rhs,
+                  const MulParamsType& mul_params, Path the_path, Ctx* ctx,
+                  Mat<DstScalar>* dst, TrMulParams* params) {
+  SetUpTrMul<CompiledPaths>(lhs, rhs, mul_params, the_path, ctx, dst, params);
+  HandlePrepackedCaching(params, ctx);
+}
+
 template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
           typename DstScalar, typename MulParamsType>
 void DispatchMul(const Mat<LhsScalar>& lhs, const Mat<RhsScalar>& rhs,
@@ -399,11 +729,6 @@ void DispatchMul(const Mat<LhsScalar>& lhs, const Mat<RhsScalar>& rhs,
                                             lhs.layout.rows, lhs.layout.cols,
                                             rhs.layout.cols);
 
-  EnforceLayoutSupport<MulParamsType>(lhs.layout, rhs.layout, dst->layout);
-  EnforceZeroPointSupport<MulParamsType>(lhs.zero_point, rhs.zero_point,
-                                         dst->zero_point);
-  EnforceDstSpecSupport<MulParamsType>(mul_params, dst->zero_point);
-
   // This should be a constant, for a given machine and CompiledPaths.
   // There is a back door to override it for testing, but in production it will
   // always be the "best" Path, i.e. the one with the newest SIMD instructions
@@ -412,15 +737,307 @@ void DispatchMul(const Mat<LhsScalar>& lhs, const Mat<RhsScalar>& rhs,
   // Unfortunately, it is not a *static* constant, since it depends on runtime
   // detection of the available SIMD instructions.
   const Path the_path = ctx->SelectPath(CompiledPaths);
+  ctx->UpdateAutoNumThreads();
+
+  TrMulParams params;
+  PrepareTrMul<CompiledPaths>(lhs, rhs, mul_params, the_path, ctx, dst,
+                              &params);
+  TrMul(&params, ctx);
+}
+
+// Sets up the TrMulParams for packing `lhs` on its own, as done by
+// DispatchPrePack. The packed layout depends on the kernel, hence on all the
+// types of the multiplication, not only LhsScalar; that is why the RHS and
+// destination types are template parameters here even though no RHS or
+// destination matrix is involved. The `mul_params` are only used for their
+// type, and for the lhs_scales of an int8 LHS packed as float.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void CreatePrePackTrMulParams(const Mat<LhsScalar>& lhs,
+                              const MulParamsType& mul_params, Path the_path,
+                              TrMulParams* params) {
+  // Placeholder RHS and destination matrices, with a single column and no
+  // data. They are only needed to instantiate the right kernel, and thus
+  // to determine the packed LHS layout.
+  Mat<RhsScalar> rhs;
+  rhs.layout.rows = lhs.layout.cols;
+  rhs.layout.cols = 1;
+  rhs.layout.stride = lhs.layout.cols;
+  rhs.layout.order = Order::kColMajor;
+  Mat<DstScalar> dst;
+  dst.layout.rows = lhs.layout.rows;
+  dst.layout.cols = 1;
+  dst.layout.stride = lhs.layout.rows;
+  dst.layout.order = Order::kColMajor;
+  EnforceLayoutSupport<MulParamsType>(lhs.layout, rhs.layout, dst.layout);
+  CheckZeroPoint<MulParamsType>(lhs.zero_point);
 
-  // As described in the comment at the top of this file, Ruy internally
-  // converts Mul into TrMul. We handle that here.
   Mat<LhsScalar> transposed_lhs(lhs);
   Transpose(&transposed_lhs);
+  CreateTrMulParams<CompiledPaths>(transposed_lhs, rhs, mul_params, &dst,
+                                   the_path, params);
+}
+
+// Packs `lhs` into `*result`, in the form that DispatchPrePackedMul consumes.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void DispatchPrePack(const Mat<LhsScalar>& lhs,
+                     const MulParamsType& mul_params, Ctx* ctx,
+                     PackedMatrix<LhsScalar>* result) {
+  static_assert(CompiledPaths != Path::kNone, "Must compile at least one Path");
+  static_assert((CompiledPaths & ~kAllPaths) == Path::kNone,
+                "CompiledPaths must be a subset of ruy::kAllPaths");
+
+  profiler::ScopeLabel label("PrePack (%dx%d)", lhs.layout.rows,
+                             lhs.layout.cols);
+
+  const Path the_path = ctx->SelectPath(CompiledPaths);
+  ctx->UpdateAutoNumThreads();
   TrMulParams params;
-  CreateTrMulParams<CompiledPaths>(transposed_lhs, rhs, mul_params, dst,
-                                   the_path, &params);
-  HandlePrepackedCaching(&params, ctx);
+  CreatePrePackTrMulParams<CompiledPaths, LhsScalar, RhsScalar, DstScalar>(
+      lhs, mul_params, the_path, &params);
+  PackedMatrix<LhsScalar> packed_matrix(the_path, lhs.layout, lhs.zero_point,
+                                        params.packed[Side::kLhs]);
+  params.packed[Side::kLhs] = packed_matrix.packed();
+  PackMatrices(&params, 1, Side::kLhs, ctx);
+  *result = std::move(packed_matrix);
+}
+
+// Batch variant of DispatchPrePack, packing lhs[0 .. batch_size-1] into
+// results[0 .. batch_size-1] in a single pass over the thread pool.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void DispatchBatchPrePack(const Mat<LhsScalar>* lhs, int batch_size,
+                          const MulParamsType& mul_params, Ctx* ctx,
+                          PackedMatrix<LhsScalar>* results) {
+  static_assert(CompiledPaths != Path::kNone, "Must compile at least one Path");
+  static_assert((CompiledPaths & ~kAllPaths) == Path::kNone,
+                "CompiledPaths must be a subset of ruy::kAllPaths");
+
+  profiler::ScopeLabel label("BatchPrePack (batch_size=%d)", batch_size);
+
+  RUY_CHECK_GE(batch_size, 0);
+  if (batch_size == 0) {
+    return;
+  }
+
+  const Path the_path = ctx->SelectPath(CompiledPaths);
+  ctx->UpdateAutoNumThreads();
+  std::vector<TrMulParams> params(batch_size);
+  for (int i = 0; i < batch_size; i++) {
+    CreatePrePackTrMulParams<CompiledPaths, LhsScalar, RhsScalar, DstScalar>(
+        lhs[i], mul_params, the_path, &params[i]);
+    results[i] = PackedMatrix<LhsScalar>(the_path, lhs[i].layout,
+                                         lhs[i].zero_point,
+                                         params[i].packed[Side::kLhs]);
+    params[i].packed[Side::kLhs] = results[i].packed();
+  }
+  PackMatrices(params.data(), batch_size, Side::kLhs, ctx);
+}
+
+// Loads into `*result` a packed LHS serialized by PackedMatrix::Serialize,
+// without copying it. Returns false if the blob is invalid, or if it was
+// packed for another Path or another kernel layout than DispatchPrePack would
+// produce for these types on the present machine, in which case the caller
+// has to repack.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+bool DispatchLoadPrePacked(const void* blob, std::size_t size,
+                           const MulParamsType& mul_params, Ctx* ctx,
+                           PackedMatrix<LhsScalar>* result) {
+  static_assert(CompiledPaths != Path::kNone, "Must compile at least one Path");
+  static_assert((CompiledPaths & ~kAllPaths) == Path::kNone,
+                "CompiledPaths must be a subset of ruy::kAllPaths");
+
+  detail::PackedMatrixDescription description;
+  if (!detail::DeserializePackedMatrix(blob, size, &description) ||
+      !detail::IsSameType(description.src_type, Type::Create<LhsScalar>())) {
+    return false;
+  }
+  const Path the_path = ctx->SelectPath(CompiledPaths);
+  if (description.path != the_path) {
+    return false;
+  }
+  Mat<LhsScalar> lhs;
+  lhs.layout = description.src_layout;
+  lhs.zero_point = static_cast<LhsScalar>(description.src_zero_point);
+  TrMulParams params;
+  CreatePrePackTrMulParams<CompiledPaths, LhsScalar, RhsScalar, DstScalar>(
+      lhs, mul_params, the_path, &params);
+  const PEMat& expected = params.packed[Side::kLhs];
+  const PEMat& loaded = description.packed;
+  if (!(loaded.layout == expected.layout) ||
+      !detail::IsSameType(loaded.data_type, expected.data_type) ||
+      !detail::IsSameType(loaded.sums_type, expected.sums_type) ||
+      loaded.zero_point != expected.zero_point ||
+      loaded.group_size != expected.group_size) {
+    return false;
+  }
+  *result = PackedMatrix<LhsScalar>::Borrowing(the_path, lhs.layout,
+                                               lhs.zero_point, loaded);
+  return true;
+}
+
+// Variant of DispatchMul where the LHS was already packed by DispatchPrePack.
+// The packed LHS must have been created with the same types and for the same
+// Path as would be selected here; this is checked at runtime.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void DispatchPrePackedMul(const PackedMatrix<LhsScalar>& lhs,
+                          const Mat<RhsScalar>& rhs,
+                          const MulParamsType& mul_params, Ctx* ctx,
+                          Mat<DstScalar>* dst) {
+  static_assert(CompiledPaths != Path::kNone, "Must compile at least one Path");
+  static_assert((CompiledPaths & ~kAllPaths) == Path::kNone,
+                "CompiledPaths must be a subset of ruy::kAllPaths");
+
+  profiler::ScopeLabel mul_label("Mul (prepacked LHS)");
+  profiler::ScopeLabel shape_specific_label("matmul shape: %dx%dx%d",
+                                            lhs.rows(), lhs.cols(),
+                                            rhs.layout.cols);
+
+  RUY_CHECK(lhs.is_valid());
+  const Path the_path = ctx->SelectPath(CompiledPaths);
+  ctx->UpdateAutoNumThreads();
+  RUY_CHECK(the_path == lhs.path());
+
+  // The LHS source data is not needed anymore, only its layout and zero point
+  // are, to set up the TrMulParams.
+  Mat<LhsScalar> internal_lhs;
+  internal_lhs.layout = lhs.src_layout();
+  internal_lhs.zero_point = lhs.zero_point();
+  TrMulParams params;
+  PrepareTrMul<CompiledPaths>(internal_lhs, rhs, mul_params, the_path, ctx,
+                              dst, &params);
+  PEMat* packed_lhs = &params.packed[Side::kLhs];
+  // A mismatch here means that PrePack was called with different types than
+  // this Mul, so that the packed layout doesn't suit the kernel.
+  RUY_CHECK(packed_lhs->layout == lhs.packed().layout);
+  // Likewise, a mismatch here means that PrePack was called with different
+  // group-wise LHS scales, so that the packed sums don't suit the kernel.
+  RUY_CHECK_EQ(packed_lhs->group_size, lhs.packed().group_size);
+  packed_lhs->data = lhs.packed().data;
+  packed_lhs->sums = lhs.packed().sums;
+  params.is_prepacked[Side::kLhs] = true;
+  TrMul(&params, ctx);
+}
+
+// Batched variant of DispatchMul. BatchItemType is ruy::BatchMulItem, see
+// ruy.h. The Path is selected once for the whole batch. The small items are
+// all set up before any of them runs, and handed together to TrMulBatch. Items
+// that TrMul would block or multi-thread on their own are then run one after
+// the other.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType, typename BatchItemType>
+void DispatchBatchMul(const BatchItemType* items, int batch_size, Ctx* ctx) {
+  static_assert(CompiledPaths != Path::kNone, "Must compile at least one Path");
+  static_assert((CompiledPaths & ~kAllPaths) == Path::kNone,
+                "CompiledPaths must be a subset of ruy::kAllPaths");
+
+  profiler::ScopeLabel mul_label("BatchMul (batch_size=%d)", batch_size);
+
+  RUY_CHECK_GE(batch_size, 0);
+  if (batch_size == 0) {
+    return;
+  }
+
+  const Path the_path = ctx->SelectPath(CompiledPaths);
+  ctx->UpdateAutoNumThreads();
+
+  // Each item is set up once, and the small ones are kept in the main
+  // allocator until they have all run. The large ones are kept aside, as
+  // TrMul frees the main allocator, and run afterwards.
+  //
+  // The prepacked cache lookups of all small items happen before any of them
+  // runs, so the local cache must not eject the packed matrix of one item
+  // while looking up the next one. Entries of a SharedPrepackedCache are kept
+  // alive by TrMulParams::prepacked_cache_entry instead.
+  PrepackedCache* local_cache =
+      ctx->shared_prepacked_cache() ? nullptr : ctx->GetPrepackedCache();
+  if (local_cache) {
+    local_cache->Pin();
+  }
+  Allocator* allocator = ctx->GetMainAllocator();
+  TrMulParams* params;
+  allocator->Allocate(batch_size, &params);
+  int small_count = 0;
+  std::vector<TrMulParams> large_params;
+  for (int i = 0; i < batch_size; i++) {
+    const BatchItemType& item = items[i];
+    Mat<DstScalar> internal_dst = ToInternal(*item.dst);
+    TrMulParams* item_params = new (params + small_count) TrMulParams;
+    SetUpTrMul<CompiledPaths>(ToInternal(*item.lhs), ToInternal(*item.rhs),
+                              *item.mul_params, the_path, ctx, &internal_dst,
+                              item_params);
+    if (!UsesSimpleLoop(*item_params, ctx)) {
+      large_params.push_back(std::move(*item_params));
+      item_params->~TrMulParams();
+      continue;
+    }
+    HandlePrepackedCaching(item_params, ctx);
+    small_count++;
+  }
+  if (small_count) {
+    TrMulBatch(params, small_count, ctx);
+  }
+  for (int i = 0; i < small_count; i++) {
+    params[i].~TrMulParams();
+  }
+  if (local_cache) {
+    local_cache->Unpin();
+  }
+  allocator->FreeAll();
+
+  // Large items look up the prepacked cache right before running, like a
+  // plain Mul.
+  for (TrMulParams& item_params : large_params) {
+    HandlePrepackedCaching(&item_params, ctx);
+    TrMul(&item_params, ctx);
+  }
+}
+
+// Strided-batch variant of DispatchMul: the RHS and destination matrices of
+// batch item i are those of the given `rhs` and `dst` with their data pointers
+// advanced by i times `rhs_batch_stride` and `dst_batch_stride` respectively,
+// in units of scalars. All batch items share the same LHS, which TrMul packs
+// only once.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void DispatchStridedBatchMul(const Mat<LhsScalar>& lhs,
+                             const Mat<RhsScalar>& rhs, int rhs_batch_stride,
+                             const MulParamsType& mul_params, int batch_size,
+                             Ctx* ctx, Mat<DstScalar>* dst,
+                             int dst_batch_stride) {
+  static_assert(CompiledPaths != Path::kNone, "Must compile at least one Path");
+  static_assert((CompiledPaths & ~kAllPaths) == Path::kNone,
+                "CompiledPaths must be a subset of ruy::kAllPaths");
+
+  profiler::ScopeLabel mul_label("StridedBatchMul (batch_size=%d)",
+                                 batch_size);
+  profiler::ScopeLabel shape_specific_label("matmul shape: %dx%dx%d",
+                                            lhs.layout.rows, lhs.layout.cols,
+                                            rhs.layout.cols);
+
+  RUY_CHECK_GE(batch_size, 0);
+  if (batch_size == 0) {
+    return;
+  }
+  if (batch_size > 1) {
+    // Destination batch items must not overlap. RHS batch items may.
+    RUY_CHECK_GE(dst_batch_stride, FlatSize(dst->layout));
+  }
+
+  const Path the_path = ctx->SelectPath(CompiledPaths);
+  ctx->UpdateAutoNumThreads();
+
+  TrMulParams params;
+  params.batch_size = batch_size;
+  params.rhs_batch_stride =
+      static_cast<std::ptrdiff_t>(rhs_batch_stride) * sizeof(RhsScalar);
+  params.dst_batch_stride =
+      static_cast<std::ptrdiff_t>(dst_batch_stride) * sizeof(DstScalar);
+  PrepareTrMul<CompiledPaths>(lhs, rhs, mul_params, the_path, ctx, dst,
+                              &params);
   TrMul(&params, ctx);
 }
 
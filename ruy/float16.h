@@ -0,0 +1,185 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// 16-bit floating-point scalar types: ruy::bfloat16 and ruy::float16.
+//
+// These are supported as LHS and RHS scalar types, with float accumulation
+// and float destination: a Matrix<bfloat16> or Matrix<float16> is widened to
+// float while it is packed, so the float kernels are used. This halves the
+// memory traffic on the source matrices compared to converting them to float
+// buffers ahead of time.
+
+#ifndef RUY_RUY_FLOAT16_H_
+#define RUY_RUY_FLOAT16_H_
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace ruy {
+
+namespace detail {
+
+inline float FloatFromBits(std::uint32_t bits) {
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+inline std::uint32_t BitsFromFloat(float x) {
+  std::uint32_t result;
+  std::memcpy(&result, &x, sizeof(result));
+  return result;
+}
+
+inline float Bfloat16BitsToFloat(std::uint16_t bits) {
+  return FloatFromBits(static_cast<std::uint32_t>(bits) << 16);
+}
+
+// Rounds to nearest, ties to even. NaNs stay NaNs.
+inline std::uint16_t FloatToBfloat16Bits(float x) {
+  const std::uint32_t bits = BitsFromFloat(x);
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    return static_cast<std::uint16_t>((bits >> 16) | 0x40);
+  }
+  const std::uint32_t rounding_bias = 0x7fff + ((bits >> 16) & 1);
+  return static_cast<std::uint16_t>((bits + rounding_bias) >> 16);
+}
+
+inline float Float16BitsToFloat(std::uint16_t bits) {
+  const std::uint32_t sign = static_cast<std::uint32_t>(bits & 0x8000) << 16;
+  const std::uint32_t exponent_and_mantissa = bits & 0x7fff;
+  if (exponent_and_mantissa >= 0x7c00) {
+    // Infinity or NaN.
+    return FloatFromBits(sign | 0x7f800000 |
+                         ((exponent_and_mantissa & 0x3ff) << 13));
+  }
+  if (exponent_and_mantissa >= 0x400) {
+    // Normal: rebias the exponent from 15 to 127.
+    return FloatFromBits(sign | ((exponent_and_mantissa << 13) +
+                                 ((127 - 15) << 23)));
+  }
+  // Zero or subnormal: exactly exponent_and_mantissa * 2^-24, a normal float.
+  const float magnitude =
+      static_cast<float>(exponent_and_mantissa) * (1.0f / 16777216.0f);
+  return sign ? -magnitude : magnitude;
+}
+
+// Rounds to nearest, ties to even. Overflows to infinity. NaNs stay NaNs.
+inline std::uint16_t FloatToFloat16Bits(float x) {
+  const std::uint32_t bits = BitsFromFloat(x);
+  const std::uint16_t sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000);
+  std::uint32_t magnitude = bits & 0x7fffffff;
+  if (magnitude >= 0x7f800000) {
+    return sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00);
+  }
+  if (magnitude >= 0x477ff000) {
+    // At least 65520, which rounds to infinity.
+    return sign | 0x7c00;
+  }
+  if (magnitude < 0x38800000) {
+    // Below 2^-14: the result is subnormal. Adding 0.5 aligns the float
+    // mantissa so that the hardware rounds it at the float16 subnormal
+    // precision, 2^-24.
+    const float sum = FloatFromBits(magnitude) + 0.5f;
+    return sign | static_cast<std::uint16_t>(BitsFromFloat(sum) - 0x3f000000);
+  }
+  const std::uint32_t mantissa_odd = (magnitude >> 13) & 1;
+  magnitude -= (127 - 15) << 23;
+  magnitude += 0xfff + mantissa_odd;
+  return sign | static_cast<std::uint16_t>(magnitude >> 13);
+}
+
+}  // namespace detail
+
+// The bfloat16 format: the upper 16 bits of an IEEE float, i.e. 8 exponent
+// bits and 7 explicit mantissa bits. Implicitly converts from and to float.
+struct bfloat16 final {
+  bfloat16() = default;
+  bfloat16(float x) : bits(detail::FloatToBfloat16Bits(x)) {}
+  operator float() const { return detail::Bfloat16BitsToFloat(bits); }
+  static bfloat16 FromBits(std::uint16_t bits) {
+    bfloat16 result;
+    result.bits = bits;
+    return result;
+  }
+  std::uint16_t bits;
+};
+
+// The IEEE 754 half-precision format: 5 exponent bits and 10 explicit mantissa
+// bits. Implicitly converts from and to float.
+struct float16 final {
+  float16() = default;
+  float16(float x) : bits(detail::FloatToFloat16Bits(x)) {}
+  operator float() const { return detail::Float16BitsToFloat(bits); }
+  static float16 FromBits(std::uint16_t bits) {
+    float16 result;
+    result.bits = bits;
+    return result;
+  }
+  std::uint16_t bits;
+};
+
+static_assert(sizeof(bfloat16) == 2, "");
+static_assert(sizeof(float16) == 2, "");
+
+}  // namespace ruy
+
+namespace std {
+
+// numeric_limits are what ruy uses to tell floating-point types from integer
+// types, see SymmetricZeroPoint.
+
+template <>
+class numeric_limits<ruy::bfloat16> {
+ public:
+  static constexpr bool is_specialized = true;
+  static constexpr bool is_signed = true;
+  static constexpr bool is_integer = false;
+  static constexpr bool is_exact = false;
+  static constexpr bool has_infinity = true;
+  static constexpr bool has_quiet_NaN = true;
+  static constexpr int radix = 2;
+  static constexpr int digits = 8;
+  static ruy::bfloat16 min() { return ruy::bfloat16::FromBits(0x0080); }
+  static ruy::bfloat16 max() { return ruy::bfloat16::FromBits(0x7f7f); }
+  static ruy::bfloat16 lowest() { return ruy::bfloat16::FromBits(0xff7f); }
+  static ruy::bfloat16 epsilon() { return ruy::bfloat16::FromBits(0x3c00); }
+  static ruy::bfloat16 infinity() { return ruy::bfloat16::FromBits(0x7f80); }
+  static ruy::bfloat16 quiet_NaN() { return ruy::bfloat16::FromBits(0x7fc0); }
+};
+
+template <>
+class numeric_limits<ruy::float16> {
+ public:
+  static constexpr bool is_specialized = true;
+  static constexpr bool is_signed = true;
+  static constexpr bool is_integer = false;
+  static constexpr bool is_exact = false;
+  static constexpr bool has_infinity = true;
+  static constexpr bool has_quiet_NaN = true;
+  static constexpr int radix = 2;
+  static constexpr int digits = 11;
+  static ruy::float16 min() { return ruy::float16::FromBits(0x0400); }
+  static ruy::float16 max() { return ruy::float16::FromBits(0x7bff); }
+  static ruy::float16 lowest() { return ruy::float16::FromBits(0xfbff); }
+  static ruy::float16 epsilon() { return ruy::float16::FromBits(0x1400); }
+  static ruy::float16 infinity() { return ruy::float16::FromBits(0x7c00); }
+  static ruy::float16 quiet_NaN() { return ruy::float16::FromBits(0x7e00); }
+};
+
+}  // namespace std
+
+#endif  // RUY_RUY_FLOAT16_H_
@@ -0,0 +1,400 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Matrix*vector products, i.e. TrMuls with a single destination column.
+//
+// The general TrMul implementation packs the RHS vector into a block of
+// kernel-width columns, all but one of them padding, and runs kernels that
+// spend most of their arithmetic on that padding. Instead, TrMulGemv (see
+// trmul.cc) reads the RHS vector directly, or a plain copy of it when its
+// type or storage needs converting (see PrepareGemvRhs), and streams the
+// packed LHS once through a GemvImpl computing one dot product per
+// destination row. The work is split among threads by ranges of rows.
+
+#ifndef RUY_RUY_GEMV_H_
+#define RUY_RUY_GEMV_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "ruy/check_macros.h"
+#include "ruy/common.h"
+#include "ruy/kernel_common.h"
+#include "ruy/mat.h"
+#include "ruy/matrix.h"
+#include "ruy/opt_set.h"
+#include "ruy/pack_common.h"
+#include "ruy/path.h"
+#include "ruy/platform.h"
+#include "ruy/profiler/instrumentation.h"
+#include "ruy/quantize.h"
+#include "ruy/side_pair.h"
+#include "ruy/tune.h"
+
+namespace ruy {
+
+// Parameters of the out-of-line GEMV functions below. They compute, for each
+// row in [start_row, end_row), the raw accumulator
+//   accum[row - start_row] = sum over d in [0, depth) of lhs(d, row) * rhs[d]
+// where lhs is the packed LHS matrix, of which lhs_base_ptr is the data and
+// lhs_stride the stride in elements, and rhs holds depth entries. start_row
+// and end_row are multiples of the kernel layout's block of columns, and
+// depth is the depth of the packed LHS. The zero points are applied later by
+// ApplyEpilogue.
+template <typename LhsScalar, typename RhsScalar, typename AccumScalar>
+struct GemvParams {
+  const LhsScalar* lhs_base_ptr;
+  int lhs_stride;
+  int depth;
+  const RhsScalar* rhs_ptr;
+  int start_row;
+  int end_row;
+  AccumScalar* accum;
+};
+
+// GemvImpl<ThePath, LhsScalar, RhsScalar> computes the raw accumulators of a
+// matrix*vector product from a packed LHS matrix of the given LhsLayout and
+// an unpacked RHS vector, both of the given packed scalar types. This primary
+// template is the case where there is no such implementation: dispatch.h only
+// uses a GemvImpl whose LhsLayout and AccumScalar match those of the kernel
+// that the packed LHS is made for.
+template <Path ThePath, typename LhsScalar, typename RhsScalar>
+struct GemvImpl {
+  using LhsLayout = void;
+  using AccumScalar = void;
+};
+
+#if RUY_PLATFORM_X86
+
+void GemvFloatAvx2(const GemvParams<float, float, float>& params);
+void Gemv8bitAvx2(
+    const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params);
+
+template <>
+struct GemvImpl<Path::kAvx2, float, float> {
+  using LhsLayout = FixedKernelLayout<Order::kRowMajor, 1, 8>;
+  using AccumScalar = float;
+  static void Run(const GemvParams<float, float, float>& params) {
+    GemvFloatAvx2(params);
+  }
+};
+
+template <>
+struct GemvImpl<Path::kAvx2, std::int8_t, std::int8_t> {
+  using LhsLayout = FixedKernelLayout<Order::kColMajor, 4, 8>;
+  using AccumScalar = std::int32_t;
+  static void Run(
+      const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params) {
+    Gemv8bitAvx2(params);
+  }
+};
+
+void GemvFloatAvx512(const GemvParams<float, float, float>& params);
+void Gemv8bitAvx512(
+    const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params);
+
+template <>
+struct GemvImpl<Path::kAvx512, float, float> {
+  using LhsLayout = FixedKernelLayout<Order::kRowMajor, 1, 16>;
+  using AccumScalar = float;
+  static void Run(const GemvParams<float, float, float>& params) {
+    GemvFloatAvx512(params);
+  }
+};
+
+template <>
+struct GemvImpl<Path::kAvx512, std::int8_t, std::int8_t> {
+  using LhsLayout = FixedKernelLayout<Order::kColMajor, 4, 16>;
+  using AccumScalar = std::int32_t;
+  static void Run(
+      const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params) {
+    Gemv8bitAvx512(params);
+  }
+};
+
+#endif  // RUY_PLATFORM_X86
+
+#if RUY_PLATFORM_NEON && RUY_OPT(ASM)
+
+void GemvFloatNeon(const GemvParams<float, float, float>& params);
+void Gemv8bitNeon(
+    const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params);
+
+template <>
+struct GemvImpl<Path::kNeon, float, float> {
+  using LhsLayout = FixedKernelLayout<Order::kRowMajor, 1, 8>;
+  using AccumScalar = float;
+  static void Run(const GemvParams<float, float, float>& params) {
+    GemvFloatNeon(params);
+  }
+};
+
+template <>
+struct GemvImpl<Path::kNeon, std::int8_t, std::int8_t> {
+  using LhsLayout = FixedKernelLayout<Order::kColMajor, 16, 4>;
+  using AccumScalar = std::int32_t;
+  static void Run(
+      const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params) {
+    Gemv8bitNeon(params);
+  }
+};
+
+#if RUY_PLATFORM_NEON_64
+
+template <>
+struct GemvImpl<Path::kNeonDotprod, float, float>
+    : GemvImpl<Path::kNeon, float, float> {};
+
+// The sdot GEMV has not been run on hardware yet, so it is opt-in: without
+// RUY_ENABLE_NEON_DOTPROD_GEMV, 8-bit matrix*vector products on
+// Path::kNeonDotprod go through the kernels.
+#if defined(RUY_ENABLE_NEON_DOTPROD_GEMV)
+
+void Gemv8bitNeonDotprod(
+    const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params);
+
+template <>
+struct GemvImpl<Path::kNeonDotprod, std::int8_t, std::int8_t> {
+  using LhsLayout = FixedKernelLayout<Order::kColMajor, 4, 8>;
+  using AccumScalar = std::int32_t;
+  static void Run(
+      const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params) {
+    Gemv8bitNeonDotprod(params);
+  }
+};
+
+#endif  // defined(RUY_ENABLE_NEON_DOTPROD_GEMV)
+
+#endif  // RUY_PLATFORM_NEON_64
+
+#endif  // RUY_PLATFORM_NEON && RUY_OPT(ASM)
+
+// Main entry point for GEMV: computes the destination entries of the rows
+// [start_row, end_row) of a matrix*vector product. The RHS "packed" matrix
+// is the one set up by PrepareGemvRhs. start_row and end_row are multiples
+// of the LHS kernel layout's block of columns; end_row may exceed the number
+// of destination rows, as in RunKernel. The packed LHS may only hold its
+// columns from origin_col on, see PEMat::origin_col.
+template <Path ThePath, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void RunGemv(Tuning, const SidePair<PEMat>& src, void* mul_params,
+             int start_row, int end_row, EMat* dst) {
+  profiler::ScopeLabel label("GEMV");
+  using Gemv = GemvImpl<ThePath, LhsScalar, RhsScalar>;
+  using AccumScalar = typename MulParamsType::AccumScalar;
+  static_assert(std::is_same<typename Gemv::AccumScalar, AccumScalar>::value,
+                "");
+  // Raw accumulators are computed by chunks of this many rows into a buffer
+  // on the stack, then go through the epilogue.
+  static constexpr int kChunkRows = 256;
+  static_assert(kChunkRows % Gemv::LhsLayout::kCols == 0, "");
+  const PMat<LhsScalar> lhs = UneraseType<LhsScalar>(src[Side::kLhs]);
+  const PMat<RhsScalar> rhs = UneraseType<RhsScalar>(src[Side::kRhs]);
+  const MulParamsType& typed_mul_params =
+      *static_cast<const MulParamsType*>(mul_params);
+  Mat<DstScalar> mdst = UneraseType<DstScalar>(*dst);
+  RUY_DCHECK_EQ(mdst.layout.cols, 1);
+  RUY_DCHECK_EQ(start_row % Gemv::LhsLayout::kCols, 0);
+  RUY_DCHECK_EQ(end_row % Gemv::LhsLayout::kCols, 0);
+  RUY_DCHECK_GE(start_row, lhs.origin_col);
+  RUY_DCHECK_LE(end_row - lhs.origin_col, lhs.layout.cols);
+  AccumScalar accum[kChunkRows];
+  GemvParams<LhsScalar, RhsScalar, AccumScalar> params;
+  params.lhs_base_ptr = lhs.data;
+  params.lhs_stride = lhs.layout.stride;
+  params.depth = lhs.layout.rows;
+  params.rhs_ptr = rhs.data;
+  params.accum = accum;
+  for (int row = start_row; row < end_row; row += kChunkRows) {
+    const int chunk_end_row = std::min(row + kChunkRows, end_row);
+    params.start_row = row - lhs.origin_col;
+    params.end_row = chunk_end_row - lhs.origin_col;
+    Gemv::Run(params);
+    const int clamped_end_row = std::min(chunk_end_row, mdst.layout.rows);
+    for (int r = row; r < clamped_end_row; r++) {
+      *ElementPtr(&mdst, r, 0) =
+          ApplyEpilogue(lhs, rhs, typed_mul_params, r, 0, mdst.zero_point,
+                        accum[r - row]);
+    }
+  }
+}
+
+// GEMV counterpart of RunGroupScaledKernel, for group-wise LHS scales (see
+// MulParams::lhs_scales): the GemvImpl runs on the depth slice of each group
+// of depth levels in turn, and the raw accumulators of each group are
+// corrected for the zero points, from the group sums of the packed LHS and
+// RHS, scaled and added up in float.
+template <Path ThePath, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void RunGroupScaledGemv(Tuning, const SidePair<PEMat>& src, void* mul_params,
+                        int start_row, int end_row, EMat* dst) {
+  profiler::ScopeLabel label("Group-scaled GEMV");
+  using Gemv = GemvImpl<ThePath, LhsScalar, RhsScalar>;
+  using AccumScalar = typename MulParamsType::AccumScalar;
+  static_assert(std::is_same<typename Gemv::AccumScalar, AccumScalar>::value,
+                "");
+  static constexpr int kChunkRows = 256;
+  static_assert(kChunkRows % Gemv::LhsLayout::kCols == 0, "");
+  const PMat<LhsScalar> lhs = UneraseType<LhsScalar>(src[Side::kLhs]);
+  const PMat<RhsScalar> rhs = UneraseType<RhsScalar>(src[Side::kRhs]);
+  const MulParamsType& typed_mul_params =
+      *static_cast<const MulParamsType*>(mul_params);
+  Mat<DstScalar> mdst = UneraseType<DstScalar>(*dst);
+  const int group_size = typed_mul_params.lhs_group_size();
+  RUY_DCHECK_EQ(mdst.layout.cols, 1);
+  RUY_DCHECK(typed_mul_params.lhs_scales());
+  RUY_DCHECK(!typed_mul_params.bias());
+  RUY_DCHECK_EQ(group_size % Gemv::LhsLayout::kRows, 0);
+  RUY_DCHECK_EQ(lhs.group_size, group_size);
+  RUY_DCHECK_EQ(rhs.group_size, group_size);
+  const int depth = lhs.layout.rows;
+  const int num_groups = NumWeightGroups(group_size, depth);
+  const int lhs_zero_point = lhs.zero_point;
+  const int rhs_zero_point = rhs.zero_point;
+  RUY_DCHECK(!lhs_zero_point || rhs.sums);
+  const int channels = mdst.layout.rows;
+  AccumScalar accum[kChunkRows];
+  float scaled[kChunkRows];
+  std::int32_t row_corrections[kChunkRows];
+  GemvParams<LhsScalar, RhsScalar, AccumScalar> params;
+  params.lhs_stride = lhs.layout.stride;
+  params.accum = accum;
+  for (int row = start_row; row < end_row; row += kChunkRows) {
+    const int chunk_end_row = std::min(row + kChunkRows, end_row);
+    params.start_row = row - lhs.origin_col;
+    params.end_row = chunk_end_row - lhs.origin_col;
+    const int clamped_end_row = std::min(chunk_end_row, mdst.layout.rows);
+    const int chunk_rows = clamped_end_row - row;
+    std::fill(scaled, scaled + kChunkRows, 0.f);
+    for (int g = 0; g < num_groups; g++) {
+      const int start_depth = g * group_size;
+      const int end_depth =
+          g + 1 < num_groups ? start_depth + group_size : depth;
+      params.lhs_base_ptr = static_cast<const LhsScalar*>(
+          PackedDepthSlice(src[Side::kLhs], start_depth, end_depth).data);
+      params.depth = end_depth - start_depth;
+      params.rhs_ptr = rhs.data + start_depth;
+      Gemv::Run(params);
+      const float* row_scales =
+          typed_mul_params.lhs_scales() + g * channels + row;
+      GetGroupRowCorrections(lhs, g, end_depth - start_depth, rhs_zero_point,
+                             row, clamped_end_row, row_corrections);
+      const std::int32_t col_correction =
+          lhs_zero_point ? lhs_zero_point * rhs.sums[g] : 0;
+      for (int r = 0; r < chunk_rows; r++) {
+        scaled[r] += row_scales[r] * static_cast<float>(
+                                         accum[r] - col_correction -
+                                         row_corrections[r]);
+      }
+    }
+    DequantizeTile<kChunkRows>(typed_mul_params, rhs, scaled, row, 0,
+                               clamped_end_row, 1, &mdst);
+  }
+}
+
+// Sets the sums of the RHS "packed" matrix of a GEMV, see PrepareGemvRhs,
+// from its packed_depth entries at data: their sum, or the sums of each
+// group of depth levels, see PEMat::group_size.
+template <typename SumsType, typename PackedScalar>
+void SetGemvRhsSums(const PackedScalar* data, int packed_depth,
+                    PEMat* packed) {
+  packed->sums_type.AssertIs<SumsType>();
+  SumsType* sums = static_cast<SumsType*>(packed->sums);
+  const int group_size = packed->group_size ? packed->group_size : packed_depth;
+  const int num_groups = SumsPerCol(*packed);
+  for (int g = 0; g < num_groups; g++) {
+    const int start_depth = g * group_size;
+    const int end_depth = std::min(start_depth + group_size, packed_depth);
+    SumsType sum = 0;
+    for (int d = start_depth; d < end_depth; d++) {
+      sum += data[d];
+    }
+    sums[g] = sum;
+  }
+}
+
+// Sets up the RHS "packed" matrix of a GEMV from the RHS vector src: its data
+// points to the depth entries of the vector, padded with the packed zero
+// point up to the packed depth, and its sums, if not null, to their sums, see
+// SetGemvRhsSums.
+// That is src's own data when it is contiguous, of the packed type and needs
+// no padding. Otherwise, the converted values are copied into buffer, which
+// must have room for the packed depth's worth of PackedScalar entries.
+template <typename Scalar, typename PackedScalar>
+void PrepareGemvRhs(const EMat& src, void* buffer, PEMat* packed) {
+  using SumsType = typename std::conditional<
+      std::is_floating_point<PackedScalar>::value, PackedScalar,
+      std::int32_t>::type;
+  const Mat<Scalar> vec = UneraseType<Scalar>(src);
+  RUY_DCHECK_EQ(vec.layout.cols, 1);
+  const int depth = vec.layout.rows;
+  const int packed_depth = packed->layout.rows;
+  const int src_inc = IsColMajor(vec.layout) ? 1 : vec.layout.stride;
+  const PackedScalar* data;
+  if (std::is_same<Scalar, PackedScalar>::value && src_inc == 1 &&
+      depth == packed_depth) {
+    data = reinterpret_cast<const PackedScalar*>(vec.data.get());
+  } else {
+    PackedScalar* copy = static_cast<PackedScalar*>(buffer);
+    for (int d = 0; d < depth; d++) {
+      copy[d] = Pack<PackedScalar>(vec.data.get()[d * src_inc]);
+    }
+    std::fill(copy + depth, copy + packed_depth,
+              static_cast<PackedScalar>(packed->zero_point));
+    data = copy;
+  }
+  packed->data = const_cast<PackedScalar*>(data);
+  if (packed->sums) {
+    SetGemvRhsSums<SumsType>(data, packed_depth, packed);
+  }
+}
+
+// Specialization for a float RHS vector multiplied by an 8-bit LHS, which is
+// quantized to int8 with a single scale, stored at packed->scales, as
+// PackQuantizedToInt8 does for each column of a packed RHS.
+template <>
+inline void PrepareGemvRhs<float, std::int8_t>(const EMat& src, void* buffer,
+                                               PEMat* packed) {
+  const Mat<float> vec = UneraseType<float>(src);
+  RUY_DCHECK_EQ(vec.layout.cols, 1);
+  RUY_DCHECK_EQ(packed->zero_point, 0);
+  RUY_DCHECK(packed->scales);
+  const int depth = vec.layout.rows;
+  const int packed_depth = packed->layout.rows;
+  const int src_inc = IsColMajor(vec.layout) ? 1 : vec.layout.stride;
+  const float* src_data = vec.data.get();
+  float max_abs = 0;
+  for (int d = 0; d < depth; d++) {
+    max_abs = std::max(max_abs, std::abs(src_data[d * src_inc]));
+  }
+  const float scale = DynamicQuantScale(max_abs);
+  const float inv_scale = 1.f / scale;
+  std::int8_t* copy = static_cast<std::int8_t*>(buffer);
+  for (int d = 0; d < depth; d++) {
+    copy[d] = DynamicQuantize(src_data[d * src_inc], inv_scale);
+  }
+  std::fill(copy + depth, copy + packed_depth, 0);
+  packed->data = copy;
+  packed->scales[0] = scale;
+  if (packed->sums) {
+    SetGemvRhsSums<std::int32_t>(copy, packed_depth, packed);
+  }
+}
+
+}  // namespace ruy
+
+#endif  // RUY_RUY_GEMV_H_
@@ -0,0 +1,206 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ruy/check_macros.h"
+#include "ruy/gemv.h"
+#include "ruy/opt_set.h"
+#include "ruy/platform.h"
+#include "ruy/profiler/instrumentation.h"
+
+#if RUY_PLATFORM_NEON && RUY_OPT(ASM)
+#include <arm_neon.h>
+#endif
+
+namespace ruy {
+
+#if RUY_PLATFORM_NEON && RUY_OPT(ASM)
+
+namespace {
+
+// Multiply-accumulate of a vector by a scalar, fused where available.
+inline float32x4_t MulAddByScalar(float32x4_t accum, float32x4_t x, float y) {
+#if RUY_PLATFORM_NEON_64
+  return vfmaq_n_f32(accum, x, y);
+#else
+  return vmlaq_n_f32(accum, x, y);
+#endif
+}
+
+// Adds up the lanes of each of the 4 given accumulators, returning the
+// 4 sums.
+inline int32x4_t ReduceAccumulators(int32x4_t accum0, int32x4_t accum1,
+                                    int32x4_t accum2, int32x4_t accum3) {
+  const int32x2_t sums01 = vpadd_s32(
+      vpadd_s32(vget_low_s32(accum0), vget_high_s32(accum0)),
+      vpadd_s32(vget_low_s32(accum1), vget_high_s32(accum1)));
+  const int32x2_t sums23 = vpadd_s32(
+      vpadd_s32(vget_low_s32(accum2), vget_high_s32(accum2)),
+      vpadd_s32(vget_low_s32(accum3), vget_high_s32(accum3)));
+  return vcombine_s32(sums01, sums23);
+}
+
+}  // namespace
+
+void GemvFloatNeon(const GemvParams<float, float, float>& params) {
+  profiler::ScopeLabel label("GEMV kNeon float");
+  static constexpr int kBlockRows = 8;
+  const int depth = params.depth;
+  const float* rhs_ptr = params.rhs_ptr;
+  for (int row = params.start_row; row < params.end_row; row += kBlockRows) {
+    // The packed LHS block of these rows holds, for each depth level, the
+    // kBlockRows entries of that level contiguously.
+    const float* lhs_ptr =
+        params.lhs_base_ptr +
+        static_cast<std::ptrdiff_t>(row) * params.lhs_stride;
+    // Independent accumulators for consecutive depth levels, to hide the
+    // latency of the multiply-adds.
+    float32x4_t accum0_lo = vdupq_n_f32(0);
+    float32x4_t accum0_hi = vdupq_n_f32(0);
+    float32x4_t accum1_lo = vdupq_n_f32(0);
+    float32x4_t accum1_hi = vdupq_n_f32(0);
+    int d = 0;
+    for (; d <= depth - 2; d += 2) {
+      accum0_lo = MulAddByScalar(accum0_lo, vld1q_f32(lhs_ptr), rhs_ptr[d]);
+      accum0_hi = MulAddByScalar(accum0_hi, vld1q_f32(lhs_ptr + 4), rhs_ptr[d]);
+      accum1_lo =
+          MulAddByScalar(accum1_lo, vld1q_f32(lhs_ptr + 8), rhs_ptr[d + 1]);
+      accum1_hi =
+          MulAddByScalar(accum1_hi, vld1q_f32(lhs_ptr + 12), rhs_ptr[d + 1]);
+      lhs_ptr += 2 * kBlockRows;
+    }
+    if (d < depth) {
+      accum0_lo = MulAddByScalar(accum0_lo, vld1q_f32(lhs_ptr), rhs_ptr[d]);
+      accum0_hi = MulAddByScalar(accum0_hi, vld1q_f32(lhs_ptr + 4), rhs_ptr[d]);
+    }
+    float* accum_ptr = params.accum + (row - params.start_row);
+    vst1q_f32(accum_ptr, vaddq_f32(accum0_lo, accum1_lo));
+    vst1q_f32(accum_ptr + 4, vaddq_f32(accum0_hi, accum1_hi));
+  }
+}
+
+// Products of int8 values are computed as int16 by vmull_s8, and pairs of
+// them added into int32 accumulators by vpadalq_s16. Unlike the kNeon 8-bit
+// kernel, this never adds two products in int16, so there is no overflow even
+// in the -128 * -128 + -128 * -128 case.
+void Gemv8bitNeon(
+    const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params) {
+  profiler::ScopeLabel label("GEMV kNeon 8-bit");
+  static constexpr int kBlockRows = 4;
+  static constexpr int kInnerSize = 16;
+  const int depth = params.depth;
+  RUY_DCHECK_EQ(depth % kInnerSize, 0);
+  const std::int8_t* rhs_ptr = params.rhs_ptr;
+  for (int row = params.start_row; row < params.end_row; row += kBlockRows) {
+    // The packed LHS block of these rows holds, for each group of kInnerSize
+    // depth levels, the kInnerSize entries of each of the kBlockRows rows.
+    const std::int8_t* lhs_ptr =
+        params.lhs_base_ptr +
+        static_cast<std::ptrdiff_t>(row) * params.lhs_stride;
+    int32x4_t accum[kBlockRows];
+    for (int i = 0; i < kBlockRows; i++) {
+      accum[i] = vdupq_n_s32(0);
+    }
+    for (int d = 0; d < depth; d += kInnerSize) {
+      const int8x16_t rhs = vld1q_s8(rhs_ptr + d);
+      for (int i = 0; i < kBlockRows; i++) {
+        const int8x16_t lhs = vld1q_s8(lhs_ptr + i * kInnerSize);
+        accum[i] = vpadalq_s16(
+            accum[i], vmull_s8(vget_low_s8(lhs), vget_low_s8(rhs)));
+        accum[i] = vpadalq_s16(
+            accum[i], vmull_s8(vget_high_s8(lhs), vget_high_s8(rhs)));
+      }
+      lhs_ptr += kBlockRows * kInnerSize;
+    }
+    vst1q_s32(params.accum + (row - params.start_row),
+              ReduceAccumulators(accum[0], accum[1], accum[2], accum[3]));
+  }
+}
+
+#if RUY_PLATFORM_NEON_64 && defined(RUY_ENABLE_NEON_DOTPROD_GEMV)
+
+// Each group of kInnerSize depth levels of the packed LHS holds the
+// kInnerSize entries of rows 0-3, then those of rows 4-7, so that one sdot by
+// element multiplies 4 rows by the same kInnerSize RHS entries. As in
+// kernel_arm64.cc, sdot is encoded as .word since this file is not compiled
+// with dot-product support; this is only called on CPUs that have it.
+void Gemv8bitNeonDotprod(
+    const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params) {
+  profiler::ScopeLabel label("GEMV kNeonDotprod 8-bit");
+  static constexpr int kBlockRows = 8;
+  static constexpr int kInnerSize = 4;
+  const int depth = params.depth;
+  RUY_DCHECK_EQ(depth % kInnerSize, 0);
+  for (int row = params.start_row; row < params.end_row; row += kBlockRows) {
+    const std::int8_t* lhs_ptr =
+        params.lhs_base_ptr +
+        static_cast<std::ptrdiff_t>(row) * params.lhs_stride;
+    const std::int8_t* rhs_ptr = params.rhs_ptr;
+    std::int32_t* accum_ptr = params.accum + (row - params.start_row);
+    int depth_remaining = depth;
+    // v16/v17 and v18/v19 accumulate rows 0-3/4-7 for alternating groups of
+    // kInnerSize depth levels, to hide the latency of sdot. The main loop
+    // consumes 16 RHS entries, i.e. one per lane of v0, at a time.
+    asm volatile(
+        "movi v16.4s, #0\n"
+        "movi v17.4s, #0\n"
+        "movi v18.4s, #0\n"
+        "movi v19.4s, #0\n"
+        "cmp %w[depth_remaining], #16\n"
+        "blt 2f\n"
+        "1:\n"
+        "ld1 {v0.16b}, [%[rhs_ptr]], #16\n"
+        "ld1 {v1.16b, v2.16b, v3.16b, v4.16b}, [%[lhs_ptr]], #64\n"
+        "ld1 {v20.16b, v21.16b, v22.16b, v23.16b}, [%[lhs_ptr]], #64\n"
+        "sub %w[depth_remaining], %w[depth_remaining], #16\n"
+        ".word 0x4f80e030  // sdot v16.4s, v1.16b, v0.4b[0]\n"
+        ".word 0x4f80e051  // sdot v17.4s, v2.16b, v0.4b[0]\n"
+        ".word 0x4fa0e072  // sdot v18.4s, v3.16b, v0.4b[1]\n"
+        ".word 0x4fa0e093  // sdot v19.4s, v4.16b, v0.4b[1]\n"
+        ".word 0x4f80ea90  // sdot v16.4s, v20.16b, v0.4b[2]\n"
+        ".word 0x4f80eab1  // sdot v17.4s, v21.16b, v0.4b[2]\n"
+        ".word 0x4fa0ead2  // sdot v18.4s, v22.16b, v0.4b[3]\n"
+        ".word 0x4fa0eaf3  // sdot v19.4s, v23.16b, v0.4b[3]\n"
+        "cmp %w[depth_remaining], #16\n"
+        "bge 1b\n"
+        "2:\n"
+        // Remaining groups of kInnerSize depth levels, one at a time.
+        "cbz %w[depth_remaining], 4f\n"
+        "3:\n"
+        "ld1 {v0.s}[0], [%[rhs_ptr]], #4\n"
+        "ld1 {v1.16b, v2.16b}, [%[lhs_ptr]], #32\n"
+        "sub %w[depth_remaining], %w[depth_remaining], #4\n"
+        ".word 0x4f80e030  // sdot v16.4s, v1.16b, v0.4b[0]\n"
+        ".word 0x4f80e051  // sdot v17.4s, v2.16b, v0.4b[0]\n"
+        "cbnz %w[depth_remaining], 3b\n"
+        "4:\n"
+        "add v16.4s, v16.4s, v18.4s\n"
+        "add v17.4s, v17.4s, v19.4s\n"
+        "st1 {v16.4s, v17.4s}, [%[accum_ptr]]\n"
+        : [ lhs_ptr ] "+r"(lhs_ptr), [ rhs_ptr ] "+r"(rhs_ptr),
+          [ depth_remaining ] "+r"(depth_remaining)
+        : [ accum_ptr ] "r"(accum_ptr)
+        : "cc", "memory", "v0", "v1", "v2", "v3", "v4", "v16", "v17", "v18",
+          "v19", "v20", "v21", "v22", "v23");
+  }
+}
+
+#endif  // RUY_PLATFORM_NEON_64 && defined(RUY_ENABLE_NEON_DOTPROD_GEMV)
+
+#endif  // RUY_PLATFORM_NEON && RUY_OPT(ASM)
+
+}  // namespace ruy
@@ -0,0 +1,146 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "ruy/check_macros.h"
+#include "ruy/gemv.h"
+#include "ruy/opt_set.h"
+#include "ruy/platform.h"
+#include "ruy/profiler/instrumentation.h"
+
+#if RUY_PLATFORM_AVX512 && RUY_OPT(ASM)
+#include <immintrin.h>  // IWYU pragma: keep
+#endif
+
+namespace ruy {
+
+#if !(RUY_PLATFORM_AVX512 && RUY_OPT(ASM))
+
+void GemvFloatAvx512(const GemvParams<float, float, float>&) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void Gemv8bitAvx512(
+    const GemvParams<std::int8_t, std::int8_t, std::int32_t>&) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+#else  // RUY_PLATFORM_AVX512 && RUY_OPT(ASM)
+
+void GemvFloatAvx512(const GemvParams<float, float, float>& params) {
+  profiler::ScopeLabel label("GEMV kAvx512 float");
+  static constexpr int kBlockRows = 16;
+  const int depth = params.depth;
+  const float* rhs_ptr = params.rhs_ptr;
+  for (int row = params.start_row; row < params.end_row; row += kBlockRows) {
+    // The packed LHS block of these rows holds, for each depth level, the
+    // kBlockRows entries of that level contiguously.
+    const float* lhs_ptr =
+        params.lhs_base_ptr +
+        static_cast<std::ptrdiff_t>(row) * params.lhs_stride;
+    // Independent accumulators for consecutive depth levels, to hide the
+    // latency of the FMAs.
+    __m512 accum0 = _mm512_setzero_ps();
+    __m512 accum1 = _mm512_setzero_ps();
+    __m512 accum2 = _mm512_setzero_ps();
+    __m512 accum3 = _mm512_setzero_ps();
+    int d = 0;
+    for (; d <= depth - 4; d += 4) {
+      accum0 = _mm512_fmadd_ps(_mm512_loadu_ps(lhs_ptr),
+                               _mm512_set1_ps(rhs_ptr[d]), accum0);
+      accum1 = _mm512_fmadd_ps(_mm512_loadu_ps(lhs_ptr + kBlockRows),
+                               _mm512_set1_ps(rhs_ptr[d + 1]), accum1);
+      accum2 = _mm512_fmadd_ps(_mm512_loadu_ps(lhs_ptr + 2 * kBlockRows),
+                               _mm512_set1_ps(rhs_ptr[d + 2]), accum2);
+      accum3 = _mm512_fmadd_ps(_mm512_loadu_ps(lhs_ptr + 3 * kBlockRows),
+                               _mm512_set1_ps(rhs_ptr[d + 3]), accum3);
+      lhs_ptr += 4 * kBlockRows;
+    }
+    for (; d < depth; d++) {
+      accum0 = _mm512_fmadd_ps(_mm512_loadu_ps(lhs_ptr),
+                               _mm512_set1_ps(rhs_ptr[d]), accum0);
+      lhs_ptr += kBlockRows;
+    }
+    const __m512 accum = _mm512_add_ps(_mm512_add_ps(accum0, accum1),
+                                       _mm512_add_ps(accum2, accum3));
+    _mm512_storeu_ps(params.accum + (row - params.start_row), accum);
+  }
+}
+
+void Gemv8bitAvx512(
+    const GemvParams<std::int8_t, std::int8_t, std::int32_t>& params) {
+  profiler::ScopeLabel label("GEMV kAvx512 8-bit");
+  static constexpr int kBlockRows = 16;
+  static constexpr int kInnerSize = 4;
+  const int depth = params.depth;
+  RUY_DCHECK_EQ(depth % kInnerSize, 0);
+  const std::int8_t* rhs_ptr = params.rhs_ptr;
+  // Products are widened to 16 bits, and adjacent pairs of them added into
+  // 32-bit accumulators by _mm512_madd_epi16. accum_lo holds those of the
+  // rows 0..7 of the block, accum_hi those of the rows 8..15, each row
+  // getting two adjacent 32-bit lanes.
+  const auto accumulate = [](const std::int8_t* lhs, const std::int8_t* rhs,
+                             __m512i* accum_lo, __m512i* accum_hi) {
+    std::int32_t rhs_4;
+    memcpy(&rhs_4, rhs, kInnerSize);
+    const __m512i rhs_16 = _mm512_cvtepi8_epi16(_mm256_set1_epi32(rhs_4));
+    const __m512i lhs_lo = _mm512_cvtepi8_epi16(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs)));
+    const __m512i lhs_hi = _mm512_cvtepi8_epi16(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + 32)));
+    *accum_lo = _mm512_add_epi32(*accum_lo, _mm512_madd_epi16(lhs_lo, rhs_16));
+    *accum_hi = _mm512_add_epi32(*accum_hi, _mm512_madd_epi16(lhs_hi, rhs_16));
+  };
+  const __m512i even_lanes = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16,
+                                               18, 20, 22, 24, 26, 28, 30);
+  const __m512i odd_lanes = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17,
+                                              19, 21, 23, 25, 27, 29, 31);
+  for (int row = params.start_row; row < params.end_row; row += kBlockRows) {
+    // The packed LHS block of these rows holds, for each group of kInnerSize
+    // depth levels, the kInnerSize entries of each of the kBlockRows rows.
+    const std::int8_t* lhs_ptr =
+        params.lhs_base_ptr +
+        static_cast<std::ptrdiff_t>(row) * params.lhs_stride;
+    __m512i accum_lo0 = _mm512_setzero_si512();
+    __m512i accum_hi0 = _mm512_setzero_si512();
+    __m512i accum_lo1 = _mm512_setzero_si512();
+    __m512i accum_hi1 = _mm512_setzero_si512();
+    int d = 0;
+    for (; d <= depth - 2 * kInnerSize; d += 2 * kInnerSize) {
+      accumulate(lhs_ptr, rhs_ptr + d, &accum_lo0, &accum_hi0);
+      accumulate(lhs_ptr + kBlockRows * kInnerSize, rhs_ptr + d + kInnerSize,
+                 &accum_lo1, &accum_hi1);
+      lhs_ptr += 2 * kBlockRows * kInnerSize;
+    }
+    if (d < depth) {
+      accumulate(lhs_ptr, rhs_ptr + d, &accum_lo0, &accum_hi0);
+    }
+    const __m512i accum_lo = _mm512_add_epi32(accum_lo0, accum_lo1);
+    const __m512i accum_hi = _mm512_add_epi32(accum_hi0, accum_hi1);
+    const __m512i accum = _mm512_add_epi32(
+        _mm512_permutex2var_epi32(accum_lo, even_lanes, accum_hi),
+        _mm512_permutex2var_epi32(accum_lo, odd_lanes, accum_hi));
+    _mm512_storeu_si512(params.accum + (row - params.start_row), accum);
+  }
+}
+
+#endif  // RUY_PLATFORM_AVX512 && RUY_OPT(ASM)
+
+}  // namespace ruy
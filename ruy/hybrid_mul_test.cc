@@ -0,0 +1,514 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Tests of dequantizing multiplications, with an integer accumulator and a
+// floating-point destination, including the dynamically quantized ('hybrid')
+// case of a float RHS, quantized to int8 by packing, and group-wise LHS
+// scales.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "ruy/context.h"
+#include "ruy/context_get_ctx.h"
+#include "ruy/ctx.h"
+#include "ruy/gtest_wrapper.h"
+#include "ruy/int4.h"
+#include "ruy/matrix.h"
+#include "ruy/mul_params.h"
+#include "ruy/path.h"
+#include "ruy/quantize.h"
+#include "ruy/reference_mul.h"
+#include "ruy/ruy.h"
+
+namespace ruy {
+namespace {
+
+// Returns the paths that Mul may use on the present machine.
+std::vector<Path> EnabledPaths() {
+  Context context;
+  const Path enabled =
+      get_ctx(&context)->GetRuntimeEnabledPaths() & kDefaultPaths;
+  std::vector<Path> paths;
+  for (int bit = 0; bit < 8 * static_cast<int>(sizeof(Path)); bit++) {
+    const Path path = static_cast<Path>(1 << bit);
+    if ((enabled & path) != Path::kNone) {
+      paths.push_back(path);
+    }
+  }
+  return paths;
+}
+
+struct Shape {
+  int rows;
+  int depth;
+  int cols;
+};
+
+struct Options {
+  Order dst_order = Order::kColMajor;
+  bool perchannel = true;
+  bool with_bias = true;
+  bool prepack_lhs = false;
+  int max_num_threads = 1;
+  // If not negative, the group size of group-wise LHS scales, see
+  // MulParams::lhs_scales. The int32 bias is then not used.
+  int lhs_group_size = -1;
+  // Only with group-wise scales and an int4 LHS: per-group zero points.
+  bool lhs_zero_points = false;
+  // Only for an integer RHS.
+  int rhs_zero_point = 0;
+  // If not 0, overrides the local data cache size, e.g. so that a GEMV packs
+  // its LHS in many chunks, see TrMulGemv.
+  int local_data_cache_size = 0;
+};
+
+// Stores the LHS entries, given in row-major order, into data.
+template <typename Scalar>
+void StoreLhsEntries(const std::vector<int>& values,
+                     std::vector<Scalar>* data) {
+  data->assign(values.begin(), values.end());
+}
+
+void StoreLhsEntries(const std::vector<int>& values, std::vector<int4>* data) {
+  data->resize(Int4StorageBytes(values.size()));
+  for (int i = 0; i < static_cast<int>(values.size()); i++) {
+    SetInt4Entry(data->data(), i, values[i]);
+  }
+}
+
+void MakeRhsValues(std::mt19937* generator, std::vector<float>* data) {
+  std::normal_distribution<float> dist(0.f, 4.f);
+  for (auto& x : *data) x = dist(*generator);
+}
+
+void MakeRhsValues(std::mt19937* generator, std::vector<std::int8_t>* data) {
+  std::uniform_int_distribution<int> dist(-127, 127);
+  for (auto& x : *data) x = dist(*generator);
+}
+
+template <typename LhsScalar, typename RhsScalar>
+class DequantizingMulTest {
+ public:
+  using MulParamsType = MulParams<std::int32_t, float>;
+
+  DequantizingMulTest(const Shape& shape, LhsScalar lhs_zero_point,
+                      const Options& options)
+      : shape_(shape), options_(options), generator_(1) {
+    std::uniform_int_distribution<int> lhs_dist(
+        std::numeric_limits<LhsScalar>::lowest() + 1,
+        std::numeric_limits<LhsScalar>::max());
+    std::vector<int> lhs_values(shape.rows * shape.depth);
+    for (auto& x : lhs_values) x = lhs_dist(generator_);
+    StoreLhsEntries(lhs_values, &lhs_data_);
+    MakeSimpleLayout(shape.rows, shape.depth, Order::kRowMajor,
+                     lhs_.mutable_layout());
+    lhs_.set_data(lhs_data_.data());
+    lhs_.set_zero_point(lhs_zero_point);
+
+    rhs_data_.resize(shape.depth * shape.cols);
+    MakeRhsValues(&generator_, &rhs_data_);
+    MakeSimpleLayout(shape.depth, shape.cols, Order::kColMajor,
+                     rhs_.mutable_layout());
+    rhs_.set_data(rhs_data_.data());
+    if (!std::is_same<RhsScalar, float>::value) {
+      rhs_.set_zero_point(options.rhs_zero_point);
+    }
+
+    std::uniform_real_distribution<float> multiplier_dist(1e-3f, 1e-2f);
+    std::uniform_real_distribution<float> bias_dist(-1.f, 1.f);
+    std::uniform_int_distribution<int> int_bias_dist(-1000, 1000);
+    multipliers_.resize(shape.rows);
+    float_bias_.resize(shape.rows);
+    bias_.resize(shape.rows);
+    for (auto& x : multipliers_) x = multiplier_dist(generator_);
+    for (auto& x : float_bias_) x = bias_dist(generator_);
+    for (auto& x : bias_) x = int_bias_dist(generator_);
+    if (options.perchannel) {
+      mul_params_.set_float_multiplier_perchannel(multipliers_.data());
+    } else {
+      mul_params_.set_float_multiplier(multipliers_[0]);
+    }
+    if (options.with_bias) {
+      if (options.lhs_group_size < 0) {
+        mul_params_.set_bias(bias_.data());
+      }
+      mul_params_.set_float_bias(float_bias_.data());
+    }
+    if (options.lhs_group_size >= 0) {
+      const int num_groups =
+          NumWeightGroups(options.lhs_group_size, shape.depth);
+      std::uniform_real_distribution<float> scale_dist(0.5f, 2.f);
+      std::uniform_int_distribution<int> zero_point_dist(-2, 2);
+      lhs_scales_.resize(num_groups * shape.rows);
+      for (auto& x : lhs_scales_) x = scale_dist(generator_);
+      mul_params_.set_lhs_scales(lhs_scales_.data());
+      mul_params_.set_lhs_group_size(options.lhs_group_size);
+      if (options.lhs_zero_points) {
+        lhs_zero_points_.resize(num_groups * shape.rows);
+        for (auto& x : lhs_zero_points_) x = zero_point_dist(generator_);
+        mul_params_.set_lhs_zero_points(lhs_zero_points_.data());
+      }
+    }
+  }
+
+  void Run() {
+    std::vector<float> expected_data;
+    Matrix<float> expected;
+    MakeDst(&expected_data, &expected);
+    ReferenceMul(lhs_, rhs_, mul_params_, &expected);
+    CheckAgainstFloat(expected_data);
+    for (Path path : EnabledPaths()) {
+      Context context;
+      context.set_max_num_threads(options_.max_num_threads);
+      get_ctx(&context)->SetRuntimeEnabledPaths(path);
+      if (options_.local_data_cache_size) {
+        get_ctx(&context)->SetDataCacheSizes(options_.local_data_cache_size,
+                                             0);
+      }
+      std::vector<float> dst_data;
+      Matrix<float> dst;
+      MakeDst(&dst_data, &dst);
+      if (options_.prepack_lhs) {
+        const PackedMatrix<LhsScalar> packed_lhs =
+            PrePack<RhsScalar>(lhs_, mul_params_, &context);
+        Mul(packed_lhs, rhs_, mul_params_, &context, &dst);
+      } else {
+        Mul(lhs_, rhs_, mul_params_, &context, &dst);
+      }
+      EXPECT_EQ(context.last_used_path(), path);
+      for (int i = 0; i < static_cast<int>(dst_data.size()); i++) {
+        // Only the float arithmetic of the dequantization may differ from
+        // the reference, the integer accumulators are exact.
+        ASSERT_NEAR(dst_data[i], expected_data[i],
+                    1e-5f * (1.f + std::abs(expected_data[i])))
+            << "path " << static_cast<int>(path) << ", entry " << i;
+      }
+    }
+  }
+
+ private:
+  void CheckAgainstFloat(const std::vector<float>& expected_data) const;
+
+  void MakeDst(std::vector<float>* data, Matrix<float>* dst) const {
+    data->assign(shape_.rows * shape_.cols, 0.f);
+    MakeSimpleLayout(shape_.rows, shape_.cols, options_.dst_order,
+                     dst->mutable_layout());
+    dst->set_data(data->data());
+  }
+
+  float Multiplier(int row) const {
+    return options_.perchannel ? multipliers_[row] : multipliers_[0];
+  }
+
+  Shape shape_;
+  Options options_;
+  std::mt19937 generator_;
+  std::vector<LhsScalar> lhs_data_;
+  std::vector<RhsScalar> rhs_data_;
+  std::vector<float> multipliers_;
+  std::vector<float> float_bias_;
+  std::vector<std::int32_t> bias_;
+  std::vector<float> lhs_scales_;
+  std::vector<std::int8_t> lhs_zero_points_;
+  Matrix<LhsScalar> lhs_;
+  Matrix<RhsScalar> rhs_;
+  MulParamsType mul_params_;
+};
+
+// The reference result of a hybrid multiplication differs from that of the
+// same multiplication in float by the quantization error of the RHS, which
+// is at most half a quantization step per RHS entry. With group-wise LHS
+// scales, the exact result is that of the dequantized LHS entries.
+template <typename LhsScalar, typename RhsScalar>
+void DequantizingMulTest<LhsScalar, RhsScalar>::CheckAgainstFloat(
+    const std::vector<float>& expected_data) const {
+  const bool dst_col_major = options_.dst_order == Order::kColMajor;
+  for (int col = 0; col < shape_.cols; col++) {
+    float max_abs = 0;
+    for (int k = 0; k < shape_.depth; k++) {
+      max_abs = std::max(
+          max_abs, std::abs(static_cast<float>(
+                       rhs_data_[col * shape_.depth + k])));
+    }
+    const float half_step = std::is_same<RhsScalar, float>::value
+                                ? 0.5f * max_abs / 127
+                                : 0.f;
+    for (int row = 0; row < shape_.rows; row++) {
+      double exact = 0;
+      double error_bound = 0;
+      for (int k = 0; k < shape_.depth; k++) {
+        const double lhs_val =
+            (static_cast<double>(Element(lhs_, row, k)) -
+             WeightZeroPoint(mul_params_.lhs_zero_points(),
+                             mul_params_.lhs_group_size(), shape_.rows, row,
+                             k, lhs_.zero_point())) *
+            WeightScale(mul_params_.lhs_scales(),
+                        mul_params_.lhs_group_size(), shape_.rows, row, k);
+        exact += lhs_val * (static_cast<double>(
+                                rhs_data_[col * shape_.depth + k]) -
+                            rhs_.zero_point());
+        error_bound += std::abs(lhs_val) * half_step;
+      }
+      if (mul_params_.bias()) {
+        exact += static_cast<double>(bias_[row]) *
+                 (std::is_same<RhsScalar, float>::value
+                      ? DynamicQuantScale(max_abs)
+                      : 1.f);
+      }
+      exact *= Multiplier(row);
+      error_bound *= Multiplier(row);
+      if (options_.with_bias) {
+        exact += float_bias_[row];
+      }
+      const int index = dst_col_major ? row + col * shape_.rows
+                                      : row * shape_.cols + col;
+      ASSERT_NEAR(expected_data[index], exact,
+                  error_bound + 1e-4 * (1 + std::abs(exact)))
+          << "row " << row << ", col " << col;
+    }
+  }
+}
+
+const Shape kShapes[] = {{1, 1, 1},     {7, 5, 3},      {16, 32, 8},
+                         {33, 70, 17},  {100, 200, 1},  {64, 300, 1},
+                         {130, 90, 70}, {255, 129, 65}};
+
+TEST(HybridMulTest, Int8Lhs) {
+  for (const Shape& shape : kShapes) {
+    DequantizingMulTest<std::int8_t, float>(shape, 0, Options()).Run();
+  }
+}
+
+TEST(HybridMulTest, Uint8LhsWithZeroPoint) {
+  for (const Shape& shape : kShapes) {
+    DequantizingMulTest<std::uint8_t, float>(shape, 128, Options()).Run();
+    DequantizingMulTest<std::uint8_t, float>(shape, 113, Options()).Run();
+  }
+}
+
+TEST(HybridMulTest, Options) {
+  const Shape shape = {70, 100, 40};
+  Options options;
+  options.dst_order = Order::kRowMajor;
+  DequantizingMulTest<std::int8_t, float>(shape, 0, options).Run();
+  options = Options();
+  options.perchannel = false;
+  options.with_bias = false;
+  DequantizingMulTest<std::int8_t, float>(shape, 0, options).Run();
+  options = Options();
+  options.prepack_lhs = true;
+  DequantizingMulTest<std::int8_t, float>(shape, 0, options).Run();
+  DequantizingMulTest<std::int8_t, float>({70, 100, 1}, 0, options).Run();
+}
+
+TEST(HybridMulTest, MultiThreaded) {
+  Options options;
+  options.max_num_threads = 4;
+  DequantizingMulTest<std::int8_t, float>({300, 500, 200}, 0, options).Run();
+  DequantizingMulTest<std::int8_t, float>({1000, 600, 1}, 0, options).Run();
+}
+
+TEST(HybridMulTest, ChunkedGemv) {
+  // A local data cache this small makes each chunk of the packed LHS a
+  // single kernel block of columns.
+  Options options;
+  options.local_data_cache_size = 1 << 10;
+  for (int threads : {1, 3}) {
+    options.max_num_threads = threads;
+    DequantizingMulTest<std::int8_t, float>({200, 300, 1}, 0, options).Run();
+    DequantizingMulTest<std::uint8_t, float>({200, 300, 1}, 113, options)
+        .Run();
+    DequantizingMulTest<std::int8_t, std::int8_t>({200, 300, 1}, 0, options)
+        .Run();
+  }
+}
+
+TEST(HybridMulTest, StridedBatch) {
+  const Shape shape = {40, 70, 9};
+  const int batch_size = 3;
+  std::mt19937 generator(1);
+  std::uniform_int_distribution<int> lhs_dist(-127, 127);
+  std::normal_distribution<float> rhs_dist(0.f, 1.f);
+  std::vector<std::int8_t> lhs_data(shape.rows * shape.depth);
+  std::vector<float> rhs_data(batch_size * shape.depth * shape.cols);
+  for (auto& x : lhs_data) x = lhs_dist(generator);
+  for (auto& x : rhs_data) x = rhs_dist(generator);
+  Matrix<std::int8_t> lhs;
+  MakeSimpleLayout(shape.rows, shape.depth, Order::kRowMajor,
+                   lhs.mutable_layout());
+  lhs.set_data(lhs_data.data());
+  Matrix<float> rhs;
+  MakeSimpleLayout(shape.depth, shape.cols, Order::kColMajor,
+                   rhs.mutable_layout());
+  MulParams<std::int32_t, float> mul_params;
+  mul_params.set_float_multiplier(0.01f);
+  const int item_size = shape.rows * shape.cols;
+  std::vector<float> dst_data(batch_size * item_size, 0.f);
+  std::vector<float> expected_data(dst_data.size(), 0.f);
+  Matrix<float> dst;
+  MakeSimpleLayout(shape.rows, shape.cols, Order::kColMajor,
+                   dst.mutable_layout());
+  for (int i = 0; i < batch_size; i++) {
+    rhs.set_data(rhs_data.data() + i * shape.depth * shape.cols);
+    dst.set_data(expected_data.data() + i * item_size);
+    ReferenceMul(lhs, rhs, mul_params, &dst);
+  }
+  Context context;
+  context.set_max_num_threads(2);
+  rhs.set_data(rhs_data.data());
+  dst.set_data(dst_data.data());
+  StridedBatchMul(lhs, rhs, shape.depth * shape.cols, mul_params, batch_size,
+                  &context, &dst, item_size);
+  for (int i = 0; i < static_cast<int>(dst_data.size()); i++) {
+    ASSERT_NEAR(dst_data[i], expected_data[i],
+                1e-5f * (1.f + std::abs(expected_data[i])))
+        << "entry " << i;
+  }
+}
+
+TEST(DequantizingMulTest, Int8Rhs) {
+  for (const Shape& shape : kShapes) {
+    DequantizingMulTest<std::int8_t, std::int8_t>(shape, 0, Options()).Run();
+  }
+  Options options;
+  options.dst_order = Order::kRowMajor;
+  options.max_num_threads = 2;
+  DequantizingMulTest<std::int8_t, std::int8_t>({130, 90, 70}, 0, options)
+      .Run();
+}
+
+TEST(GroupScaledMulTest, Int8Lhs) {
+  for (int group_size : {0, 16, 32, 64}) {
+    Options options;
+    options.lhs_group_size = group_size;
+    for (const Shape& shape : kShapes) {
+      DequantizingMulTest<std::int8_t, float>(shape, 0, options).Run();
+      DequantizingMulTest<std::int8_t, std::int8_t>(shape, 0, options).Run();
+    }
+  }
+}
+
+TEST(GroupScaledMulTest, ZeroPoints) {
+  Options options;
+  options.lhs_group_size = 32;
+  for (const Shape& shape : kShapes) {
+    DequantizingMulTest<std::uint8_t, float>(shape, 113, options).Run();
+  }
+  options.rhs_zero_point = 5;
+  for (const Shape& shape : kShapes) {
+    DequantizingMulTest<std::int8_t, std::int8_t>(shape, 0, options).Run();
+    DequantizingMulTest<std::int8_t, std::int8_t>(shape, -3, options).Run();
+  }
+  // The group sums are packed along with a prepacked LHS.
+  options.prepack_lhs = true;
+  DequantizingMulTest<std::int8_t, std::int8_t>({70, 100, 40}, -3, options)
+      .Run();
+  DequantizingMulTest<std::int8_t, std::int8_t>({70, 100, 1}, -3, options)
+      .Run();
+}
+
+TEST(GroupScaledMulTest, InvalidParams) {
+  const int rows = 2;
+  const int depth = 32;
+  std::vector<std::int8_t> lhs_data(rows * depth, 1);
+  std::vector<std::int8_t> rhs_data(depth, 1);
+  std::vector<float> dst_data(rows);
+  std::vector<float> lhs_scales(rows * depth, 1.f);
+  const std::int32_t bias[rows] = {};
+  Matrix<std::int8_t> lhs;
+  MakeSimpleLayout(rows, depth, Order::kRowMajor, lhs.mutable_layout());
+  lhs.set_data(lhs_data.data());
+  Matrix<std::int8_t> rhs;
+  MakeSimpleLayout(depth, 1, Order::kColMajor, rhs.mutable_layout());
+  rhs.set_data(rhs_data.data());
+  Matrix<float> dst;
+  MakeSimpleLayout(rows, 1, Order::kColMajor, dst.mutable_layout());
+  dst.set_data(dst_data.data());
+  Context context;
+  MulParams<std::int32_t, float> mul_params;
+  mul_params.set_lhs_scales(lhs_scales.data());
+  // These are checked in all builds, see MulParams::lhs_scales.
+  mul_params.set_lhs_group_size(8);
+  RUY_ASSERT_DEATH(Mul(lhs, rhs, mul_params, &context, &dst), "");
+  mul_params.set_lhs_group_size(16);
+  mul_params.set_bias(bias);
+  RUY_ASSERT_DEATH(Mul(lhs, rhs, mul_params, &context, &dst), "");
+  mul_params.set_bias(nullptr);
+  Mul(lhs, rhs, mul_params, &context, &dst);
+  EXPECT_EQ(dst_data[0], static_cast<float>(depth));
+}
+
+TEST(GroupScaledMulTest, Int4Lhs) {
+  for (int group_size : {0, 32, 128}) {
+    Options options;
+    options.lhs_group_size = group_size;
+    options.lhs_zero_points = true;
+    for (const Shape& shape : kShapes) {
+      DequantizingMulTest<int4, float>(shape, 0, options).Run();
+      DequantizingMulTest<int4, std::int8_t>(shape, 0, options).Run();
+    }
+  }
+}
+
+TEST(GroupScaledMulTest, ChunkedInt4Gemv) {
+  // As in HybridMulTest.ChunkedGemv, the int4 LHS is expanded to int8 one
+  // kernel block of columns at a time.
+  Options options;
+  options.local_data_cache_size = 1 << 10;
+  options.lhs_zero_points = true;
+  for (int group_size : {0, 32}) {
+    options.lhs_group_size = group_size;
+    for (int threads : {1, 3}) {
+      options.max_num_threads = threads;
+      DequantizingMulTest<int4, float>({200, 300, 1}, 0, options).Run();
+      DequantizingMulTest<int4, std::int8_t>({200, 300, 1}, 0, options).Run();
+    }
+  }
+}
+
+TEST(GroupScaledMulTest, Options) {
+  const Shape shape = {70, 100, 40};
+  Options options;
+  options.lhs_group_size = 32;
+  options.dst_order = Order::kRowMajor;
+  DequantizingMulTest<std::int8_t, float>(shape, 0, options).Run();
+  options.dst_order = Order::kColMajor;
+  options.perchannel = false;
+  options.with_bias = false;
+  DequantizingMulTest<std::int8_t, float>(shape, 0, options).Run();
+  options.perchannel = true;
+  options.with_bias = true;
+  options.prepack_lhs = true;
+  DequantizingMulTest<std::int8_t, float>(shape, 0, options).Run();
+  DequantizingMulTest<std::int8_t, float>({70, 100, 1}, 0, options).Run();
+  options.prepack_lhs = false;
+  options.max_num_threads = 4;
+  DequantizingMulTest<std::int8_t, float>({300, 500, 200}, 0, options).Run();
+  DequantizingMulTest<int4, float>({1000, 600, 1}, 0, options).Run();
+}
+
+}  // namespace
+}  // namespace ruy
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,109 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// 4-bit signed integer scalar type: ruy::int4, with values in [-8, 7].
+//
+// It is supported as an LHS scalar type (typically quantized weights), with
+// an 8-bit integer RHS, or a float RHS quantized by packing, and int32
+// accumulation. A Matrix<int4> stores two
+// entries per byte: its layout is in entries, as for any other type, and the
+// entry at linear offset i (see Offset in matrix.h) is the low nibble of byte
+// i / 2 if i is even, and the high nibble of it otherwise. The data pointer
+// of the matrix thus points to raw bytes, not to int4 objects.
+//
+// Packing expands the entries to int8, minus their zero points, so the 8-bit
+// kernels are used. This halves the memory traffic on the LHS compared to an
+// int8 LHS, which is what matters for matrix*vector products. The zero
+// points may be given per group of depth levels, see
+// MulParams::lhs_zero_points.
+
+#ifndef RUY_RUY_INT4_H_
+#define RUY_RUY_INT4_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "ruy/check_macros.h"
+#include "ruy/matrix.h"
+
+namespace ruy {
+
+// A 4-bit signed integer value. Implicitly converts from and to int. This is
+// the value type of a single entry; in a Matrix<int4>, entries are stored as
+// nibbles, see the comment at the top of this file.
+struct int4 final {
+  int4() = default;
+  int4(int x) : value(static_cast<std::int8_t>(x)) {
+    RUY_DCHECK_GE(x, -8);
+    RUY_DCHECK_LE(x, 7);
+  }
+  operator int() const { return value; }
+  std::int8_t value;
+};
+
+static_assert(sizeof(int4) == 1, "");
+
+// Returns the number of bytes storing `size` entries of type int4.
+inline std::ptrdiff_t Int4StorageBytes(std::ptrdiff_t size) {
+  return (size + 1) / 2;
+}
+
+// Returns the entry at linear offset i of int4 storage, sign-extended.
+inline int Int4Entry(const int4* data, std::ptrdiff_t i) {
+  const std::uint8_t byte = reinterpret_cast<const std::uint8_t*>(data)[i / 2];
+  const std::uint8_t nibble = (i & 1) ? (byte >> 4) : (byte & 0xf);
+  return static_cast<int>(nibble ^ 8) - 8;
+}
+
+// Sets the entry at linear offset i of int4 storage, leaving the other entry
+// of the same byte unchanged.
+inline void SetInt4Entry(int4* data, std::ptrdiff_t i, int4 x) {
+  std::uint8_t* byte = reinterpret_cast<std::uint8_t*>(data) + i / 2;
+  const std::uint8_t nibble = static_cast<std::uint8_t>(x.value) & 0xf;
+  *byte = (i & 1) ? ((*byte & 0x0f) | (nibble << 4))
+                  : ((*byte & 0xf0) | nibble);
+}
+
+// Overload of Element in matrix.h: the generic one would read whole bytes.
+inline int4 Element(const Matrix<int4>& mat, int row, int col) {
+  return Int4Entry(mat.data(), Offset(mat.layout(), row, col));
+}
+
+}  // namespace ruy
+
+namespace std {
+
+// See the comment on numeric_limits in ruy/float16.h.
+template <>
+class numeric_limits<ruy::int4> {
+ public:
+  static constexpr bool is_specialized = true;
+  static constexpr bool is_signed = true;
+  static constexpr bool is_integer = true;
+  static constexpr bool is_exact = true;
+  static constexpr bool has_infinity = false;
+  static constexpr bool has_quiet_NaN = false;
+  static constexpr int radix = 2;
+  static constexpr int digits = 3;
+  static ruy::int4 min() { return -8; }
+  static ruy::int4 max() { return 7; }
+  static ruy::int4 lowest() { return -8; }
+  static ruy::int4 epsilon() { return 0; }
+};
+
+}  // namespace std
+
+#endif  // RUY_RUY_INT4_H_
@@ -388,7 +388,140 @@ inline void mm256_n_storeu_ps(float* dst, int residual_rows, const __m256 v) {
     dst[i] = intrin_utils::mm256_get1_ps(v, i);
   }
 }
+
+// Transposes the 8x8 block of which v holds the columns, so that v holds its
+// rows instead.
+inline void mm256_transpose8x8_ps(__m256* v) {
+  const __m256 t0 = _mm256_unpacklo_ps(v[0], v[1]);
+  const __m256 t1 = _mm256_unpackhi_ps(v[0], v[1]);
+  const __m256 t2 = _mm256_unpacklo_ps(v[2], v[3]);
+  const __m256 t3 = _mm256_unpackhi_ps(v[2], v[3]);
+  const __m256 t4 = _mm256_unpacklo_ps(v[4], v[5]);
+  const __m256 t5 = _mm256_unpackhi_ps(v[4], v[5]);
+  const __m256 t6 = _mm256_unpacklo_ps(v[6], v[7]);
+  const __m256 t7 = _mm256_unpackhi_ps(v[6], v[7]);
+  // Each of these holds 4 entries of a row in its low 128-bit lane, and the
+  // same 4 entries of the row 4 places below in its high lane.
+  const __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+  v[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+  v[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+  v[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+  v[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+  v[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+  v[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+  v[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+  v[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+inline void mm256_transpose8x8_epi32(__m256i* v) {
+  __m256 v_ps[8];
+  for (int i = 0; i < 8; ++i) {
+    v_ps[i] = _mm256_castsi256_ps(v[i]);
+  }
+  mm256_transpose8x8_ps(v_ps);
+  for (int i = 0; i < 8; ++i) {
+    v[i] = _mm256_castps_si256(v_ps[i]);
+  }
+}
+
+// Stores the rows of a block of a row-major destination, see
+// RUY_ASM_FLAG_DST_ROW_MAJOR, from the clamped accumulators of its columns.
+inline void mm256_n_storeu_ps_rows(float* dst, std::int64_t dst_stride,
+                                   int residual_rows, int residual_cols,
+                                   __m256* v) {
+  mm256_transpose8x8_ps(v);
+  for (int i = 0; i < residual_rows; ++i) {
+    if (residual_cols == 8) {
+      _mm256_storeu_ps(dst, v[i]);
+    } else {
+      mm256_n_storeu_ps(dst, residual_cols, v[i]);
+    }
+    dst += dst_stride;
+  }
+}
 }  // namespace intrin_utils
+
+// Stores a block of the destination of Kernel8bitAvx2 when it is row-major,
+// see RUY_ASM_FLAG_DST_ROW_MAJOR: the accumulators of each column are clamped,
+// or dequantized for a float destination, as in the column-major case, then
+// the block is transposed in registers so as to store whole rows.
+void StoreRowMajorDst8bitAvx2(const KernelParams8bit<8, 8>& params, int row,
+                              int col, int residual_rows, int residual_cols,
+                              const __m256i* accum_data_v, void* dst_ptr) {
+  if (params.dst_type_id == DstTypeId<float>::kValue) {
+    const __m256 multiplier_v =
+        (params.flags & RUY_ASM_FLAG_HAS_PERCHANNEL)
+            ? intrin_utils::mm256_n_loadu_ps(residual_rows,
+                                             &params.float_multiplier[row])
+            : _mm256_set1_ps(params.float_multiplier[0]);
+    const __m256 float_bias_v =
+        (params.flags & RUY_ASM_FLAG_HAS_FLOAT_BIAS)
+            ? intrin_utils::mm256_n_loadu_ps(residual_rows,
+                                             &params.float_bias[row])
+            : _mm256_setzero_ps();
+    const __m256 float_clamp_max_v = _mm256_set1_ps(params.float_clamp_max);
+    const __m256 float_clamp_min_v = _mm256_set1_ps(params.float_clamp_min);
+    __m256 results[kAvx8bitBlockSize];
+    for (int j = 0; j < kAvx8bitBlockSize; ++j) {
+      const float rhs_scale = (params.flags & RUY_ASM_FLAG_HAS_RHS_SCALES) &&
+                                      j < residual_cols
+                                  ? params.rhs_scales[col + j]
+                                  : 1.f;
+      __m256 result = _mm256_cvtepi32_ps(accum_data_v[j]);
+      result = _mm256_mul_ps(result, multiplier_v);
+      result = _mm256_mul_ps(result, _mm256_set1_ps(rhs_scale));
+      result = _mm256_add_ps(result, float_bias_v);
+      result = _mm256_min_ps(result, float_clamp_max_v);
+      results[j] = _mm256_max_ps(result, float_clamp_min_v);
+    }
+    intrin_utils::mm256_n_storeu_ps_rows(
+        static_cast<float*>(dst_ptr), params.dst_stride / sizeof(float),
+        residual_rows, residual_cols, results);
+    return;
+  }
+  __m256i results[kAvx8bitBlockSize];
+  const __m256i clamp_max_v = _mm256_set1_epi32(params.clamp_max);
+  const __m256i clamp_min_v = _mm256_set1_epi32(params.clamp_min);
+  for (int j = 0; j < kAvx8bitBlockSize; ++j) {
+    // As in the column-major case, a std::int32_t destination isn't clamped.
+    results[j] = accum_data_v[j];
+    if (params.dst_type_id != DstTypeId<std::int32_t>::kValue) {
+      results[j] = _mm256_min_epi32(results[j], clamp_max_v);
+      results[j] = _mm256_max_epi32(results[j], clamp_min_v);
+    }
+  }
+  intrin_utils::mm256_transpose8x8_epi32(results);
+  char* dst_row_ptr = static_cast<char*>(dst_ptr);
+  for (int i = 0; i < residual_rows; ++i) {
+    if (params.dst_type_id == DstTypeId<std::int8_t>::kValue) {
+      intrin_utils::mm256_n_storeu_cvtepi32_epi8(
+          reinterpret_cast<std::int8_t*>(dst_row_ptr), residual_cols,
+          results[i]);
+    } else if (params.dst_type_id == DstTypeId<std::uint8_t>::kValue) {
+      intrin_utils::mm256_n_storeu_cvtepi32_epi8(
+          reinterpret_cast<std::uint8_t*>(dst_row_ptr), residual_cols,
+          results[i]);
+    } else if (params.dst_type_id == DstTypeId<std::int16_t>::kValue) {
+      intrin_utils::mm256_n_storeu_cvtepi32_epi16(
+          reinterpret_cast<std::int16_t*>(dst_row_ptr), residual_cols,
+          results[i]);
+    } else if (params.dst_type_id == DstTypeId<std::int32_t>::kValue) {
+      intrin_utils::mm256_n_storeu_epi32(
+          reinterpret_cast<std::int32_t*>(dst_row_ptr), residual_cols,
+          results[i]);
+    } else {
+      RUY_DCHECK(false);
+    }
+    dst_row_ptr += params.dst_stride;
+  }
+}
 }  // namespace
 
 void Kernel8bitAvx2(const KernelParams8bit<8, 8>& params) {
@@ -401,16 +534,29 @@ void Kernel8bitAvx2(const KernelParams8bit<8, 8>& params) {
   };
 
   std::int32_t dst_stride = 0;
+  std::int32_t dst_element_size = 0;
   if ((params.dst_type_id == DstTypeId<std::int8_t>::kValue) ||
       (params.dst_type_id == DstTypeId<std::uint8_t>::kValue)) {
     dst_stride = params.dst_stride;
+    dst_element_size = 1;
   } else if (params.dst_type_id == DstTypeId<std::int16_t>::kValue) {
     dst_stride = params.dst_stride / sizeof(std::int16_t);
+    dst_element_size = sizeof(std::int16_t);
   } else if (params.dst_type_id == DstTypeId<std::int32_t>::kValue) {
     dst_stride = params.dst_stride / sizeof(std::int32_t);
+    dst_element_size = sizeof(std::int32_t);
+  } else if (params.dst_type_id == DstTypeId<float>::kValue) {
+    dst_stride = params.dst_stride / sizeof(float);
+    dst_element_size = sizeof(float);
   } else {
     RUY_DCHECK(false);
   }
+  // For a row-major destination, dst_stride is the offset between rows, and
+  // consecutive blocks of columns are contiguous.
+  const bool dst_row_major = params.flags & RUY_ASM_FLAG_DST_ROW_MAJOR;
+  const std::int32_t dst_col_block_offset =
+      kAvx8bitBlockSize *
+      (dst_row_major ? dst_element_size : params.dst_stride);
 
   int bias_ptr_block_increment =
       params.flags & RUY_ASM_FLAG_HAS_BIAS ? kAvx8bitBlockSize : 0;
@@ -675,7 +821,8 @@ void Kernel8bitAvx2(const KernelParams8bit<8, 8>& params) {
         rhs_ptr += kAvx8bitBlockSize * kAvx8bitInnerSize;
       }
 
-      if (params.dst_type_id != DstTypeId<std::int32_t>::kValue) {
+      if (params.dst_type_id != DstTypeId<std::int32_t>::kValue &&
+          params.dst_type_id != DstTypeId<float>::kValue) {
         __m256i m_vector;
         __m256i e_vector;
         // Does not make use of RUY_ASM_FLAG_NEEDS_LEFT_SHIFT.
@@ -996,7 +1143,7 @@ void Kernel8bitAvx2(const KernelParams8bit<8, 8>& params) {
                                     (residual_cols == kAvx8bitBlockSize);
 
       __m256i accum_data_v[kAvx8bitBlockSize];
-      if (!store_full_block) {
+      if (!store_full_block || dst_row_major) {
         accum_data_v[0] = accum_data_v0;
         accum_data_v[1] = accum_data_v1;
         accum_data_v[2] = accum_data_v2;
@@ -1007,7 +1154,12 @@ void Kernel8bitAvx2(const KernelParams8bit<8, 8>& params) {
         accum_data_v[7] = accum_data_v7;
       }
 
-      if (params.dst_type_id == DstTypeId<std::int8_t>::kValue) {
+      if (dst_row_major) {
+        StoreRowMajorDst8bitAvx2(params, row, col, residual_rows,
+                                 residual_cols, accum_data_v, dst_ptr);
+        dst_ptr = static_cast<void*>(static_cast<char*>(dst_ptr) +
+                                     kAvx8bitBlockSize * params.dst_stride);
+      } else if (params.dst_type_id == DstTypeId<std::int8_t>::kValue) {
         std::int8_t* tmp_ptr = static_cast<std::int8_t*>(dst_ptr);
         if (store_full_block) {
           accum_data_v0 = _mm256_min_epi32(accum_data_v0, clamp_max_v);
@@ -1173,6 +1325,46 @@ void Kernel8bitAvx2(const KernelParams8bit<8, 8>& params) {
         }
         dst_ptr = static_cast<void*>(static_cast<std::int32_t*>(dst_ptr) +
                                      kAvx8bitBlockSize);
+      } else if (params.dst_type_id == DstTypeId<float>::kValue) {
+        // Dequantization, see MulParams::float_multiplier: the accumulators
+        // are converted to float and scaled by the multiplier of their row
+        // and the scale of their RHS column, then the float bias is added.
+        const __m256 multiplier_v =
+            (params.flags & RUY_ASM_FLAG_HAS_PERCHANNEL)
+                ? intrin_utils::mm256_n_loadu_ps(residual_rows,
+                                                 &params.float_multiplier[row])
+                : _mm256_set1_ps(params.float_multiplier[0]);
+        const __m256 float_bias_v =
+            (params.flags & RUY_ASM_FLAG_HAS_FLOAT_BIAS)
+                ? intrin_utils::mm256_n_loadu_ps(residual_rows,
+                                                 &params.float_bias[row])
+                : _mm256_setzero_ps();
+        const __m256 float_clamp_max_v = _mm256_set1_ps(params.float_clamp_max);
+        const __m256 float_clamp_min_v = _mm256_set1_ps(params.float_clamp_min);
+        const __m256i accum_data[kAvx8bitBlockSize] = {
+            accum_data_v0, accum_data_v1, accum_data_v2, accum_data_v3,
+            accum_data_v4, accum_data_v5, accum_data_v6, accum_data_v7};
+        float* dst_block_ptr = static_cast<float*>(dst_ptr);
+        for (int j = 0; j < residual_cols; ++j) {
+          const float rhs_scale = (params.flags & RUY_ASM_FLAG_HAS_RHS_SCALES)
+                                      ? params.rhs_scales[col + j]
+                                      : 1.f;
+          __m256 result = _mm256_cvtepi32_ps(accum_data[j]);
+          result = _mm256_mul_ps(result, multiplier_v);
+          result = _mm256_mul_ps(result, _mm256_set1_ps(rhs_scale));
+          result = _mm256_add_ps(result, float_bias_v);
+          result = _mm256_min_ps(result, float_clamp_max_v);
+          result = _mm256_max_ps(result, float_clamp_min_v);
+          if (store_full_block) {
+            _mm256_storeu_ps(dst_block_ptr, result);
+          } else {
+            intrin_utils::mm256_n_storeu_ps(dst_block_ptr, residual_rows,
+                                            result);
+          }
+          dst_block_ptr += dst_stride;
+        }
+        dst_ptr = static_cast<void*>(static_cast<float*>(dst_ptr) +
+                                     kAvx8bitBlockSize);
       } else {
         RUY_DCHECK(false);
       }
@@ -1181,7 +1373,7 @@ void Kernel8bitAvx2(const KernelParams8bit<8, 8>& params) {
     }  // End row-block loop.
 
     dst_col_ptr = static_cast<void*>(static_cast<char*>(dst_col_ptr) +
-                                     kAvx8bitBlockSize * params.dst_stride);
+                                     dst_col_block_offset);
     rhs_col_ptr += kAvx8bitBlockSize * params.rhs_stride;
   }  // End col-block loop.
 }  // NOLINT(readability/fn_size)
@@ -1314,7 +1506,8 @@ void Kernel8bitAvx2SingleCol(const KernelParams8bit<8, 8>& params) {
       rhs_ptr += kAvx8bitBlockSize * kAvx8bitInnerSize;
     }
 
-    if (params.dst_type_id != DstTypeId<std::int32_t>::kValue) {
+    if (params.dst_type_id != DstTypeId<std::int32_t>::kValue &&
+        params.dst_type_id != DstTypeId<float>::kValue) {
       __m256i m_vector;
       __m256i e_vector;
       // Does not make use of RUY_ASM_FLAG_NEEDS_LEFT_SHIFT.
@@ -1442,6 +1635,31 @@ void Kernel8bitAvx2SingleCol(const KernelParams8bit<8, 8>& params) {
                                          accum_data_v0);
       dst_ptr = static_cast<void*>(static_cast<std::int32_t*>(dst_ptr) +
                                    kAvx8bitBlockSize);
+    } else if (params.dst_type_id == DstTypeId<float>::kValue) {
+      // Dequantization, as in Kernel8bitAvx2.
+      const __m256 multiplier_v =
+          (params.flags & RUY_ASM_FLAG_HAS_PERCHANNEL)
+              ? intrin_utils::mm256_n_loadu_ps(residual_rows,
+                                               &params.float_multiplier[row])
+              : _mm256_set1_ps(params.float_multiplier[0]);
+      const __m256 float_bias_v =
+          (params.flags & RUY_ASM_FLAG_HAS_FLOAT_BIAS)
+              ? intrin_utils::mm256_n_loadu_ps(residual_rows,
+                                               &params.float_bias[row])
+              : _mm256_setzero_ps();
+      const float rhs_scale = (params.flags & RUY_ASM_FLAG_HAS_RHS_SCALES)
+                                  ? params.rhs_scales[0]
+                                  : 1.f;
+      float* dst_block_ptr = static_cast<float*>(dst_ptr);
+      __m256 result = _mm256_cvtepi32_ps(accum_data_v0);
+      result = _mm256_mul_ps(result, multiplier_v);
+      result = _mm256_mul_ps(result, _mm256_set1_ps(rhs_scale));
+      result = _mm256_add_ps(result, float_bias_v);
+      result = _mm256_min_ps(result, _mm256_set1_ps(params.float_clamp_max));
+      result = _mm256_max_ps(result, _mm256_set1_ps(params.float_clamp_min));
+      intrin_utils::mm256_n_storeu_ps(dst_block_ptr, residual_rows, result);
+      dst_ptr = static_cast<void*>(static_cast<float*>(dst_ptr) +
+                                   kAvx8bitBlockSize);
     } else {
       RUY_DCHECK(false);
     }
@@ -1469,8 +1687,10 @@ void KernelFloatAvx2(const KernelParamsFloat<8, 8>& params) {
   //
   const float* adj_rhs_col_ptr =
       params.rhs_base_ptr - params.start_col * rhs_stride;
-  float* adj_dst_col_ptr =
-      params.dst_base_ptr - params.start_col * dst_stride - params.start_row;
+  // Offsets between consecutive rows and columns of the destination.
+  const bool dst_row_major = params.flags & RUY_ASM_FLAG_DST_ROW_MAJOR;
+  const std::int64_t dst_row_offset = dst_row_major ? dst_stride : 1;
+  const std::int64_t dst_col_offset = dst_row_major ? 1 : dst_stride;
   const float* adj_lhs_col_ptr =
       params.lhs_base_ptr - params.start_row * lhs_stride;
   const float* bias_col_ptr = params.bias;
@@ -1484,13 +1704,14 @@ void KernelFloatAvx2(const KernelParamsFloat<8, 8>& params) {
     __m256 accum_data_v[8];
 
     const float* rhs_col_ptr = adj_rhs_col_ptr + col * rhs_stride;
-    float* dst_col_ptr = adj_dst_col_ptr + col * dst_stride;
+    float* dst_col_ptr =
+        params.dst_base_ptr + (col - params.start_col) * dst_col_offset;
 
     for (int row = params.start_row; row < end_row; row += 8) {
       const int residual_rows = std::min(end_row - row, 8);
 
       const float* lhs_col_ptr = adj_lhs_col_ptr + row * lhs_stride;
-      float* dst_ptr = dst_col_ptr + row;
+      float* dst_ptr = dst_col_ptr + (row - params.start_row) * dst_row_offset;
       const float* bias_ptr = bias_col_ptr + row * bias_ptr_block_increment;
 
       // Initialize with bias.
@@ -1520,7 +1741,14 @@ void KernelFloatAvx2(const KernelParamsFloat<8, 8>& params) {
         rhs_ptr += 8;
       }
 
-      if (residual_rows == 8) {
+      if (dst_row_major) {
+        for (int j = 0; j < 8; ++j) {
+          accum_data_v[j] = _mm256_min_ps(accum_data_v[j], clamp_max_v);
+          accum_data_v[j] = _mm256_max_ps(accum_data_v[j], clamp_min_v);
+        }
+        intrin_utils::mm256_n_storeu_ps_rows(dst_ptr, dst_stride, residual_rows,
+                                             8, accum_data_v);
+      } else if (residual_rows == 8) {
         for (int j = 0; j < 8; ++j) {
           float* block_ptr = dst_ptr + j * dst_stride;
           accum_data_v[j] = _mm256_min_ps(accum_data_v[j], clamp_max_v);
@@ -1547,14 +1775,15 @@ void KernelFloatAvx2(const KernelParamsFloat<8, 8>& params) {
     __m256 accum_data_v[8];
 
     const float* rhs_col_ptr = adj_rhs_col_ptr + col * rhs_stride;
-    float* dst_col_ptr = adj_dst_col_ptr + col * dst_stride;
+    float* dst_col_ptr =
+        params.dst_base_ptr + (col - params.start_col) * dst_col_offset;
     const int residual_cols = std::min(end_col - col, 8);
 
     for (int row = params.start_row; row < end_row; row += 8) {
       const int residual_rows = std::min(end_row - row, 8);
 
       const float* lhs_col_ptr = adj_lhs_col_ptr + row * lhs_stride;
-      float* dst_ptr = dst_col_ptr + row;
+      float* dst_ptr = dst_col_ptr + (row - params.start_row) * dst_row_offset;
       const float* bias_ptr = bias_col_ptr + row * bias_ptr_block_increment;
 
       // Initialize with bias.
@@ -1580,12 +1809,21 @@ void KernelFloatAvx2(const KernelParamsFloat<8, 8>& params) {
         rhs_ptr += 8;
       }
 
-      for (int j = 0; j < residual_cols; ++j) {
-        float* block_ptr = dst_ptr + j * dst_stride;
-        accum_data_v[j] = _mm256_min_ps(accum_data_v[j], clamp_max_v);
-        accum_data_v[j] = _mm256_max_ps(accum_data_v[j], clamp_min_v);
-        intrin_utils::mm256_n_storeu_ps(block_ptr, residual_rows,
-                                        accum_data_v[j]);
+      if (dst_row_major) {
+        for (int j = 0; j < 8; ++j) {
+          accum_data_v[j] = _mm256_min_ps(accum_data_v[j], clamp_max_v);
+          accum_data_v[j] = _mm256_max_ps(accum_data_v[j], clamp_min_v);
+        }
+        intrin_utils::mm256_n_storeu_ps_rows(dst_ptr, dst_stride, residual_rows,
+                                             residual_cols, accum_data_v);
+      } else {
+        for (int j = 0; j < residual_cols; ++j) {
+          float* block_ptr = dst_ptr + j * dst_stride;
+          accum_data_v[j] = _mm256_min_ps(accum_data_v[j], clamp_max_v);
+          accum_data_v[j] = _mm256_max_ps(accum_data_v[j], clamp_min_v);
+          intrin_utils::mm256_n_storeu_ps(block_ptr, residual_rows,
+                                          accum_data_v[j]);
+        }
       }
     }  // End row-block loop.
   }    // End col-block terminal conditional.
@@ -1605,7 +1843,6 @@ void KernelFloatAvx2SingleCol(const KernelParamsFloat<8, 8>& params) {
   // AVX2 float block size = 8.
   const int end_row = std::min(params.dst_rows, params.last_row + 8);
 
-  float* adj_dst_col_ptr = params.dst_base_ptr - params.start_row;
   const float* adj_lhs_col_ptr =
       params.lhs_base_ptr - params.start_row * lhs_stride;
   const float* bias_col_ptr = params.bias;
@@ -1616,12 +1853,11 @@ void KernelFloatAvx2SingleCol(const KernelParamsFloat<8, 8>& params) {
   __m256 accum_data_v;
 
   const float* rhs_col_ptr = params.rhs_base_ptr;
-  float* dst_col_ptr = adj_dst_col_ptr;
 
   int row = params.start_row;
   for (; row <= end_row - 8; row += 8) {
     const float* lhs_col_ptr = adj_lhs_col_ptr + row * lhs_stride;
-    float* dst_ptr = dst_col_ptr + row;
+    float* dst_ptr = params.dst_base_ptr + (row - params.start_row);
     const float* bias_ptr = bias_col_ptr + row * bias_ptr_block_increment;
 
     // Initialize with bias.
@@ -1672,7 +1908,7 @@ void KernelFloatAvx2SingleCol(const KernelParamsFloat<8, 8>& params) {
     RUY_CHECK_LT(residual_rows, 8);
 
     const float* lhs_col_ptr = adj_lhs_col_ptr + row * lhs_stride;
-    float* dst_ptr = dst_col_ptr + row;
+    float* dst_ptr = params.dst_base_ptr + (row - params.start_row);
     const float* bias_ptr = bias_col_ptr + row * bias_ptr_block_increment;
 
     // Initialize with bias.
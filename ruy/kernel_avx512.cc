@@ -52,20 +52,189 @@ void KernelFloatAvx512SingleCol(const KernelParamsFloat<16, 16>&) {
 
 #else  // RUY_PLATFORM_AVX512 && RUY_OPT(ASM)
 
+namespace {
+
+// Transposes the 16x16 block of which v holds the columns, so that v holds its
+// rows instead.
+inline void Transpose16x16Epi32(__m512i* v) {
+  __m512i t[16];
+  for (int i = 0; i < 16; i += 2) {
+    t[i] = _mm512_unpacklo_epi32(v[i], v[i + 1]);
+    t[i + 1] = _mm512_unpackhi_epi32(v[i], v[i + 1]);
+  }
+  // u[4 * g + k] holds, in its 128-bit lane l, the entries of columns
+  // 4 * g to 4 * g + 3 of row 4 * l + k.
+  __m512i u[16];
+  for (int g = 0; g < 16; g += 4) {
+    u[g + 0] = _mm512_unpacklo_epi64(t[g], t[g + 2]);
+    u[g + 1] = _mm512_unpackhi_epi64(t[g], t[g + 2]);
+    u[g + 2] = _mm512_unpacklo_epi64(t[g + 1], t[g + 3]);
+    u[g + 3] = _mm512_unpackhi_epi64(t[g + 1], t[g + 3]);
+  }
+  for (int k = 0; k < 4; ++k) {
+    const __m512i a = _mm512_shuffle_i32x4(u[k], u[4 + k], 0x88);
+    const __m512i b = _mm512_shuffle_i32x4(u[8 + k], u[12 + k], 0x88);
+    const __m512i c = _mm512_shuffle_i32x4(u[k], u[4 + k], 0xdd);
+    const __m512i d = _mm512_shuffle_i32x4(u[8 + k], u[12 + k], 0xdd);
+    v[k] = _mm512_shuffle_i32x4(a, b, 0x88);
+    v[4 + k] = _mm512_shuffle_i32x4(c, d, 0x88);
+    v[8 + k] = _mm512_shuffle_i32x4(a, b, 0xdd);
+    v[12 + k] = _mm512_shuffle_i32x4(c, d, 0xdd);
+  }
+}
+
+// Stores a block of the destination of Kernel8bitAvx512 when it is row-major,
+// see RUY_ASM_FLAG_DST_ROW_MAJOR: the accumulators of each column are clamped,
+// or dequantized for a float destination, as in the column-major case, then
+// the block is transposed in registers so as to store whole rows.
+void StoreRowMajorDst8bitAvx512(const KernelParams8bit<16, 16>& params,
+                                int row, int col, int residual_rows,
+                                int residual_cols,
+                                const __m512i* accum_data_v, void* dst_ptr) {
+  const __mmask16 row_mask =
+      (static_cast<std::uint32_t>(1) << residual_rows) - 1;
+  const __mmask16 col_mask =
+      (static_cast<std::uint32_t>(1) << residual_cols) - 1;
+  __m512i results[16];
+  if (params.dst_type_id == DstTypeId<float>::kValue) {
+    const __m512 multiplier_v =
+        (params.flags & RUY_ASM_FLAG_HAS_PERCHANNEL)
+            ? _mm512_maskz_loadu_ps(row_mask, &params.float_multiplier[row])
+            : _mm512_set1_ps(params.float_multiplier[0]);
+    const __m512 float_bias_v =
+        (params.flags & RUY_ASM_FLAG_HAS_FLOAT_BIAS)
+            ? _mm512_maskz_loadu_ps(row_mask, &params.float_bias[row])
+            : _mm512_setzero_ps();
+    const __m512 float_clamp_max_v = _mm512_set1_ps(params.float_clamp_max);
+    const __m512 float_clamp_min_v = _mm512_set1_ps(params.float_clamp_min);
+    for (int j = 0; j < 16; ++j) {
+      const float rhs_scale = (params.flags & RUY_ASM_FLAG_HAS_RHS_SCALES) &&
+                                      j < residual_cols
+                                  ? params.rhs_scales[col + j]
+                                  : 1.f;
+      __m512 result = _mm512_cvtepi32_ps(accum_data_v[j]);
+      result = _mm512_mul_ps(result, multiplier_v);
+      result = _mm512_mul_ps(result, _mm512_set1_ps(rhs_scale));
+      result = _mm512_add_ps(result, float_bias_v);
+      result = _mm512_min_ps(result, float_clamp_max_v);
+      result = _mm512_max_ps(result, float_clamp_min_v);
+      results[j] = _mm512_castps_si512(result);
+    }
+  } else {
+    const __m512i clamp_max_v = _mm512_set1_epi32(params.clamp_max);
+    const __m512i clamp_min_v = _mm512_set1_epi32(params.clamp_min);
+    for (int j = 0; j < 16; ++j) {
+      // As in the column-major case, a std::int32_t destination isn't
+      // clamped.
+      results[j] = accum_data_v[j];
+      if (params.dst_type_id != DstTypeId<std::int32_t>::kValue) {
+        results[j] = _mm512_min_epi32(results[j], clamp_max_v);
+        results[j] = _mm512_max_epi32(results[j], clamp_min_v);
+      }
+    }
+  }
+  Transpose16x16Epi32(results);
+  char* dst_row_ptr = static_cast<char*>(dst_ptr);
+  for (int i = 0; i < residual_rows; ++i) {
+    if ((params.dst_type_id == DstTypeId<std::int8_t>::kValue) ||
+        (params.dst_type_id == DstTypeId<std::uint8_t>::kValue)) {
+      _mm_mask_storeu_epi8(dst_row_ptr, col_mask,
+                           _mm512_cvtepi32_epi8(results[i]));
+    } else if (params.dst_type_id == DstTypeId<std::int16_t>::kValue) {
+      _mm256_mask_storeu_epi16(dst_row_ptr, col_mask,
+                               _mm512_cvtepi32_epi16(results[i]));
+    } else if (params.dst_type_id == DstTypeId<std::int32_t>::kValue) {
+      _mm512_mask_storeu_epi32(dst_row_ptr, col_mask, results[i]);
+    } else if (params.dst_type_id == DstTypeId<float>::kValue) {
+      _mm512_mask_storeu_ps(dst_row_ptr, col_mask,
+                            _mm512_castsi512_ps(results[i]));
+    } else {
+      RUY_DCHECK(false);
+    }
+    dst_row_ptr += params.dst_stride;
+  }
+}
+
+// Clamps and stores 8 columns of a block of a row-major destination, see
+// RUY_ASM_FLAG_DST_ROW_MAJOR, held one per register in v: transposes them in
+// registers so as to store the first residual_cols entries of the first
+// residual_rows rows.
+void ClampAndStoreRowMajorFloatAvx512(const __m512 clamp_min_v,
+                                      const __m512 clamp_max_v,
+                                      int residual_rows, int residual_cols,
+                                      __m512* v, float* dst,
+                                      std::int64_t dst_stride) {
+  if (residual_cols <= 0) {
+    return;
+  }
+  __m512 t[8];
+  for (int i = 0; i < 8; i += 2) {
+    const __m512 v0 =
+        _mm512_max_ps(_mm512_min_ps(v[i], clamp_max_v), clamp_min_v);
+    const __m512 v1 =
+        _mm512_max_ps(_mm512_min_ps(v[i + 1], clamp_max_v), clamp_min_v);
+    t[i] = _mm512_unpacklo_ps(v0, v1);
+    t[i + 1] = _mm512_unpackhi_ps(v0, v1);
+  }
+  // u[4 * g + k] holds, in its 128-bit lane l, the entries of columns
+  // 4 * g to 4 * g + 3 of row 4 * l + k.
+  __m512 u[8];
+  for (int g = 0; g < 8; g += 4) {
+    const __m512d ta = _mm512_castps_pd(t[g]);
+    const __m512d tb = _mm512_castps_pd(t[g + 1]);
+    const __m512d tc = _mm512_castps_pd(t[g + 2]);
+    const __m512d td = _mm512_castps_pd(t[g + 3]);
+    u[g + 0] = _mm512_castpd_ps(_mm512_unpacklo_pd(ta, tc));
+    u[g + 1] = _mm512_castpd_ps(_mm512_unpackhi_pd(ta, tc));
+    u[g + 2] = _mm512_castpd_ps(_mm512_unpacklo_pd(tb, td));
+    u[g + 3] = _mm512_castpd_ps(_mm512_unpackhi_pd(tb, td));
+  }
+  // rows[k] holds row k in its low 256 bits, and row 8 + k in its high 256
+  // bits.
+  __m512 rows[8];
+  for (int k = 0; k < 4; ++k) {
+    const __m512 a = _mm512_shuffle_f32x4(u[k], u[4 + k], 0x88);
+    const __m512 b = _mm512_shuffle_f32x4(u[k], u[4 + k], 0xdd);
+    rows[k] = _mm512_shuffle_f32x4(a, a, 0xd8);
+    rows[4 + k] = _mm512_shuffle_f32x4(b, b, 0xd8);
+  }
+  const __mmask8 col_mask =
+      (static_cast<std::uint32_t>(1) << residual_cols) - 1;
+  for (int i = 0; i < residual_rows; ++i) {
+    const __m256 row_v = i < 8 ? _mm512_castps512_ps256(rows[i])
+                               : _mm512_extractf32x8_ps(rows[i - 8], 1);
+    _mm256_mask_storeu_ps(dst + i * dst_stride, col_mask, row_v);
+  }
+}
+
+}  // namespace
+
 void Kernel8bitAvx512(const KernelParams8bit<16, 16>& params) {
   profiler::ScopeLabel label("Kernel kAvx512 8-bit");
 
   std::int32_t dst_stride = 0;
+  std::int32_t dst_element_size = 0;
   if ((params.dst_type_id == DstTypeId<std::int8_t>::kValue) ||
       (params.dst_type_id == DstTypeId<std::uint8_t>::kValue)) {
     dst_stride = params.dst_stride;
+    dst_element_size = 1;
   } else if (params.dst_type_id == DstTypeId<std::int16_t>::kValue) {
     dst_stride = params.dst_stride / sizeof(std::int16_t);
+    dst_element_size = sizeof(std::int16_t);
   } else if (params.dst_type_id == DstTypeId<std::int32_t>::kValue) {
     dst_stride = params.dst_stride / sizeof(std::int32_t);
+    dst_element_size = sizeof(std::int32_t);
+  } else if (params.dst_type_id == DstTypeId<float>::kValue) {
+    dst_stride = params.dst_stride / sizeof(float);
+    dst_element_size = sizeof(float);
   } else {
     RUY_DCHECK(false);
   }
+  // For a row-major destination, dst_stride is the offset between rows, and
+  // consecutive blocks of columns are contiguous.
+  const bool dst_row_major = params.flags & RUY_ASM_FLAG_DST_ROW_MAJOR;
+  const std::int32_t dst_col_block_offset =
+      16 * (dst_row_major ? dst_element_size : params.dst_stride);
 
   int bias_ptr_block_increment = params.flags & RUY_ASM_FLAG_HAS_BIAS ? 16 : 0;
 
@@ -463,7 +632,8 @@ void Kernel8bitAvx512(const KernelParams8bit<16, 16>& params) {
         rhs_ptr += 16 * 4;
       }
 
-      if (params.dst_type_id != DstTypeId<std::int32_t>::kValue) {
+      if (params.dst_type_id != DstTypeId<std::int32_t>::kValue &&
+          params.dst_type_id != DstTypeId<float>::kValue) {
         __m512i m_vector;
         __m512i e_vector;
         // Does not make use of RUY_ASM_FLAG_NEEDS_LEFT_SHIFT.
@@ -959,7 +1129,12 @@ void Kernel8bitAvx512(const KernelParams8bit<16, 16>& params) {
         accum_data_v[15] = accum_data_vf;
       }
 
-      if (params.dst_type_id == DstTypeId<std::int8_t>::kValue) {
+      if (dst_row_major) {
+        StoreRowMajorDst8bitAvx512(params, row, col, residual_rows,
+                                   residual_cols, accum_data_v, dst_ptr);
+        dst_ptr = static_cast<void*>(static_cast<char*>(dst_ptr) +
+                                     16 * params.dst_stride);
+      } else if (params.dst_type_id == DstTypeId<std::int8_t>::kValue) {
         std::int8_t* tmp_ptr = static_cast<std::int8_t*>(dst_ptr);
         const int block_col_offset = dst_stride;
         if (store_full_block) {
@@ -1039,6 +1214,38 @@ void Kernel8bitAvx512(const KernelParams8bit<16, 16>& params) {
           }
         }
         dst_ptr = static_cast<void*>(static_cast<std::int32_t*>(dst_ptr) + 16);
+      } else if (params.dst_type_id == DstTypeId<float>::kValue) {
+        // Dequantization, see MulParams::float_multiplier: the accumulators
+        // are converted to float and scaled by the multiplier of their row
+        // and the scale of their RHS column, then the float bias is added.
+        const __m512 multiplier_v =
+            (params.flags & RUY_ASM_FLAG_HAS_PERCHANNEL)
+                ? _mm512_maskz_loadu_ps(row_mask, &params.float_multiplier[row])
+                : _mm512_set1_ps(params.float_multiplier[0]);
+        const __m512 float_bias_v =
+            (params.flags & RUY_ASM_FLAG_HAS_FLOAT_BIAS)
+                ? _mm512_maskz_loadu_ps(row_mask, &params.float_bias[row])
+                : _mm512_setzero_ps();
+        const __m512 float_clamp_max_v = _mm512_set1_ps(params.float_clamp_max);
+        const __m512 float_clamp_min_v = _mm512_set1_ps(params.float_clamp_min);
+        float* tmp_ptr = static_cast<float*>(dst_ptr);
+        for (int j = 0; j < residual_cols; ++j) {
+          const float rhs_scale = (params.flags & RUY_ASM_FLAG_HAS_RHS_SCALES)
+                                      ? params.rhs_scales[col + j]
+                                      : 1.f;
+          __m512 result = _mm512_cvtepi32_ps(accum_data_v[j]);
+          result = _mm512_mul_ps(result, multiplier_v);
+          result = _mm512_mul_ps(result, _mm512_set1_ps(rhs_scale));
+          result = _mm512_add_ps(result, float_bias_v);
+          result = _mm512_min_ps(result, float_clamp_max_v);
+          result = _mm512_max_ps(result, float_clamp_min_v);
+          if (store_full_block) {
+            _mm512_storeu_ps(tmp_ptr + j * dst_stride, result);
+          } else {
+            _mm512_mask_storeu_ps(tmp_ptr + j * dst_stride, row_mask, result);
+          }
+        }
+        dst_ptr = static_cast<void*>(static_cast<float*>(dst_ptr) + 16);
       } else {
         RUY_DCHECK(false);
       }
@@ -1047,7 +1254,7 @@ void Kernel8bitAvx512(const KernelParams8bit<16, 16>& params) {
     }  // End row-block loop.
 
     dst_col_ptr = static_cast<void*>(static_cast<char*>(dst_col_ptr) +
-                                     16 * params.dst_stride);
+                                     dst_col_block_offset);
     rhs_col_ptr += 16 * params.rhs_stride;
   }  // End col-block loop.
 }  // NOLINT(readability/fn_size)
@@ -1159,7 +1366,8 @@ void Kernel8bitAvx512SingleCol(const KernelParams8bit<16, 16>& params) {
       rhs_ptr += 16 * 4;
     }
 
-    if (params.dst_type_id != DstTypeId<std::int32_t>::kValue) {
+    if (params.dst_type_id != DstTypeId<std::int32_t>::kValue &&
+        params.dst_type_id != DstTypeId<float>::kValue) {
       __m512i m_vector;
       __m512i e_vector;
       // Does not make use of RUY_ASM_FLAG_NEEDS_LEFT_SHIFT.
@@ -1259,6 +1467,28 @@ void Kernel8bitAvx512SingleCol(const KernelParams8bit<16, 16>& params) {
       std::int32_t* tmp_ptr = static_cast<std::int32_t*>(dst_ptr);
       _mm512_mask_storeu_epi32(tmp_ptr, row_mask, accum_data_v0);
       dst_ptr = static_cast<void*>(static_cast<std::int32_t*>(dst_ptr) + 16);
+    } else if (params.dst_type_id == DstTypeId<float>::kValue) {
+      // Dequantization, as in Kernel8bitAvx512.
+      const __m512 multiplier_v =
+          (params.flags & RUY_ASM_FLAG_HAS_PERCHANNEL)
+              ? _mm512_maskz_loadu_ps(row_mask, &params.float_multiplier[row])
+              : _mm512_set1_ps(params.float_multiplier[0]);
+      const __m512 float_bias_v =
+          (params.flags & RUY_ASM_FLAG_HAS_FLOAT_BIAS)
+              ? _mm512_maskz_loadu_ps(row_mask, &params.float_bias[row])
+              : _mm512_setzero_ps();
+      const float rhs_scale = (params.flags & RUY_ASM_FLAG_HAS_RHS_SCALES)
+                                  ? params.rhs_scales[0]
+                                  : 1.f;
+      float* tmp_ptr = static_cast<float*>(dst_ptr);
+      __m512 result = _mm512_cvtepi32_ps(accum_data_v0);
+      result = _mm512_mul_ps(result, multiplier_v);
+      result = _mm512_mul_ps(result, _mm512_set1_ps(rhs_scale));
+      result = _mm512_add_ps(result, float_bias_v);
+      result = _mm512_min_ps(result, _mm512_set1_ps(params.float_clamp_max));
+      result = _mm512_max_ps(result, _mm512_set1_ps(params.float_clamp_min));
+      _mm512_mask_storeu_ps(tmp_ptr, row_mask, result);
+      dst_ptr = static_cast<void*>(static_cast<float*>(dst_ptr) + 16);
     } else {
       RUY_DCHECK(false);
     }
@@ -1281,8 +1511,10 @@ void KernelFloatAvx512(const KernelParamsFloat<16, 16>& params) {
 
   const float* adj_rhs_col_ptr =
       params.rhs_base_ptr - params.start_col * rhs_stride;
-  float* adj_dst_col_ptr =
-      params.dst_base_ptr - params.start_col * dst_stride - params.start_row;
+  // Offsets between consecutive rows and columns of the destination.
+  const bool dst_row_major = params.flags & RUY_ASM_FLAG_DST_ROW_MAJOR;
+  const std::int64_t dst_row_offset = dst_row_major ? dst_stride : 1;
+  const std::int64_t dst_col_offset = dst_row_major ? 1 : dst_stride;
   const float* adj_lhs_col_ptr =
       params.lhs_base_ptr - params.start_row * lhs_stride;
   const float* bias_col_ptr = params.bias;
@@ -1293,12 +1525,13 @@ void KernelFloatAvx512(const KernelParamsFloat<16, 16>& params) {
   int col = params.start_col;
   for (; col <= end_col - 16; col += 16) {
     const float* rhs_col_ptr = adj_rhs_col_ptr + col * rhs_stride;
-    float* dst_col_ptr = adj_dst_col_ptr + col * dst_stride;
+    float* dst_col_ptr =
+        params.dst_base_ptr + (col - params.start_col) * dst_col_offset;
 
     int row = params.start_row;
     for (; row <= end_row - 16; row += 16) {
       const float* lhs_col_ptr = adj_lhs_col_ptr + row * lhs_stride;
-      float* dst_ptr = dst_col_ptr + row;
+      float* dst_ptr = dst_col_ptr + (row - params.start_row) * dst_row_offset;
       const float* bias_ptr = bias_col_ptr + row * bias_ptr_block_increment;
 
       // Initialize with bias.
@@ -1385,7 +1618,15 @@ void KernelFloatAvx512(const KernelParamsFloat<16, 16>& params) {
             accum_data_v7 =
                 _mm512_fmadd_ps(lhs_data, dup_rhs_element_j7, accum_data_v7);
           }
-          {
+          if (dst_row_major) {
+            __m512 accum_data_v[8] = {accum_data_v0, accum_data_v1,
+                                      accum_data_v2, accum_data_v3,
+                                      accum_data_v4, accum_data_v5,
+                                      accum_data_v6, accum_data_v7};
+            ClampAndStoreRowMajorFloatAvx512(clamp_min_v, clamp_max_v, 16, 8,
+                                             accum_data_v, dst_ptr + mmm * 8,
+                                             dst_stride);
+          } else {
             float* block_ptr = dst_ptr + (mmm * 8 + 0) * dst_stride;
             accum_data_v0 = _mm512_min_ps(accum_data_v0, clamp_max_v);
             accum_data_v0 = _mm512_max_ps(accum_data_v0, clamp_min_v);
@@ -1489,7 +1730,15 @@ void KernelFloatAvx512(const KernelParamsFloat<16, 16>& params) {
             accum_data_v7 =
                 _mm512_fmadd_ps(lhs_data, dup_rhs_element_j7, accum_data_v7);
           }
-          {
+          if (dst_row_major) {
+            __m512 accum_data_v[8] = {accum_data_v0, accum_data_v1,
+                                      accum_data_v2, accum_data_v3,
+                                      accum_data_v4, accum_data_v5,
+                                      accum_data_v6, accum_data_v7};
+            ClampAndStoreRowMajorFloatAvx512(clamp_min_v, clamp_max_v, 16, 8,
+                                             accum_data_v, dst_ptr + mmm * 8,
+                                             dst_stride);
+          } else {
             float* block_ptr = dst_ptr + (mmm * 8 + 0) * dst_stride;
             accum_data_v0 = _mm512_min_ps(accum_data_v0, clamp_max_v);
             accum_data_v0 = _mm512_max_ps(accum_data_v0, clamp_min_v);
@@ -1526,7 +1775,7 @@ void KernelFloatAvx512(const KernelParamsFloat<16, 16>& params) {
       const int residual_rows = end_row - row;
 
       const float* lhs_col_ptr = adj_lhs_col_ptr + row * lhs_stride;
-      float* dst_ptr = dst_col_ptr + row;
+      float* dst_ptr = dst_col_ptr + (row - params.start_row) * dst_row_offset;
       const float* bias_ptr = bias_col_ptr + row * bias_ptr_block_increment;
 
       // Initialize with bias.
@@ -1609,7 +1858,15 @@ void KernelFloatAvx512(const KernelParamsFloat<16, 16>& params) {
             accum_data_v7 =
                 _mm512_fmadd_ps(lhs_data, dup_rhs_element_j7, accum_data_v7);
           }
-          {
+          if (dst_row_major) {
+            __m512 accum_data_v[8] = {accum_data_v0, accum_data_v1,
+                                      accum_data_v2, accum_data_v3,
+                                      accum_data_v4, accum_data_v5,
+                                      accum_data_v6, accum_data_v7};
+            ClampAndStoreRowMajorFloatAvx512(clamp_min_v, clamp_max_v,
+                                             residual_rows, 8, accum_data_v,
+                                             dst_ptr + mmm * 8, dst_stride);
+          } else {
             float* block_ptr = dst_ptr + (mmm * 8 + 0) * dst_stride;
             accum_data_v0 = _mm512_min_ps(accum_data_v0, clamp_max_v);
             accum_data_v0 = _mm512_max_ps(accum_data_v0, clamp_min_v);
@@ -1656,13 +1913,14 @@ void KernelFloatAvx512(const KernelParamsFloat<16, 16>& params) {
     __m512 accum_data_v[8];
 
     const float* rhs_col_ptr = adj_rhs_col_ptr + col * rhs_stride;
-    float* dst_col_ptr = adj_dst_col_ptr + col * dst_stride;
+    float* dst_col_ptr =
+        params.dst_base_ptr + (col - params.start_col) * dst_col_offset;
 
     for (int row = params.start_row; row < end_row; row += 16) {
       const int residual_rows = std::min(end_row - row, 16);
 
       const float* lhs_col_ptr = adj_lhs_col_ptr + row * lhs_stride;
-      float* dst_ptr = dst_col_ptr + row;
+      float* dst_ptr = dst_col_ptr + (row - params.start_row) * dst_row_offset;
       const float* bias_ptr = bias_col_ptr + row * bias_ptr_block_increment;
 
       // Initialize with bias.
@@ -1694,7 +1952,12 @@ void KernelFloatAvx512(const KernelParamsFloat<16, 16>& params) {
 
         const int residual_cols = std::min(end_col - col - 8 * mmm, 8);
 
-        if (residual_rows == 16) {
+        if (dst_row_major) {
+          ClampAndStoreRowMajorFloatAvx512(clamp_min_v, clamp_max_v,
+                                           residual_rows, residual_cols,
+                                           accum_data_v, dst_ptr + mmm * 8,
+                                           dst_stride);
+        } else if (residual_rows == 16) {
           if (residual_cols == 8) {
             for (int j = 0; j < 8; ++j) {
               float* block_ptr = dst_ptr + (mmm * 8 + j) * dst_stride;
@@ -1736,7 +1999,6 @@ void KernelFloatAvx512SingleCol(const KernelParamsFloat<16, 16>& params) {
   int bias_ptr_block_increment = params.flags & RUY_ASM_FLAG_HAS_BIAS ? 1 : 0;
   const int end_row = std::min(params.dst_rows, params.last_row + 16);
 
-  float* adj_dst_col_ptr = params.dst_base_ptr - params.start_row;
   const float* adj_lhs_col_ptr =
       params.lhs_base_ptr - params.start_row * lhs_stride;
   const float* bias_col_ptr = params.bias;
@@ -1747,12 +2009,11 @@ void KernelFloatAvx512SingleCol(const KernelParamsFloat<16, 16>& params) {
   __m512 accum_data_v;
 
   const float* rhs_col_ptr = params.rhs_base_ptr;
-  float* dst_col_ptr = adj_dst_col_ptr;
 
   int row = params.start_row;
   for (; row <= end_row - 16; row += 16) {
     const float* lhs_col_ptr = adj_lhs_col_ptr + row * lhs_stride;
-    float* dst_ptr = dst_col_ptr + row;
+    float* dst_ptr = params.dst_base_ptr + (row - params.start_row);
     const float* bias_ptr = bias_col_ptr + row * bias_ptr_block_increment;
 
     // Initialize with bias.
@@ -1781,7 +2042,7 @@ void KernelFloatAvx512SingleCol(const KernelParamsFloat<16, 16>& params) {
     RUY_CHECK_LT(residual_rows, 16);
 
     const float* lhs_col_ptr = adj_lhs_col_ptr + row * lhs_stride;
-    float* dst_ptr = dst_col_ptr + row;
+    float* dst_ptr = params.dst_base_ptr + (row - params.start_row);
     const float* bias_ptr = bias_col_ptr + row * bias_ptr_block_increment;
 
     // Initialize with bias.
@@ -143,7 +143,8 @@ void Kernel8bitAvxVnni(const KernelParams8bit<16, 16>& params) {
         }
       }
 
-      if (params.dst_type_id != DstTypeId<std::int32_t>::kValue) {
+      if (params.dst_type_id != DstTypeId<std::int32_t>::kValue &&
+          params.dst_type_id != DstTypeId<float>::kValue) {
         std::int32_t m_vector[kAvx8bitBlockSize];
         std::int32_t e_vector[kAvx8bitBlockSize];
         // Does not make use of RUY_ASM_FLAG_NEEDS_LEFT_SHIFT.
@@ -167,7 +168,7 @@ void Kernel8bitAvxVnni(const KernelParams8bit<16, 16>& params) {
 
         for (int j = 0; j < kAvx8bitBlockSize; ++j) {
           for (int i = 0; i < kAvx8bitBlockSize; ++i) {
-            accum_data[j][i] = MultiplyByQuantizedMultiplier(
+            accum_data[j][i] = detail::MultiplyByQuantizedMultiplier(
                 accum_data[j][i], m_vector[i], e_vector[i]);
           }
         }
@@ -306,6 +307,33 @@ void Kernel8bitAvxVnni(const KernelParams8bit<16, 16>& params) {
         }
         dst_ptr = static_cast<void*>(static_cast<std::int32_t*>(dst_ptr) +
                                      kAvx8bitBlockSize);
+      } else if (params.dst_type_id == DstTypeId<float>::kValue) {
+        // Dequantization, see MulParams::float_multiplier: the accumulators
+        // are converted to float and scaled by the multiplier of their row
+        // and the scale of their RHS column, then the float bias is added.
+        float* dst_block_ptr = static_cast<float*>(dst_ptr);
+        for (int j = 0; j < residual_cols; ++j) {
+          const float rhs_scale = (params.flags & RUY_ASM_FLAG_HAS_RHS_SCALES)
+                                      ? params.rhs_scales[col + j]
+                                      : 1.f;
+          for (int i = 0; i < residual_rows; ++i) {
+            const float multiplier =
+                (params.flags & RUY_ASM_FLAG_HAS_PERCHANNEL)
+                    ? params.float_multiplier[row + i]
+                    : params.float_multiplier[0];
+            const float float_bias =
+                (params.flags & RUY_ASM_FLAG_HAS_FLOAT_BIAS)
+                    ? params.float_bias[row + i]
+                    : 0.f;
+            float result = static_cast<float>(accum_data[j][i]) * multiplier;
+            result = result * rhs_scale + float_bias;
+            result = std::min(result, params.float_clamp_max);
+            dst_block_ptr[i] = std::max(result, params.float_clamp_min);
+          }
+          dst_block_ptr += params.dst_stride / sizeof(float);
+        }
+        dst_ptr = static_cast<void*>(static_cast<float*>(dst_ptr) +
+                                     kAvx8bitBlockSize);
       } else {
         RUY_DCHECK(false);
       }
@@ -17,7 +17,9 @@ limitations under the License.
 #define RUY_RUY_KERNEL_COMMON_H_
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <type_traits>
 
 #include "ruy/apply_multiplier.h"
@@ -30,6 +32,7 @@ limitations under the License.
 #include "ruy/path.h"
 #include "ruy/platform.h"
 #include "ruy/profiler/instrumentation.h"
+#include "ruy/quantize.h"
 #include "ruy/side_pair.h"
 #include "ruy/size_util.h"
 #include "ruy/tune.h"
@@ -40,6 +43,91 @@ template <Path ThePath, typename LhsScalar, typename RhsScalar,
           typename DstScalar, typename MulParamsType>
 struct Kernel {};
 
+template <typename KernelType, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void RunKernelBlocks(const KernelType& kernel, const PMat<LhsScalar>& lhs,
+                     const PMat<RhsScalar>& rhs,
+                     const MulParamsType& mul_params, int start_row,
+                     int start_col, int end_row, int end_col,
+                     Mat<DstScalar>* dst) {
+#if RUY_OPT(FAT_KERNEL)
+  kernel.Run(lhs, rhs, mul_params, start_row, start_col, end_row, end_col, dst);
+#else
+  using LhsLayout = typename KernelType::LhsLayout;
+  using RhsLayout = typename KernelType::RhsLayout;
+  for (int col = start_col; col < end_col; col += RhsLayout::kCols) {
+    int block_end_col = std::min(col + RhsLayout::kCols, end_col);
+    for (int row = start_row; row < end_row; row += LhsLayout::kCols) {
+      int block_end_row = std::min(row + LhsLayout::kCols, end_row);
+      kernel.Run(lhs, rhs, mul_params, row, col, block_end_row, block_end_col,
+                 dst);
+    }
+  }
+#endif
+}
+
+// Whether the kernels of ThePath store row-major destinations themselves:
+// Path::kStandardCpp through ElementPtr, the AVX2 and AVX-512 kernels by
+// transposing each block in registers (see RUY_ASM_FLAG_DST_ROW_MAJOR).
+constexpr bool KernelStoresRowMajorDst(Path path) {
+  return path == Path::kStandardCpp || path == Path::kAvx2 ||
+         path == Path::kAvx512;
+}
+
+// The other optimized kernels (NEON, and the SSE 4.2 / AVX-VNNI placeholders)
+// only know how to store to a column-major destination. For a row-major
+// destination, we let them store into a small column-major buffer on the
+// stack, one tile at a time, and transpose each tile into the actual
+// destination. The extra copy is cheap compared to the arithmetic that
+// produced the tile, and much cheaper than falling back to Path::kStandardCpp.
+template <typename KernelType, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void RunKernelBlocksRowMajorDst(const KernelType& kernel,
+                                const PMat<LhsScalar>& lhs,
+                                const PMat<RhsScalar>& rhs,
+                                const MulParamsType& mul_params, int start_row,
+                                int start_col, int end_row, int end_col,
+                                Mat<DstScalar>* dst) {
+  using LhsLayout = typename KernelType::LhsLayout;
+  using RhsLayout = typename KernelType::RhsLayout;
+  static constexpr int kTileRows = 64;
+  static constexpr int kTileCols = 64;
+  static_assert(kTileRows % LhsLayout::kCols == 0, "");
+  static_assert(kTileCols % RhsLayout::kCols == 0, "");
+  RUY_DCHECK(IsRowMajor(dst->layout));
+  DstScalar tile_buf[kTileRows * kTileCols];
+  for (int tile_col = start_col; tile_col < end_col; tile_col += kTileCols) {
+    const int tile_end_col = std::min(tile_col + kTileCols, end_col);
+    for (int tile_row = start_row; tile_row < end_row; tile_row += kTileRows) {
+      const int tile_end_row = std::min(tile_row + kTileRows, end_row);
+      // The kernels address the destination with absolute (row, col)
+      // coordinates, so the tile has the same dimensions as the destination
+      // and its origin at the current tile.
+      Mat<DstScalar> tile_dst;
+      tile_dst.layout.rows = dst->layout.rows;
+      tile_dst.layout.cols = dst->layout.cols;
+      tile_dst.layout.stride = kTileRows;
+      tile_dst.layout.order = Order::kColMajor;
+      tile_dst.zero_point = dst->zero_point;
+      tile_dst.layout.origin_row = tile_row;
+      tile_dst.layout.origin_col = tile_col;
+      tile_dst.data.set(tile_buf);
+      RunKernelBlocks(kernel, lhs, rhs, mul_params, tile_row, tile_col,
+                      tile_end_row, tile_end_col, &tile_dst);
+      const int clamped_end_row = std::min(tile_end_row, dst->layout.rows);
+      const int clamped_end_col = std::min(tile_end_col, dst->layout.cols);
+      for (int row = tile_row; row < clamped_end_row; row++) {
+        DstScalar* dst_ptr = ElementPtr(dst, row, tile_col);
+        const DstScalar* src_ptr = tile_buf + (row - tile_row);
+        for (int col = tile_col; col < clamped_end_col; col++) {
+          *dst_ptr++ = *src_ptr;
+          src_ptr += kTileRows;
+        }
+      }
+    }
+  }
+}
+
 template <Path ThePath, typename LhsScalar, typename RhsScalar,
           typename DstScalar, typename MulParamsType>
 void RunKernelTyped(Tuning tuning, const PMat<LhsScalar>& lhs,
@@ -65,18 +153,13 @@ void RunKernelTyped(Tuning tuning, const PMat<LhsScalar>& lhs,
   RUY_DCHECK_LE(start_col, end_col);
   RUY_DCHECK_LT(end_col, dst->layout.cols + RhsLayout::kCols);
   RUY_DCHECK_EQ((end_col - start_col) % RhsLayout::kCols, 0);
-#if RUY_OPT(FAT_KERNEL)
-  kernel.Run(lhs, rhs, mul_params, start_row, start_col, end_row, end_col, dst);
-#else
-  for (int col = start_col; col < end_col; col += RhsLayout::kCols) {
-    int block_end_col = std::min(col + RhsLayout::kCols, end_col);
-    for (int row = start_row; row < end_row; row += LhsLayout::kCols) {
-      int block_end_row = std::min(row + LhsLayout::kCols, end_row);
-      kernel.Run(lhs, rhs, mul_params, row, col, block_end_row, block_end_col,
-                 dst);
-    }
+  if (!KernelStoresRowMajorDst(ThePath) && !IsColMajor(dst->layout)) {
+    RunKernelBlocksRowMajorDst(kernel, lhs, rhs, mul_params, start_row,
+                               start_col, end_row, end_col, dst);
+    return;
   }
-#endif
+  RunKernelBlocks(kernel, lhs, rhs, mul_params, start_row, start_col, end_row,
+                  end_col, dst);
 }
 
 // Main entry point for kernels.
@@ -93,6 +176,431 @@ void RunKernel(Tuning tuning, const SidePair<PEMat>& src, void* mul_params,
       start[Side::kRhs], end[Side::kLhs], end[Side::kRhs], &mdst);
 }
 
+// Stores a tile of accumulators, already including the zero-point
+// corrections and the bias, into the destination of a dequantizing
+// multiplication, with the same arithmetic as DequantizeAccum, the per-row
+// parameters being gathered up front so that the loop over rows is
+// branch-free. The tile is a column-major buffer with a stride of kTileRows,
+// holding the destination entries in [tile_row, end_row) x
+// [tile_col, end_col). Its entries may also be float, see
+// RunGroupScaledKernel.
+template <int kTileRows, typename TileScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void DequantizeTile(const MulParamsType& mul_params,
+                    const PMat<RhsScalar>& rhs, const TileScalar* tile_buf,
+                    int tile_row, int tile_col, int end_row, int end_col,
+                    Mat<DstScalar>* dst) {
+  const int tile_rows = end_row - tile_row;
+  float row_multipliers[kTileRows];
+  float row_biases[kTileRows];
+  for (int r = 0; r < tile_rows; r++) {
+    row_multipliers[r] =
+        mul_params.float_multiplier_perchannel()
+            ? mul_params.float_multiplier_perchannel()[tile_row + r]
+            : mul_params.float_multiplier();
+    row_biases[r] =
+        mul_params.float_bias() ? mul_params.float_bias()[tile_row + r] : 0.f;
+  }
+  const float clamp_min = mul_params.clamp_min();
+  const float clamp_max = mul_params.clamp_max();
+  const bool dst_col_major = IsColMajor(dst->layout);
+  for (int col = tile_col; col < end_col; col++) {
+    const float rhs_scale = rhs.scales ? rhs.scales[col] : 1.f;
+    const TileScalar* src_ptr = tile_buf + (col - tile_col) * kTileRows;
+    DstScalar* dst_ptr = ElementPtr(dst, tile_row, col);
+    // A column-major destination is stored directly, with contiguous stores
+    // that keep this loop vectorized, which matters on memory-bound shapes.
+    DstScalar vals[kTileRows];
+    DstScalar* out = dst_col_major ? dst_ptr : vals;
+    for (int r = 0; r < tile_rows; r++) {
+      float val =
+          static_cast<float>(src_ptr[r]) * row_multipliers[r] * rhs_scale +
+          row_biases[r];
+      val = std::min(val, clamp_max);
+      out[r] = static_cast<DstScalar>(std::max(val, clamp_min));
+    }
+    if (!dst_col_major) {
+      for (int r = 0; r < tile_rows; r++) {
+        dst_ptr[r * dst->layout.stride] = vals[r];
+      }
+    }
+  }
+}
+
+// Entry point for kernels of a dequantizing multiplication (see
+// MulParams::float_multiplier) on paths whose kernels only store integer
+// destinations. The kernel for raw accumulators, which still applies the
+// zero-point corrections and the bias, stores into a small buffer on the
+// stack, one tile at a time, as in RunKernelBlocksRowMajorDst, and each tile
+// goes through DequantizeTile into the destination, of either storage order.
+template <Path ThePath, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void RunDequantizingKernel(Tuning tuning, const SidePair<PEMat>& src,
+                           void* mul_params, const SidePair<int>& start,
+                           const SidePair<int>& end, EMat* dst) {
+  using AccumScalar = typename MulParamsType::AccumScalar;
+  using RawMulParams = MulParams<AccumScalar, AccumScalar>;
+  using RawKernel =
+      Kernel<ThePath, LhsScalar, RhsScalar, AccumScalar, RawMulParams>;
+  using LhsLayout = typename RawKernel::LhsLayout;
+  using RhsLayout = typename RawKernel::RhsLayout;
+  static constexpr int kTileRows = 64;
+  static constexpr int kTileCols = 64;
+  static_assert(kTileRows % LhsLayout::kCols == 0, "");
+  static_assert(kTileCols % RhsLayout::kCols == 0, "");
+  const PMat<LhsScalar> lhs = UneraseType<LhsScalar>(src[Side::kLhs]);
+  const PMat<RhsScalar> rhs = UneraseType<RhsScalar>(src[Side::kRhs]);
+  const MulParamsType& typed_mul_params =
+      *static_cast<const MulParamsType*>(mul_params);
+  RawMulParams raw_mul_params;
+  raw_mul_params.set_bias(typed_mul_params.bias());
+  Mat<DstScalar> mdst = UneraseType<DstScalar>(*dst);
+  RawKernel kernel(tuning);
+  AccumScalar tile_buf[kTileRows * kTileCols];
+  for (int tile_col = start[Side::kRhs]; tile_col < end[Side::kRhs];
+       tile_col += kTileCols) {
+    const int tile_end_col = std::min(tile_col + kTileCols, end[Side::kRhs]);
+    for (int tile_row = start[Side::kLhs]; tile_row < end[Side::kLhs];
+         tile_row += kTileRows) {
+      const int tile_end_row = std::min(tile_row + kTileRows, end[Side::kLhs]);
+      Mat<AccumScalar> tile_dst;
+      tile_dst.layout.rows = mdst.layout.rows;
+      tile_dst.layout.cols = mdst.layout.cols;
+      tile_dst.layout.stride = kTileRows;
+      tile_dst.layout.order = Order::kColMajor;
+      tile_dst.layout.origin_row = tile_row;
+      tile_dst.layout.origin_col = tile_col;
+      tile_dst.data.set(tile_buf);
+      RunKernelBlocks(kernel, lhs, rhs, raw_mul_params, tile_row, tile_col,
+                      tile_end_row, tile_end_col, &tile_dst);
+      DequantizeTile<kTileRows>(
+          typed_mul_params, rhs, tile_buf, tile_row, tile_col,
+          std::min(tile_end_row, mdst.layout.rows),
+          std::min(tile_end_col, mdst.layout.cols), &mdst);
+    }
+  }
+}
+
+// Computes the part of the zero-point corrections of the raw accumulators
+// over the group of depth levels of the given index, made of group_depth
+// packed depth levels, that does not depend on the column, for the
+// destination rows [start_row, end_row), see RunGroupScaledKernel:
+//   rhs_zero_point * (sum of the LHS entries - lhs_zero_point * group_depth),
+// taking the sums from the group sums of the packed LHS, see
+// PEMat::group_size. The other part is lhs_zero_point times the sum of the
+// RHS entries of the group.
+template <typename LhsScalar>
+void GetGroupRowCorrections(const PMat<LhsScalar>& lhs, int group,
+                            int group_depth, int rhs_zero_point, int start_row,
+                            int end_row, std::int32_t* corrections) {
+  if (!rhs_zero_point) {
+    std::fill(corrections, corrections + end_row - start_row, 0);
+    return;
+  }
+  RUY_DCHECK(lhs.sums);
+  const int num_groups = NumWeightGroups(lhs.group_size, lhs.layout.rows);
+  const std::int32_t* group_sums = lhs.sums + group;
+  const std::int32_t zero_point_sum = lhs.zero_point * group_depth;
+  for (int row = start_row; row < end_row; row++) {
+    corrections[row - start_row] =
+        rhs_zero_point *
+        (group_sums[(row - lhs.origin_col) * num_groups] - zero_point_sum);
+  }
+}
+
+// Entry point for kernels of a dequantizing multiplication with group-wise
+// LHS scales, see MulParams::lhs_scales. The accumulators must be scaled
+// within the depth loop, before the sum over the groups of depth levels, so
+// the kernel for raw accumulators runs on the depth slice of each group in
+// turn, as depth blocking does (see trmul.cc), storing into a small buffer on
+// the stack, one tile at a time. The zero-point corrections of the group,
+// from the group sums computed by packing (see PEMat::group_size), are
+// applied there, the result is scaled and added to a float tile, and the
+// float tile finally goes through DequantizeTile into the destination.
+template <Path ThePath, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void RunGroupScaledKernel(Tuning tuning, const SidePair<PEMat>& src,
+                          void* mul_params, const SidePair<int>& start,
+                          const SidePair<int>& end, EMat* dst) {
+  profiler::ScopeLabel label("Group-scaled kernel");
+  using AccumScalar = typename MulParamsType::AccumScalar;
+  using RawMulParams = MulParams<AccumScalar, AccumScalar>;
+  using RawKernel =
+      Kernel<ThePath, LhsScalar, RhsScalar, AccumScalar, RawMulParams>;
+  using LhsLayout = typename RawKernel::LhsLayout;
+  using RhsLayout = typename RawKernel::RhsLayout;
+  static constexpr int kTileRows = 64;
+  static constexpr int kTileCols = 64;
+  static_assert(kTileRows % LhsLayout::kCols == 0, "");
+  static_assert(kTileCols % RhsLayout::kCols == 0, "");
+  const MulParamsType& typed_mul_params =
+      *static_cast<const MulParamsType*>(mul_params);
+  const int group_size = typed_mul_params.lhs_group_size();
+  RUY_DCHECK(typed_mul_params.lhs_scales());
+  RUY_DCHECK(!typed_mul_params.bias());
+  RUY_DCHECK_EQ(group_size % LhsLayout::kRows, 0);
+  const int depth = src[Side::kLhs].layout.rows;
+  const int num_groups = NumWeightGroups(group_size, depth);
+  const int lhs_zero_point = src[Side::kLhs].zero_point;
+  const int rhs_zero_point = src[Side::kRhs].zero_point;
+  const PMat<LhsScalar> lhs = UneraseType<LhsScalar>(src[Side::kLhs]);
+  const PMat<RhsScalar> rhs = UneraseType<RhsScalar>(src[Side::kRhs]);
+  RUY_DCHECK_EQ(lhs.group_size, group_size);
+  RUY_DCHECK_EQ(rhs.group_size, group_size);
+  RUY_DCHECK(!lhs_zero_point || rhs.sums);
+  Mat<DstScalar> mdst = UneraseType<DstScalar>(*dst);
+  const int channels = mdst.layout.rows;
+  const RawMulParams raw_mul_params;
+  RawKernel kernel(tuning);
+  AccumScalar tile_buf[kTileRows * kTileCols];
+  float scaled_buf[kTileRows * kTileCols];
+  for (int tile_col = start[Side::kRhs]; tile_col < end[Side::kRhs];
+       tile_col += kTileCols) {
+    const int tile_end_col = std::min(tile_col + kTileCols, end[Side::kRhs]);
+    const int clamped_end_col = std::min(tile_end_col, mdst.layout.cols);
+    for (int tile_row = start[Side::kLhs]; tile_row < end[Side::kLhs];
+         tile_row += kTileRows) {
+      const int tile_end_row = std::min(tile_row + kTileRows, end[Side::kLhs]);
+      const int clamped_end_row = std::min(tile_end_row, mdst.layout.rows);
+      const int tile_rows = clamped_end_row - tile_row;
+      Mat<AccumScalar> tile_dst;
+      tile_dst.layout.rows = mdst.layout.rows;
+      tile_dst.layout.cols = mdst.layout.cols;
+      tile_dst.layout.stride = kTileRows;
+      tile_dst.layout.order = Order::kColMajor;
+      tile_dst.layout.origin_row = tile_row;
+      tile_dst.layout.origin_col = tile_col;
+      tile_dst.data.set(tile_buf);
+      std::fill(scaled_buf, scaled_buf + kTileRows * kTileCols, 0.f);
+      for (int g = 0; g < num_groups; g++) {
+        const int start_depth = g * group_size;
+        const int end_depth =
+            g + 1 < num_groups ? start_depth + group_size : depth;
+        SidePair<PEMat> slice;
+        for (Side side : {Side::kLhs, Side::kRhs}) {
+          slice[side] = PackedDepthSlice(src[side], start_depth, end_depth);
+          // The zero points are taken into account below.
+          slice[side].zero_point = 0;
+        }
+        RunKernelBlocks(kernel, UneraseType<LhsScalar>(slice[Side::kLhs]),
+                        UneraseType<RhsScalar>(slice[Side::kRhs]),
+                        raw_mul_params, tile_row, tile_col, tile_end_row,
+                        tile_end_col, &tile_dst);
+        const float* row_scales =
+            typed_mul_params.lhs_scales() + g * channels + tile_row;
+        std::int32_t row_corrections[kTileRows];
+        GetGroupRowCorrections(lhs, g, end_depth - start_depth, rhs_zero_point,
+                               tile_row, clamped_end_row, row_corrections);
+        for (int col = tile_col; col < clamped_end_col; col++) {
+          const std::int32_t col_correction =
+              lhs_zero_point ? lhs_zero_point * rhs.sums[col * num_groups + g]
+                             : 0;
+          const AccumScalar* src_ptr = tile_buf + (col - tile_col) * kTileRows;
+          float* scaled_ptr = scaled_buf + (col - tile_col) * kTileRows;
+          for (int r = 0; r < tile_rows; r++) {
+            scaled_ptr[r] += row_scales[r] * static_cast<float>(
+                                                 src_ptr[r] - col_correction -
+                                                 row_corrections[r]);
+          }
+        }
+      }
+      DequantizeTile<kTileRows>(typed_mul_params, rhs, scaled_buf, tile_row,
+                                tile_col, clamped_end_row, clamped_end_col,
+                                &mdst);
+    }
+  }
+}
+
+// Like RunKernelBlocks, but adds the results to the existing contents of the
+// destination instead of overwriting them. As in RunKernelBlocksRowMajorDst,
+// the kernel stores into a small buffer on the stack, one tile at a time,
+// which is then added to the destination.
+template <typename KernelType, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void RunKernelBlocksAccumulate(const KernelType& kernel,
+                               const PMat<LhsScalar>& lhs,
+                               const PMat<RhsScalar>& rhs,
+                               const MulParamsType& mul_params, int start_row,
+                               int start_col, int end_row, int end_col,
+                               Mat<DstScalar>* dst) {
+  using LhsLayout = typename KernelType::LhsLayout;
+  using RhsLayout = typename KernelType::RhsLayout;
+  static constexpr int kTileRows = 64;
+  static constexpr int kTileCols = 64;
+  static_assert(kTileRows % LhsLayout::kCols == 0, "");
+  static_assert(kTileCols % RhsLayout::kCols == 0, "");
+  RUY_DCHECK(IsColMajor(dst->layout));
+  DstScalar tile_buf[kTileRows * kTileCols];
+  for (int tile_col = start_col; tile_col < end_col; tile_col += kTileCols) {
+    const int tile_end_col = std::min(tile_col + kTileCols, end_col);
+    for (int tile_row = start_row; tile_row < end_row; tile_row += kTileRows) {
+      const int tile_end_row = std::min(tile_row + kTileRows, end_row);
+      Mat<DstScalar> tile_dst;
+      tile_dst.layout.rows = dst->layout.rows;
+      tile_dst.layout.cols = dst->layout.cols;
+      tile_dst.layout.stride = kTileRows;
+      tile_dst.layout.order = Order::kColMajor;
+      tile_dst.zero_point = dst->zero_point;
+      tile_dst.layout.origin_row = tile_row;
+      tile_dst.layout.origin_col = tile_col;
+      tile_dst.data.set(tile_buf);
+      RunKernelBlocks(kernel, lhs, rhs, mul_params, tile_row, tile_col,
+                      tile_end_row, tile_end_col, &tile_dst);
+      const int clamped_end_row = std::min(tile_end_row, dst->layout.rows);
+      const int clamped_end_col = std::min(tile_end_col, dst->layout.cols);
+      for (int col = tile_col; col < clamped_end_col; col++) {
+        DstScalar* dst_ptr = ElementPtr(dst, tile_row, col);
+        const DstScalar* src_ptr = tile_buf + (col - tile_col) * kTileRows;
+        for (int row = tile_row; row < clamped_end_row; row++) {
+          *dst_ptr++ += *src_ptr++;
+        }
+      }
+    }
+  }
+}
+
+// Entry point for kernels computing raw accumulators: the sums of products of
+// LHS and RHS entries, without any of the work done by ApplyEpilogue, stored
+// into a column-major destination of AccumScalar, or added to its existing
+// contents if accumulate is true. The zero points of the packed matrices must
+// be 0. Used by split-depth TrMul and by depth blocking, see trmul.cc.
+template <Path ThePath, typename LhsScalar, typename RhsScalar,
+          typename AccumScalar>
+void RunAccumKernel(Tuning tuning, const SidePair<PEMat>& src,
+                    const SidePair<int>& start, const SidePair<int>& end,
+                    bool accumulate, EMat* dst) {
+  RUY_DCHECK_EQ(src[Side::kLhs].zero_point, 0);
+  RUY_DCHECK_EQ(src[Side::kRhs].zero_point, 0);
+  using MulParamsType = MulParams<AccumScalar, AccumScalar>;
+  const MulParamsType mul_params;
+  const PMat<LhsScalar> lhs = UneraseType<LhsScalar>(src[Side::kLhs]);
+  const PMat<RhsScalar> rhs = UneraseType<RhsScalar>(src[Side::kRhs]);
+  Mat<AccumScalar> mdst = UneraseType<AccumScalar>(*dst);
+  if (!accumulate) {
+    RunKernelTyped<ThePath, LhsScalar, RhsScalar, AccumScalar>(
+        tuning, lhs, rhs, mul_params, start[Side::kLhs], start[Side::kRhs],
+        end[Side::kLhs], end[Side::kRhs], &mdst);
+    return;
+  }
+  using Kernel =
+      Kernel<ThePath, LhsScalar, RhsScalar, AccumScalar, MulParamsType>;
+  Kernel kernel(tuning);
+  RunKernelBlocksAccumulate(kernel, lhs, rhs, mul_params, start[Side::kLhs],
+                            start[Side::kRhs], end[Side::kLhs],
+                            end[Side::kRhs], &mdst);
+}
+
+// Whether a multiplication with these MulParams converts integer
+// accumulators to a floating-point destination, see
+// MulParams::float_multiplier.
+template <typename MulParamsType>
+constexpr bool IsDequantizing() {
+  return !std::is_floating_point<typename MulParamsType::AccumScalar>::value &&
+         std::is_floating_point<typename MulParamsType::DstScalar>::value;
+}
+
+// Whether the kernels of ThePath for 8-bit operands store floating-point
+// destinations, applying the dequantization to the accumulators themselves:
+// Path::kStandardCpp through DequantizeAccum, the AVX2, AVX-512 and AVX-VNNI
+// kernels before their stores (see RUY_ASM_TYPE_ID_FLOAT). On other paths,
+// dequantizing multiplications go through RunDequantizingKernel. That
+// includes the NEON paths: the assembly of their 8-bit kernels hardcodes the
+// offsets of the KernelParams8bit fields, which the float fields are not
+// part of.
+constexpr bool KernelStoresDequantizedDst(Path path) {
+  return path == Path::kStandardCpp || path == Path::kAvx2 ||
+         path == Path::kAvx512 || path == Path::kAvxVnni;
+}
+
+// Computes the destination value of a dequantizing multiplication from an
+// accumulator that already includes the zero-point corrections and the bias:
+// applies the float multiplier, the scale of the RHS column (1 unless the RHS
+// was quantized by packing), the float bias and the clamping.
+template <typename MulParamsType>
+typename MulParamsType::DstScalar DequantizeAccum(
+    const MulParamsType& mul_params, int row, float rhs_scale,
+    typename MulParamsType::AccumScalar accum) {
+  using DstScalar = typename MulParamsType::DstScalar;
+  const float multiplier = mul_params.float_multiplier_perchannel()
+                               ? mul_params.float_multiplier_perchannel()[row]
+                               : mul_params.float_multiplier();
+  float val = static_cast<float>(accum) * multiplier * rhs_scale;
+  if (mul_params.float_bias()) {
+    val += mul_params.float_bias()[row];
+  }
+  val = std::min<float>(val, mul_params.clamp_max());
+  val = std::max<float>(val, mul_params.clamp_min());
+  return static_cast<DstScalar>(val);
+}
+
+// Computes a destination entry from the sum of the products of the LHS and
+// RHS entries over the whole depth: applies the zero-point corrections based
+// on the sums of the packed matrices, the bias, the multiplier, the
+// destination zero point and the clamping.
+template <typename LhsScalar, typename RhsScalar, typename DstScalar,
+          typename MulParamsType>
+DstScalar ApplyEpilogue(const PMat<LhsScalar>& lhs, const PMat<RhsScalar>& rhs,
+                        const MulParamsType& mul_params, int row, int col,
+                        DstScalar dst_zero_point,
+                        typename MulParamsType::AccumScalar accum) {
+  using AccumScalar = typename MulParamsType::AccumScalar;
+  const int depth = lhs.layout.rows;
+  if (mul_params.bias()) {
+    accum += mul_params.bias()[row];
+  }
+  if (lhs.zero_point) {
+    accum -= lhs.zero_point * rhs.sums[col];
+  }
+  if (rhs.zero_point) {
+    accum -= rhs.zero_point * lhs.sums[row - lhs.origin_col];
+  }
+  if (lhs.zero_point && rhs.zero_point) {
+    accum += lhs.zero_point * rhs.zero_point * depth;
+  }
+  if (IsDequantizing<MulParamsType>()) {
+    return DequantizeAccum(mul_params, row, rhs.scales ? rhs.scales[col] : 1.f,
+                           accum);
+  }
+  ApplyMultiplier(mul_params, row, &accum);
+  accum += dst_zero_point;
+  accum = std::min<AccumScalar>(accum, mul_params.clamp_max());
+  accum = std::max<AccumScalar>(accum, mul_params.clamp_min());
+  return static_cast<DstScalar>(accum);
+}
+
+// Final pass of split-depth TrMul and of depth blocking: sums the raw
+// accumulators computed by RunAccumKernel over each of the num_partials depth
+// slices, and applies ApplyEpilogue, for the destination entries in
+// [start, end). Each partial is a buffer with the given layout, addressed with
+// destination coordinates. The packed matrices span the whole depth, and their
+// sums must be complete.
+template <typename LhsScalar, typename RhsScalar, typename DstScalar,
+          typename MulParamsType>
+void RunSplitDepthEpilogue(const SidePair<PEMat>& packed, void* mul_params,
+                           const void* const* partials, int num_partials,
+                           const MatLayout& partial_layout,
+                           const SidePair<int>& start,
+                           const SidePair<int>& end, EMat* dst) {
+  profiler::ScopeLabel label("Split-depth epilogue");
+  using AccumScalar = typename MulParamsType::AccumScalar;
+  const PMat<LhsScalar> lhs = UneraseType<LhsScalar>(packed[Side::kLhs]);
+  const PMat<RhsScalar> rhs = UneraseType<RhsScalar>(packed[Side::kRhs]);
+  const MulParamsType& typed_mul_params =
+      *static_cast<const MulParamsType*>(mul_params);
+  Mat<DstScalar> mdst = UneraseType<DstScalar>(*dst);
+  for (int col = start[Side::kRhs]; col < end[Side::kRhs]; col++) {
+    for (int row = start[Side::kLhs]; row < end[Side::kLhs]; row++) {
+      const std::ptrdiff_t offset = Offset(partial_layout, row, col);
+      AccumScalar accum = 0;
+      for (int i = 0; i < num_partials; i++) {
+        accum += static_cast<const AccumScalar*>(partials[i])[offset];
+      }
+      *ElementPtr(&mdst, row, col) = ApplyEpilogue(
+          lhs, rhs, typed_mul_params, row, col, mdst.zero_point, accum);
+    }
+  }
+}
+
 template <typename LhsScalar, typename RhsScalar, typename DstScalar,
           typename MulParamsType>
 struct Kernel<Path::kStandardCpp, LhsScalar, RhsScalar, DstScalar,
@@ -131,23 +639,8 @@ struct Kernel<Path::kStandardCpp, LhsScalar, RhsScalar, DstScalar,
           AccumScalar rhs_val = Element(rhs, k, j);
           accum += lhs_val * rhs_val;
         }
-        if (mul_params.bias()) {
-          accum += mul_params.bias()[i];
-        }
-        if (lhs.zero_point) {
-          accum -= lhs.zero_point * rhs.sums[j];
-        }
-        if (rhs.zero_point) {
-          accum -= rhs.zero_point * lhs.sums[i];
-        }
-        if (lhs.zero_point && rhs.zero_point) {
-          accum += lhs.zero_point * rhs.zero_point * depth;
-        }
-        ApplyMultiplier(mul_params, i, &accum);
-        accum += dst->zero_point;
-        accum = std::min<AccumScalar>(accum, mul_params.clamp_max());
-        accum = std::max<AccumScalar>(accum, mul_params.clamp_min());
-        *ElementPtr(dst, i, j) = static_cast<DstScalar>(accum);
+        *ElementPtr(dst, i, j) =
+            ApplyEpilogue(lhs, rhs, mul_params, i, j, dst->zero_point, accum);
       }
     }
   }
@@ -185,11 +678,17 @@ RUY_INHERIT_KERNEL(Path::kAvx512, Path::kAvxVnni)
 #define RUY_ASM_FLAG_HAS_RHS_SUMS 0x4
 #define RUY_ASM_FLAG_HAS_PERCHANNEL 0x8
 #define RUY_ASM_FLAG_NEEDS_LEFT_SHIFT 0x10
+#define RUY_ASM_FLAG_HAS_RHS_SCALES 0x20
+#define RUY_ASM_FLAG_HAS_FLOAT_BIAS 0x40
+// The destination is row-major: dst_stride is the offset between rows. Only
+// set for the paths where KernelStoresRowMajorDst is true.
+#define RUY_ASM_FLAG_DST_ROW_MAJOR 0x80
 
 #define RUY_ASM_TYPE_ID_UINT8 1
 #define RUY_ASM_TYPE_ID_INT8 2
 #define RUY_ASM_TYPE_ID_INT16 3
 #define RUY_ASM_TYPE_ID_INT32 4
+#define RUY_ASM_TYPE_ID_FLOAT 5
 
 template <typename DstScalar>
 struct DstTypeId {};
@@ -214,6 +713,11 @@ struct DstTypeId<std::int32_t> {
   static constexpr int kValue = RUY_ASM_TYPE_ID_INT32;
 };
 
+template <>
+struct DstTypeId<float> {
+  static constexpr int kValue = RUY_ASM_TYPE_ID_FLOAT;
+};
+
 template <int LhsCols, int RhsCols>
 struct KernelParams8bit {
   static constexpr int kMaxDstTypeSize = 4;
@@ -248,8 +752,58 @@ struct KernelParams8bit {
   std::uint8_t dst_tmp_buf[LhsCols * RhsCols * kMaxDstTypeSize];
   std::int32_t multiplier_fixedpoint_buf[LhsCols];
   std::int32_t multiplier_exponent_buf[LhsCols];
+  // Only used with a floating-point destination, see
+  // MulParams::float_multiplier. These come last so as not to move the fields
+  // above, whose offsets the arm assembly kernels hardcode.
+  const float* float_multiplier;
+  const float* float_bias;
+  const float* rhs_scales;
+  float float_clamp_min;
+  float float_clamp_max;
+  float float_multiplier_buf[LhsCols];
 };
 
+// Sets the clamp bounds of an integer destination.
+template <typename DstScalar, int LhsCols, int RhsCols>
+void MakeKernelParams8bitDstParams(
+    const PMat<std::int8_t>&,
+    const MulParams<std::int32_t, DstScalar>& mul_params,
+    KernelParams8bit<LhsCols, RhsCols>* params) {
+  params->clamp_min = mul_params.clamp_min();
+  params->clamp_max = mul_params.clamp_max();
+}
+
+// Sets the parameters of the dequantization to a floating-point destination,
+// which kernels apply to the accumulators in registers instead of the
+// fixed-point multiplier, see MulParams::float_multiplier.
+template <int LhsCols, int RhsCols>
+void MakeKernelParams8bitDstParams(
+    const PMat<std::int8_t>& rhs,
+    const MulParams<std::int32_t, float>& mul_params,
+    KernelParams8bit<LhsCols, RhsCols>* params) {
+  params->clamp_min = std::numeric_limits<std::int32_t>::lowest();
+  params->clamp_max = std::numeric_limits<std::int32_t>::max();
+  params->float_clamp_min = mul_params.clamp_min();
+  params->float_clamp_max = mul_params.clamp_max();
+  if (mul_params.float_multiplier_perchannel()) {
+    params->flags |= RUY_ASM_FLAG_HAS_PERCHANNEL;
+    params->float_multiplier = mul_params.float_multiplier_perchannel();
+  } else {
+    params->float_multiplier = params->float_multiplier_buf;
+    for (int i = 0; i < LhsCols; i++) {
+      params->float_multiplier_buf[i] = mul_params.float_multiplier();
+    }
+  }
+  params->float_bias = mul_params.float_bias();
+  if (params->float_bias) {
+    params->flags |= RUY_ASM_FLAG_HAS_FLOAT_BIAS;
+  }
+  params->rhs_scales = rhs.scales;
+  if (params->rhs_scales) {
+    params->flags |= RUY_ASM_FLAG_HAS_RHS_SCALES;
+  }
+}
+
 template <typename DstScalar, int LhsCols, int RhsCols>
 void MakeKernelParams8bit(const PMat<std::int8_t>& lhs,
                           const PMat<std::int8_t>& rhs,
@@ -312,8 +866,7 @@ void MakeKernelParams8bit(const PMat<std::int8_t>& lhs,
       params->multiplier_exponent_buf[i] = mul_params.multiplier_exponent();
     }
   }
-  params->clamp_min = mul_params.clamp_min();
-  params->clamp_max = mul_params.clamp_max();
+  MakeKernelParams8bitDstParams(rhs, mul_params, params);
   params->dst_rows = dst->layout.rows;
   params->dst_cols = dst->layout.cols;
 
@@ -321,8 +874,10 @@ void MakeKernelParams8bit(const PMat<std::int8_t>& lhs,
   RUY_DCHECK_LT(params->last_col, params->dst_cols);
 
   params->dst_type_id = DstTypeId<DstScalar>::kValue;
-  params->dst_base_ptr =
-      dst->data.get() + start_col * dst->layout.stride + start_row;
+  params->dst_base_ptr = ElementPtr(dst, start_row, start_col);
+  if (IsRowMajor(dst->layout)) {
+    params->flags |= RUY_ASM_FLAG_DST_ROW_MAJOR;
+  }
 }
 
 template <int LhsCols, int RhsCols>
@@ -363,10 +918,12 @@ inline void MakeKernelParamsFloat(const PMat<float>& lhs,
 
   params->lhs_base_ptr = lhs.data + start_row * lhs.layout.stride;
   params->rhs_base_ptr = rhs.data + start_col * rhs.layout.stride;
-  params->dst_base_ptr =
-      dst->data.get() + start_col * dst->layout.stride + start_row;
+  params->dst_base_ptr = ElementPtr(dst, start_row, start_col);
 
   std::uint8_t flags = 0;
+  if (IsRowMajor(dst->layout)) {
+    flags |= RUY_ASM_FLAG_DST_ROW_MAJOR;
+  }
   params->bias = params->zero_data;
   if (mul_params.bias()) {
     params->bias = mul_params.bias();
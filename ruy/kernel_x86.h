@@ -88,7 +88,8 @@ struct Kernel<Path::kAvx512, std::int8_t, std::int8_t, DstScalar,
     KernelParams8bit<LhsLayout::kCols, RhsLayout::kCols> params;
     MakeKernelParams8bit(lhs, rhs, mul_params, start_row, start_col, end_row,
                          end_col, dst, &params);
-    if (dst->layout.cols == 1) {
+    // The single-column kernels only store column-major destinations.
+    if (dst->layout.cols == 1 && IsColMajor(dst->layout)) {
       Kernel8bitAvx512SingleCol(params);
     } else {
       Kernel8bitAvx512(params);
@@ -111,7 +112,8 @@ struct Kernel<Path::kAvx512, float, float, float, MulParams<float, float>> {
     KernelParamsFloat<LhsLayout::kCols, RhsLayout::kCols> params;
     MakeKernelParamsFloat(lhs, rhs, mul_params, start_row, start_col, end_row,
                           end_col, dst, &params);
-    if (dst->layout.cols == 1) {
+    // The single-column kernels only store column-major destinations.
+    if (dst->layout.cols == 1 && IsColMajor(dst->layout)) {
       KernelFloatAvx512SingleCol(params);
     } else {
       KernelFloatAvx512(params);
@@ -135,7 +137,8 @@ struct Kernel<Path::kAvx2, std::int8_t, std::int8_t, DstScalar,
     KernelParams8bit<LhsLayout::kCols, RhsLayout::kCols> params;
     MakeKernelParams8bit(lhs, rhs, mul_params, start_row, start_col, end_row,
                          end_col, dst, &params);
-    if (dst->layout.cols == 1) {
+    // The single-column kernels only store column-major destinations.
+    if (dst->layout.cols == 1 && IsColMajor(dst->layout)) {
       Kernel8bitAvx2SingleCol(params);
     } else {
       Kernel8bitAvx2(params);
@@ -158,7 +161,8 @@ struct Kernel<Path::kAvx2, float, float, float, MulParams<float, float>> {
     KernelParamsFloat<LhsLayout::kCols, RhsLayout::kCols> params;
     MakeKernelParamsFloat(lhs, rhs, mul_params, start_row, start_col, end_row,
                           end_col, dst, &params);
-    if (dst->layout.cols == 1) {
+    // The single-column kernels only store column-major destinations.
+    if (dst->layout.cols == 1 && IsColMajor(dst->layout)) {
       KernelFloatAvx2SingleCol(params);
     } else {
       KernelFloatAvx2(params);
@@ -96,7 +96,9 @@ limitations under the License.
 
 #include "ruy/check_macros.h"
 #include "ruy/common.h"
+#include "ruy/int4.h"
 #include "ruy/matrix.h"
+#include "ruy/quantize.h"
 #include "ruy/size_util.h"
 
 namespace ruy {
@@ -109,6 +111,12 @@ struct MatLayout final {
   // in the non-contiguous direction.
   std::int32_t stride = 0;
   Order order = Order::kColMajor;
+  // Coordinates of the element at the start of the data buffer. Nonzero when
+  // the buffer only holds a block of the matrix, which is still addressed
+  // with the coordinates of the whole matrix, as the destination tiles in
+  // kernel_common.h.
+  std::int32_t origin_row = 0;
+  std::int32_t origin_col = 0;
 };
 
 inline MatLayout ToInternal(const Layout& src) {
@@ -127,6 +135,24 @@ struct Mat final {
   MatLayout layout;
   Scalar zero_point = 0;
   CachePolicy cache_policy = CachePolicy::kNeverCache;
+  // Only for a quantized LHS that packing dequantizes to float or expands
+  // from int4, see MulParams::lhs_scales and MulParams::lhs_zero_points. In
+  // TrMul terms, the rows of the matrix are the depth dimension: the scale of
+  // the entry at (row, col) is
+  //   scales[col + group_col_offset]
+  // if group_size is 0, and otherwise
+  //   scales[((row + group_row_offset) / group_size) *
+  //          (layout.cols + group_col_offset) + col + group_col_offset],
+  // and likewise for its zero point in zero_points. group_row_offset is the
+  // first row of the matrix, when that is a depth slice of a larger one, and
+  // group_col_offset its first column, when that is made of the columns of a
+  // larger one from there on. Null scales mean scales of 1, and null
+  // zero_points mean that zero_point applies to all entries.
+  const float* scales = nullptr;
+  const std::int8_t* zero_points = nullptr;
+  int group_size = 0;
+  int group_row_offset = 0;
+  int group_col_offset = 0;
 };
 
 template <typename Scalar>
@@ -211,6 +237,7 @@ struct Type final {
     ret.is_signed = std::is_signed<T>::value;
     ret.is_floating_point = std::is_floating_point<T>::value;
     ret.size = sizeof(T);
+    ret.is_int4 = std::is_same<T, int4>::value;
     return ret;
   }
 
@@ -219,11 +246,24 @@ struct Type final {
     RUY_DCHECK_EQ(is_signed, Create<T>().is_signed);
     RUY_DCHECK_EQ(is_floating_point, Create<T>().is_floating_point);
     RUY_DCHECK_EQ(size, Create<T>().size);
+    RUY_DCHECK_EQ(is_int4, Create<T>().is_int4);
+  }
+
+  // Returns the number of bytes of data preceding the entry at the given
+  // offset, in entries. Matrices of ruy::int4 store two entries per byte,
+  // so for them the offset must be even.
+  std::ptrdiff_t OffsetBytes(std::ptrdiff_t offset) const {
+    if (is_int4) {
+      RUY_DCHECK_EQ(offset % 2, 0);
+      return offset / 2;
+    }
+    return offset * size;
   }
 
   bool is_signed = false;
   bool is_floating_point = false;
   std::uint8_t size = 0;
+  bool is_int4 = false;
 };
 
 // Type-erased matrix.
@@ -233,6 +273,12 @@ struct EMat final {
   MatLayout layout;
   std::int32_t zero_point = 0;
   CachePolicy cache_policy = CachePolicy::kNeverCache;
+  // See Mat::scales.
+  const float* scales = nullptr;
+  const std::int8_t* zero_points = nullptr;
+  int group_size = 0;
+  int group_row_offset = 0;
+  int group_col_offset = 0;
 };
 
 // Type-erased packed matrix.
@@ -243,6 +289,25 @@ struct PEMat final {
   void* sums = nullptr;
   PMatLayout layout;
   std::int32_t zero_point = 0;
+  // Whether the packed matrix is the quantized form of a floating-point
+  // source matrix, quantized by packing with one scale per column. Those
+  // scales are then stored at `scales`. See ruy/quantize.h.
+  bool has_scales = false;
+  float* scales = nullptr;
+  // If not 0, the packed matrix is for a multiplication with group-wise LHS
+  // scales (see MulParams::lhs_scales), whose kernels need the sums of each
+  // group of group_size depth levels rather than those of the whole depth:
+  // the sum of the group g of the column col is then at
+  //   sums[col * NumWeightGroups(group_size, layout.rows) + g],
+  // see SumsPerCol.
+  int group_size = 0;
+  // Column of the first column held in data, sums and scales, when they only
+  // hold the columns of a larger packed matrix from there on, which are still
+  // addressed with the column indices of the whole matrix, as for
+  // MatLayout::origin_col. layout.cols is then the number of columns held.
+  // Only the GEMV code handles a nonzero origin_col, see TrMulGemv: packing
+  // and the kernels require 0.
+  std::int32_t origin_col = 0;
 };
 
 // Convenient typed helper for packed matrices.
@@ -264,8 +329,15 @@ struct PMat final {
 
   Scalar* data = nullptr;
   SumsType* sums = nullptr;
+  // The per-column scales of a packed matrix quantized by packing, see
+  // PEMat::has_scales. Null otherwise.
+  float* scales = nullptr;
   PMatLayout layout;
   std::int32_t zero_point = 0;
+  // See PEMat::group_size.
+  int group_size = 0;
+  // See PEMat::origin_col.
+  std::int32_t origin_col = 0;
 };
 
 template <typename T>
@@ -276,6 +348,11 @@ EMat EraseType(const Mat<T>& matrix) {
   ret.layout = matrix.layout;
   ret.zero_point = matrix.zero_point;
   ret.cache_policy = matrix.cache_policy;
+  ret.scales = matrix.scales;
+  ret.zero_points = matrix.zero_points;
+  ret.group_size = matrix.group_size;
+  ret.group_row_offset = matrix.group_row_offset;
+  ret.group_col_offset = matrix.group_col_offset;
   return ret;
 }
 
@@ -287,6 +364,11 @@ Mat<T> UneraseType(const EMat& matrix) {
   ret.layout = matrix.layout;
   ret.zero_point = matrix.zero_point;
   ret.cache_policy = matrix.cache_policy;
+  ret.scales = matrix.scales;
+  ret.zero_points = matrix.zero_points;
+  ret.group_size = matrix.group_size;
+  ret.group_row_offset = matrix.group_row_offset;
+  ret.group_col_offset = matrix.group_col_offset;
   return ret;
 }
 
@@ -298,8 +380,11 @@ PMat<T> UneraseType(const PEMat& matrix) {
   PMat<T> ret;
   ret.data = static_cast<T*>(matrix.data);
   ret.sums = static_cast<SumsType*>(matrix.sums);
+  ret.scales = matrix.scales;
   ret.layout = matrix.layout;
   ret.zero_point = matrix.zero_point;
+  ret.group_size = matrix.group_size;
+  ret.origin_col = matrix.origin_col;
   return ret;
 }
 
@@ -360,7 +445,8 @@ inline int Offset(const MatLayout& layout, int row, int col) {
   // RUY_DCHECK_LT(col, layout.cols);
   int row_stride = layout.order == Order::kColMajor ? 1 : layout.stride;
   int col_stride = layout.order == Order::kRowMajor ? 1 : layout.stride;
-  return row * row_stride + col * col_stride;
+  return (row - layout.origin_row) * row_stride +
+         (col - layout.origin_col) * col_stride;
 }
 
 // TODO(b/130417400) add a unit test
@@ -427,10 +513,36 @@ inline int DataBytes(const PEMat& packed) {
   return FlatSize(packed.layout) * packed.data_type.size;
 }
 
+// Returns the number of sums of each column of a packed matrix: one, or one
+// per group of depth levels, see PEMat::group_size.
+inline int SumsPerCol(const PEMat& packed) {
+  return NumWeightGroups(packed.group_size, packed.layout.rows);
+}
+
 inline int SumsBytes(const PEMat& packed) {
   // Packed matrices are only relevant for Ruy's TrMul implementations. For
-  // TrMul, the number of sums is always equal to the number of columns.
-  return packed.layout.cols * packed.sums_type.size;
+  // TrMul, the sums are those of each column.
+  return packed.layout.cols * SumsPerCol(packed) * packed.sums_type.size;
+}
+
+inline int ScalesBytes(const PEMat& packed) {
+  return packed.has_scales ? packed.layout.cols * sizeof(float) : 0;
+}
+
+// Returns a view of the depth levels [start_depth, end_depth) of a packed
+// matrix. Each group of kernel.rows packed rows is stored as kernel.cols
+// contiguous groups of kernel.rows entries within each block of kernel.cols
+// columns, so the slice of each block starts start_depth * kernel.cols
+// entries into it. The sums are still those of the whole packed matrix.
+inline PEMat PackedDepthSlice(const PEMat& packed, int start_depth,
+                              int end_depth) {
+  RUY_DCHECK_EQ(start_depth % packed.layout.kernel.rows, 0);
+  PEMat slice = packed;
+  slice.data = static_cast<char*>(packed.data) +
+               static_cast<std::ptrdiff_t>(start_depth) *
+                   packed.layout.kernel.cols * packed.data_type.size;
+  slice.layout.rows = end_depth - start_depth;
+  return slice;
 }
 
 // Transpose helpers.
@@ -442,6 +554,7 @@ inline void TransposeOrder(Order* order) {
 inline void TransposeLayout(MatLayout* layout) {
   TransposeOrder(&layout->order);
   std::swap(layout->rows, layout->cols);
+  std::swap(layout->origin_row, layout->origin_col);
 }
 
 template <typename Scalar>
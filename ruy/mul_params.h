@@ -16,10 +16,11 @@ limitations under the License.
 #ifndef RUY_RUY_SPEC_H_
 #define RUY_RUY_SPEC_H_
 
+#include <cstdint>
 #include <limits>
 #include <type_traits>
 
-#include "ruy/cpu_cache_size.h"
+#include "ruy/cpu_cache_size.h"  // IWYU pragma: keep
 #include "ruy/matrix.h"
 
 namespace ruy {
@@ -85,6 +86,22 @@ class MulParams /* not final, legitimate to subclass */ {
   void set_multiplier_exponent_perchannel(const int* ptr) {
     multiplier_exponent_perchannel_ = ptr;
   }
+  float float_multiplier() const { return float_multiplier_; }
+  void set_float_multiplier(const float value) { float_multiplier_ = value; }
+  const float* float_multiplier_perchannel() const {
+    return float_multiplier_perchannel_;
+  }
+  void set_float_multiplier_perchannel(const float* ptr) {
+    float_multiplier_perchannel_ = ptr;
+  }
+  const float* float_bias() const { return float_bias_; }
+  void set_float_bias(const float* ptr) { float_bias_ = ptr; }
+  const float* lhs_scales() const { return lhs_scales_; }
+  void set_lhs_scales(const float* ptr) { lhs_scales_ = ptr; }
+  const std::int8_t* lhs_zero_points() const { return lhs_zero_points_; }
+  void set_lhs_zero_points(const std::int8_t* ptr) { lhs_zero_points_ = ptr; }
+  int lhs_group_size() const { return lhs_group_size_; }
+  void set_lhs_group_size(const int value) { lhs_group_size_ = value; }
   DstScalar clamp_min() const { return clamp_min_; }
   void set_clamp_min(const DstScalar value) { clamp_min_ = value; }
   DstScalar clamp_max() const { return clamp_max_; }
@@ -113,6 +130,51 @@ class MulParams /* not final, legitimate to subclass */ {
   // Either none or both of multiplier_exponent_perchannel and
   // multiplier_fixedpoint_perchannel must be nullptr.
   const int* multiplier_exponent_perchannel_ = nullptr;
+  // Only for an integer AccumScalar with a floating-point DstScalar, which
+  // is a 'dequantizing' multiplication, e.g. with int8 weights, the RHS of
+  // which may be quantized or float (then it is quantized to int8 per column
+  // by packing, see ruy/quantize.h). The accumulators, including the
+  // zero-point corrections and the bias, are converted to floating-point and
+  // multiplied by float_multiplier, and by the scale of their RHS column if
+  // the RHS was quantized by packing, then float_bias is added, if not null,
+  // before clamping. The fixed-point multiplier fields above must not be set
+  // and the destination zero point must be 0.
+  float float_multiplier_ = 1.f;
+  // Per-channel variant of float_multiplier. If not nullptr, this must point
+  // to a buffer of as many values as there are rows in the destination
+  // matrix, typically the scales of the rows of a quantized LHS.
+  const float* float_multiplier_perchannel_ = nullptr;
+  // The floating-point bias vector data, if not null. Only for dequantizing
+  // multiplications, see float_multiplier.
+  const float* float_bias_ = nullptr;
+  // Only for an int8 LHS with a floating-point AccumScalar, which is a
+  // 'weight-only quantized' multiplication: the LHS entry q at (row, k)
+  // stands for the float value (q - zero_point) * scale, and packing
+  // dequantizes it so that the rest is a plain float multiplication.
+  // If lhs_group_size is 0, scale is lhs_scales[row]: one scale per row,
+  // i.e. per destination channel. Otherwise, each row is divided along the
+  // depth dimension into groups of lhs_group_size entries, each with its own
+  // scale, stored group-major:
+  //   scale = lhs_scales[(k / lhs_group_size) * lhs_rows + row].
+  // If lhs_scales is nullptr, all scales are 1.
+  //
+  // Also for an 8-bit or int4 LHS in a dequantizing multiplication (see
+  // float_multiplier), for weights quantized group-wise: the accumulators
+  // over each group of depth levels, including their zero-point corrections,
+  // are converted to float and multiplied by the scale of their group and
+  // row, then added up over the groups, in float, before the rest of the
+  // dequantization. The kernels then run on the depth slice of each group,
+  // so lhs_group_size must be a multiple of 16, or 0, and the int32 bias must
+  // be null: use float_bias. Both are checked at runtime, in all builds.
+  const float* lhs_scales_ = nullptr;
+  // Only for an int8 LHS with a floating-point AccumScalar, or an int4 LHS
+  // (see ruy/int4.h). If not nullptr, the zero points of the LHS entries,
+  // laid out like lhs_scales, replacing the zero point of the LHS matrix,
+  // which must then be 0. For an int4 LHS, they must be in [-8, 7].
+  const std::int8_t* lhs_zero_points_ = nullptr;
+  // The number of depth levels sharing an entry of lhs_scales and
+  // lhs_zero_points, or 0 for one entry per row over the whole depth.
+  int lhs_group_size_ = 0;
   // min clamp bound of destination values.
   DstScalar clamp_min_ = std::is_floating_point<DstScalar>::value
                              ? -std::numeric_limits<DstScalar>::infinity()
@@ -134,15 +196,15 @@ class MulParams /* not final, legitimate to subclass */ {
   // Used for testing of various kernel layouts.
   using StandardCppKernelLhsLayout = FixedKernelLayout<Order::kColMajor, 1, 1>;
   using StandardCppKernelRhsLayout = FixedKernelLayout<Order::kColMajor, 1, 1>;
-  // Returns (a reasonable estimate of) the local CPU cache size.
-  // See ruy::LocalDataCacheSize() which returns some coarse, sane default for
-  // each CPU architecture.
-  // This may be overridden, either to provide more accurate/runtime values,
-  // or to test with other values to let testcases have more coverage.
-  static int local_data_cache_size() { return LocalDataCacheSize(); }
+  // Returns (a reasonable estimate of) the local CPU cache size, or 0 to use
+  // the value detected at runtime, see Ctx::GetLocalDataCacheSize().
+  // This used to return ruy::LocalDataCacheSize(), see the note in ruy.h.
+  // This may be overridden, e.g. to test with other values to let testcases
+  // have more coverage.
+  static int local_data_cache_size() { return 0; }
   // Same as local_data_cache_size but for the total data cache size accessible
-  // to each CPU core. See ruy::SharedDataCacheSize().
-  static int shared_data_cache_size() { return SharedDataCacheSize(); }
+  // to each CPU core. See Ctx::GetSharedDataCacheSize().
+  static int shared_data_cache_size() { return 0; }
 };
 
 template <typename tAccumScalar, typename tDstScalar>
@@ -34,6 +34,7 @@ limitations under the License.
 #define RUY_OPT_BIT_FRACTAL_Z 0x400
 #define RUY_OPT_BIT_FRACTAL_U 0x800
 #define RUY_OPT_BIT_FRACTAL_HILBERT 0x1000
+#define RUY_OPT_BIT_DEPTH_BLOCKING 0x2000
 
 #if !defined(RUY_OPT_SET)
 #ifdef RUY_OPTIMIZE_FOR_MATMUL_BENCHMARK
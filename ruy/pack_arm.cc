@@ -12,14 +12,23 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 #include "ruy/common.h"
+#include "ruy/float16.h"
+#include "ruy/int4.h"
 #include "ruy/opt_set.h"
 #include "ruy/pack.h"
 #include "ruy/platform.h"
 #include "ruy/profiler/instrumentation.h"
 
+#if (RUY_PLATFORM_NEON_32 || RUY_PLATFORM_NEON_64) && RUY_OPT(ASM)
+#include <arm_neon.h>
+#endif
+
 namespace ruy {
 
 #if RUY_PLATFORM_NEON_64 && RUY_OPT(ASM)
@@ -1928,4 +1937,216 @@ void PackFloatNeonInOrder(const float* src_ptr0, const float* src_ptr1,
 }
 #endif  // RUY_PLATFORM_NEON_64 && RUY_OPT(ASM)
 
+#if (RUY_PLATFORM_NEON_32 || RUY_PLATFORM_NEON_64) && RUY_OPT(ASM)
+
+void Pack8bitRowMajorNeon(const std::int8_t* src_ptr, std::int8_t input_xor,
+                          const std::int8_t* zerobuf, int src_stride,
+                          int remaining_src_cols, int src_rows,
+                          std::int8_t* packed_ptr, std::int32_t* sums_ptr) {
+  profiler::ScopeLabel label("Pack (kNeon, row-major source)");
+  // The kernel layout is 16x4 column-major: each column of a 16-row block
+  // is 16 contiguous packed values.
+  static constexpr int kCols = 4;
+  static constexpr int kRows = 16;
+  const int available_src_cols =
+      std::max(0, std::min(remaining_src_cols, kCols));
+  const int packed_rows = (src_rows + kRows - 1) & ~(kRows - 1);
+  const int8x8_t input_xor_v = vdup_n_s8(input_xor);
+  int32x4_t sums = vdupq_n_s32(0);
+  for (int k = 0; k < packed_rows; k += 4) {
+    // Load 4 rows of 4 columns, padding with the zero point.
+    int8x8_t r[4];
+    for (int i = 0; i < 4; ++i) {
+      std::int8_t buf[8];
+      memcpy(buf, zerobuf, sizeof(buf));
+      if (k + i < src_rows) {
+        memcpy(buf, src_ptr + (k + i) * src_stride, available_src_cols);
+      }
+      r[i] = veor_s8(vld1_s8(buf), input_xor_v);
+    }
+    // Transpose the 4x4 block so that each column's 4 values are contiguous:
+    // t.val[0] holds columns 0 and 1, t.val[1] holds columns 2 and 3.
+    const int8x8x2_t r01 = vzip_s8(r[0], r[1]);
+    const int8x8x2_t r23 = vzip_s8(r[2], r[3]);
+    const int16x4x2_t t = vzip_s16(vreinterpret_s16_s8(r01.val[0]),
+                                   vreinterpret_s16_s8(r23.val[0]));
+    std::int8_t* dst_ptr =
+        packed_ptr + (k & ~(kRows - 1)) * kCols + (k & (kRows - 1));
+    vst1_lane_s32(reinterpret_cast<std::int32_t*>(dst_ptr + 0 * kRows),
+                  vreinterpret_s32_s16(t.val[0]), 0);
+    vst1_lane_s32(reinterpret_cast<std::int32_t*>(dst_ptr + 1 * kRows),
+                  vreinterpret_s32_s16(t.val[0]), 1);
+    vst1_lane_s32(reinterpret_cast<std::int32_t*>(dst_ptr + 2 * kRows),
+                  vreinterpret_s32_s16(t.val[1]), 0);
+    vst1_lane_s32(reinterpret_cast<std::int32_t*>(dst_ptr + 3 * kRows),
+                  vreinterpret_s32_s16(t.val[1]), 1);
+    const int16x8_t sums16 =
+        vaddq_s16(vaddl_s8(r[0], r[1]), vaddl_s8(r[2], r[3]));
+    sums = vaddw_s16(sums, vget_low_s16(sums16));
+  }
+  if (sums_ptr) {
+    vst1q_s32(sums_ptr, sums);
+  }
+}
+
+void PackFloatRowMajorNeon(const float* src_ptr, int src_stride,
+                           int remaining_src_cols, int src_rows,
+                           float* packed_ptr) {
+  profiler::ScopeLabel label("Pack (kNeon float, row-major source)");
+  // The kernel layout is 1x8 row-major, so each source row maps to 8
+  // contiguous packed values and packing is a strided copy.
+  static constexpr int kCols = 8;
+  if (remaining_src_cols >= kCols) {
+    for (int k = 0; k < src_rows; ++k) {
+      vst1q_f32(packed_ptr, vld1q_f32(src_ptr));
+      vst1q_f32(packed_ptr + 4, vld1q_f32(src_ptr + 4));
+      src_ptr += src_stride;
+      packed_ptr += kCols;
+    }
+  } else {
+    const int available_src_cols = std::max(0, remaining_src_cols);
+    for (int k = 0; k < src_rows; ++k) {
+      float buf[kCols] = {0};
+      memcpy(buf, src_ptr, available_src_cols * sizeof(float));
+      vst1q_f32(packed_ptr, vld1q_f32(buf));
+      vst1q_f32(packed_ptr + 4, vld1q_f32(buf + 4));
+      src_ptr += src_stride;
+      packed_ptr += kCols;
+    }
+  }
+}
+
+#endif  // (RUY_PLATFORM_NEON_32 || RUY_PLATFORM_NEON_64) && RUY_OPT(ASM)
+
+#if RUY_PLATFORM_NEON_64 && RUY_OPT(ASM)
+
+void Pack8bitRowMajorNeonDotprod(const std::int8_t* src_ptr,
+                                 std::int8_t input_xor,
+                                 const std::int8_t* zerobuf, int src_stride,
+                                 int remaining_src_cols, int src_rows,
+                                 std::int8_t* packed_ptr,
+                                 std::int32_t* sums_ptr) {
+  profiler::ScopeLabel label("Pack (kNeonDotprod, row-major source)");
+  // The kernel layout is 4x8 column-major: each column of a 4-row block is 4
+  // contiguous packed values, which is what the dotprod instructions consume.
+  static constexpr int kCols = 8;
+  static constexpr int kRows = 4;
+  const int available_src_cols =
+      std::max(0, std::min(remaining_src_cols, kCols));
+  const int8x8_t input_xor_v = vdup_n_s8(input_xor);
+  const int8x8_t zero_point_v = vld1_s8(zerobuf);
+  int32x4_t sums_lo = vdupq_n_s32(0);
+  int32x4_t sums_hi = vdupq_n_s32(0);
+  for (int k = 0; k < src_rows; k += kRows) {
+    // Load 4 rows of 8 columns, padding with the zero point.
+    int8x8_t r[kRows];
+    for (int i = 0; i < kRows; ++i) {
+      if (k + i >= src_rows) {
+        r[i] = zero_point_v;
+      } else if (available_src_cols == kCols) {
+        r[i] = vld1_s8(src_ptr + (k + i) * src_stride);
+      } else {
+        std::int8_t buf[kCols];
+        memcpy(buf, zerobuf, sizeof(buf));
+        memcpy(buf, src_ptr + (k + i) * src_stride, available_src_cols);
+        r[i] = vld1_s8(buf);
+      }
+      r[i] = veor_s8(r[i], input_xor_v);
+    }
+    // Transpose the 4x8 block so that each column's 4 values are contiguous.
+    const int8x8x2_t r01 = vzip_s8(r[0], r[1]);
+    const int8x8x2_t r23 = vzip_s8(r[2], r[3]);
+    const int16x4x2_t t_lo = vzip_s16(vreinterpret_s16_s8(r01.val[0]),
+                                      vreinterpret_s16_s8(r23.val[0]));
+    const int16x4x2_t t_hi = vzip_s16(vreinterpret_s16_s8(r01.val[1]),
+                                      vreinterpret_s16_s8(r23.val[1]));
+    vst1_s8(packed_ptr + 0, vreinterpret_s8_s16(t_lo.val[0]));
+    vst1_s8(packed_ptr + 8, vreinterpret_s8_s16(t_lo.val[1]));
+    vst1_s8(packed_ptr + 16, vreinterpret_s8_s16(t_hi.val[0]));
+    vst1_s8(packed_ptr + 24, vreinterpret_s8_s16(t_hi.val[1]));
+    packed_ptr += kCols * kRows;
+    const int16x8_t sums16 =
+        vaddq_s16(vaddl_s8(r[0], r[1]), vaddl_s8(r[2], r[3]));
+    sums_lo = vaddw_s16(sums_lo, vget_low_s16(sums16));
+    sums_hi = vaddw_s16(sums_hi, vget_high_s16(sums16));
+  }
+  if (sums_ptr) {
+    vst1q_s32(sums_ptr, sums_lo);
+    vst1q_s32(sums_ptr + 4, sums_hi);
+  }
+}
+
+void WidenToFloatNeon(const bfloat16* src_ptr, int count, float* dst_ptr) {
+  // bfloat16 is the upper half of a float.
+  const std::uint16_t* src = reinterpret_cast<const std::uint16_t*>(src_ptr);
+  int i = 0;
+  for (; i <= count - 4; i += 4) {
+    vst1q_f32(dst_ptr + i,
+              vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(src + i), 16)));
+  }
+  for (; i < count; ++i) {
+    dst_ptr[i] = src_ptr[i];
+  }
+}
+
+void WidenToFloatNeon(const float16* src_ptr, int count, float* dst_ptr) {
+  const std::uint16_t* src = reinterpret_cast<const std::uint16_t*>(src_ptr);
+  int i = 0;
+  for (; i <= count - 4; i += 4) {
+    vst1q_f32(dst_ptr + i,
+              vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+  }
+  for (; i < count; ++i) {
+    dst_ptr[i] = src_ptr[i];
+  }
+}
+
+void DequantizeToFloatNeon(const std::int8_t* src_ptr, int count,
+                           std::int32_t zero_point, float scale,
+                           float* dst_ptr) {
+  const int16x8_t zero_point_v = vdupq_n_s16(zero_point);
+  int i = 0;
+  for (; i <= count - 8; i += 8) {
+    // The difference q - zero_point of two int8 values fits in int16.
+    const int16x8_t x = vsubq_s16(vmovl_s8(vld1_s8(src_ptr + i)), zero_point_v);
+    vst1q_f32(dst_ptr + i,
+              vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+    vst1q_f32(dst_ptr + i + 4,
+              vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+  }
+  for (; i < count; ++i) {
+    dst_ptr[i] = DequantizeWeight(src_ptr[i], zero_point, scale);
+  }
+}
+
+void ExpandInt4Neon(const int4* data, std::ptrdiff_t offset, int count,
+                    std::int32_t zero_point, std::int8_t* dst_ptr) {
+  // Start from a byte boundary, so that each byte holds two consecutive
+  // entries: its low nibble, then its high nibble.
+  int i = (offset & 1) ? std::min(count, 1) : 0;
+  ExpandInt4(data, offset, i, zero_point, dst_ptr);
+  const std::uint8_t* src_ptr =
+      reinterpret_cast<const std::uint8_t*>(data) + (offset + i) / 2;
+  const uint8x16_t nibble_mask = vdupq_n_u8(0x0f);
+  const uint8x16_t sign_bit = vdupq_n_u8(8);
+  // Sign-extending a nibble x is (x ^ 8) - 8. The result, minus the zero
+  // point, fits in int8, so the byte arithmetic may wrap in between.
+  const uint8x16_t offset_v =
+      vdupq_n_u8(static_cast<std::uint8_t>(8 + zero_point));
+  for (; i + 32 <= count; i += 32) {
+    const uint8x16_t bytes = vld1q_u8(src_ptr);
+    src_ptr += 16;
+    const uint8x16_t lo =
+        vsubq_u8(veorq_u8(vandq_u8(bytes, nibble_mask), sign_bit), offset_v);
+    const uint8x16_t hi =
+        vsubq_u8(veorq_u8(vshrq_n_u8(bytes, 4), sign_bit), offset_v);
+    const uint8x16x2_t entries = vzipq_u8(lo, hi);
+    vst1q_s8(dst_ptr + i, vreinterpretq_s8_u8(entries.val[0]));
+    vst1q_s8(dst_ptr + i + 16, vreinterpretq_s8_u8(entries.val[1]));
+  }
+  ExpandInt4(data, offset + i, count - i, zero_point, dst_ptr + i);
+}
+
+#endif  // RUY_PLATFORM_NEON_64 && RUY_OPT(ASM)
+
 }  // namespace ruy
@@ -16,11 +16,14 @@ limitations under the License.
 #ifndef RUY_RUY_PACK_ARM_H_
 #define RUY_RUY_PACK_ARM_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <type_traits>
 
 #include "ruy/check_macros.h"
 #include "ruy/common.h"
+#include "ruy/float16.h"
+#include "ruy/int4.h"
 #include "ruy/mat.h"
 #include "ruy/matrix.h"
 #include "ruy/opt_set.h"
@@ -63,6 +66,30 @@ void Pack8bitNeonOutOfOrder4Cols(const PackParams8bit& params);
 void Pack8bitNeonOutOfOrder2Cols(const PackParams8bit& params);
 #endif  // (RUY_PLATFORM_NEON_64&& RUY_OPT(ASM)
 
+#if (RUY_PLATFORM_NEON_32 || RUY_PLATFORM_NEON_64) && RUY_OPT(ASM)
+// Packing routines for row-major sources. They pack one block of columns,
+// i.e. as many columns as the kernel layout has: src_ptr points to the first
+// column of that block, and src_stride is the distance between consecutive
+// rows. Note that source and zero buffers can be uint8 type, but in the
+// packing function are reinterpreted as int8, and are XOR-ed with input_xor.
+void Pack8bitRowMajorNeon(const std::int8_t* src_ptr, std::int8_t input_xor,
+                          const std::int8_t* zerobuf, int src_stride,
+                          int remaining_src_cols, int src_rows,
+                          std::int8_t* packed_ptr, std::int32_t* sums_ptr);
+void PackFloatRowMajorNeon(const float* src_ptr, int src_stride,
+                           int remaining_src_cols, int src_rows,
+                           float* packed_ptr);
+#endif  // (RUY_PLATFORM_NEON_32 || RUY_PLATFORM_NEON_64) && RUY_OPT(ASM)
+
+#if RUY_PLATFORM_NEON_64 && RUY_OPT(ASM)
+void Pack8bitRowMajorNeonDotprod(const std::int8_t* src_ptr,
+                                 std::int8_t input_xor,
+                                 const std::int8_t* zerobuf, int src_stride,
+                                 int remaining_src_cols, int src_rows,
+                                 std::int8_t* packed_ptr,
+                                 std::int32_t* sums_ptr);
+#endif  // RUY_PLATFORM_NEON_64 && RUY_OPT(ASM)
+
 #if (RUY_PLATFORM_NEON_32 || RUY_PLATFORM_NEON_64) && RUY_OPT(ASM)
 
 template <typename Scalar>
@@ -77,12 +104,24 @@ struct PackImpl<Path::kNeon, FixedKernelLayout<Order::kColMajor, 16, 4>, Scalar,
   static void Run(Tuning tuning, const Mat<Scalar>& src_matrix,
                   PMat<std::int8_t>* packed_matrix, int start_col,
                   int end_col) {
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ(start_col % 4, 0);
     std::int32_t* sums = packed_matrix->sums;
     Scalar zerobuf[16];
     memset(zerobuf, src_matrix.zero_point, sizeof(zerobuf));
+    if (!IsColMajor(src_matrix.layout)) {
+      for (int block_col = start_col; block_col < end_col; block_col += 4) {
+        Pack8bitRowMajorNeon(
+            reinterpret_cast<const std::int8_t*>(src_matrix.data.get() +
+                                                 block_col),
+            kInputXor, reinterpret_cast<const std::int8_t*>(zerobuf),
+            src_matrix.layout.stride, src_matrix.layout.cols - block_col,
+            src_matrix.layout.rows,
+            packed_matrix->data + packed_matrix->layout.stride * block_col,
+            sums ? sums + block_col : nullptr);
+      }
+      return;
+    }
     for (int block_col = start_col; block_col < end_col; block_col += 4) {
       int src_stride = src_matrix.layout.stride;
       const Scalar* src_ptr0 = src_matrix.data.get() + src_stride * block_col;
@@ -157,10 +196,17 @@ struct PackImpl<Path::kNeon, FixedKernelLayout<Order::kColMajor, 16, 2>, Scalar,
                 "");
   static constexpr int kInputXor =
       std::is_same<Scalar, std::int8_t>::value ? 0 : 0x80;
-  static void Run(Tuning, const Mat<Scalar>& src_matrix,
+  static void Run(Tuning tuning, const Mat<Scalar>& src_matrix,
                   PMat<std::int8_t>* packed_matrix, int start_col,
                   int end_col) {
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
+    if (!IsColMajor(src_matrix.layout)) {
+      // No dedicated code for row-major sources with this layout.
+      PackImpl<Path::kStandardCpp, FixedKernelLayout<Order::kColMajor, 16, 2>,
+               Scalar, std::int8_t, std::int32_t>::Run(tuning, src_matrix,
+                                                       packed_matrix,
+                                                       start_col, end_col);
+      return;
+    }
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ(start_col % 2, 0);
     std::int32_t* sums = packed_matrix->sums;
@@ -209,12 +255,24 @@ struct PackImpl<Path::kNeonDotprod, FixedKernelLayout<Order::kColMajor, 4, 8>,
   static void Run(Tuning tuning, const Mat<Scalar>& src_matrix,
                   PMat<std::int8_t>* packed_matrix, int start_col,
                   int end_col) {
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ(start_col % 8, 0);
     std::int32_t* sums = packed_matrix->sums;
     Scalar zerobuf[16];
     memset(zerobuf, src_matrix.zero_point, sizeof(zerobuf));
+    if (!IsColMajor(src_matrix.layout)) {
+      for (int block_col = start_col; block_col < end_col; block_col += 8) {
+        Pack8bitRowMajorNeonDotprod(
+            reinterpret_cast<const std::int8_t*>(src_matrix.data.get() +
+                                                 block_col),
+            kInputXor, reinterpret_cast<const std::int8_t*>(zerobuf),
+            src_matrix.layout.stride, src_matrix.layout.cols - block_col,
+            src_matrix.layout.rows,
+            packed_matrix->data + packed_matrix->layout.stride * block_col,
+            sums ? sums + block_col : nullptr);
+      }
+      return;
+    }
     for (int block_col = start_col; block_col < end_col; block_col += 4) {
       int src_stride = src_matrix.layout.stride;
       const Scalar* src_ptr0 = src_matrix.data.get() + src_stride * block_col;
@@ -288,9 +346,17 @@ struct PackImpl<Path::kNeon, FixedKernelLayout<Order::kRowMajor, 1, 8>, float,
                 float, float> {
   static void Run(Tuning tuning, const Mat<float>& src_matrix,
                   PMat<float>* packed_matrix, int start_col, int end_col) {
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ(start_col % 8, 0);
+    if (!IsColMajor(src_matrix.layout)) {
+      for (int block_col = start_col; block_col < end_col; block_col += 8) {
+        PackFloatRowMajorNeon(
+            src_matrix.data.get() + block_col, src_matrix.layout.stride,
+            src_matrix.layout.cols - block_col, src_matrix.layout.rows,
+            packed_matrix->data + packed_matrix->layout.stride * block_col);
+      }
+      return;
+    }
     const float zerobuf[4] = {0};
     for (int block_col = start_col; block_col < end_col; block_col += 4) {
       int src_stride = src_matrix.layout.stride;
@@ -362,9 +428,15 @@ struct PackImpl<Path::kNeon, FixedKernelLayout<Order::kRowMajor, 1, 8>, float,
 template <>
 struct PackImpl<Path::kNeon, FixedKernelLayout<Order::kRowMajor, 1, 4>, float,
                 float, float> {
-  static void Run(Tuning, const Mat<float>& src_matrix,
+  static void Run(Tuning tuning, const Mat<float>& src_matrix,
                   PMat<float>* packed_matrix, int start_col, int end_col) {
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
+    if (!IsColMajor(src_matrix.layout)) {
+      // No dedicated code for row-major sources with this layout.
+      PackImpl<Path::kStandardCpp, FixedKernelLayout<Order::kRowMajor, 1, 4>,
+               float, float, float>::Run(tuning, src_matrix, packed_matrix,
+                                         start_col, end_col);
+      return;
+    }
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ(start_col % 4, 0);
     const float zerobuf[4] = {0};
@@ -416,6 +488,67 @@ struct PackImpl<Path::kNeon, FixedKernelLayout<Order::kRowMajor, 1, 4>, float,
 #endif  // (RUY_PLATFORM_NEON_64 || RUY_PLATFORM_NEON_32) && \
         // RUY_OPT(ASM)
 
+#if RUY_PLATFORM_NEON_64 && RUY_OPT(ASM)
+
+// Widens `count` contiguous 16-bit floating-point values to float, see
+// PackWidenedToFloat.
+void WidenToFloatNeon(const bfloat16* src_ptr, int count, float* dst_ptr);
+void WidenToFloatNeon(const float16* src_ptr, int count, float* dst_ptr);
+
+template <typename Scalar>
+struct PackImpl<Path::kNeon, FixedKernelLayout<Order::kRowMajor, 1, 8>, Scalar,
+                float, float> {
+  static_assert(std::is_same<Scalar, bfloat16>::value ||
+                    std::is_same<Scalar, float16>::value,
+                "");
+  using Layout = FixedKernelLayout<Order::kRowMajor, 1, 8>;
+  static void Run(Tuning tuning, const Mat<Scalar>& src_matrix,
+                  PMat<float>* packed_matrix, int start_col, int end_col) {
+    profiler::ScopeLabel label("Pack (kNeon 16-bit float)");
+    PackWidenedToFloat<Path::kNeon, Layout>(
+        tuning, src_matrix, packed_matrix, start_col, end_col,
+        [](const Scalar* src_ptr, int count, float* dst_ptr) {
+          WidenToFloatNeon(src_ptr, count, dst_ptr);
+        });
+  }
+};
+
+// Dequantizes `count` contiguous int8 weights sharing the same scale, see
+// PackDequantizedToFloat.
+void DequantizeToFloatNeon(const std::int8_t* src_ptr, int count,
+                           std::int32_t zero_point, float scale,
+                           float* dst_ptr);
+
+template <>
+struct PackImpl<Path::kNeon, FixedKernelLayout<Order::kRowMajor, 1, 8>,
+                std::int8_t, float, float> {
+  using Layout = FixedKernelLayout<Order::kRowMajor, 1, 8>;
+  static void Run(Tuning tuning, const Mat<std::int8_t>& src_matrix,
+                  PMat<float>* packed_matrix, int start_col, int end_col) {
+    profiler::ScopeLabel label("Pack (kNeon dequantizing int8)");
+    PackDequantizedToFloat<Path::kNeon, Layout>(
+        tuning, src_matrix, packed_matrix, start_col, end_col,
+        &DequantizeToFloatNeon);
+  }
+};
+
+// Expands `count` int4 entries to int8, see ExpandInt4.
+void ExpandInt4Neon(const int4* data, std::ptrdiff_t offset, int count,
+                    std::int32_t zero_point, std::int8_t* dst_ptr);
+
+template <>
+struct ExpandInt4Impl<Path::kNeon> {
+  static void Run(const int4* data, std::ptrdiff_t offset, int count,
+                  std::int32_t zero_point, std::int8_t* dst_ptr) {
+    ExpandInt4Neon(data, offset, count, zero_point, dst_ptr);
+  }
+};
+
+template <>
+struct ExpandInt4Impl<Path::kNeonDotprod> : ExpandInt4Impl<Path::kNeon> {};
+
+#endif  // RUY_PLATFORM_NEON_64 && RUY_OPT(ASM)
+
 }  // namespace ruy
 
 #endif  // RUY_RUY_PACK_ARM_H_
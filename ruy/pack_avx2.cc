@@ -13,10 +13,14 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 
 #include "ruy/check_macros.h"
+#include "ruy/float16.h"
+#include "ruy/int4.h"
 #include "ruy/matrix.h"
 #include "ruy/opt_set.h"
 #include "ruy/pack.h"
@@ -43,6 +47,39 @@ void PackFloatAvx2(const float*, const float*, int, int, int, float*) {
   RUY_DCHECK(false);
 }
 
+void Pack8bitRowMajorAvx2(const std::int8_t*, std::int8_t, const std::int8_t*,
+                          int, int, int, std::int8_t*, std::int32_t*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void PackFloatRowMajorAvx2(const float*, const float*, int, int, int, float*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void WidenToFloatAvx2(const bfloat16*, int, float*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void WidenToFloatAvx2(const float16*, int, float*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void DequantizeToFloatAvx2(const std::int8_t*, int, std::int32_t, float,
+                           float*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void ExpandInt4Avx2(const int4*, std::ptrdiff_t, int, std::int32_t,
+                    std::int8_t*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
 #else  // RUY_PLATFORM_AVX2 && RUY_OPT(ASM)
 
 // The first int8_t template parameter is arbitrary: this routine is common to
@@ -808,6 +845,192 @@ void PackFloatAvx2(const float* src_ptr, const float* zerobuf, int src_stride,
   }
 }
 
+void Pack8bitRowMajorAvx2(const std::int8_t* src_ptr, std::int8_t input_xor,
+                          const std::int8_t* zerobuf, int src_stride,
+                          int remaining_src_cols, int src_rows,
+                          std::int8_t* packed_ptr, std::int32_t* sums_ptr) {
+  profiler::ScopeLabel label("Pack kAvx2 8bit row-major");
+
+  using Layout = PackImpl8bitAvx2::Layout;
+  RUY_DCHECK_EQ(Layout::kCols, 8);
+  RUY_DCHECK_EQ(Layout::kRows, 4);
+
+  // Each source row contributes 8 contiguous values, one per packed column.
+  // Short rows, and rows past the end of the source, are padded with the
+  // contents of zerobuf, i.e. the zero point.
+  const int available_src_cols =
+      std::max(0, std::min(remaining_src_cols, Layout::kCols));
+  const __m128i input_xor_v = _mm_set1_epi8(input_xor);
+  const __m128i zero_point_v =
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(zerobuf));
+  __m256i sums = _mm256_setzero_si256();
+
+  // Destination rows are padded to next highest multiple of Layout::kRows.
+  for (int k = 0; k < src_rows; k += Layout::kRows) {
+    __m128i r[Layout::kRows];
+    for (int i = 0; i < Layout::kRows; ++i) {
+      r[i] = zero_point_v;
+      if (k + i < src_rows) {
+        const std::int8_t* row_ptr = src_ptr + (k + i) * src_stride;
+        if (available_src_cols == Layout::kCols) {
+          r[i] = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row_ptr));
+        } else {
+          memcpy(&r[i], row_ptr, available_src_cols);
+        }
+      }
+      r[i] = _mm_xor_si128(r[i], input_xor_v);
+      sums = _mm256_add_epi32(sums, _mm256_cvtepi8_epi32(r[i]));
+    }
+    // Transpose the 4x8 block: interleaving bytes, then pairs of bytes, of
+    // consecutive rows gives 4 contiguous values per column.
+    const __m128i r01 = _mm_unpacklo_epi8(r[0], r[1]);
+    const __m128i r23 = _mm_unpacklo_epi8(r[2], r[3]);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(packed_ptr),
+                     _mm_unpacklo_epi16(r01, r23));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(packed_ptr + 16),
+                     _mm_unpackhi_epi16(r01, r23));
+    packed_ptr += Layout::kCols * Layout::kRows;
+  }
+
+  if (sums_ptr) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums_ptr), sums);
+  }
+}
+
+void PackFloatRowMajorAvx2(const float* src_ptr, const float* zerobuf,
+                           int src_stride, int remaining_src_cols,
+                           int src_rows, float* packed_ptr) {
+  profiler::ScopeLabel label("Pack kAvx2 float row-major");
+  static constexpr int kPackCols = 8;  // Source cols packed together.
+  // The kernel layout is 1x8 row-major, so each source row maps to 8
+  // contiguous packed values and packing is a strided copy.
+  if (remaining_src_cols >= kPackCols) {
+    for (int k = 0; k < src_rows; ++k) {
+      _mm256_storeu_ps(packed_ptr, _mm256_loadu_ps(src_ptr));
+      src_ptr += src_stride;
+      packed_ptr += kPackCols;
+    }
+  } else {
+    // Masked-out lanes are neither loaded nor faulted on, and read as zero,
+    // matching the contents of zerobuf.
+    RUY_DCHECK_EQ(zerobuf[0], 0.0f);
+    const __m256i mask =
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining_src_cols),
+                           _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    for (int k = 0; k < src_rows; ++k) {
+      _mm256_storeu_ps(packed_ptr, _mm256_maskload_ps(src_ptr, mask));
+      src_ptr += src_stride;
+      packed_ptr += kPackCols;
+    }
+  }
+}
+
+void WidenToFloatAvx2(const bfloat16* src_ptr, int count, float* dst_ptr) {
+  // bfloat16 is the upper half of a float.
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i x = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_ptr + i)));
+    _mm256_storeu_ps(dst_ptr + i,
+                     _mm256_castsi256_ps(_mm256_slli_epi32(x, 16)));
+  }
+  for (; i < count; ++i) {
+    dst_ptr[i] = src_ptr[i];
+  }
+}
+
+void WidenToFloatAvx2(const float16* src_ptr, int count, float* dst_ptr) {
+  // F16C is not part of the instruction sets that this path requires, so this
+  // converts with integer arithmetic, as detail::Float16BitsToFloat does.
+  const __m256i exponent_and_mantissa_mask = _mm256_set1_epi32(0x7fff);
+  const __m256i sign_mask = _mm256_set1_epi32(0x8000);
+  const __m256i exponent_rebias = _mm256_set1_epi32((127 - 15) << 23);
+  const __m256i float_exponent_mask = _mm256_set1_epi32(0x7f800000);
+  const __m256i max_finite = _mm256_set1_epi32(0x7bff);
+  const __m256i min_normal = _mm256_set1_epi32(0x400);
+  const __m256 subnormal_scale = _mm256_set1_ps(1.0f / 16777216.0f);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i x = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_ptr + i)));
+    const __m256i exponent_and_mantissa =
+        _mm256_and_si256(x, exponent_and_mantissa_mask);
+    const __m256i sign = _mm256_slli_epi32(_mm256_and_si256(x, sign_mask), 16);
+    const __m256i shifted = _mm256_slli_epi32(exponent_and_mantissa, 13);
+    const __m256i normal = _mm256_add_epi32(shifted, exponent_rebias);
+    const __m256i inf_or_nan = _mm256_or_si256(shifted, float_exponent_mask);
+    const __m256i subnormal = _mm256_castps_si256(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(exponent_and_mantissa), subnormal_scale));
+    __m256i result = _mm256_blendv_epi8(
+        normal, inf_or_nan,
+        _mm256_cmpgt_epi32(exponent_and_mantissa, max_finite));
+    result = _mm256_blendv_epi8(
+        result, subnormal,
+        _mm256_cmpgt_epi32(min_normal, exponent_and_mantissa));
+    _mm256_storeu_ps(dst_ptr + i,
+                     _mm256_castsi256_ps(_mm256_or_si256(result, sign)));
+  }
+  for (; i < count; ++i) {
+    dst_ptr[i] = src_ptr[i];
+  }
+}
+
+void DequantizeToFloatAvx2(const std::int8_t* src_ptr, int count,
+                           std::int32_t zero_point, float scale,
+                           float* dst_ptr) {
+  const __m256i zero_point_v = _mm256_set1_epi32(zero_point);
+  const __m256 scale_v = _mm256_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i x = _mm256_cvtepi8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src_ptr + i)));
+    const __m256 dequantized =
+        _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(x, zero_point_v)),
+                      scale_v);
+    _mm256_storeu_ps(dst_ptr + i, dequantized);
+  }
+  for (; i < count; ++i) {
+    dst_ptr[i] = DequantizeWeight(src_ptr[i], zero_point, scale);
+  }
+}
+
+void ExpandInt4Avx2(const int4* data, std::ptrdiff_t offset, int count,
+                    std::int32_t zero_point, std::int8_t* dst_ptr) {
+  // Start from a byte boundary, so that each byte holds two consecutive
+  // entries: its low nibble, then its high nibble.
+  int i = (offset & 1) ? std::min(count, 1) : 0;
+  ExpandInt4(data, offset, i, zero_point, dst_ptr);
+  const std::uint8_t* src_ptr =
+      reinterpret_cast<const std::uint8_t*>(data) + (offset + i) / 2;
+  const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+  const __m256i sign_bit = _mm256_set1_epi8(8);
+  // Sign-extending a nibble x is (x ^ 8) - 8. The result, minus the zero
+  // point, fits in int8, so the byte arithmetic may wrap in between.
+  const __m256i offset_v = _mm256_set1_epi8(8 + zero_point);
+  for (; i + 64 <= count; i += 64) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src_ptr));
+    src_ptr += 32;
+    const __m256i lo = _mm256_sub_epi8(
+        _mm256_xor_si256(_mm256_and_si256(bytes, nibble_mask), sign_bit),
+        offset_v);
+    const __m256i hi = _mm256_sub_epi8(
+        _mm256_xor_si256(
+            _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble_mask),
+            sign_bit),
+        offset_v);
+    // Interleaving works within 128-bit lanes: a holds the entries of bytes
+    // 0-7 and 16-23, b those of bytes 8-15 and 24-31.
+    const __m256i a = _mm256_unpacklo_epi8(lo, hi);
+    const __m256i b = _mm256_unpackhi_epi8(lo, hi);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_ptr + i),
+                        _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_ptr + i + 32),
+                        _mm256_permute2x128_si256(a, b, 0x31));
+  }
+  ExpandInt4(data, offset + i, count - i, zero_point, dst_ptr + i);
+}
+
 #endif  // RUY_PLATFORM_AVX2 && RUY_OPT(INTRINSICS)
 
 }  // namespace ruy
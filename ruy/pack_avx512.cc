@@ -13,10 +13,14 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 
 #include "ruy/check_macros.h"
+#include "ruy/float16.h"
+#include "ruy/int4.h"
 #include "ruy/matrix.h"
 #include "ruy/opt_set.h"
 #include "ruy/pack.h"
@@ -43,6 +47,41 @@ void PackFloatAvx512(const float*, const float*, int, int, int, float*) {
   RUY_DCHECK(false);
 }
 
+void Pack8bitRowMajorAvx512(const std::int8_t*, std::int8_t,
+                            const std::int8_t*, int, int, int, std::int8_t*,
+                            std::int32_t*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void PackFloatRowMajorAvx512(const float*, const float*, int, int, int,
+                             float*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void WidenToFloatAvx512(const bfloat16*, int, float*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void WidenToFloatAvx512(const float16*, int, float*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void ExpandInt4Avx512(const int4*, std::ptrdiff_t, int, std::int32_t,
+                      std::int8_t*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
+void DequantizeToFloatAvx512(const std::int8_t*, int, std::int32_t, float,
+                             float*) {
+  // CPU-ID-based checks should disable the path that would reach this point.
+  RUY_DCHECK(false);
+}
+
 #else  // RUY_PLATFORM_AVX512 && RUY_OPT(ASM)
 
 // The first int8_t template parameter is arbitrary: this routine is common to
@@ -713,6 +752,162 @@ void PackFloatAvx512(const float* src_ptr, const float* zerobuf, int src_stride,
   }
 }
 
+void Pack8bitRowMajorAvx512(const std::int8_t* src_ptr, std::int8_t input_xor,
+                            const std::int8_t* zerobuf, int src_stride,
+                            int remaining_src_cols, int src_rows,
+                            std::int8_t* packed_ptr, std::int32_t* sums_ptr) {
+  profiler::ScopeLabel label("Pack kAvx512 8bit row-major");
+
+  using Layout = PackImpl8bitAvx512::Layout;
+  RUY_DCHECK_EQ(Layout::kCols, 16);
+  RUY_DCHECK_EQ(Layout::kRows, 4);
+
+  // Each source row contributes 16 contiguous values, one per packed column.
+  // Short rows, and rows past the end of the source, are padded with the
+  // contents of zerobuf, i.e. the zero point.
+  const int available_src_cols =
+      std::max(0, std::min(remaining_src_cols, Layout::kCols));
+  const __mmask16 col_mask =
+      static_cast<__mmask16>((1u << available_src_cols) - 1);
+  const __m128i input_xor_v = _mm_set1_epi8(input_xor);
+  const __m128i zero_point_v =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(zerobuf));
+  __m512i sums = _mm512_setzero_si512();
+
+  // Destination rows are padded to next highest multiple of Layout::kRows.
+  for (int k = 0; k < src_rows; k += Layout::kRows) {
+    __m128i r[Layout::kRows];
+    for (int i = 0; i < Layout::kRows; ++i) {
+      r[i] = k + i < src_rows
+                 ? _mm_mask_loadu_epi8(zero_point_v, col_mask,
+                                       src_ptr + (k + i) * src_stride)
+                 : zero_point_v;
+      r[i] = _mm_xor_si128(r[i], input_xor_v);
+      sums = _mm512_add_epi32(sums, _mm512_cvtepi8_epi32(r[i]));
+    }
+    // Transpose the 4x16 block: interleaving bytes, then pairs of bytes, of
+    // consecutive rows gives 4 contiguous values per column.
+    const __m128i r01_lo = _mm_unpacklo_epi8(r[0], r[1]);
+    const __m128i r01_hi = _mm_unpackhi_epi8(r[0], r[1]);
+    const __m128i r23_lo = _mm_unpacklo_epi8(r[2], r[3]);
+    const __m128i r23_hi = _mm_unpackhi_epi8(r[2], r[3]);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(packed_ptr),
+                     _mm_unpacklo_epi16(r01_lo, r23_lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(packed_ptr + 16),
+                     _mm_unpackhi_epi16(r01_lo, r23_lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(packed_ptr + 32),
+                     _mm_unpacklo_epi16(r01_hi, r23_hi));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(packed_ptr + 48),
+                     _mm_unpackhi_epi16(r01_hi, r23_hi));
+    packed_ptr += Layout::kCols * Layout::kRows;
+  }
+
+  if (sums_ptr) {
+    _mm512_storeu_si512(sums_ptr, sums);
+  }
+}
+
+void PackFloatRowMajorAvx512(const float* src_ptr, const float* zerobuf,
+                             int src_stride, int remaining_src_cols,
+                             int src_rows, float* packed_ptr) {
+  profiler::ScopeLabel label("Pack kAvx512 float row-major");
+  static constexpr int kPackCols = 16;  // Source cols packed together.
+  // The kernel layout is 1x16 row-major, so each source row maps to 16
+  // contiguous packed values and packing is a strided copy. Masked-out lanes
+  // are neither loaded nor faulted on, and read as zero, matching the
+  // contents of zerobuf.
+  RUY_DCHECK_EQ(zerobuf[0], 0.0f);
+  const int available_src_cols =
+      std::max(0, std::min(remaining_src_cols, kPackCols));
+  const __mmask16 col_mask =
+      static_cast<__mmask16>((1u << available_src_cols) - 1);
+  for (int k = 0; k < src_rows; ++k) {
+    _mm512_storeu_ps(packed_ptr, _mm512_maskz_loadu_ps(col_mask, src_ptr));
+    src_ptr += src_stride;
+    packed_ptr += kPackCols;
+  }
+}
+
+void WidenToFloatAvx512(const bfloat16* src_ptr, int count, float* dst_ptr) {
+  // bfloat16 is the upper half of a float.
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512i x = _mm512_cvtepu16_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src_ptr + i)));
+    _mm512_storeu_ps(dst_ptr + i,
+                     _mm512_castsi512_ps(_mm512_slli_epi32(x, 16)));
+  }
+  for (; i < count; ++i) {
+    dst_ptr[i] = src_ptr[i];
+  }
+}
+
+void WidenToFloatAvx512(const float16* src_ptr, int count, float* dst_ptr) {
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    _mm512_storeu_ps(dst_ptr + i,
+                     _mm512_cvtph_ps(_mm256_loadu_si256(
+                         reinterpret_cast<const __m256i*>(src_ptr + i))));
+  }
+  for (; i < count; ++i) {
+    dst_ptr[i] = src_ptr[i];
+  }
+}
+
+void DequantizeToFloatAvx512(const std::int8_t* src_ptr, int count,
+                             std::int32_t zero_point, float scale,
+                             float* dst_ptr) {
+  const __m512i zero_point_v = _mm512_set1_epi32(zero_point);
+  const __m512 scale_v = _mm512_set1_ps(scale);
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512i x = _mm512_cvtepi8_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_ptr + i)));
+    const __m512 dequantized =
+        _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_sub_epi32(x, zero_point_v)),
+                      scale_v);
+    _mm512_storeu_ps(dst_ptr + i, dequantized);
+  }
+  for (; i < count; ++i) {
+    dst_ptr[i] = DequantizeWeight(src_ptr[i], zero_point, scale);
+  }
+}
+
+void ExpandInt4Avx512(const int4* data, std::ptrdiff_t offset, int count,
+                      std::int32_t zero_point, std::int8_t* dst_ptr) {
+  // See ExpandInt4Avx2.
+  int i = (offset & 1) ? std::min(count, 1) : 0;
+  ExpandInt4(data, offset, i, zero_point, dst_ptr);
+  const std::uint8_t* src_ptr =
+      reinterpret_cast<const std::uint8_t*>(data) + (offset + i) / 2;
+  const __m512i nibble_mask = _mm512_set1_epi8(0x0f);
+  const __m512i sign_bit = _mm512_set1_epi8(8);
+  const __m512i offset_v = _mm512_set1_epi8(8 + zero_point);
+  // Interleaving works within 128-bit lanes, so the 64-bit halves of the
+  // lanes of a and b are reordered as a0 b0 a1 b1 and a2 b2 a3 b3.
+  const __m512i first_half = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+  const __m512i second_half = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+  for (; i + 128 <= count; i += 128) {
+    const __m512i bytes = _mm512_loadu_si512(src_ptr);
+    src_ptr += 64;
+    const __m512i lo = _mm512_sub_epi8(
+        _mm512_xor_si512(_mm512_and_si512(bytes, nibble_mask), sign_bit),
+        offset_v);
+    const __m512i hi = _mm512_sub_epi8(
+        _mm512_xor_si512(
+            _mm512_and_si512(_mm512_srli_epi16(bytes, 4), nibble_mask),
+            sign_bit),
+        offset_v);
+    const __m512i a = _mm512_unpacklo_epi8(lo, hi);
+    const __m512i b = _mm512_unpackhi_epi8(lo, hi);
+    _mm512_storeu_si512(dst_ptr + i,
+                        _mm512_permutex2var_epi64(a, first_half, b));
+    _mm512_storeu_si512(dst_ptr + i + 64,
+                        _mm512_permutex2var_epi64(a, second_half, b));
+  }
+  ExpandInt4(data, offset + i, count - i, zero_point, dst_ptr + i);
+}
+
 #endif  // RUY_PLATFORM_AVX512 && RUY_OPT(INTRINSICS)
 
 }  // namespace ruy
@@ -16,16 +16,21 @@ limitations under the License.
 #ifndef RUY_RUY_PACK_COMMON_H_
 #define RUY_RUY_PACK_COMMON_H_
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 
 #include "ruy/check_macros.h"
 #include "ruy/common.h"
+#include "ruy/float16.h"
+#include "ruy/int4.h"
 #include "ruy/mat.h"
 #include "ruy/matrix.h"
 #include "ruy/opt_set.h"
 #include "ruy/path.h"
 #include "ruy/platform.h"
 #include "ruy/profiler/instrumentation.h"
+#include "ruy/quantize.h"
 #include "ruy/tune.h"
 
 namespace ruy {
@@ -35,6 +40,24 @@ struct PackedTypeImpl {
   using Type = Scalar;
 };
 
+// 16-bit floating-point types are widened to float by packing, on all paths,
+// so that the float kernels apply.
+template <Path ThePath>
+struct PackedTypeImpl<ThePath, bfloat16> {
+  using Type = float;
+};
+template <Path ThePath>
+struct PackedTypeImpl<ThePath, float16> {
+  using Type = float;
+};
+
+// int4 is expanded to int8 by packing, on all paths, so that the 8-bit
+// kernels apply. See PackInt4ToInt8.
+template <Path ThePath>
+struct PackedTypeImpl<ThePath, int4> {
+  using Type = std::int8_t;
+};
+
 #if RUY_PLATFORM_NEON_32
 struct PackParams8bit {
   const void* src_ptr0;
@@ -161,6 +184,509 @@ RUY_INHERIT_PACK(Path::kAvx2, Path::kAvx512)
 RUY_INHERIT_PACK(Path::kAvx512, Path::kAvxVnni)
 #endif
 
+// Number of rows of a 16-bit floating-point source matrix that
+// PackWidenedToFloat widens to float at once.
+constexpr int kWidenToFloatChunkRows = 128;
+
+// Packs a bfloat16 or float16 source matrix into a float packed matrix, for
+// paths that have dedicated float packing code but no 16-bit variant of it.
+// Chunks of the source matrix, of at most kWidenToFloatChunkRows rows and one
+// kernel block of columns, are widened to float into a small local buffer,
+// which is then packed by the float PackImpl of the same path. `widen` is
+// called as widen(src_ptr, count, dst_ptr) to widen `count` contiguous
+// source values.
+template <Path ThePath, typename FixedKernelLayout, typename Scalar,
+          typename WidenFn>
+void PackWidenedToFloat(Tuning tuning, const Mat<Scalar>& src_matrix,
+                        PMat<float>* packed_matrix, int start_col, int end_col,
+                        WidenFn widen) {
+  static constexpr int kCols = FixedKernelLayout::kCols;
+  static constexpr int kChunkRows = kWidenToFloatChunkRows;
+  static_assert(kChunkRows % FixedKernelLayout::kRows == 0, "");
+  RUY_DCHECK(IsColMajor(packed_matrix->layout));
+  RUY_DCHECK_EQ((end_col - start_col) % kCols, 0);
+  RUY_DCHECK_EQ(start_col % kCols, 0);
+  float buf[kChunkRows * kCols];
+  const bool src_is_col_major = IsColMajor(src_matrix.layout);
+  const int src_stride = src_matrix.layout.stride;
+  for (int block_col = start_col; block_col < end_col; block_col += kCols) {
+    const int block_src_cols =
+        std::max(0, std::min(kCols, src_matrix.layout.cols - block_col));
+    for (int row = 0; row < packed_matrix->layout.rows; row += kChunkRows) {
+      const int chunk_src_rows =
+          std::max(0, std::min(kChunkRows, src_matrix.layout.rows - row));
+      // The widened chunk keeps the storage order of the source matrix.
+      Mat<float> chunk;
+      chunk.data.set(static_cast<const float*>(buf));
+      chunk.layout.rows = chunk_src_rows;
+      chunk.layout.cols = block_src_cols;
+      chunk.layout.order = src_matrix.layout.order;
+      if (src_is_col_major) {
+        chunk.layout.stride = kChunkRows;
+        for (int col = 0; col < block_src_cols; col++) {
+          widen(src_matrix.data.get() + (block_col + col) * src_stride + row,
+                chunk_src_rows, buf + col * kChunkRows);
+        }
+      } else {
+        chunk.layout.stride = kCols;
+        for (int r = 0; r < chunk_src_rows; r++) {
+          widen(src_matrix.data.get() + (row + r) * src_stride + block_col,
+                block_src_cols, buf + r * kCols);
+        }
+      }
+      // The part of the packed matrix corresponding to the chunk. As the
+      // chunk starts on a multiple of the kernel block rows, it is laid out
+      // like a whole packed matrix of one kernel block of columns.
+      PMat<float> packed_chunk = *packed_matrix;
+      packed_chunk.data = packed_matrix->data +
+                          packed_matrix->layout.stride * block_col +
+                          row * kCols;
+      packed_chunk.layout.rows =
+          std::min(kChunkRows, packed_matrix->layout.rows - row);
+      packed_chunk.layout.cols = kCols;
+      PackImpl<ThePath, FixedKernelLayout, float, float, float>::Run(
+          tuning, chunk, &packed_chunk, 0, kCols);
+    }
+  }
+}
+
+// Number of rows of an int8 source matrix that PackDequantizedToFloat
+// dequantizes to float at once.
+constexpr int kDequantizeToFloatChunkRows = 128;
+
+// Packs an int8 source matrix of quantized weights into a float packed
+// matrix, dequantizing each entry with the zero points and the scales of the
+// source matrix, see Mat::scales. As in PackWidenedToFloat, chunks of the
+// source matrix, of at most kDequantizeToFloatChunkRows rows and one kernel
+// block of columns, are dequantized into a small local buffer, which is then
+// packed by the float PackImpl of the path. `dequantize` is called as
+// dequantize(src_ptr, count, zero_point, scale, dst_ptr) to dequantize
+// `count` contiguous source values sharing the same zero point and scale,
+// which are the runs of a column within a group. Row-major source matrices,
+// whose rows have one scale per entry, are dequantized one entry at a time.
+template <Path ThePath, typename FixedKernelLayout, typename DequantizeFn>
+void PackDequantizedToFloat(Tuning tuning, const Mat<std::int8_t>& src_matrix,
+                            PMat<float>* packed_matrix, int start_col,
+                            int end_col, DequantizeFn dequantize) {
+  static constexpr int kCols = FixedKernelLayout::kCols;
+  static constexpr int kChunkRows = kDequantizeToFloatChunkRows;
+  static_assert(kChunkRows % FixedKernelLayout::kRows == 0, "");
+  RUY_DCHECK(IsColMajor(packed_matrix->layout));
+  RUY_DCHECK_EQ((end_col - start_col) % kCols, 0);
+  RUY_DCHECK_EQ(start_col % kCols, 0);
+  RUY_DCHECK_EQ(packed_matrix->zero_point, 0);
+  float buf[kChunkRows * kCols];
+  const bool src_is_col_major = IsColMajor(src_matrix.layout);
+  const int src_stride = src_matrix.layout.stride;
+  const int src_cols = src_matrix.layout.cols;
+  const float* scales = src_matrix.scales;
+  const std::int8_t* zero_points = src_matrix.zero_points;
+  const int group_size = src_matrix.group_size;
+  const int row_offset = src_matrix.group_row_offset;
+  const int first_channel = src_matrix.group_col_offset;
+  const int channels = src_cols + first_channel;
+  for (int block_col = start_col; block_col < end_col; block_col += kCols) {
+    const int block_src_cols =
+        std::max(0, std::min(kCols, src_cols - block_col));
+    for (int row = 0; row < packed_matrix->layout.rows; row += kChunkRows) {
+      const int chunk_src_rows =
+          std::max(0, std::min(kChunkRows, src_matrix.layout.rows - row));
+      // The dequantized chunk keeps the storage order of the source matrix.
+      Mat<float> chunk;
+      chunk.data.set(static_cast<const float*>(buf));
+      chunk.layout.rows = chunk_src_rows;
+      chunk.layout.cols = block_src_cols;
+      chunk.layout.order = src_matrix.layout.order;
+      if (src_is_col_major) {
+        chunk.layout.stride = kChunkRows;
+        for (int col = 0; col < block_src_cols; col++) {
+          const std::int8_t* src_ptr =
+              src_matrix.data.get() + (block_col + col) * src_stride + row;
+          float* dst_ptr = buf + col * kChunkRows;
+          int r = 0;
+          while (r < chunk_src_rows) {
+            const int k = row_offset + row + r;
+            const int count =
+                group_size ? std::min(chunk_src_rows - r,
+                                      group_size - k % group_size)
+                           : chunk_src_rows - r;
+            dequantize(src_ptr + r, count,
+                       WeightZeroPoint(zero_points, group_size, channels,
+                                       first_channel + block_col + col, k,
+                                       src_matrix.zero_point),
+                       WeightScale(scales, group_size, channels,
+                                   first_channel + block_col + col, k),
+                       dst_ptr + r);
+            r += count;
+          }
+        }
+      } else {
+        chunk.layout.stride = kCols;
+        for (int r = 0; r < chunk_src_rows; r++) {
+          const std::int8_t* src_ptr =
+              src_matrix.data.get() + (row + r) * src_stride + block_col;
+          const int k = row_offset + row + r;
+          for (int col = 0; col < block_src_cols; col++) {
+            const int channel = first_channel + block_col + col;
+            buf[r * kCols + col] = DequantizeWeight(
+                src_ptr[col],
+                WeightZeroPoint(zero_points, group_size, channels, channel, k,
+                                src_matrix.zero_point),
+                WeightScale(scales, group_size, channels, channel, k));
+          }
+        }
+      }
+      // As in PackWidenedToFloat, the part of the packed matrix
+      // corresponding to the chunk is laid out like a whole packed matrix of
+      // one kernel block of columns. Float packed matrices need no sums, and
+      // those of the chunk would be indexed from its first column.
+      PMat<float> packed_chunk = *packed_matrix;
+      packed_chunk.data = packed_matrix->data +
+                          packed_matrix->layout.stride * block_col +
+                          row * kCols;
+      packed_chunk.sums = nullptr;
+      packed_chunk.layout.rows =
+          std::min(kChunkRows, packed_matrix->layout.rows - row);
+      packed_chunk.layout.cols = kCols;
+      PackImpl<ThePath, FixedKernelLayout, float, float, float>::Run(
+          tuning, chunk, &packed_chunk, 0, kCols);
+    }
+  }
+}
+
+// Generic packing of int8 weights into a float packed matrix, dequantizing
+// them as described in PackDequantizedToFloat. Paths with dedicated float
+// packing code specialize this for the layout of their float kernel, with
+// a SIMD dequantization.
+template <typename FixedKernelLayout>
+struct PackImpl<Path::kStandardCpp, FixedKernelLayout, std::int8_t, float,
+                float> {
+  static void Run(Tuning tuning, const Mat<std::int8_t>& src_matrix,
+                  PMat<float>* packed_matrix, int start_col, int end_col) {
+    profiler::ScopeLabel label("Pack (generic, dequantizing int8)");
+    PackDequantizedToFloat<Path::kStandardCpp, FixedKernelLayout>(
+        tuning, src_matrix, packed_matrix, start_col, end_col,
+        [](const std::int8_t* src_ptr, int count, std::int32_t zero_point,
+           float scale, float* dst_ptr) {
+          for (int i = 0; i < count; i++) {
+            dst_ptr[i] = DequantizeWeight(src_ptr[i], zero_point, scale);
+          }
+        });
+  }
+};
+
+// Number of rows of a float source matrix that PackQuantizedToInt8
+// quantizes at once.
+constexpr int kQuantizeToInt8ChunkRows = 128;
+
+// Packs a float source matrix into an int8 packed matrix, quantizing each
+// column with its own scale, stored into packed_matrix->scales, as described
+// in ruy/quantize.h. Chunks of the source matrix, of at most
+// kQuantizeToInt8ChunkRows rows and one kernel block of columns, are quantized
+// into a small local buffer, which is then packed by the 8-bit PackImpl of
+// the path, as in PackWidenedToFloat. Each column is read twice: once for its
+// largest magnitude, then for its quantization.
+template <Path ThePath, typename FixedKernelLayout>
+void PackQuantizedToInt8(Tuning tuning, const Mat<float>& src_matrix,
+                         PMat<std::int8_t>* packed_matrix, int start_col,
+                         int end_col) {
+  static constexpr int kCols = FixedKernelLayout::kCols;
+  static constexpr int kChunkRows = kQuantizeToInt8ChunkRows;
+  static_assert(kChunkRows % FixedKernelLayout::kRows == 0, "");
+  RUY_DCHECK(IsColMajor(packed_matrix->layout));
+  RUY_DCHECK_EQ((end_col - start_col) % kCols, 0);
+  RUY_DCHECK_EQ(start_col % kCols, 0);
+  RUY_DCHECK_EQ(packed_matrix->zero_point, 0);
+  RUY_DCHECK(packed_matrix->scales);
+  std::int8_t buf[kChunkRows * kCols];
+  float inv_scales[kCols];
+  std::int32_t chunk_sums[kCols];
+  const int src_rows = src_matrix.layout.rows;
+  // Distances between consecutive source entries along rows and columns.
+  const bool src_is_col_major = IsColMajor(src_matrix.layout);
+  const int row_inc = src_is_col_major ? 1 : src_matrix.layout.stride;
+  const int col_inc = src_is_col_major ? src_matrix.layout.stride : 1;
+  for (int block_col = start_col; block_col < end_col; block_col += kCols) {
+    const int block_src_cols =
+        std::max(0, std::min(kCols, src_matrix.layout.cols - block_col));
+    for (int col = 0; col < kCols; col++) {
+      float scale = 1.f;
+      if (col < block_src_cols) {
+        const float* src_ptr =
+            src_matrix.data.get() + (block_col + col) * col_inc;
+        float max_abs = 0;
+        for (int row = 0; row < src_rows; row++) {
+          max_abs = std::max(max_abs, std::abs(src_ptr[row * row_inc]));
+        }
+        scale = DynamicQuantScale(max_abs);
+      }
+      packed_matrix->scales[block_col + col] = scale;
+      inv_scales[col] = 1.f / scale;
+    }
+    std::int32_t* sums = packed_matrix->sums;
+    if (sums) {
+      std::fill(sums + block_col, sums + block_col + kCols, 0);
+    }
+    for (int row = 0; row < packed_matrix->layout.rows; row += kChunkRows) {
+      const int chunk_src_rows =
+          std::max(0, std::min(kChunkRows, src_rows - row));
+      // The quantized chunk is column-major, whatever the source order.
+      Mat<std::int8_t> chunk;
+      chunk.data.set(static_cast<const std::int8_t*>(buf));
+      chunk.layout.rows = chunk_src_rows;
+      chunk.layout.cols = block_src_cols;
+      chunk.layout.order = Order::kColMajor;
+      chunk.layout.stride = kChunkRows;
+      for (int col = 0; col < block_src_cols; col++) {
+        const float* src_ptr = src_matrix.data.get() +
+                               (block_col + col) * col_inc + row * row_inc;
+        std::int8_t* chunk_ptr = buf + col * kChunkRows;
+        for (int r = 0; r < chunk_src_rows; r++) {
+          chunk_ptr[r] = DynamicQuantize(src_ptr[r * row_inc], inv_scales[col]);
+        }
+      }
+      // As in PackWidenedToFloat, the part of the packed matrix
+      // corresponding to the chunk is laid out like a whole packed matrix of
+      // one kernel block of columns.
+      PMat<std::int8_t> packed_chunk = *packed_matrix;
+      packed_chunk.data = packed_matrix->data +
+                          packed_matrix->layout.stride * block_col +
+                          row * kCols;
+      packed_chunk.sums = sums ? chunk_sums : nullptr;
+      packed_chunk.layout.rows =
+          std::min(kChunkRows, packed_matrix->layout.rows - row);
+      packed_chunk.layout.cols = kCols;
+      PackImpl<ThePath, FixedKernelLayout, std::int8_t, std::int8_t,
+               std::int32_t>::Run(tuning, chunk, &packed_chunk, 0, kCols);
+      if (sums) {
+        for (int col = 0; col < kCols; col++) {
+          sums[block_col + col] += chunk_sums[col];
+        }
+      }
+    }
+  }
+}
+
+// Computes the sums of each group of depth levels of the columns
+// [start_col, end_col) of a packed matrix from its packed entries, if it has
+// a group_size, see PEMat::group_size. The packing entry points below then
+// pass null sums to the packing code, so that it computes no sums of its own
+// over the whole depth. Each group is a whole number of kernel blocks of depth
+// levels, see MulParams::lhs_scales.
+template <typename PackedScalar>
+void PackGroupSums(PEMat* packed_matrix, int start_col, int end_col) {
+  if (!packed_matrix->group_size) {
+    return;
+  }
+  using SumsType = typename PMat<PackedScalar>::SumsType;
+  const PMat<PackedScalar> packed = UneraseType<PackedScalar>(*packed_matrix);
+  const PMatLayout& layout = packed.layout;
+  const int kernel_rows = layout.kernel.rows;
+  const int kernel_cols = layout.kernel.cols;
+  const int group_size = packed.group_size;
+  const int num_groups = NumWeightGroups(group_size, layout.rows);
+  const bool kernel_is_col_major = layout.kernel.order == Order::kColMajor;
+  RUY_DCHECK(IsColMajor(layout));
+  RUY_DCHECK_EQ(group_size % kernel_rows, 0);
+  RUY_DCHECK_EQ(start_col % kernel_cols, 0);
+  for (int block_col = start_col; block_col < end_col;
+       block_col += kernel_cols) {
+    SumsType* block_sums =
+        packed.sums + static_cast<std::ptrdiff_t>(block_col) * num_groups;
+    std::fill(block_sums, block_sums + kernel_cols * num_groups, 0);
+    const PackedScalar* block_ptr =
+        packed.data + static_cast<std::ptrdiff_t>(block_col) * layout.stride;
+    for (int d = 0; d < layout.rows; d += kernel_rows) {
+      const PackedScalar* ptr = block_ptr + d * kernel_cols;
+      SumsType* group_sums = block_sums + d / group_size;
+      for (int col = 0; col < kernel_cols; col++) {
+        SumsType sum = 0;
+        for (int r = 0; r < kernel_rows; r++) {
+          sum += ptr[kernel_is_col_major ? col * kernel_rows + r
+                                         : r * kernel_cols + col];
+        }
+        group_sums[col * num_groups] += sum;
+      }
+    }
+  }
+}
+
+// Entry point for packing a float source matrix into an int8 packed matrix,
+// see PackQuantizedToInt8.
+template <Path ThePath, typename FixedKernelLayout>
+void RunQuantizingPack(Tuning tuning, const EMat& src_matrix,
+                       PEMat* packed_matrix, int start_col, int end_col) {
+  profiler::ScopeLabel label("Pack (quantizing to int8)");
+  Mat<float> src = UneraseType<float>(src_matrix);
+  PMat<std::int8_t> packed = UneraseType<std::int8_t>(*packed_matrix);
+  RUY_DCHECK_EQ(packed.origin_col, 0);
+  if (packed.group_size) {
+    packed.sums = nullptr;
+  }
+  PackQuantizedToInt8<ThePath, FixedKernelLayout>(tuning, src, &packed,
+                                                  start_col, end_col);
+  PackGroupSums<std::int8_t>(packed_matrix, start_col, end_col);
+}
+
+// Number of rows of an int4 source matrix that PackInt4ToInt8 expands to
+// int8 at once.
+constexpr int kExpandInt4ChunkRows = 128;
+
+// Expands the `count` int4 entries at linear offsets [offset, offset + count)
+// of `data` to int8, minus zero_point. The entries are read two per byte,
+// except possibly the first and the last.
+inline void ExpandInt4(const int4* data, std::ptrdiff_t offset, int count,
+                       std::int32_t zero_point, std::int8_t* dst_ptr) {
+  int i = 0;
+  if ((offset & 1) && count > 0) {
+    dst_ptr[i++] = Int4Entry(data, offset) - zero_point;
+  }
+  const std::uint8_t* bytes =
+      reinterpret_cast<const std::uint8_t*>(data) + (offset + i) / 2;
+  for (; i + 1 < count; i += 2) {
+    const std::uint8_t byte = *bytes++;
+    dst_ptr[i] = static_cast<int>((byte & 0xf) ^ 8) - 8 - zero_point;
+    dst_ptr[i + 1] = static_cast<int>((byte >> 4) ^ 8) - 8 - zero_point;
+  }
+  if (i < count) {
+    dst_ptr[i] = Int4Entry(data, offset + i) - zero_point;
+  }
+}
+
+// Expands int4 entries to int8 for PackInt4ToInt8, as ExpandInt4 does. Paths
+// with dedicated 8-bit packing code specialize this with a SIMD expansion.
+template <Path ThePath>
+struct ExpandInt4Impl {
+  static void Run(const int4* data, std::ptrdiff_t offset, int count,
+                  std::int32_t zero_point, std::int8_t* dst_ptr) {
+    ExpandInt4(data, offset, count, zero_point, dst_ptr);
+  }
+};
+
+// Packs an int4 source matrix into an int8 packed matrix, subtracting from
+// each entry its zero point, which may be given per group along the depth
+// dimension, see Mat::zero_points. The resulting values are in [-15, 15], so
+// the packed matrix has a zero point of 0. Chunks of the source matrix, of at
+// most kExpandInt4ChunkRows rows and one kernel block of columns, are expanded
+// into a small local buffer, which is then packed by the 8-bit PackImpl of
+// the path, as in PackQuantizedToInt8. The runs of a column of a
+// column-major source matrix within a group are expanded by ExpandInt4Impl.
+// For a GEMV, this is called on a few kernel blocks of columns at a time,
+// which the GEMV reads while they are in cache, see GemvTask, so the int8
+// expansion of the whole matrix is never stored.
+template <Path ThePath, typename FixedKernelLayout>
+void PackInt4ToInt8(Tuning tuning, const Mat<int4>& src_matrix,
+                    PMat<std::int8_t>* packed_matrix, int start_col,
+                    int end_col) {
+  static constexpr int kCols = FixedKernelLayout::kCols;
+  static constexpr int kChunkRows = kExpandInt4ChunkRows;
+  static_assert(kChunkRows % FixedKernelLayout::kRows == 0, "");
+  RUY_DCHECK(IsColMajor(packed_matrix->layout));
+  RUY_DCHECK_EQ((end_col - start_col) % kCols, 0);
+  RUY_DCHECK_EQ(start_col % kCols, 0);
+  RUY_DCHECK_EQ(packed_matrix->zero_point, 0);
+  std::int8_t buf[kChunkRows * kCols];
+  std::int32_t chunk_sums[kCols];
+  const int4* src_data = src_matrix.data.get();
+  const bool src_is_col_major = IsColMajor(src_matrix.layout);
+  const int src_stride = src_matrix.layout.stride;
+  const int src_cols = src_matrix.layout.cols;
+  const std::int8_t* zero_points = src_matrix.zero_points;
+  const int group_size = src_matrix.group_size;
+  const int row_offset = src_matrix.group_row_offset;
+  const int first_channel = src_matrix.group_col_offset;
+  const int channels = src_cols + first_channel;
+  for (int block_col = start_col; block_col < end_col; block_col += kCols) {
+    const int block_src_cols =
+        std::max(0, std::min(kCols, src_cols - block_col));
+    std::int32_t* sums = packed_matrix->sums;
+    if (sums) {
+      std::fill(sums + block_col, sums + block_col + kCols, 0);
+    }
+    for (int row = 0; row < packed_matrix->layout.rows; row += kChunkRows) {
+      const int chunk_src_rows =
+          std::max(0, std::min(kChunkRows, src_matrix.layout.rows - row));
+      // The expanded chunk is column-major, whatever the source order.
+      Mat<std::int8_t> chunk;
+      chunk.data.set(static_cast<const std::int8_t*>(buf));
+      chunk.layout.rows = chunk_src_rows;
+      chunk.layout.cols = block_src_cols;
+      chunk.layout.order = Order::kColMajor;
+      chunk.layout.stride = kChunkRows;
+      for (int col = 0; col < block_src_cols; col++) {
+        std::int8_t* chunk_ptr = buf + col * kChunkRows;
+        if (src_is_col_major) {
+          // Runs of the column within a group share their zero point.
+          const std::ptrdiff_t col_offset =
+              static_cast<std::ptrdiff_t>(block_col + col) * src_stride + row;
+          int r = 0;
+          while (r < chunk_src_rows) {
+            const int k = row_offset + row + r;
+            const int count =
+                group_size ? std::min(chunk_src_rows - r,
+                                      group_size - k % group_size)
+                           : chunk_src_rows - r;
+            ExpandInt4Impl<ThePath>::Run(
+                src_data, col_offset + r, count,
+                WeightZeroPoint(zero_points, group_size, channels,
+                                first_channel + block_col + col, k,
+                                src_matrix.zero_point),
+                chunk_ptr + r);
+            r += count;
+          }
+        } else {
+          for (int r = 0; r < chunk_src_rows; r++) {
+            const int k = row_offset + row + r;
+            const std::ptrdiff_t offset =
+                static_cast<std::ptrdiff_t>(row + r) * src_stride + block_col +
+                col;
+            chunk_ptr[r] =
+                Int4Entry(src_data, offset) -
+                WeightZeroPoint(zero_points, group_size, channels,
+                                first_channel + block_col + col, k,
+                                src_matrix.zero_point);
+          }
+        }
+      }
+      // As in PackWidenedToFloat, the part of the packed matrix
+      // corresponding to the chunk is laid out like a whole packed matrix of
+      // one kernel block of columns.
+      PMat<std::int8_t> packed_chunk = *packed_matrix;
+      packed_chunk.data = packed_matrix->data +
+                          packed_matrix->layout.stride * block_col +
+                          row * kCols;
+      packed_chunk.sums = sums ? chunk_sums : nullptr;
+      packed_chunk.layout.rows =
+          std::min(kChunkRows, packed_matrix->layout.rows - row);
+      packed_chunk.layout.cols = kCols;
+      PackImpl<ThePath, FixedKernelLayout, std::int8_t, std::int8_t,
+               std::int32_t>::Run(tuning, chunk, &packed_chunk, 0, kCols);
+      if (sums) {
+        for (int col = 0; col < kCols; col++) {
+          sums[block_col + col] += chunk_sums[col];
+        }
+      }
+    }
+  }
+}
+
+// Entry point for packing an int4 source matrix into an int8 packed matrix,
+// see PackInt4ToInt8.
+template <Path ThePath, typename FixedKernelLayout>
+void RunInt4ExpandingPack(Tuning tuning, const EMat& src_matrix,
+                          PEMat* packed_matrix, int start_col, int end_col) {
+  profiler::ScopeLabel label("Pack (expanding int4 to int8)");
+  Mat<int4> src = UneraseType<int4>(src_matrix);
+  PMat<std::int8_t> packed = UneraseType<std::int8_t>(*packed_matrix);
+  RUY_DCHECK_EQ(packed.origin_col, 0);
+  if (packed.group_size) {
+    packed.sums = nullptr;
+  }
+  PackInt4ToInt8<ThePath, FixedKernelLayout>(tuning, src, &packed, start_col,
+                                             end_col);
+  PackGroupSums<std::int8_t>(packed_matrix, start_col, end_col);
+}
+
 // Main entry point for packing.
 template <Path ThePath, typename FixedKernelLayout, typename Scalar,
           typename PackedScalar>
@@ -169,8 +695,13 @@ void RunPack(Tuning tuning, const EMat& src_matrix, PEMat* packed_matrix,
   using SumsType = typename PMat<PackedScalar>::SumsType;
   Mat<Scalar> src = UneraseType<Scalar>(src_matrix);
   PMat<PackedScalar> packed = UneraseType<PackedScalar>(*packed_matrix);
+  RUY_DCHECK_EQ(packed.origin_col, 0);
+  if (packed.group_size) {
+    packed.sums = nullptr;
+  }
   PackImpl<ThePath, FixedKernelLayout, Scalar, PackedScalar, SumsType>::Run(
       tuning, src, &packed, start_col, end_col);
+  PackGroupSums<PackedScalar>(packed_matrix, start_col, end_col);
 }
 
 }  // namespace ruy
@@ -16,12 +16,15 @@ limitations under the License.
 #ifndef RUY_RUY_PACK_X86_H_
 #define RUY_RUY_PACK_X86_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <type_traits>
 
 #include "ruy/check_macros.h"
 #include "ruy/common.h"
+#include "ruy/float16.h"
+#include "ruy/int4.h"
 #include "ruy/mat.h"
 #include "ruy/matrix.h"
 #include "ruy/opt_set.h"
@@ -55,12 +58,18 @@ struct PackImpl<Path::kSse42, FixedKernelLayout<Order::kColMajor, 4, 8>, Scalar,
   static constexpr std::int8_t kInputXor =
       std::is_same<Scalar, std::int8_t>::value ? 0 : 0x80;
 
-  static void Run(Tuning, const Mat<Scalar>& src_matrix,
+  static void Run(Tuning tuning, const Mat<Scalar>& src_matrix,
                   PMat<std::int8_t>* packed_matrix, int start_col,
                   int end_col) {
     profiler::ScopeLabel label("Pack (SSE 4.2 8-bit)");
 
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
+    if (!IsColMajor(src_matrix.layout)) {
+      // No dedicated code for row-major sources on this placeholder path.
+      PackImpl<Path::kStandardCpp, Layout, Scalar, std::int8_t,
+               std::int32_t>::Run(tuning, src_matrix, packed_matrix,
+                                  start_col, end_col);
+      return;
+    }
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ((end_col - start_col) % Layout::kCols, 0);
     RUY_DCHECK_EQ(start_col % Layout::kCols, 0);
@@ -98,11 +107,16 @@ template <>
 struct PackImpl<Path::kSse42, FixedKernelLayout<Order::kRowMajor, 1, 8>, float,
                 float, float> {
   using Layout = FixedKernelLayout<Order::kRowMajor, 1, 8>;
-  static void Run(Tuning, const Mat<float>& src_matrix,
+  static void Run(Tuning tuning, const Mat<float>& src_matrix,
                   PMat<float>* packed_matrix, int start_col, int end_col) {
     profiler::ScopeLabel label("Pack (SSE 4.2 float)");
 
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
+    if (!IsColMajor(src_matrix.layout)) {
+      // No dedicated code for row-major sources on this placeholder path.
+      PackImpl<Path::kStandardCpp, Layout, float, float, float>::Run(
+          tuning, src_matrix, packed_matrix, start_col, end_col);
+      return;
+    }
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ((end_col - start_col) % Layout::kCols, 0);
     RUY_DCHECK_EQ(start_col % Layout::kCols, 0);
@@ -131,6 +145,14 @@ void Pack8bitAvx2(const std::int8_t* src_ptr, std::int8_t input_xor,
                   int remaining_src_cols, int src_rows, std::int8_t* packed_ptr,
                   std::int32_t* sums_ptr);
 
+// Variant of Pack8bitAvx2 for a row-major source. In that case, src_stride
+// is the distance between consecutive rows, and src_ptr points to the first
+// column of the block to pack.
+void Pack8bitRowMajorAvx2(const std::int8_t* src_ptr, std::int8_t input_xor,
+                          const std::int8_t* zerobuf, int src_stride,
+                          int remaining_src_cols, int src_rows,
+                          std::int8_t* packed_ptr, std::int32_t* sums_ptr);
+
 template <typename Scalar>
 struct PackImpl<Path::kAvx2, FixedKernelLayout<Order::kColMajor, 4, 8>, Scalar,
                 std::int8_t, std::int32_t> {
@@ -146,7 +168,6 @@ struct PackImpl<Path::kAvx2, FixedKernelLayout<Order::kColMajor, 4, 8>, Scalar,
                   int end_col) {
     profiler::ScopeLabel label("Pack (AVX2 8-bit)");
 
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ((end_col - start_col) % Layout::kCols, 0);
     RUY_DCHECK_EQ(start_col % Layout::kCols, 0);
@@ -154,21 +175,32 @@ struct PackImpl<Path::kAvx2, FixedKernelLayout<Order::kColMajor, 4, 8>, Scalar,
     Scalar zerobuf[Layout::kCols * Layout::kRows];
     memset(zerobuf, packed_matrix->zero_point ^ kInputXor,
            Layout::kCols * Layout::kRows * sizeof(Scalar));
+    const bool src_is_col_major = IsColMajor(src_matrix.layout);
     for (int block_col = start_col; block_col < end_col;
          block_col += Layout::kCols) {
       std::int32_t* sums_ptr = sums ? sums + block_col : nullptr;
       int src_stride = src_matrix.layout.stride;
-      const Scalar* src_ptr = src_matrix.data.get() + src_stride * block_col;
+      const Scalar* src_ptr =
+          src_matrix.data.get() +
+          (src_is_col_major ? src_stride * block_col : block_col);
       int remaining_src_cols = src_matrix.layout.cols - block_col;
 
       static constexpr int block_col_mask = ~(Layout::kCols - 1);  // High bits.
       std::int8_t* packed_ptr =
           packed_matrix->data +
           packed_matrix->layout.stride * (block_col & block_col_mask);
-      Pack8bitAvx2(reinterpret_cast<const std::int8_t*>(src_ptr), kInputXor,
-                   reinterpret_cast<const std::int8_t*>(zerobuf), src_stride,
-                   remaining_src_cols, src_matrix.layout.rows, packed_ptr,
-                   sums_ptr);
+      if (src_is_col_major) {
+        Pack8bitAvx2(reinterpret_cast<const std::int8_t*>(src_ptr), kInputXor,
+                     reinterpret_cast<const std::int8_t*>(zerobuf), src_stride,
+                     remaining_src_cols, src_matrix.layout.rows, packed_ptr,
+                     sums_ptr);
+      } else {
+        Pack8bitRowMajorAvx2(reinterpret_cast<const std::int8_t*>(src_ptr),
+                             kInputXor,
+                             reinterpret_cast<const std::int8_t*>(zerobuf),
+                             src_stride, remaining_src_cols,
+                             src_matrix.layout.rows, packed_ptr, sums_ptr);
+      }
     }
   }
 };
@@ -176,6 +208,11 @@ struct PackImpl<Path::kAvx2, FixedKernelLayout<Order::kColMajor, 4, 8>, Scalar,
 void PackFloatAvx2(const float* src_ptr, const float* zerobuf, int src_stride,
                    int remaining_src_cols, int src_rows, float* packed_ptr);
 
+// Variant of PackFloatAvx2 for a row-major source, see Pack8bitRowMajorAvx2.
+void PackFloatRowMajorAvx2(const float* src_ptr, const float* zerobuf,
+                           int src_stride, int remaining_src_cols,
+                           int src_rows, float* packed_ptr);
+
 template <>
 struct PackImpl<Path::kAvx2, FixedKernelLayout<Order::kRowMajor, 1, 8>, float,
                 float, float> {
@@ -184,28 +221,89 @@ struct PackImpl<Path::kAvx2, FixedKernelLayout<Order::kRowMajor, 1, 8>, float,
                   PMat<float>* packed_matrix, int start_col, int end_col) {
     profiler::ScopeLabel label("Pack (AVX2 float)");
 
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ((end_col - start_col) % Layout::kCols, 0);
     RUY_DCHECK_EQ(start_col % Layout::kCols, 0);
     const float zerobuf[Layout::kCols] = {
         0.0f};  // Remainder default inits to 0.0f.
+    const bool src_is_col_major = IsColMajor(src_matrix.layout);
     for (int block_col = start_col; block_col < end_col;
          block_col += Layout::kCols) {
       int src_stride = src_matrix.layout.stride;
-      const float* src_ptr = src_matrix.data.get() + src_stride * block_col;
+      const float* src_ptr =
+          src_matrix.data.get() +
+          (src_is_col_major ? src_stride * block_col : block_col);
       int remaining_src_cols = src_matrix.layout.cols - block_col;
 
       static constexpr int block_col_mask = ~(Layout::kCols - 1);  // High bits.
       float* packed_ptr =
           packed_matrix->data +
           packed_matrix->layout.stride * (block_col & block_col_mask);
-      PackFloatAvx2(src_ptr, zerobuf, src_stride, remaining_src_cols,
-                    src_matrix.layout.rows, packed_ptr);
+      if (src_is_col_major) {
+        PackFloatAvx2(src_ptr, zerobuf, src_stride, remaining_src_cols,
+                      src_matrix.layout.rows, packed_ptr);
+      } else {
+        PackFloatRowMajorAvx2(src_ptr, zerobuf, src_stride, remaining_src_cols,
+                              src_matrix.layout.rows, packed_ptr);
+      }
     }
   }
 };
 
+// Widens `count` contiguous 16-bit floating-point values to float, see
+// PackWidenedToFloat.
+void WidenToFloatAvx2(const bfloat16* src_ptr, int count, float* dst_ptr);
+void WidenToFloatAvx2(const float16* src_ptr, int count, float* dst_ptr);
+
+template <typename Scalar>
+struct PackImpl<Path::kAvx2, FixedKernelLayout<Order::kRowMajor, 1, 8>,
+                Scalar, float, float> {
+  static_assert(std::is_same<Scalar, bfloat16>::value ||
+                    std::is_same<Scalar, float16>::value,
+                "");
+  using Layout = FixedKernelLayout<Order::kRowMajor, 1, 8>;
+  static void Run(Tuning tuning, const Mat<Scalar>& src_matrix,
+                  PMat<float>* packed_matrix, int start_col, int end_col) {
+    profiler::ScopeLabel label("Pack (AVX2 16-bit float)");
+    PackWidenedToFloat<Path::kAvx2, Layout>(
+        tuning, src_matrix, packed_matrix, start_col, end_col,
+        [](const Scalar* src_ptr, int count, float* dst_ptr) {
+          WidenToFloatAvx2(src_ptr, count, dst_ptr);
+        });
+  }
+};
+
+// Dequantizes `count` contiguous int8 weights sharing the same scale, see
+// PackDequantizedToFloat.
+void DequantizeToFloatAvx2(const std::int8_t* src_ptr, int count,
+                           std::int32_t zero_point, float scale,
+                           float* dst_ptr);
+
+template <>
+struct PackImpl<Path::kAvx2, FixedKernelLayout<Order::kRowMajor, 1, 8>,
+                std::int8_t, float, float> {
+  using Layout = FixedKernelLayout<Order::kRowMajor, 1, 8>;
+  static void Run(Tuning tuning, const Mat<std::int8_t>& src_matrix,
+                  PMat<float>* packed_matrix, int start_col, int end_col) {
+    profiler::ScopeLabel label("Pack (AVX2 dequantizing int8)");
+    PackDequantizedToFloat<Path::kAvx2, Layout>(
+        tuning, src_matrix, packed_matrix, start_col, end_col,
+        &DequantizeToFloatAvx2);
+  }
+};
+
+// Expands `count` int4 entries to int8, see ExpandInt4.
+void ExpandInt4Avx2(const int4* data, std::ptrdiff_t offset, int count,
+                    std::int32_t zero_point, std::int8_t* dst_ptr);
+
+template <>
+struct ExpandInt4Impl<Path::kAvx2> {
+  static void Run(const int4* data, std::ptrdiff_t offset, int count,
+                  std::int32_t zero_point, std::int8_t* dst_ptr) {
+    ExpandInt4Avx2(data, offset, count, zero_point, dst_ptr);
+  }
+};
+
 // Note that source and zero buffers can be uint8 type, but in the packing
 // function are reinterpreted as int8, and are XOR-ed with input_xor.
 void Pack8bitAvx512(const std::int8_t* src_ptr, std::int8_t input_xor,
@@ -213,6 +311,14 @@ void Pack8bitAvx512(const std::int8_t* src_ptr, std::int8_t input_xor,
                     int remaining_src_cols, int src_rows,
                     std::int8_t* packed_ptr, std::int32_t* sums_ptr);
 
+// Variant of Pack8bitAvx512 for a row-major source. In that case, src_stride
+// is the distance between consecutive rows, and src_ptr points to the first
+// column of the block to pack.
+void Pack8bitRowMajorAvx512(const std::int8_t* src_ptr, std::int8_t input_xor,
+                            const std::int8_t* zerobuf, int src_stride,
+                            int remaining_src_cols, int src_rows,
+                            std::int8_t* packed_ptr, std::int32_t* sums_ptr);
+
 template <typename Scalar>
 struct PackImpl<Path::kAvx512, FixedKernelLayout<Order::kColMajor, 4, 16>,
                 Scalar, std::int8_t, std::int32_t> {
@@ -230,7 +336,6 @@ struct PackImpl<Path::kAvx512, FixedKernelLayout<Order::kColMajor, 4, 16>,
                   int end_col) {
     profiler::ScopeLabel label("Pack (AVX-512 8-bit)");
 
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ((end_col - start_col) % Layout::kCols, 0);
     RUY_DCHECK_EQ(start_col % Layout::kCols, 0);
@@ -239,21 +344,32 @@ struct PackImpl<Path::kAvx512, FixedKernelLayout<Order::kColMajor, 4, 16>,
     Scalar zerobuf[kHalfLayoutCols * Layout::kRows];
     memset(zerobuf, packed_matrix->zero_point ^ kInputXor,
            kHalfLayoutCols * Layout::kRows * sizeof(Scalar));
+    const bool src_is_col_major = IsColMajor(src_matrix.layout);
     for (int block_col = start_col; block_col < end_col;
          block_col += Layout::kCols) {
       std::int32_t* sums_ptr = sums ? sums + block_col : nullptr;
       int src_stride = src_matrix.layout.stride;
-      const Scalar* src_ptr = src_matrix.data.get() + src_stride * block_col;
+      const Scalar* src_ptr =
+          src_matrix.data.get() +
+          (src_is_col_major ? src_stride * block_col : block_col);
       int remaining_src_cols = src_matrix.layout.cols - block_col;
 
       static constexpr int block_col_mask = ~(Layout::kCols - 1);  // High bits.
       std::int8_t* packed_ptr =
           packed_matrix->data +
           packed_matrix->layout.stride * (block_col & block_col_mask);
-      Pack8bitAvx512(reinterpret_cast<const std::int8_t*>(src_ptr), kInputXor,
-                     reinterpret_cast<const std::int8_t*>(zerobuf), src_stride,
-                     remaining_src_cols, src_matrix.layout.rows, packed_ptr,
-                     sums_ptr);
+      if (src_is_col_major) {
+        Pack8bitAvx512(reinterpret_cast<const std::int8_t*>(src_ptr), kInputXor,
+                       reinterpret_cast<const std::int8_t*>(zerobuf),
+                       src_stride, remaining_src_cols, src_matrix.layout.rows,
+                       packed_ptr, sums_ptr);
+      } else {
+        Pack8bitRowMajorAvx512(reinterpret_cast<const std::int8_t*>(src_ptr),
+                               kInputXor,
+                               reinterpret_cast<const std::int8_t*>(zerobuf),
+                               src_stride, remaining_src_cols,
+                               src_matrix.layout.rows, packed_ptr, sums_ptr);
+      }
     }
   }
 };
@@ -261,6 +377,12 @@ struct PackImpl<Path::kAvx512, FixedKernelLayout<Order::kColMajor, 4, 16>,
 void PackFloatAvx512(const float* src_ptr, const float* zerobuf, int src_stride,
                      int remaining_src_cols, int src_rows, float* packed_ptr);
 
+// Variant of PackFloatAvx512 for a row-major source, see
+// Pack8bitRowMajorAvx512.
+void PackFloatRowMajorAvx512(const float* src_ptr, const float* zerobuf,
+                             int src_stride, int remaining_src_cols,
+                             int src_rows, float* packed_ptr);
+
 template <>
 struct PackImpl<Path::kAvx512, FixedKernelLayout<Order::kRowMajor, 1, 16>,
                 float, float, float> {
@@ -268,28 +390,91 @@ struct PackImpl<Path::kAvx512, FixedKernelLayout<Order::kRowMajor, 1, 16>,
                   PMat<float>* packed_matrix, int start_col, int end_col) {
     profiler::ScopeLabel label("Pack (AVX-512 float)");
     using Layout = FixedKernelLayout<Order::kRowMajor, 1, 16>;
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ((end_col - start_col) % Layout::kCols, 0);
     RUY_DCHECK_EQ(start_col % Layout::kCols, 0);
     const float zerobuf[Layout::kCols] = {
         0.0f};  // Remainder default inits to 0.0f.
+    const bool src_is_col_major = IsColMajor(src_matrix.layout);
     for (int block_col = start_col; block_col < end_col;
          block_col += Layout::kCols) {
       int src_stride = src_matrix.layout.stride;
-      const float* src_ptr = src_matrix.data.get() + src_stride * block_col;
+      const float* src_ptr =
+          src_matrix.data.get() +
+          (src_is_col_major ? src_stride * block_col : block_col);
       int remaining_src_cols = src_matrix.layout.cols - block_col;
 
       static constexpr int block_col_mask = ~(Layout::kCols - 1);  // High bits.
       float* packed_ptr =
           packed_matrix->data +
           packed_matrix->layout.stride * (block_col & block_col_mask);
-      PackFloatAvx512(src_ptr, zerobuf, src_stride, remaining_src_cols,
-                      src_matrix.layout.rows, packed_ptr);
+      if (src_is_col_major) {
+        PackFloatAvx512(src_ptr, zerobuf, src_stride, remaining_src_cols,
+                        src_matrix.layout.rows, packed_ptr);
+      } else {
+        PackFloatRowMajorAvx512(src_ptr, zerobuf, src_stride,
+                                remaining_src_cols, src_matrix.layout.rows,
+                                packed_ptr);
+      }
     }
   }
 };
 
+// AVX-512 variants of WidenToFloatAvx2.
+void WidenToFloatAvx512(const bfloat16* src_ptr, int count, float* dst_ptr);
+void WidenToFloatAvx512(const float16* src_ptr, int count, float* dst_ptr);
+
+template <typename Scalar>
+struct PackImpl<Path::kAvx512, FixedKernelLayout<Order::kRowMajor, 1, 16>,
+                Scalar, float, float> {
+  static_assert(std::is_same<Scalar, bfloat16>::value ||
+                    std::is_same<Scalar, float16>::value,
+                "");
+  using Layout = FixedKernelLayout<Order::kRowMajor, 1, 16>;
+  static void Run(Tuning tuning, const Mat<Scalar>& src_matrix,
+                  PMat<float>* packed_matrix, int start_col, int end_col) {
+    profiler::ScopeLabel label("Pack (AVX-512 16-bit float)");
+    PackWidenedToFloat<Path::kAvx512, Layout>(
+        tuning, src_matrix, packed_matrix, start_col, end_col,
+        [](const Scalar* src_ptr, int count, float* dst_ptr) {
+          WidenToFloatAvx512(src_ptr, count, dst_ptr);
+        });
+  }
+};
+
+// AVX-512 variant of DequantizeToFloatAvx2.
+void DequantizeToFloatAvx512(const std::int8_t* src_ptr, int count,
+                             std::int32_t zero_point, float scale,
+                             float* dst_ptr);
+
+template <>
+struct PackImpl<Path::kAvx512, FixedKernelLayout<Order::kRowMajor, 1, 16>,
+                std::int8_t, float, float> {
+  using Layout = FixedKernelLayout<Order::kRowMajor, 1, 16>;
+  static void Run(Tuning tuning, const Mat<std::int8_t>& src_matrix,
+                  PMat<float>* packed_matrix, int start_col, int end_col) {
+    profiler::ScopeLabel label("Pack (AVX-512 dequantizing int8)");
+    PackDequantizedToFloat<Path::kAvx512, Layout>(
+        tuning, src_matrix, packed_matrix, start_col, end_col,
+        &DequantizeToFloatAvx512);
+  }
+};
+
+// AVX-512 variant of ExpandInt4Avx2.
+void ExpandInt4Avx512(const int4* data, std::ptrdiff_t offset, int count,
+                      std::int32_t zero_point, std::int8_t* dst_ptr);
+
+template <>
+struct ExpandInt4Impl<Path::kAvx512> {
+  static void Run(const int4* data, std::ptrdiff_t offset, int count,
+                  std::int32_t zero_point, std::int8_t* dst_ptr) {
+    ExpandInt4Avx512(data, offset, count, zero_point, dst_ptr);
+  }
+};
+
+template <>
+struct ExpandInt4Impl<Path::kAvxVnni> : ExpandInt4Impl<Path::kAvx512> {};
+
 // TODO(b/147376783): SSE 4.2 and AVX-VNNI support is incomplete / placeholder.
 // Optimization is not finished. In particular the dimensions of the kernel
 // blocks can be changed as desired.
@@ -313,12 +498,18 @@ struct PackImpl<Path::kAvxVnni, FixedKernelLayout<Order::kColMajor, 4, 16>,
   static constexpr std::int8_t kInputXor =
       std::is_same<Scalar, std::int8_t>::value ? 0 : 0x80;
 
-  static void Run(Tuning, const Mat<Scalar>& src_matrix,
+  static void Run(Tuning tuning, const Mat<Scalar>& src_matrix,
                   PMat<std::int8_t>* packed_matrix, int start_col,
                   int end_col) {
     profiler::ScopeLabel label("Pack (AVX-512 8-bit)");
 
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
+    if (!IsColMajor(src_matrix.layout)) {
+      // No dedicated code for row-major sources on this placeholder path.
+      PackImpl<Path::kStandardCpp, Layout, Scalar, std::int8_t,
+               std::int32_t>::Run(tuning, src_matrix, packed_matrix,
+                                  start_col, end_col);
+      return;
+    }
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ((end_col - start_col) % Layout::kCols, 0);
     RUY_DCHECK_EQ(start_col % Layout::kCols, 0);
@@ -357,12 +548,17 @@ void PackFloatAvxVnni(const float* src_ptr, const float* zerobuf,
 template <>
 struct PackImpl<Path::kAvxVnni, FixedKernelLayout<Order::kRowMajor, 1, 16>,
                 float, float, float> {
-  static void Run(Tuning, const Mat<float>& src_matrix,
+  static void Run(Tuning tuning, const Mat<float>& src_matrix,
                   PMat<float>* packed_matrix, int start_col, int end_col) {
     profiler::ScopeLabel label("Pack (AVX-512 float)");
 
     using Layout = FixedKernelLayout<Order::kRowMajor, 1, 16>;
-    RUY_DCHECK(IsColMajor(src_matrix.layout));
+    if (!IsColMajor(src_matrix.layout)) {
+      // No dedicated code for row-major sources on this placeholder path.
+      PackImpl<Path::kStandardCpp, Layout, float, float, float>::Run(
+          tuning, src_matrix, packed_matrix, start_col, end_col);
+      return;
+    }
     RUY_DCHECK(IsColMajor(packed_matrix->layout));
     RUY_DCHECK_EQ((end_col - start_col) % Layout::kCols, 0);
     RUY_DCHECK_EQ(start_col % Layout::kCols, 0);
@@ -0,0 +1,231 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "ruy/packed_matrix.h"
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "ruy/check_macros.h"
+#include "ruy/size_util.h"
+
+namespace ruy {
+namespace detail {
+
+namespace {
+
+// Bump whenever the blob format changes. Blobs of other versions are rejected.
+constexpr std::uint32_t kPackedMatrixBlobVersion = 2;
+constexpr char kPackedMatrixBlobMagic[8] = "ruypack";
+// Written in native byte order, so that a blob written on a machine of the
+// opposite byte order is rejected.
+constexpr std::uint32_t kByteOrderMark = 0x01020304;
+
+// The header at the start of a blob, followed by the packed data, then the
+// sums if any, each aligned to kMinimumBlockAlignment.
+struct BlobHeader final {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order_mark;
+  double src_zero_point;
+  std::int32_t path;
+  std::int32_t src_rows;
+  std::int32_t src_cols;
+  std::int32_t src_stride;
+  std::int32_t src_order;
+  std::int32_t src_type[3];
+  std::int32_t data_type[3];
+  std::int32_t sums_type[3];
+  std::int32_t packed_rows;
+  std::int32_t packed_cols;
+  std::int32_t packed_stride;
+  std::int32_t packed_order;
+  std::int32_t kernel_order;
+  std::int32_t kernel_rows;
+  std::int32_t kernel_cols;
+  std::int32_t packed_zero_point;
+  std::int32_t group_size;
+  std::int64_t data_offset;
+  std::int64_t data_bytes;
+  std::int64_t sums_offset;
+  std::int64_t sums_bytes;
+};
+
+static_assert(std::is_trivially_copyable<BlobHeader>::value, "");
+
+void TypeToInts(const Type& type, std::int32_t* ints) {
+  ints[0] = type.is_signed;
+  ints[1] = type.is_floating_point;
+  ints[2] = type.size;
+}
+
+Type TypeFromInts(const std::int32_t* ints) {
+  Type type;
+  type.is_signed = ints[0];
+  type.is_floating_point = ints[1];
+  type.size = ints[2];
+  return type;
+}
+
+bool IsValidOrder(std::int32_t order) {
+  return order == static_cast<std::int32_t>(Order::kColMajor) ||
+         order == static_cast<std::int32_t>(Order::kRowMajor);
+}
+
+bool IsValidType(const Type& type) {
+  return type.size == 1 || type.size == 2 || type.size == 4 || type.size == 8;
+}
+
+std::int64_t DataOffset() {
+  return round_up_pot<std::int64_t>(sizeof(BlobHeader),
+                                    kMinimumBlockAlignment);
+}
+
+std::int64_t SumsOffset(std::int64_t data_bytes) {
+  return DataOffset() +
+         round_up_pot<std::int64_t>(data_bytes, kMinimumBlockAlignment);
+}
+
+bool HasSums(const PEMat& packed) {
+  return !packed.sums_type.is_floating_point;
+}
+
+}  // namespace
+
+std::size_t SerializedPackedMatrixBytes(const PEMat& packed) {
+  const std::int64_t data_bytes = DataBytes(packed);
+  const std::int64_t sums_bytes = HasSums(packed) ? SumsBytes(packed) : 0;
+  return SumsOffset(data_bytes) + sums_bytes;
+}
+
+void SerializePackedMatrix(const PackedMatrixDescription& description,
+                           void* blob) {
+  RUY_CHECK(reinterpret_cast<std::uintptr_t>(blob) % kMinimumBlockAlignment ==
+            0);
+  const PEMat& packed = description.packed;
+  BlobHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kPackedMatrixBlobMagic, sizeof(header.magic));
+  header.version = kPackedMatrixBlobVersion;
+  header.byte_order_mark = kByteOrderMark;
+  header.src_zero_point = description.src_zero_point;
+  header.path = static_cast<std::int32_t>(description.path);
+  header.src_rows = description.src_layout.rows;
+  header.src_cols = description.src_layout.cols;
+  header.src_stride = description.src_layout.stride;
+  header.src_order = static_cast<std::int32_t>(description.src_layout.order);
+  TypeToInts(description.src_type, header.src_type);
+  TypeToInts(packed.data_type, header.data_type);
+  TypeToInts(packed.sums_type, header.sums_type);
+  header.packed_rows = packed.layout.rows;
+  header.packed_cols = packed.layout.cols;
+  header.packed_stride = packed.layout.stride;
+  header.packed_order = static_cast<std::int32_t>(packed.layout.order);
+  header.kernel_order = static_cast<std::int32_t>(packed.layout.kernel.order);
+  header.kernel_rows = packed.layout.kernel.rows;
+  header.kernel_cols = packed.layout.kernel.cols;
+  header.packed_zero_point = packed.zero_point;
+  header.group_size = packed.group_size;
+  header.data_bytes = DataBytes(packed);
+  header.data_offset = DataOffset();
+  header.sums_bytes = HasSums(packed) ? SumsBytes(packed) : 0;
+  header.sums_offset = header.sums_bytes ? SumsOffset(header.data_bytes) : 0;
+
+  char* dst = static_cast<char*>(blob);
+  std::memset(dst, 0, header.data_offset);
+  std::memcpy(dst, &header, sizeof(header));
+  std::memcpy(dst + header.data_offset, packed.data, header.data_bytes);
+  if (header.sums_bytes) {
+    std::memset(dst + header.data_offset + header.data_bytes, 0,
+                header.sums_offset - header.data_offset - header.data_bytes);
+    std::memcpy(dst + header.sums_offset, packed.sums, header.sums_bytes);
+  }
+}
+
+bool DeserializePackedMatrix(const void* blob, std::size_t size,
+                             PackedMatrixDescription* result) {
+  if (reinterpret_cast<std::uintptr_t>(blob) % kMinimumBlockAlignment ||
+      size < sizeof(BlobHeader)) {
+    return false;
+  }
+  BlobHeader header;
+  std::memcpy(&header, blob, sizeof(header));
+  if (std::memcmp(header.magic, kPackedMatrixBlobMagic,
+                  sizeof(header.magic)) ||
+      header.version != kPackedMatrixBlobVersion ||
+      header.byte_order_mark != kByteOrderMark) {
+    return false;
+  }
+  if (!IsValidOrder(header.src_order) || !IsValidOrder(header.packed_order) ||
+      !IsValidOrder(header.kernel_order) || header.src_rows < 0 ||
+      header.src_cols < 0 || header.packed_rows < header.src_cols ||
+      header.packed_cols < header.src_rows || header.kernel_rows <= 0 ||
+      header.kernel_cols <= 0 || header.kernel_rows > 255 ||
+      header.kernel_cols > 255 || header.group_size < 0) {
+    return false;
+  }
+
+  PackedMatrixDescription& description = *result;
+  description.path = static_cast<Path>(header.path);
+  description.src_layout.rows = header.src_rows;
+  description.src_layout.cols = header.src_cols;
+  description.src_layout.stride = header.src_stride;
+  description.src_layout.order = static_cast<Order>(header.src_order);
+  description.src_type = TypeFromInts(header.src_type);
+  description.src_zero_point = header.src_zero_point;
+  PEMat& packed = description.packed;
+  packed.data_type = TypeFromInts(header.data_type);
+  packed.sums_type = TypeFromInts(header.sums_type);
+  packed.layout.rows = header.packed_rows;
+  packed.layout.cols = header.packed_cols;
+  packed.layout.stride = header.packed_stride;
+  packed.layout.order = static_cast<Order>(header.packed_order);
+  packed.layout.kernel.order = static_cast<Order>(header.kernel_order);
+  packed.layout.kernel.rows = header.kernel_rows;
+  packed.layout.kernel.cols = header.kernel_cols;
+  packed.zero_point = header.packed_zero_point;
+  packed.group_size = header.group_size;
+  if (!IsValidType(description.src_type) || !IsValidType(packed.data_type) ||
+      !IsValidType(packed.sums_type)) {
+    return false;
+  }
+  // Bound the packed size before computing it in int arithmetic.
+  if (packed.layout.stride < packed.layout.rows ||
+      static_cast<std::int64_t>(packed.layout.stride) * packed.layout.cols *
+              packed.data_type.size >
+          static_cast<std::int64_t>(size)) {
+    return false;
+  }
+
+  // Check that the buffers are where they should be, and within the blob.
+  const std::int64_t sums_bytes = HasSums(packed) ? SumsBytes(packed) : 0;
+  if (header.data_offset != DataOffset() ||
+      header.data_bytes != DataBytes(packed) ||
+      header.sums_bytes != sums_bytes ||
+      (sums_bytes && header.sums_offset != SumsOffset(header.data_bytes)) ||
+      SerializedPackedMatrixBytes(packed) > size) {
+    return false;
+  }
+  // The packed matrix is only ever read from, so it is fine for it to point
+  // into the const blob.
+  char* src = const_cast<char*>(static_cast<const char*>(blob));
+  packed.data = src + header.data_offset;
+  packed.sums = sums_bytes ? src + header.sums_offset : nullptr;
+  return true;
+}
+
+}  // namespace detail
+}  // namespace ruy
@@ -0,0 +1,194 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// PackedMatrix: an LHS matrix packed ahead of time by ruy::PrePack, and its
+// serialization to a binary blob.
+
+#ifndef RUY_RUY_PACKED_MATRIX_H_
+#define RUY_RUY_PACKED_MATRIX_H_
+
+#include <cstddef>
+#include <utility>
+
+#include "ruy/mat.h"
+#include "ruy/path.h"
+#include "ruy/system_aligned_alloc.h"
+
+namespace ruy {
+
+namespace detail {
+
+// Everything about a packed matrix that is stored in a serialized blob.
+struct PackedMatrixDescription final {
+  Path path = Path::kNone;
+  MatLayout src_layout;
+  Type src_type;
+  // Zero point of the source matrix. All supported source scalar types are
+  // exactly representable as double.
+  double src_zero_point = 0;
+  PEMat packed;
+};
+
+inline bool IsSameType(const Type& a, const Type& b) {
+  return a.is_signed == b.is_signed &&
+         a.is_floating_point == b.is_floating_point && a.size == b.size;
+}
+
+// Returns the size in bytes of the blob serializing `packed`.
+std::size_t SerializedPackedMatrixBytes(const PEMat& packed);
+
+// Writes the blob describing `description` to `blob`, which must be aligned to
+// kMinimumBlockAlignment and have room for
+// SerializedPackedMatrixBytes(description.packed) bytes.
+void SerializePackedMatrix(const PackedMatrixDescription& description,
+                           void* blob);
+
+// Reads back a blob written by SerializePackedMatrix. The data and sums
+// pointers of result->packed point into the blob: nothing is copied.
+// Returns false if `blob` isn't a valid blob of the current format version,
+// for the current byte order, or isn't aligned to kMinimumBlockAlignment.
+bool DeserializePackedMatrix(const void* blob, std::size_t size,
+                             PackedMatrixDescription* result);
+
+}  // namespace detail
+
+// An LHS matrix in the packed form used by ruy's kernels, as returned by
+// ruy::PrePack and consumed by the ruy::Mul overload taking a PackedMatrix.
+//
+// A PackedMatrix owns its buffers: once packed, the source matrix may be
+// freed, moved or modified without affecting it. Unlike caching through
+// Matrix::set_cache_policy, no lookup keyed on the source data pointer takes
+// place.
+//
+// The packed form depends on the Path and on the kernel that will consume it,
+// so a PackedMatrix may only be used in multiplications with the same scalar
+// and MulParams types as passed to PrePack, on a machine supporting the same
+// Path. This is checked at runtime.
+//
+// A PackedMatrix can be serialized to a binary blob, to be stored along with a
+// model and loaded back with ruy::LoadPrePacked, which skips packing entirely.
+// A loaded PackedMatrix does not own its buffers, which point into the blob.
+//
+// Movable, not copyable.
+template <typename LhsScalar>
+class PackedMatrix final {
+ public:
+  PackedMatrix() {}
+  // Used by ruy::PrePack. Allocates the buffers for a packed matrix described
+  // by `packed`, which the caller then fills.
+  PackedMatrix(Path path, const MatLayout& src_layout, LhsScalar zero_point,
+               const PEMat& packed)
+      : path_(path),
+        src_layout_(src_layout),
+        zero_point_(zero_point),
+        packed_(packed),
+        owns_buffers_(true) {
+    packed_.data = detail::SystemAlignedAlloc(DataBytes(packed_));
+    packed_.sums = nullptr;
+    if (!packed_.sums_type.is_floating_point) {
+      packed_.sums = detail::SystemAlignedAlloc(SumsBytes(packed_));
+    }
+  }
+  PackedMatrix(PackedMatrix&& other) { *this = std::move(other); }
+  PackedMatrix& operator=(PackedMatrix&& other) {
+    if (this != &other) {
+      Free();
+      path_ = other.path_;
+      src_layout_ = other.src_layout_;
+      zero_point_ = other.zero_point_;
+      packed_ = other.packed_;
+      owns_buffers_ = other.owns_buffers_;
+      other.packed_ = PEMat();
+      other.owns_buffers_ = false;
+    }
+    return *this;
+  }
+  ~PackedMatrix() { Free(); }
+
+  // Used by ruy::LoadPrePacked. Refers to the existing buffers of `packed`,
+  // which must outlive the returned PackedMatrix.
+  static PackedMatrix Borrowing(Path path, const MatLayout& src_layout,
+                                LhsScalar zero_point, const PEMat& packed) {
+    PackedMatrix result;
+    result.path_ = path;
+    result.src_layout_ = src_layout;
+    result.zero_point_ = zero_point;
+    result.packed_ = packed;
+    return result;
+  }
+
+  // Whether this holds a packed matrix, i.e. was returned by ruy::PrePack.
+  bool is_valid() const { return packed_.data != nullptr; }
+
+  // Dimensions of the source matrix.
+  int rows() const { return src_layout_.rows; }
+  int cols() const { return src_layout_.cols; }
+
+  // The Path that this matrix was packed for.
+  Path path() const { return path_; }
+
+  // Internal: the layout and zero point of the source matrix, and the packed
+  // matrix itself.
+  const MatLayout& src_layout() const { return src_layout_; }
+  LhsScalar zero_point() const { return zero_point_; }
+  const PEMat& packed() const { return packed_; }
+
+  // Whether the packed data is owned by this PackedMatrix, as opposed to
+  // pointing into a blob passed to ruy::LoadPrePacked.
+  bool owns_buffers() const { return owns_buffers_; }
+
+  // Size in bytes of the blob written by Serialize.
+  std::size_t SerializedSize() const {
+    return detail::SerializedPackedMatrixBytes(packed_);
+  }
+
+  // Writes this packed matrix to `blob`, which must have room for
+  // SerializedSize() bytes and be aligned to detail::kMinimumBlockAlignment
+  // (64 bytes). The blob format is versioned and records the Path and kernel
+  // layout, so that ruy::LoadPrePacked can tell whether it is usable as is.
+  // It uses the native byte order.
+  void Serialize(void* blob) const {
+    detail::PackedMatrixDescription description;
+    description.path = path_;
+    description.src_layout = src_layout_;
+    description.src_type = Type::Create<LhsScalar>();
+    description.src_zero_point = static_cast<double>(zero_point_);
+    description.packed = packed_;
+    detail::SerializePackedMatrix(description, blob);
+  }
+
+ private:
+  void Free() {
+    if (owns_buffers_) {
+      detail::SystemAlignedFree(packed_.data);
+      detail::SystemAlignedFree(packed_.sums);
+    }
+    packed_.data = nullptr;
+    packed_.sums = nullptr;
+  }
+
+  Path path_ = Path::kNone;
+  MatLayout src_layout_;
+  LhsScalar zero_point_ = 0;
+  PEMat packed_;
+  bool owns_buffers_ = false;
+
+  PackedMatrix(const PackedMatrix&) = delete;
+  PackedMatrix& operator=(const PackedMatrix&) = delete;
+};
+
+}  // namespace ruy
+
+#endif  // RUY_RUY_PACKED_MATRIX_H_
@@ -0,0 +1,324 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ruy/context.h"
+#include "ruy/context_get_ctx.h"
+#include "ruy/ctx.h"
+#include "ruy/gtest_wrapper.h"
+#include "ruy/matrix.h"
+#include "ruy/mul_params.h"
+#include "ruy/packed_matrix.h"
+#include "ruy/ruy.h"
+
+namespace ruy {
+namespace {
+
+template <typename Scalar>
+void FillRandom(std::mt19937* generator, std::vector<Scalar>* data) {
+  // Small integer values, so that float results are exact and comparable.
+  std::uniform_int_distribution<int> dist(-20, 20);
+  for (auto& x : *data) x = static_cast<Scalar>(dist(*generator));
+}
+
+template <typename LhsScalar, typename DstScalar>
+using TestMulParams = MulParams<
+    typename std::conditional<std::is_floating_point<LhsScalar>::value,
+                              LhsScalar, std::int32_t>::type,
+    DstScalar>;
+
+template <typename LhsScalar, typename DstScalar>
+TestMulParams<LhsScalar, DstScalar> MakeMulParams() {
+  TestMulParams<LhsScalar, DstScalar> mul_params;
+  if (!std::is_floating_point<DstScalar>::value &&
+      !std::is_same<DstScalar, std::int32_t>::value) {
+    mul_params.set_multiplier_fixedpoint(1 << 30);
+    mul_params.set_multiplier_exponent(-4);
+  }
+  return mul_params;
+}
+
+template <typename LhsScalar>
+Matrix<LhsScalar> MakeLhs(int rows, int depth, Order order,
+                          LhsScalar zero_point, std::mt19937* generator,
+                          std::vector<LhsScalar>* data) {
+  data->resize(rows * depth);
+  FillRandom(generator, data);
+  Matrix<LhsScalar> lhs;
+  MakeSimpleLayout(rows, depth, order, lhs.mutable_layout());
+  lhs.set_zero_point(zero_point);
+  lhs.set_data(data->data());
+  return lhs;
+}
+
+// Checks that multiplying by `packed_lhs` gives the same results as
+// multiplying by `lhs`, with RHS matrices of various widths.
+template <typename LhsScalar, typename RhsScalar, typename DstScalar>
+void CheckPackedMul(const PackedMatrix<LhsScalar>& packed_lhs,
+                    const Matrix<LhsScalar>& lhs, int cols,
+                    RhsScalar rhs_zero_point, std::mt19937* generator,
+                    Context* context) {
+  const auto mul_params = MakeMulParams<LhsScalar, DstScalar>();
+  const int rows = lhs.layout().rows();
+  const int depth = lhs.layout().cols();
+  ASSERT_TRUE(packed_lhs.is_valid());
+  EXPECT_EQ(packed_lhs.rows(), rows);
+  EXPECT_EQ(packed_lhs.cols(), depth);
+  for (int c : {1, cols}) {
+    std::vector<RhsScalar> rhs_data(depth * c);
+    FillRandom(generator, &rhs_data);
+    Matrix<RhsScalar> rhs;
+    MakeSimpleLayout(depth, c, Order::kColMajor, rhs.mutable_layout());
+    rhs.set_data(rhs_data.data());
+    rhs.set_zero_point(rhs_zero_point);
+
+    std::vector<DstScalar> dst_data(rows * c);
+    std::vector<DstScalar> expected_data(rows * c);
+    Matrix<DstScalar> dst;
+    MakeSimpleLayout(rows, c, Order::kColMajor, dst.mutable_layout());
+    dst.set_data(dst_data.data());
+    Matrix<DstScalar> expected = dst;
+    expected.set_data(expected_data.data());
+
+    Mul(packed_lhs, rhs, mul_params, context, &dst);
+    Mul(lhs, rhs, mul_params, context, &expected);
+    EXPECT_EQ(dst_data, expected_data) << "cols=" << c;
+  }
+}
+
+template <typename LhsScalar, typename RhsScalar, typename DstScalar>
+void TestPrePack(int rows, int depth, int cols, Order lhs_order,
+                 LhsScalar lhs_zero_point, RhsScalar rhs_zero_point,
+                 int max_num_threads) {
+  std::mt19937 generator(1);
+  std::vector<LhsScalar> lhs_data;
+  Matrix<LhsScalar> lhs = MakeLhs(rows, depth, lhs_order, lhs_zero_point,
+                                  &generator, &lhs_data);
+  Context context;
+  context.set_max_num_threads(max_num_threads);
+  const auto mul_params = MakeMulParams<LhsScalar, DstScalar>();
+
+  // Pack a copy of the LHS data, then overwrite and free it, to check that the
+  // PackedMatrix doesn't depend on it.
+  PackedMatrix<LhsScalar> packed_lhs;
+  EXPECT_FALSE(packed_lhs.is_valid());
+  {
+    std::vector<LhsScalar> lhs_data_copy = lhs_data;
+    Matrix<LhsScalar> lhs_copy = lhs;
+    lhs_copy.set_data(lhs_data_copy.data());
+    PackedMatrix<LhsScalar> tmp =
+        PrePack<RhsScalar>(lhs_copy, mul_params, &context);
+    lhs_data_copy.assign(lhs_data_copy.size(), 0);
+    packed_lhs = std::move(tmp);
+    EXPECT_FALSE(tmp.is_valid());
+  }
+  EXPECT_TRUE(packed_lhs.owns_buffers());
+  CheckPackedMul<LhsScalar, RhsScalar, DstScalar>(
+      packed_lhs, lhs, cols, rhs_zero_point, &generator, &context);
+}
+
+// A buffer aligned as required by PackedMatrix::Serialize.
+class Blob {
+ public:
+  explicit Blob(std::size_t size)
+      : storage_(size + kAlignment), size_(size) {
+    const std::size_t misalignment =
+        reinterpret_cast<std::uintptr_t>(storage_.data()) % kAlignment;
+    data_ = storage_.data() + (kAlignment - misalignment) % kAlignment;
+  }
+  char* data() { return data_; }
+  std::size_t size() const { return size_; }
+
+ private:
+  static constexpr std::size_t kAlignment = 64;
+  std::vector<char> storage_;
+  char* data_;
+  std::size_t size_;
+};
+
+template <typename LhsScalar>
+Blob Serialize(const PackedMatrix<LhsScalar>& packed_lhs) {
+  Blob blob(packed_lhs.SerializedSize());
+  packed_lhs.Serialize(blob.data());
+  return blob;
+}
+
+template <typename LhsScalar, typename RhsScalar, typename DstScalar>
+void TestSerialization(int rows, int depth, int cols, LhsScalar lhs_zero_point,
+                       RhsScalar rhs_zero_point) {
+  std::mt19937 generator(1);
+  std::vector<LhsScalar> lhs_data;
+  Matrix<LhsScalar> lhs = MakeLhs(rows, depth, Order::kRowMajor,
+                                  lhs_zero_point, &generator, &lhs_data);
+  Context context;
+  const auto mul_params = MakeMulParams<LhsScalar, DstScalar>();
+  Blob blob = Serialize(PrePack<RhsScalar>(lhs, mul_params, &context));
+
+  PackedMatrix<LhsScalar> loaded;
+  ASSERT_TRUE(LoadPrePacked<RhsScalar>(blob.data(), blob.size(), mul_params,
+                                       &context, &loaded));
+  EXPECT_FALSE(loaded.owns_buffers());
+  CheckPackedMul<LhsScalar, RhsScalar, DstScalar>(
+      loaded, lhs, cols, rhs_zero_point, &generator, &context);
+
+  PackedMatrix<LhsScalar> loaded_or_packed = LoadOrPrePack<RhsScalar>(
+      blob.data(), blob.size(), lhs, mul_params, &context);
+  EXPECT_FALSE(loaded_or_packed.owns_buffers());
+
+  // A truncated blob is rejected.
+  EXPECT_FALSE(LoadPrePacked<RhsScalar>(blob.data(), blob.size() - 1,
+                                        mul_params, &context, &loaded));
+  // A misaligned blob is rejected.
+  Blob misaligned(blob.size() + 1);
+  std::memcpy(misaligned.data() + 1, blob.data(), blob.size());
+  EXPECT_FALSE(LoadPrePacked<RhsScalar>(misaligned.data() + 1, blob.size(),
+                                        mul_params, &context, &loaded));
+  // A corrupted blob is rejected, and LoadOrPrePack then repacks.
+  blob.data()[0] ^= 1;
+  EXPECT_FALSE(LoadPrePacked<RhsScalar>(blob.data(), blob.size(), mul_params,
+                                        &context, &loaded));
+  loaded_or_packed = LoadOrPrePack<RhsScalar>(blob.data(), blob.size(), lhs,
+                                              mul_params, &context);
+  EXPECT_TRUE(loaded_or_packed.owns_buffers());
+  CheckPackedMul<LhsScalar, RhsScalar, DstScalar>(
+      loaded_or_packed, lhs, cols, rhs_zero_point, &generator, &context);
+}
+
+TEST(PrePackTest, Float) {
+  for (int max_num_threads : {1, 4}) {
+    TestPrePack<float, float, float>(1, 1, 1, Order::kRowMajor, 0, 0,
+                                     max_num_threads);
+    TestPrePack<float, float, float>(13, 27, 11, Order::kRowMajor, 0, 0,
+                                     max_num_threads);
+    TestPrePack<float, float, float>(200, 150, 90, Order::kColMajor, 0, 0,
+                                     max_num_threads);
+  }
+}
+
+TEST(PrePackTest, MultiThreaded) {
+  // Large enough for the packing to be split among threads.
+  for (int max_num_threads : {3, 8}) {
+    TestPrePack<float, float, float>(700, 500, 20, Order::kRowMajor, 0, 0,
+                                     max_num_threads);
+    TestPrePack<std::int8_t, std::int8_t, std::int32_t>(
+        1000, 900, 20, Order::kColMajor, 0, 0, max_num_threads);
+  }
+}
+
+TEST(PrePackTest, BatchPrePack) {
+  const int shapes[][2] = {{1, 1}, {13, 27}, {700, 500}, {200, 150}};
+  constexpr int kBatchSize = sizeof(shapes) / sizeof(shapes[0]);
+  std::mt19937 generator(1);
+  std::vector<std::vector<std::int8_t>> lhs_data(kBatchSize);
+  std::vector<Matrix<std::int8_t>> lhs;
+  for (int i = 0; i < kBatchSize; i++) {
+    lhs.push_back(MakeLhs<std::int8_t>(shapes[i][0], shapes[i][1],
+                                       Order::kRowMajor, 0, &generator,
+                                       &lhs_data[i]));
+  }
+  const auto mul_params = MakeMulParams<std::int8_t, std::int32_t>();
+  for (int max_num_threads : {1, 4}) {
+    Context context;
+    context.set_max_num_threads(max_num_threads);
+    std::vector<PackedMatrix<std::int8_t>> packed_lhs(kBatchSize);
+    BatchPrePack<std::int8_t>(lhs.data(), kBatchSize, mul_params, &context,
+                              packed_lhs.data());
+    for (int i = 0; i < kBatchSize; i++) {
+      EXPECT_TRUE(packed_lhs[i].owns_buffers());
+      CheckPackedMul<std::int8_t, std::int8_t, std::int32_t>(
+          packed_lhs[i], lhs[i], 11, 0, &generator, &context);
+    }
+  }
+}
+
+TEST(PrePackTest, Int8) {
+  for (int max_num_threads : {1, 4}) {
+    TestPrePack<std::int8_t, std::int8_t, std::int32_t>(
+        13, 27, 11, Order::kRowMajor, 0, 0, max_num_threads);
+    TestPrePack<std::int8_t, std::int8_t, std::int32_t>(
+        200, 150, 90, Order::kColMajor, 0, 0, max_num_threads);
+  }
+}
+
+TEST(PrePackTest, Int8WithZeroPoints) {
+  for (int max_num_threads : {1, 4}) {
+    TestPrePack<std::int8_t, std::int8_t, std::int8_t>(
+        13, 27, 11, Order::kRowMajor, 3, -5, max_num_threads);
+    TestPrePack<std::uint8_t, std::uint8_t, std::uint8_t>(
+        200, 150, 90, Order::kRowMajor, 128, 120, max_num_threads);
+  }
+}
+
+TEST(PrePackTest, Serialization) {
+  TestSerialization<float, float, float>(1, 1, 1, 0, 0);
+  TestSerialization<float, float, float>(200, 150, 90, 0, 0);
+  TestSerialization<std::int8_t, std::int8_t, std::int32_t>(13, 27, 11, 0, 0);
+  TestSerialization<std::uint8_t, std::uint8_t, std::uint8_t>(200, 150, 90,
+                                                              128, 120);
+}
+
+TEST(PrePackTest, SerializationPathMismatch) {
+  using MulParamsType = MulParams<float, float>;
+  std::mt19937 generator(1);
+  std::vector<float> lhs_data;
+  Matrix<float> lhs =
+      MakeLhs(50, 40, Order::kRowMajor, 0.f, &generator, &lhs_data);
+  MulParamsType mul_params;
+  Context standard_cpp_context;
+  get_ctx(&standard_cpp_context)->SetRuntimeEnabledPaths(Path::kStandardCpp);
+  Blob blob =
+      Serialize(PrePack<float>(lhs, mul_params, &standard_cpp_context));
+
+  Context context;
+  const bool same_path =
+      get_ctx(&context)->SelectPath(kDefaultPaths) == Path::kStandardCpp;
+  PackedMatrix<float> loaded;
+  EXPECT_EQ(LoadPrePacked<float>(blob.data(), blob.size(), mul_params,
+                                 &context, &loaded),
+            same_path);
+  PackedMatrix<float> loaded_or_packed = LoadOrPrePack<float>(
+      blob.data(), blob.size(), lhs, mul_params, &context);
+  EXPECT_EQ(loaded_or_packed.owns_buffers(), !same_path);
+  CheckPackedMul<float, float, float>(loaded_or_packed, lhs, 30, 0.f,
+                                      &generator, &context);
+}
+
+TEST(PrePackTest, SerializationTypeMismatch) {
+  std::mt19937 generator(1);
+  std::vector<std::int8_t> lhs_data;
+  Matrix<std::int8_t> lhs =
+      MakeLhs<std::int8_t>(20, 30, Order::kRowMajor, 0, &generator, &lhs_data);
+  Context context;
+  MulParams<std::int32_t, std::int32_t> mul_params;
+  Blob blob = Serialize(PrePack<std::int8_t>(lhs, mul_params, &context));
+  PackedMatrix<std::uint8_t> loaded;
+  EXPECT_FALSE(LoadPrePacked<std::int8_t>(blob.data(), blob.size(),
+                                          mul_params, &context, &loaded));
+}
+
+}  // namespace
+}  // namespace ruy
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "ruy/prepacked_cache.h"
 
+#include "ruy/check_macros.h"
 #include "ruy/mat.h"
 #include "ruy/profiler/instrumentation.h"
 #include "ruy/system_aligned_alloc.h"
@@ -83,6 +84,7 @@ PrepackedCache::Action PrepackedCache::Get(const void* src_data,
   key.src_data = src_data;
   key.packed_layout = packed_matrix->layout;
   key.zero_point = packed_matrix->zero_point;
+  key.group_size = packed_matrix->group_size;
   const auto& itr = cache_.find(key);
 
   if (itr != cache_.end()) {
@@ -101,15 +103,31 @@ PrepackedCache::Action PrepackedCache::Get(const void* src_data,
   return Action::kInsertedNewEntry;
 }
 
+constexpr PrepackedCache::Timestamp PrepackedCache::kNotPinned;
+
+void PrepackedCache::Pin() {
+  RUY_DCHECK_EQ(pinned_timestamp_, kNotPinned);
+  pinned_timestamp_ = timestamp_;
+}
+
+void PrepackedCache::Unpin() {
+  RUY_DCHECK_NE(pinned_timestamp_, kNotPinned);
+  pinned_timestamp_ = kNotPinned;
+  EjectUntilRoomFor(0);
+}
+
 void PrepackedCache::EjectUntilRoomFor(int new_bytes) {
   profiler::ScopeLabel label("PrepackedCacheEjection");
-  // While we are above the threshold of ejection, eject the LRU entry.
+  // While we are above the threshold of ejection, eject the LRU entry, unless
+  // it is pinned, in which case all entries are.
   while (!cache_.empty() && buffers_bytes_ + new_bytes > max_buffers_bytes_) {
-    EjectOne();
+    if (!EjectOne()) {
+      break;
+    }
   }
 }
 
-void PrepackedCache::EjectOne() {
+bool PrepackedCache::EjectOne() {
   auto oldest = cache_.begin();
   Timestamp oldest_timestamp = oldest->second.timestamp;
   {
@@ -120,10 +138,137 @@ void PrepackedCache::EjectOne() {
       }
     }
   }
+  if (oldest_timestamp >= pinned_timestamp_) {
+    return false;
+  }
   const PEMat& packed_matrix = oldest->second.packed_matrix;
   buffers_bytes_ -= DataBytes(packed_matrix) + SumsBytes(packed_matrix);
   FreeBuffers(packed_matrix);
   cache_.erase(oldest);
+  return true;
+}
+
+class SharedPrepackedCache::Entry final {
+ public:
+  explicit Entry(const PEMat& packed_matrix, int bytes, Timestamp timestamp)
+      : packed_matrix_(packed_matrix), bytes_(bytes), timestamp_(timestamp) {}
+  ~Entry() { FreeBuffers(packed_matrix_); }
+
+  const PEMat& packed_matrix() const { return packed_matrix_; }
+  int bytes() const { return bytes_; }
+  Timestamp timestamp() const {
+    return timestamp_.load(std::memory_order_relaxed);
+  }
+  void set_timestamp(Timestamp timestamp) {
+    timestamp_.store(timestamp, std::memory_order_relaxed);
+  }
+
+  void WaitUntilPacked() {
+    // Fast path: the acquire load synchronizes with the release store in
+    // MarkPacked, making the packed data visible to this thread.
+    if (packed_.load(std::memory_order_acquire)) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock,
+               [this]() { return packed_.load(std::memory_order_acquire); });
+  }
+
+  void MarkPacked() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      packed_.store(true, std::memory_order_release);
+    }
+    cond_.notify_all();
+  }
+
+ private:
+  const PEMat packed_matrix_;
+  const int bytes_;
+  // Updated by concurrent lookups holding only a shared lock, hence atomic.
+  std::atomic<Timestamp> timestamp_;
+  std::atomic<bool> packed_{false};
+  std::mutex mutex_;
+  std::condition_variable cond_;
+};
+
+SharedPrepackedCache::SharedPrepackedCache(int max_buffers_bytes)
+    : max_buffers_bytes_(max_buffers_bytes), timestamp_(0) {}
+
+SharedPrepackedCache::~SharedPrepackedCache() {}
+
+int SharedPrepackedCache::BuffersBytes() const {
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  return buffers_bytes_;
+}
+
+int SharedPrepackedCache::MatrixCount() const {
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  return cache_.size();
+}
+
+SharedPrepackedCache::Action SharedPrepackedCache::Get(
+    const void* src_data, PEMat* packed_matrix,
+    std::shared_ptr<Entry>* entry) {
+  Key key;
+  key.src_data = src_data;
+  key.packed_layout = packed_matrix->layout;
+  key.zero_point = packed_matrix->zero_point;
+  key.group_size = packed_matrix->group_size;
+
+  // Look up existing entries under a shared lock only.
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+    const auto& itr = cache_.find(key);
+    if (itr != cache_.end()) {
+      *entry = itr->second;
+    }
+  }
+  if (!*entry) {
+    std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+    // Another thread may have inserted the same entry since we released the
+    // shared lock.
+    const auto& itr = cache_.find(key);
+    if (itr != cache_.end()) {
+      *entry = itr->second;
+    } else {
+      const int new_bytes = AllocateBuffers(packed_matrix);
+      EjectUntilRoomFor(new_bytes);
+      entry->reset(new Entry(*packed_matrix, new_bytes, timestamp_++));
+      cache_.emplace(key, *entry);
+      buffers_bytes_ += new_bytes;
+      return Action::kInsertedNewEntry;
+    }
+  }
+
+  (*entry)->set_timestamp(timestamp_++);
+  (*entry)->WaitUntilPacked();
+  *packed_matrix = (*entry)->packed_matrix();
+  return Action::kGotExistingEntry;
+}
+
+void SharedPrepackedCache::MarkPacked(Entry* entry) { entry->MarkPacked(); }
+
+void SharedPrepackedCache::EjectUntilRoomFor(int new_bytes) {
+  profiler::ScopeLabel label("SharedPrepackedCacheEjection");
+  while (!cache_.empty() && buffers_bytes_ + new_bytes > max_buffers_bytes_) {
+    EjectOne();
+  }
+}
+
+void SharedPrepackedCache::EjectOne() {
+  auto oldest = cache_.begin();
+  Timestamp oldest_timestamp = oldest->second->timestamp();
+  for (auto itr = cache_.begin(); itr != cache_.end(); ++itr) {
+    if (itr->second->timestamp() < oldest_timestamp) {
+      oldest = itr;
+      oldest_timestamp = itr->second->timestamp();
+    }
+  }
+  buffers_bytes_ -= oldest->second->bytes();
+  // The buffers are freed when the last reference to the entry goes away,
+  // which may be right now or when another thread is done using it.
+  cache_.erase(oldest);
 }
 
 }  // namespace ruy
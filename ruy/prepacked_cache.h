@@ -16,8 +16,13 @@ limitations under the License.
 #ifndef RUY_RUY_PREPACKED_CACHE_H_
 #define RUY_RUY_PREPACKED_CACHE_H_
 
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <shared_mutex>
 #include <unordered_map>
 
 #include "ruy/mat.h"
@@ -59,7 +64,8 @@ class PrepackedCache final {
   //
   // The only other field that needs to be involved is the zero_point, for
   // quantized matrices, although it seems far-fetched that the same matrix
-  // data would be reused with different zero_point values.
+  // data would be reused with different zero_point values, and the
+  // group_size, which determines which sums are packed along with the data.
   //
   // The data types (PEMat::data_type and PEMat::sums_type) are omitted based on
   // the "strict aliasing" model: each memory location should contain data of
@@ -72,11 +78,13 @@ class PrepackedCache final {
     PMatLayout packed_layout;
     // The packed matrix's zero point (for integer-quantized matrices only).
     std::int32_t zero_point;
+    // The packed matrix's group size, see PEMat::group_size.
+    int group_size;
   };
 
   friend bool operator==(const Key& a, const Key& b) {
     return a.src_data == b.src_data && a.packed_layout == b.packed_layout &&
-           a.zero_point == b.zero_point;
+           a.zero_point == b.zero_point && a.group_size == b.group_size;
   }
 
   struct KeyHash {
@@ -126,14 +134,95 @@ class PrepackedCache final {
   //    entry was created. Otherwise it is Action::kGotExistingEntry.
   Action Get(const void* src_data, PEMat* packed_matrix);
 
+  // Between a call to Pin and the next call to Unpin, the entries returned by
+  // Get are not ejected, even if that takes the cache over its budget. This
+  // is needed when the packed matrices of several multiplications are looked
+  // up before any of them runs, as in a BatchMul. Unpin ejects entries as
+  // needed to get back under the budget.
+  void Pin();
+  void Unpin();
+
  private:
-  void EjectOne();
+  static constexpr Timestamp kNotPinned = ~Timestamp(0);
+
+  bool EjectOne();
   void EjectUntilRoomFor(int new_bytes);
 
   std::unordered_map<Key, Entry, KeyHash> cache_;
   const int max_buffers_bytes_;
   int buffers_bytes_ = 0;
   Timestamp timestamp_ = 0;
+  // Entries with a timestamp at least this are pinned, see Pin.
+  Timestamp pinned_timestamp_ = kNotPinned;
+};
+
+// Thread-safe variant of PrepackedCache, meant to be shared by any number of
+// Contexts, possibly used concurrently from different threads, so that
+// matrices used by all of them, typically constant weights, are packed and
+// stored only once. See Context::set_shared_prepacked_cache. Like
+// PrepackedCache, it keeps the total size of its buffers under a budget by
+// ejecting least recently used entries.
+//
+// Lookups of existing entries only take a shared (reader) lock. Inserting a
+// new entry takes an exclusive lock, but packing the new entry happens after
+// releasing it: the thread that inserted an entry packs it, while other
+// threads Getting the same entry in the meantime wait for that to be done.
+//
+// Entries are reference-counted: an entry that is ejected while some thread
+// is still using it stays alive until that thread is done with it. Such
+// entries no longer count towards BuffersBytes().
+//
+// A SharedPrepackedCache must outlive the Contexts it is attached to.
+class SharedPrepackedCache final {
+ public:
+  using Action = PrepackedCache::Action;
+  using Key = PrepackedCache::Key;
+  using Timestamp = PrepackedCache::Timestamp;
+
+  static constexpr int kDefaultMaxBuffersBytes =
+      PrepackedCache::kDefaultMaxBuffersBytes;
+
+  // A cached packed matrix. Opaque to users.
+  class Entry;
+
+  explicit SharedPrepackedCache(
+      int max_buffers_bytes = kDefaultMaxBuffersBytes);
+
+  ~SharedPrepackedCache();
+
+  // Returns the total size in bytes of buffers held in this cache.
+  int BuffersBytes() const;
+
+  // Returns the number of packed matrices held in this cache.
+  int MatrixCount() const;
+
+  // Same as PrepackedCache::Get, except that:
+  // - `*entry` receives a reference to the cache entry, keeping its buffers
+  //   alive for as long as the caller holds it.
+  // - If the return value is Action::kInsertedNewEntry, the caller must pack
+  //   the matrix into the buffers of `packed_matrix`, then call
+  //   MarkPacked(*entry). If the return value is Action::kGotExistingEntry,
+  //   the matrix is already packed: this waits for that if needed.
+  Action Get(const void* src_data, PEMat* packed_matrix,
+             std::shared_ptr<Entry>* entry);
+
+  // Marks an entry obtained by Get as packed, waking up waiting threads.
+  void MarkPacked(Entry* entry);
+
+ private:
+  void EjectOne();
+  void EjectUntilRoomFor(int new_bytes);
+
+  // Guards cache_ and buffers_bytes_. Lookups take it in shared mode.
+  mutable std::shared_timed_mutex mutex_;
+  std::unordered_map<Key, std::shared_ptr<Entry>, PrepackedCache::KeyHash>
+      cache_;
+  const int max_buffers_bytes_;
+  int buffers_bytes_ = 0;
+  // Incremented by concurrent lookups, hence atomic.
+  std::atomic<Timestamp> timestamp_;
+
+  SharedPrepackedCache(const SharedPrepackedCache&) = delete;
 };
 
 }  // namespace ruy
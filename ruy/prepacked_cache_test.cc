@@ -15,7 +15,12 @@ limitations under the License.
 
 #include "ruy/prepacked_cache.h"
 
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstring>
+#include <memory>
 #include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
 #include "ruy/context.h"
 #include "ruy/context_get_ctx.h"
@@ -186,6 +191,44 @@ TEST(PrepackedCacheTest, TestCacheEjection2) {
               PrepackedCache::Action::kInsertedNewEntry);
 }
 
+TEST(PrepackedCacheTest, TestCachePinning) {
+  PrepackedCache prepacked_cache(600);
+  // DataBytes=200, SumsBytes=20*4=80, Total: 280 bytes
+  std::vector<std::uint8_t> data1(10 * 20);
+  PEMat mat1 = MakeDummyPEMat(Type::Create<std::uint8_t>(), 10, 20);
+  prepacked_cache.Get(data1.data(), &mat1);
+  DummyPack(data1, &mat1);
+
+  prepacked_cache.Pin();
+  // Matrix 1 was used before pinning, so it may still be ejected, making room
+  // for matrix 2. Matrices 2 and 3 are pinned, so the cache goes over budget.
+  std::vector<std::uint8_t> data2(10 * 20);
+  PEMat mat2 = MakeDummyPEMat(Type::Create<std::uint8_t>(), 10, 20);
+  prepacked_cache.Get(data2.data(), &mat2);
+  DummyPack(data2, &mat2);
+  std::vector<std::uint8_t> data3(10 * 20);
+  PEMat mat3 = MakeDummyPEMat(Type::Create<std::uint8_t>(), 10, 20);
+  prepacked_cache.Get(data3.data(), &mat3);
+  DummyPack(data3, &mat3);
+  std::vector<std::uint8_t> data4(10 * 20);
+  PEMat mat4 = MakeDummyPEMat(Type::Create<std::uint8_t>(), 10, 20);
+  prepacked_cache.Get(data4.data(), &mat4);
+  DummyPack(data4, &mat4);
+  EXPECT_EQ(prepacked_cache.MatrixCount(), 3);
+  EXPECT_EQ(prepacked_cache.BuffersBytes(), 840);
+
+  // Unpinning gets back under budget, ejecting the least recently used.
+  prepacked_cache.Unpin();
+  EXPECT_EQ(prepacked_cache.MatrixCount(), 2);
+  EXPECT_EQ(prepacked_cache.BuffersBytes(), 560);
+  EXPECT_TRUE(prepacked_cache.Get(data3.data(), &mat3) ==
+              PrepackedCache::Action::kGotExistingEntry);
+  EXPECT_TRUE(prepacked_cache.Get(data4.data(), &mat4) ==
+              PrepackedCache::Action::kGotExistingEntry);
+  EXPECT_TRUE(prepacked_cache.Get(data2.data(), &mat2) ==
+              PrepackedCache::Action::kInsertedNewEntry);
+}
+
 TEST(PrepackedCacheTest, TestDistinguishSubtlyDifferentMatrices) {
   PrepackedCache prepacked_cache;
 
@@ -300,6 +343,213 @@ TEST(PrepackedCacheTest, TestClearCache) {
   EXPECT_EQ(cache->MatrixCount(), 0);
 }
 
+// Checks that a matrix large enough for its insertion into the cache to be
+// packed by several threads is packed correctly, with either cache.
+TEST(PrepackedCacheTest, TestMultiThreadedInsertion) {
+  const int rows = 500;
+  const int depth = 700;
+  const int cols = 3;
+  std::vector<float> lhs_data(rows * depth);
+  std::vector<float> rhs_data(depth * cols);
+  for (int i = 0; i < rows * depth; i++) {
+    lhs_data[i] = static_cast<float>(i % 17 - 8);
+  }
+  for (int i = 0; i < depth * cols; i++) {
+    rhs_data[i] = static_cast<float>(i % 5 - 2);
+  }
+  ruy::Matrix<float> lhs;
+  ruy::MakeSimpleLayout(rows, depth, ruy::Order::kRowMajor,
+                        lhs.mutable_layout());
+  lhs.set_data(lhs_data.data());
+  ruy::Matrix<float> rhs;
+  ruy::MakeSimpleLayout(depth, cols, ruy::Order::kColMajor,
+                        rhs.mutable_layout());
+  rhs.set_data(rhs_data.data());
+  ruy::MulParams<float, float> mul_params;
+
+  std::vector<float> expected_data(rows * cols);
+  ruy::Matrix<float> expected;
+  ruy::MakeSimpleLayout(rows, cols, ruy::Order::kColMajor,
+                        expected.mutable_layout());
+  expected.set_data(expected_data.data());
+  ruy::Context reference_context;
+  ruy::Mul(lhs, rhs, mul_params, &reference_context, &expected);
+
+  SharedPrepackedCache shared_cache;
+  for (bool use_shared_cache : {false, true}) {
+    ruy::Context context;
+    context.set_max_num_threads(4);
+    if (use_shared_cache) {
+      context.set_shared_prepacked_cache(&shared_cache);
+    }
+    ruy::Matrix<float> cached_lhs = lhs;
+    cached_lhs.set_cache_policy(CachePolicy::kAlwaysCache);
+    std::vector<float> dst_data(rows * cols);
+    ruy::Matrix<float> dst;
+    ruy::MakeSimpleLayout(rows, cols, ruy::Order::kColMajor,
+                          dst.mutable_layout());
+    dst.set_data(dst_data.data());
+    // The first Mul inserts into the cache, the second one hits it.
+    for (int i = 0; i < 2; i++) {
+      ruy::Mul(cached_lhs, rhs, mul_params, &context, &dst);
+      EXPECT_EQ(dst_data, expected_data);
+    }
+    if (use_shared_cache) {
+      EXPECT_EQ(shared_cache.MatrixCount(), 1);
+    } else {
+      EXPECT_EQ(get_ctx(&context)->GetPrepackedCache()->MatrixCount(), 1);
+    }
+  }
+}
+
+TEST(SharedPrepackedCacheTest, TestCacheEjection) {
+  SharedPrepackedCache cache(306);
+  std::shared_ptr<SharedPrepackedCache::Entry> entry1;
+  std::shared_ptr<SharedPrepackedCache::Entry> entry2;
+  // DataBytes=200, SumsBytes=20*4=80, Total: 280 bytes
+  std::vector<std::uint8_t> data1(10 * 20);
+  PEMat mat1 = MakeDummyPEMat(Type::Create<std::uint8_t>(), 10, 20);
+  EXPECT_EQ(cache.Get(data1.data(), &mat1, &entry1),
+            SharedPrepackedCache::Action::kInsertedNewEntry);
+  DummyPack(data1, &mat1);
+  cache.MarkPacked(entry1.get());
+
+  // DataBytes=15, SumsBytes=3*4=12, Total: 27 bytes
+  std::vector<std::uint8_t> data2(5 * 3);
+  PEMat mat2 = MakeDummyPEMat(Type::Create<std::uint8_t>(), 5, 3);
+  EXPECT_EQ(cache.Get(data2.data(), &mat2, &entry2),
+            SharedPrepackedCache::Action::kInsertedNewEntry);
+  DummyPack(data2, &mat2);
+  cache.MarkPacked(entry2.get());
+
+  // The first matrix should have been ejected from the cache, but since we
+  // still hold a reference to it, its buffer is still valid.
+  EXPECT_EQ(cache.MatrixCount(), 1);
+  EXPECT_EQ(cache.BuffersBytes(), 27);
+  EXPECT_EQ(memcmp(mat1.data, data1.data(), data1.size()), 0);
+  entry1 = nullptr;
+
+  std::shared_ptr<SharedPrepackedCache::Entry> entry;
+  PEMat mat = MakeDummyPEMat(Type::Create<std::uint8_t>(), 5, 3);
+  EXPECT_EQ(cache.Get(data2.data(), &mat, &entry),
+            SharedPrepackedCache::Action::kGotExistingEntry);
+  EXPECT_EQ(entry, entry2);
+  EXPECT_EQ(mat.data, mat2.data);
+}
+
+TEST(SharedPrepackedCacheTest, TestCacheLru) {
+  SharedPrepackedCache cache(1000);
+  std::vector<std::uint8_t> data[4];
+  PEMat mats[4];
+  for (int i = 0; i < 4; i++) {
+    // Each matrix takes 280 bytes, see TestCacheEjection2 above.
+    data[i].resize(10 * 20);
+    mats[i] = MakeDummyPEMat(Type::Create<std::uint8_t>(), 10, 20);
+    std::shared_ptr<SharedPrepackedCache::Entry> entry;
+    EXPECT_EQ(cache.Get(data[i].data(), &mats[i], &entry),
+              SharedPrepackedCache::Action::kInsertedNewEntry);
+    cache.MarkPacked(entry.get());
+    if (i == 2) {
+      // Touch matrices 0 and 2 to make matrix 1 the oldest.
+      for (int j : {0, 2}) {
+        EXPECT_EQ(cache.Get(data[j].data(), &mats[j], &entry),
+                  SharedPrepackedCache::Action::kGotExistingEntry);
+      }
+    }
+  }
+  EXPECT_EQ(cache.MatrixCount(), 3);
+  for (int i : {0, 2, 3}) {
+    std::shared_ptr<SharedPrepackedCache::Entry> entry;
+    EXPECT_EQ(cache.Get(data[i].data(), &mats[i], &entry),
+              SharedPrepackedCache::Action::kGotExistingEntry);
+  }
+  std::shared_ptr<SharedPrepackedCache::Entry> entry;
+  EXPECT_EQ(cache.Get(data[1].data(), &mats[1], &entry),
+            SharedPrepackedCache::Action::kInsertedNewEntry);
+  cache.MarkPacked(entry.get());
+}
+
+TEST(SharedPrepackedCacheTest, TestConcurrentGetPacksOnce) {
+  SharedPrepackedCache cache;
+  std::vector<std::uint8_t> data(100 * 100, 7);
+  std::atomic<int> insertions(0);
+  std::atomic<int> mismatches(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&]() {
+      PEMat mat = MakeDummyPEMat(Type::Create<std::uint8_t>(), 100, 100);
+      std::shared_ptr<SharedPrepackedCache::Entry> entry;
+      if (cache.Get(data.data(), &mat, &entry) ==
+          SharedPrepackedCache::Action::kInsertedNewEntry) {
+        insertions++;
+        // Make other threads likely to find the entry not yet packed.
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        DummyPack(data, &mat);
+        cache.MarkPacked(entry.get());
+      } else if (memcmp(mat.data, data.data(), data.size())) {
+        mismatches++;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(insertions.load(), 1);
+  EXPECT_EQ(mismatches.load(), 0);
+  EXPECT_EQ(cache.MatrixCount(), 1);
+}
+
+TEST(SharedPrepackedCacheTest, TestSharedByContexts) {
+  SharedPrepackedCache cache;
+  std::vector<float> lhs_data(64 * 64);
+  for (int i = 0; i < static_cast<int>(lhs_data.size()); i++) {
+    lhs_data[i] = i % 13 - 6;
+  }
+  std::vector<float> rhs_data(64 * 8, 1);
+  const int kThreads = 4;
+  std::vector<std::vector<float>> dst_data(kThreads,
+                                           std::vector<float>(64 * 8));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      ruy::Context context;
+      context.set_shared_prepacked_cache(&cache);
+      ruy::Matrix<float> lhs;
+      ruy::MakeSimpleLayout(64, 64, ruy::Order::kRowMajor,
+                            lhs.mutable_layout());
+      lhs.set_data(lhs_data.data());
+      lhs.set_cache_policy(CachePolicy::kAlwaysCache);
+      ruy::Matrix<float> rhs;
+      ruy::MakeSimpleLayout(64, 8, ruy::Order::kColMajor,
+                            rhs.mutable_layout());
+      rhs.set_data(rhs_data.data());
+      ruy::Matrix<float> dst;
+      ruy::MakeSimpleLayout(64, 8, ruy::Order::kColMajor,
+                            dst.mutable_layout());
+      dst.set_data(dst_data[t].data());
+      ruy::MulParams<float, float> mul_params;
+      for (int repeat = 0; repeat < 10; repeat++) {
+        ruy::Mul(lhs, rhs, mul_params, &context, &dst);
+      }
+      // The Context's own cache was not used.
+      EXPECT_EQ(get_ctx(&context)->GetPrepackedCache()->MatrixCount(), 0);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(cache.MatrixCount(), 1);
+  for (int t = 0; t < kThreads; t++) {
+    for (int row = 0; row < 64; row++) {
+      float expected = 0;
+      for (int k = 0; k < 64; k++) {
+        expected += lhs_data[row * 64 + k];
+      }
+      EXPECT_EQ(dst_data[t][row], expected);
+    }
+  }
+}
+
 }  // namespace
 }  // namespace ruy
 
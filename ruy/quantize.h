@@ -0,0 +1,102 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Conversions between floating-point values and int8 done by packing:
+//  - Dynamic quantization, when a float RHS is multiplied by an 8-bit LHS
+//    with integer accumulators (see PackQuantizedToInt8 in pack_common.h).
+//    Each column of the RHS gets its own scale, computed from its largest
+//    magnitude, and is quantized symmetrically, with a zero point of 0.
+//  - Dequantization of int8 weights, when an int8 LHS is multiplied with
+//    float accumulators (see PackDequantizedToFloat in pack_common.h), with
+//    the scales given by MulParams::lhs_scales.
+//  - Expansion of int4 weights to int8 (see PackInt4ToInt8 in pack_common.h),
+//    which only subtracts zero points and does not involve scales.
+//
+// These functions are shared by the packing code and by ReferenceMul, so
+// that the reference computes the exact same values.
+
+#ifndef RUY_RUY_QUANTIZE_H_
+#define RUY_RUY_QUANTIZE_H_
+
+#include <algorithm>
+#include <cstdint>
+
+namespace ruy {
+
+// Largest magnitude of the quantized values. The range is kept symmetric,
+// [-kDynamicQuantMax, kDynamicQuantMax], so that -128 never occurs.
+constexpr int kDynamicQuantMax = 127;
+
+// Returns the scale of the quantized values of a vector whose entries have
+// at most the magnitude max_abs: a quantized value q stands for q * scale.
+inline float DynamicQuantScale(float max_abs) {
+  return max_abs > 0 ? max_abs / kDynamicQuantMax : 1.f;
+}
+
+// Returns the quantized value of x, given the inverse of the scale returned
+// by DynamicQuantScale. Rounds to nearest, ties to even, by adding and
+// subtracting 1.5 * 2^23: unlike std::lrint, that is cheap and lets compilers
+// vectorize the loops calling this.
+inline std::int8_t DynamicQuantize(float x, float inv_scale) {
+  constexpr float kRoundingOffset = 12582912.f;
+  const float clamped =
+      std::min<float>(kDynamicQuantMax,
+                      std::max<float>(-kDynamicQuantMax, x * inv_scale));
+  return static_cast<std::int8_t>(
+      static_cast<int>((clamped + kRoundingOffset) - kRoundingOffset));
+}
+
+// Returns the index of the scale or zero point of the entry of a quantized
+// weights matrix at the given channel (destination row) and depth, k, given
+// the layout described for MulParams::lhs_scales: one per channel if
+// group_size is 0, and otherwise one per channel and group of group_size
+// depth levels, stored group-major for `channels` channels.
+inline int WeightGroupIndex(int group_size, int channels, int channel, int k) {
+  return group_size ? (k / group_size) * channels + channel : channel;
+}
+
+// Returns the number of groups of depth levels that share a scale or zero
+// point along the given depth, see WeightGroupIndex.
+inline int NumWeightGroups(int group_size, int depth) {
+  return group_size ? (depth + group_size - 1) / group_size : 1;
+}
+
+// Returns the scale of the weight at the given channel and depth, see
+// WeightGroupIndex. Null scales mean scales of 1.
+inline float WeightScale(const float* scales, int group_size, int channels,
+                         int channel, int k) {
+  return scales ? scales[WeightGroupIndex(group_size, channels, channel, k)]
+                : 1.f;
+}
+
+// Returns the zero point of the weight at the given channel and depth, see
+// WeightGroupIndex. Null zero_points mean that matrix_zero_point applies.
+inline std::int32_t WeightZeroPoint(const std::int8_t* zero_points,
+                                    int group_size, int channels, int channel,
+                                    int k, std::int32_t matrix_zero_point) {
+  return zero_points
+             ? zero_points[WeightGroupIndex(group_size, channels, channel, k)]
+             : matrix_zero_point;
+}
+
+// Returns the float value that the quantized weight q stands for.
+inline float DequantizeWeight(std::int8_t q, std::int32_t zero_point,
+                              float scale) {
+  return static_cast<float>(q - zero_point) * scale;
+}
+
+}  // namespace ruy
+
+#endif  // RUY_RUY_QUANTIZE_H_
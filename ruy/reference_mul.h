@@ -17,10 +17,15 @@ limitations under the License.
 #define RUY_RUY_REFERENCE_MUL_H_
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
 
 #include "ruy/apply_multiplier.h"
+#include "ruy/int4.h"
 #include "ruy/matrix.h"
 #include "ruy/mul_params.h"
+#include "ruy/quantize.h"
 
 namespace ruy {
 
@@ -29,17 +34,91 @@ template <typename LhsScalar, typename RhsScalar, typename AccumScalar,
 void ReferenceMul(const Matrix<LhsScalar>& lhs, const Matrix<RhsScalar>& rhs,
                   const MulParams<AccumScalar, DstScalar>& mul_params,
                   Matrix<DstScalar>* dst) {
-  for (int i = 0; i < lhs.layout().rows(); i++) {
-    for (int j = 0; j < rhs.layout().cols(); j++) {
+  // Integer accumulators with a floating-point destination: see
+  // MulParams::float_multiplier. A float RHS is then quantized to int8 per
+  // column, as done by packing.
+  static constexpr bool kDequantizes =
+      !std::is_floating_point<AccumScalar>::value &&
+      std::is_floating_point<DstScalar>::value;
+  static constexpr bool kQuantizesRhs =
+      kDequantizes && std::is_same<RhsScalar, float>::value;
+  // An int8 LHS with float accumulators: see MulParams::lhs_scales. Its
+  // entries are dequantized, zero point included, as done by packing.
+  static constexpr bool kDequantizesLhs =
+      std::is_same<AccumScalar, float>::value &&
+      std::is_same<LhsScalar, std::int8_t>::value;
+  for (int j = 0; j < rhs.layout().cols(); j++) {
+    float rhs_scale = 1.f;
+    float rhs_inv_scale = 1.f;
+    if (kQuantizesRhs) {
+      float max_abs = 0;
+      for (int k = 0; k < rhs.layout().rows(); k++) {
+        max_abs = std::max(max_abs,
+                           std::abs(static_cast<float>(Element(rhs, k, j))));
+      }
+      rhs_scale = DynamicQuantScale(max_abs);
+      rhs_inv_scale = 1.f / rhs_scale;
+    }
+    for (int i = 0; i < lhs.layout().rows(); i++) {
       AccumScalar accum = 0;
+      // Group-wise LHS scales in a dequantizing multiplication: see
+      // MulParams::lhs_scales. The sum of the scaled accumulators of the
+      // groups completed so far.
+      const bool scales_groups = kDequantizes && mul_params.lhs_scales();
+      float scaled_accum = 0;
       for (int k = 0; k < lhs.layout().cols(); k++) {
-        AccumScalar lhs_val = Element(lhs, i, k);
-        AccumScalar rhs_val = Element(rhs, k, j);
-        accum += (lhs_val - lhs.zero_point()) * (rhs_val - rhs.zero_point());
+        // See MulParams::lhs_zero_points.
+        const std::int32_t lhs_zero_point = WeightZeroPoint(
+            mul_params.lhs_zero_points(), mul_params.lhs_group_size(),
+            lhs.layout().rows(), i, k, lhs.zero_point());
+        AccumScalar lhs_val =
+            kDequantizesLhs
+                ? static_cast<AccumScalar>(DequantizeWeight(
+                      static_cast<std::int8_t>(Element(lhs, i, k)),
+                      lhs_zero_point,
+                      WeightScale(mul_params.lhs_scales(),
+                                  mul_params.lhs_group_size(),
+                                  lhs.layout().rows(), i, k)))
+                : static_cast<AccumScalar>(Element(lhs, i, k));
+        AccumScalar rhs_val =
+            kQuantizesRhs
+                ? static_cast<AccumScalar>(DynamicQuantize(
+                      static_cast<float>(Element(rhs, k, j)), rhs_inv_scale))
+                : static_cast<AccumScalar>(Element(rhs, k, j));
+        if (!kDequantizesLhs) {
+          lhs_val -= lhs_zero_point;
+        }
+        accum += lhs_val * (rhs_val - rhs.zero_point());
+        if (scales_groups &&
+            (k + 1 == lhs.layout().cols() ||
+             (mul_params.lhs_group_size() &&
+              (k + 1) % mul_params.lhs_group_size() == 0))) {
+          scaled_accum +=
+              WeightScale(mul_params.lhs_scales(), mul_params.lhs_group_size(),
+                          lhs.layout().rows(), i, k) *
+              static_cast<float>(accum);
+          accum = 0;
+        }
       }
       if (mul_params.bias()) {
         accum += mul_params.bias()[i];
       }
+      if (kDequantizes) {
+        const float multiplier =
+            mul_params.float_multiplier_perchannel()
+                ? mul_params.float_multiplier_perchannel()[i]
+                : mul_params.float_multiplier();
+        float val =
+            (scales_groups ? scaled_accum : static_cast<float>(accum)) *
+            multiplier * rhs_scale;
+        if (mul_params.float_bias()) {
+          val += mul_params.float_bias()[i];
+        }
+        val = std::min<float>(val, mul_params.clamp_max());
+        val = std::max<float>(val, mul_params.clamp_min());
+        *ElementPtr(dst, i, j) = static_cast<DstScalar>(val);
+        continue;
+      }
       ApplyMultiplier(mul_params, i, &accum);
       accum += dst->zero_point();
       accum = std::min<AccumScalar>(accum, mul_params.clamp_max());
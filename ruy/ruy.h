@@ -18,12 +18,18 @@ limitations under the License.
 #ifndef RUY_RUY_RUY_H_
 #define RUY_RUY_RUY_H_
 
+#include <cstddef>
+#include <vector>
+
 #include "ruy/context.h"
 #include "ruy/context_get_ctx.h"
 #include "ruy/dispatch.h"
+#include "ruy/float16.h"
+#include "ruy/int4.h"
 #include "ruy/mat.h"
 #include "ruy/matrix.h"
 #include "ruy/mul_params.h"
+#include "ruy/packed_matrix.h"
 #include "ruy/path.h"
 
 namespace ruy {
@@ -41,6 +47,37 @@ namespace ruy {
 // A simple reference implementation of the operation performed by ruy::Mul
 // is provided by the ruy::ReferenceMul function in reference_mul.h.
 //
+// With an 8-bit `lhs`, MulParams<std::int32_t, float> and a float `dst`, the
+// int32 accumulators are dequantized to float, see
+// MulParams::float_multiplier. The `rhs` may then be float too, as
+// activations of a dynamically quantized ('hybrid') model: it is quantized to
+// int8 by packing, with one scale per column, and the int8 kernels run on it.
+// MulParams::lhs_scales may then give group-wise scales of the `lhs`, applied
+// to the int32 accumulators of each group of depth levels, which are then
+// added up in float.
+//
+// With an int8 `lhs`, a float `rhs` and MulParams<float, float>, the `lhs`
+// holds weight-only quantized weights, with the float scales given by
+// MulParams::lhs_scales, per row or per group of depth levels. Packing
+// dequantizes them to float and the float kernels run on them, so that only
+// the int8 weights are read from memory.
+//
+// The `lhs` may also be a Matrix<int4>, storing 4-bit weights two per byte,
+// with an 8-bit `rhs`, or a float one as above, and int32 accumulators, see
+// ruy/int4.h. Its zero points
+// may be given per group of depth levels, see MulParams::lhs_zero_points.
+// Packing expands it to int8 and the 8-bit kernels run on it.
+//
+// The data cache sizes that guide the blocking of large multiplications are
+// detected at runtime, see Ctx::GetLocalDataCacheSize. This is a change in
+// behavior from earlier versions: MulParams::local_data_cache_size() and
+// shared_data_cache_size() now return 0, meaning "use the detected size",
+// instead of the fixed per-architecture defaults. Code that called them
+// directly to get those defaults should call ruy::LocalDataCacheSize() and
+// ruy::SharedDataCacheSize() from ruy/cpu_cache_size.h instead. A MulParams
+// subclass returning nonzero sizes still takes precedence over detection, so
+// returning those functions' values there restores the former blocking.
+//
 // The `context` argument can be any ruy::Context object as long as no other
 // thread is going to concurrently access that ruy::Context. The simplest
 // correct (but not efficient) calling pattern is
@@ -101,6 +138,272 @@ void Mul(const Matrix<LhsScalar>& lhs, const Matrix<RhsScalar>& rhs,
       internal_lhs, internal_rhs, mul_params, get_ctx(context), &internal_dst);
 }
 
+// Packs `lhs` ahead of time, returning a PackedMatrix that owns the packed
+// data and can be passed to ruy::Mul in place of `lhs`:
+//
+//   ruy::PackedMatrix<float> packed_lhs =
+//       ruy::PrePack<float>(lhs, mul_params, context);
+//   // Many times:
+//   ruy::Mul(packed_lhs, rhs, mul_params, context, dst);
+//
+// This is the explicit alternative to setting a cache_policy on `lhs`: there is
+// no cache lookup keyed on the data pointer of `lhs`, and no cache eviction.
+// The source matrix data may be freed or modified as soon as PrePack returns.
+//
+// The packed form depends on the kernel, so the RHS scalar type must be given
+// as the first template parameter, and `mul_params` must be of the same type
+// as in the subsequent Mul calls. Its LHS quantization fields are used by
+// packing, so they must also match those of the subsequent Mul calls:
+// lhs_scales and lhs_zero_points, which packing applies to an int8 or int4
+// LHS as it dequantizes it to float or expands it to int8, and lhs_group_size,
+// by which packing groups the sums of an LHS with group-wise scales. Mul
+// checks that lhs_group_size matches, but not the scales or zero points. The
+// other values of `mul_params` are not used. The PackedMatrix may be used with
+// any Context on the same machine, but not with a different set of
+// CompiledPaths or a Context restricted to a different Path.
+template <typename RhsScalar, typename LhsScalar, typename MulParamsType>
+PackedMatrix<LhsScalar> PrePack(const Matrix<LhsScalar>& lhs,
+                                const MulParamsType& mul_params,
+                                Context* context) {
+  using DstScalar = typename MulParamsType::DstScalar;
+  PackedMatrix<LhsScalar> result;
+  DispatchPrePack<ruy::kDefaultPaths, LhsScalar, RhsScalar, DstScalar,
+                  MulParamsType>(ToInternal(lhs), mul_params, get_ctx(context),
+                                 &result);
+  return result;
+}
+
+// Variant of ruy::PrePack allowing to specify a custom OR-ed set of Path's to
+// compile. See the comments in path.h for more details.
+template <Path CompiledPaths, typename RhsScalar, typename LhsScalar,
+          typename MulParamsType>
+PackedMatrix<LhsScalar> PrePack(const Matrix<LhsScalar>& lhs,
+                                const MulParamsType& mul_params,
+                                Context* context) {
+  using DstScalar = typename MulParamsType::DstScalar;
+  PackedMatrix<LhsScalar> result;
+  DispatchPrePack<CompiledPaths, LhsScalar, RhsScalar, DstScalar,
+                  MulParamsType>(ToInternal(lhs), mul_params, get_ctx(context),
+                                 &result);
+  return result;
+}
+
+// Batch variant of ruy::PrePack, meant for warming up a model: packs the
+// `batch_size` matrices lhs[0 .. batch_size-1], which may have different
+// shapes, into results[0 .. batch_size-1], equivalently to
+//
+//   results[i] = ruy::PrePack<RhsScalar>(lhs[i], mul_params, context);
+//
+// but spreading the packing work of all matrices over the thread pool at once,
+// per context->max_num_threads().
+template <typename RhsScalar, typename LhsScalar, typename MulParamsType>
+void BatchPrePack(const Matrix<LhsScalar>* lhs, int batch_size,
+                  const MulParamsType& mul_params, Context* context,
+                  PackedMatrix<LhsScalar>* results) {
+  using DstScalar = typename MulParamsType::DstScalar;
+  std::vector<Mat<LhsScalar>> internal_lhs;
+  internal_lhs.reserve(batch_size);
+  for (int i = 0; i < batch_size; i++) {
+    internal_lhs.push_back(ToInternal(lhs[i]));
+  }
+  DispatchBatchPrePack<ruy::kDefaultPaths, LhsScalar, RhsScalar, DstScalar,
+                       MulParamsType>(internal_lhs.data(), batch_size,
+                                      mul_params, get_ctx(context), results);
+}
+
+// Variant of ruy::BatchPrePack allowing to specify a custom OR-ed set of
+// Path's to compile. See the comments in path.h for more details.
+template <Path CompiledPaths, typename RhsScalar, typename LhsScalar,
+          typename MulParamsType>
+void BatchPrePack(const Matrix<LhsScalar>* lhs, int batch_size,
+                  const MulParamsType& mul_params, Context* context,
+                  PackedMatrix<LhsScalar>* results) {
+  using DstScalar = typename MulParamsType::DstScalar;
+  std::vector<Mat<LhsScalar>> internal_lhs;
+  internal_lhs.reserve(batch_size);
+  for (int i = 0; i < batch_size; i++) {
+    internal_lhs.push_back(ToInternal(lhs[i]));
+  }
+  DispatchBatchPrePack<CompiledPaths, LhsScalar, RhsScalar, DstScalar,
+                       MulParamsType>(internal_lhs.data(), batch_size,
+                                      mul_params, get_ctx(context), results);
+}
+
+// Loads a PackedMatrix serialized by PackedMatrix::Serialize, for instance
+// from a file mapped in memory, without packing or copying anything: the
+// returned PackedMatrix points into `blob`, which must outlive it, stay
+// unmodified, and be aligned to 64 bytes.
+//
+// Returns false if the blob is invalid, or if it was packed for another Path or
+// kernel layout than ruy::PrePack would use here with the same template
+// arguments, e.g. if it was serialized on a machine supporting different SIMD
+// instructions. The LHS then needs to be packed again by ruy::PrePack, which is
+// what ruy::LoadOrPrePack does.
+template <typename RhsScalar, typename LhsScalar, typename MulParamsType>
+bool LoadPrePacked(const void* blob, std::size_t size,
+                   const MulParamsType& mul_params, Context* context,
+                   PackedMatrix<LhsScalar>* result) {
+  using DstScalar = typename MulParamsType::DstScalar;
+  return DispatchLoadPrePacked<ruy::kDefaultPaths, LhsScalar, RhsScalar,
+                               DstScalar, MulParamsType>(
+      blob, size, mul_params, get_ctx(context), result);
+}
+
+// Variant of ruy::LoadPrePacked allowing to specify a custom OR-ed set of
+// Path's to compile. See the comments in path.h for more details.
+template <Path CompiledPaths, typename RhsScalar, typename LhsScalar,
+          typename MulParamsType>
+bool LoadPrePacked(const void* blob, std::size_t size,
+                   const MulParamsType& mul_params, Context* context,
+                   PackedMatrix<LhsScalar>* result) {
+  using DstScalar = typename MulParamsType::DstScalar;
+  return DispatchLoadPrePacked<CompiledPaths, LhsScalar, RhsScalar, DstScalar,
+                               MulParamsType>(blob, size, mul_params,
+                                              get_ctx(context), result);
+}
+
+// Returns the result of ruy::LoadPrePacked if it succeeds and matches `lhs`,
+// and otherwise that of ruy::PrePack(lhs). Check PackedMatrix::owns_buffers()
+// to tell which happened, e.g. to write a new blob after a repack.
+template <typename RhsScalar, typename LhsScalar, typename MulParamsType>
+PackedMatrix<LhsScalar> LoadOrPrePack(const void* blob, std::size_t size,
+                                      const Matrix<LhsScalar>& lhs,
+                                      const MulParamsType& mul_params,
+                                      Context* context) {
+  PackedMatrix<LhsScalar> result;
+  if (LoadPrePacked<RhsScalar>(blob, size, mul_params, context, &result) &&
+      result.rows() == lhs.layout().rows() &&
+      result.cols() == lhs.layout().cols() &&
+      result.zero_point() == lhs.zero_point()) {
+    return result;
+  }
+  return PrePack<RhsScalar>(lhs, mul_params, context);
+}
+
+// Variant of ruy::Mul taking a LHS packed by ruy::PrePack.
+template <typename LhsScalar, typename RhsScalar, typename DstScalar,
+          typename MulParamsType>
+void Mul(const PackedMatrix<LhsScalar>& lhs, const Matrix<RhsScalar>& rhs,
+         const MulParamsType& mul_params, Context* context,
+         Matrix<DstScalar>* dst) {
+  Mat<RhsScalar> internal_rhs = ToInternal(rhs);
+  Mat<DstScalar> internal_dst = ToInternal(*dst);
+  DispatchPrePackedMul<ruy::kDefaultPaths, LhsScalar, RhsScalar, DstScalar,
+                       MulParamsType>(lhs, internal_rhs, mul_params,
+                                      get_ctx(context), &internal_dst);
+}
+
+// Variant of the above allowing to specify a custom OR-ed set of Path's to
+// compile. Must be the same as was passed to ruy::PrePack.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void Mul(const PackedMatrix<LhsScalar>& lhs, const Matrix<RhsScalar>& rhs,
+         const MulParamsType& mul_params, Context* context,
+         Matrix<DstScalar>* dst) {
+  Mat<RhsScalar> internal_rhs = ToInternal(rhs);
+  Mat<DstScalar> internal_dst = ToInternal(*dst);
+  DispatchPrePackedMul<CompiledPaths, LhsScalar, RhsScalar, DstScalar,
+                       MulParamsType>(lhs, internal_rhs, mul_params,
+                                      get_ctx(context), &internal_dst);
+}
+
+// Strided-batch variant of ruy::Mul, multiplying the same `lhs` by
+// `batch_size` RHS matrices, into as many destination matrices:
+//
+//   for i in [0, batch_size):
+//     dst_i = lhs * rhs_i
+//
+// where rhs_i (resp. dst_i) is `rhs` (resp. `*dst`) with its data pointer
+// advanced by i * rhs_batch_stride (resp. i * dst_batch_stride) scalars.
+// All RHS and destination matrices thus share the layout of `rhs` and `*dst`.
+// The destination matrices must not overlap, so dst_batch_stride must be at
+// least the flat size of `*dst` when batch_size > 1.
+//
+// This is typically used to apply weights to a 3-D tensor. Compared to calling
+// ruy::Mul in a loop, the LHS is packed only once, and the blocks of all
+// batch items are distributed together over the thread pool.
+//
+// Caching of the packed LHS, per its cache_policy, is supported as in ruy::Mul.
+// The RHS cache_policy is ignored.
+template <typename LhsScalar, typename RhsScalar, typename DstScalar,
+          typename MulParamsType>
+void StridedBatchMul(const Matrix<LhsScalar>& lhs, const Matrix<RhsScalar>& rhs,
+                     int rhs_batch_stride, const MulParamsType& mul_params,
+                     int batch_size, Context* context, Matrix<DstScalar>* dst,
+                     int dst_batch_stride) {
+  Mat<LhsScalar> internal_lhs = ToInternal(lhs);
+  Mat<RhsScalar> internal_rhs = ToInternal(rhs);
+  Mat<DstScalar> internal_dst = ToInternal(*dst);
+  DispatchStridedBatchMul<ruy::kDefaultPaths, LhsScalar, RhsScalar, DstScalar,
+                          MulParamsType>(
+      internal_lhs, internal_rhs, rhs_batch_stride, mul_params, batch_size,
+      get_ctx(context), &internal_dst, dst_batch_stride);
+}
+
+// Variant of ruy::StridedBatchMul allowing to specify a custom OR-ed set of
+// Path's to compile. See the comments in path.h for more details.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void StridedBatchMul(const Matrix<LhsScalar>& lhs, const Matrix<RhsScalar>& rhs,
+                     int rhs_batch_stride, const MulParamsType& mul_params,
+                     int batch_size, Context* context, Matrix<DstScalar>* dst,
+                     int dst_batch_stride) {
+  Mat<LhsScalar> internal_lhs = ToInternal(lhs);
+  Mat<RhsScalar> internal_rhs = ToInternal(rhs);
+  Mat<DstScalar> internal_dst = ToInternal(*dst);
+  DispatchStridedBatchMul<CompiledPaths, LhsScalar, RhsScalar, DstScalar,
+                          MulParamsType>(
+      internal_lhs, internal_rhs, rhs_batch_stride, mul_params, batch_size,
+      get_ctx(context), &internal_dst, dst_batch_stride);
+}
+
+// One item of a batch of independent matrix multiplications, as consumed by
+// ruy::BatchMul. The pointed-to objects must outlive the BatchMul call.
+template <typename LhsScalar, typename RhsScalar, typename DstScalar,
+          typename MulParamsType>
+struct BatchMulItem {
+  const Matrix<LhsScalar>* lhs = nullptr;
+  const Matrix<RhsScalar>* rhs = nullptr;
+  const MulParamsType* mul_params = nullptr;
+  Matrix<DstScalar>* dst = nullptr;
+};
+
+// Performs the `batch_size` independent multiplications described by
+// `items`, each of them equivalent to
+//
+//   ruy::Mul(*items[i].lhs, *items[i].rhs, *items[i].mul_params, context,
+//            items[i].dst);
+//
+// This is meant for workloads made of many small multiplications, for which
+// the per-call overhead of ruy::Mul (path selection, and above all the
+// thread pool round-trip when multi-threading) would dominate. Here the path
+// is selected once, and the small items are spread over the thread pool all
+// at once, each being handled entirely by one thread, with a single wait at
+// the end. Items that are large enough to be multi-threaded on their own are
+// handled as ruy::Mul would.
+//
+// The destination matrices must not overlap each other, nor any of the
+// source matrices.
+template <typename LhsScalar, typename RhsScalar, typename DstScalar,
+          typename MulParamsType>
+void BatchMul(const BatchMulItem<LhsScalar, RhsScalar, DstScalar,
+                                 MulParamsType>* items,
+              int batch_size, Context* context) {
+  DispatchBatchMul<ruy::kDefaultPaths, LhsScalar, RhsScalar, DstScalar,
+                   MulParamsType>(items, batch_size, get_ctx(context));
+}
+
+// Variant of ruy::BatchMul allowing to specify a custom OR-ed set of Path's to
+// compile. See the comments in path.h for more details.
+template <Path CompiledPaths, typename LhsScalar, typename RhsScalar,
+          typename DstScalar, typename MulParamsType>
+void BatchMul(const BatchMulItem<LhsScalar, RhsScalar, DstScalar,
+                                 MulParamsType>* items,
+              int batch_size, Context* context) {
+  DispatchBatchMul<CompiledPaths, LhsScalar, RhsScalar, DstScalar,
+                   MulParamsType>(items, batch_size, get_ctx(context));
+}
+
 }  // namespace ruy
 
 #endif  // RUY_RUY_RUY_H_
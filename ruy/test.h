@@ -37,10 +37,13 @@ limitations under the License.
 #include <vector>
 
 #include "ruy/allocator.h"
+#include "ruy/block_scheduling.h"
 #include "ruy/context.h"
 #include "ruy/context_get_ctx.h"
 #include "ruy/ctx.h"
+#include "ruy/float16.h"
 #include "ruy/gtest_wrapper.h"  // IWYU pragma: export
+#include "ruy/int4.h"
 #include "ruy/matrix.h"         // IWYU pragma: export
 #include "ruy/mul_params.h"     // IWYU pragma: export
 #include "ruy/platform.h"
@@ -228,7 +231,7 @@ enum class RandomRange {
 };
 
 template <typename Scalar,
-          bool IsFloatingPoint = std::is_floating_point<Scalar>::value>
+          bool IsFloatingPoint = !std::numeric_limits<Scalar>::is_integer>
 struct RandomRangeBounds {};
 
 template <typename Scalar>
@@ -311,7 +314,7 @@ struct RandomRangeBounds<Scalar, false> {
       case RandomRange::kBias:
         return std::is_same<Scalar, std::int32_t>::value
                    ? static_cast<Scalar>(-10000)
-                   : 0;
+                   : static_cast<Scalar>(0);
       default:
         RUY_CHECK(false);
         return 0;
@@ -332,7 +335,7 @@ struct RandomRangeBounds<Scalar, false> {
       case RandomRange::kBias:
         return std::is_same<Scalar, std::int32_t>::value
                    ? static_cast<Scalar>(10000)
-                   : 0;
+                   : static_cast<Scalar>(0);
       default:
         RUY_CHECK(false);
         return 0;
@@ -354,9 +357,12 @@ struct UniformRandomDistribution {
   // std::uniform_int_distribution is specified not to support char types,
   // only short and wider types. MSVC actually generates an error on
   // std::uniform_int_distribution<std::int8_t>.
+  // Likewise, std::uniform_real_distribution only supports the standard
+  // floating-point types, so 16-bit floats are drawn as float and rounded.
   using StdDistType = typename std::conditional<
-      std::is_floating_point<Scalar>::value,
-      std::uniform_real_distribution<Scalar>,
+      !std::numeric_limits<Scalar>::is_integer,
+      std::uniform_real_distribution<typename std::conditional<
+          std::is_floating_point<Scalar>::value, Scalar, float>::type>,
       std::uniform_int_distribution<std::int32_t>>::type;
   StdDistType dist;
 };
@@ -447,6 +453,28 @@ inline int FlatSize(const Layout& layout) {
   return layout.stride() * outerdim;
 }
 
+// Returns the number of Scalar elements storing a matrix of the given layout.
+// Matrices of ruy::int4 store two entries per element, see ruy/int4.h.
+template <typename Scalar>
+int StorageFlatSize(const Layout& layout) {
+  return std::is_same<Scalar, int4>::value
+             ? static_cast<int>(Int4StorageBytes(FlatSize(layout)))
+             : FlatSize(layout);
+}
+
+// Stores entries, given one per element, as a matrix of their type stores
+// them: a no-op except for ruy::int4, see StorageFlatSize.
+template <typename Scalar>
+void StoreEntries(std::vector<Scalar>*) {}
+
+inline void StoreEntries(std::vector<int4>* data) {
+  std::vector<int4> storage(Int4StorageBytes(data->size()));
+  for (std::size_t i = 0; i < data->size(); i++) {
+    SetInt4Entry(storage.data(), i, (*data)[i]);
+  }
+  data->swap(storage);
+}
+
 template <typename Scalar>
 void VerifyConsistentFields(const StorageMatrix<Scalar>& storage_matrix) {
   if (storage_matrix.data.empty()) {
@@ -455,7 +483,7 @@ void VerifyConsistentFields(const StorageMatrix<Scalar>& storage_matrix) {
     RUY_CHECK_EQ(storage_matrix.matrix.layout().cols(), 0);
   } else {
     RUY_CHECK_EQ(storage_matrix.matrix.data(), storage_matrix.data.data());
-    RUY_CHECK_EQ(FlatSize(storage_matrix.matrix.layout()),
+    RUY_CHECK_EQ(StorageFlatSize<Scalar>(storage_matrix.matrix.layout()),
                  static_cast<int>(storage_matrix.data.size()));
   }
 }
@@ -470,6 +498,7 @@ void MakeRandom(int rows, int cols, Order order, Scalar zero_point,
   UniformRandomDistribution<Scalar> data_dist(range);
   MakeRandomVector(&data_dist, FlatSize(storage_matrix->matrix.layout()),
                    &storage_matrix->data);
+  StoreEntries(&storage_matrix->data);
   storage_matrix->matrix.set_data(storage_matrix->data.data());
   VerifyConsistentFields(*storage_matrix);
 }
@@ -584,6 +613,8 @@ struct TestSet final {
   StorageMatrix<RhsScalar> rhs;
   MulParamsType mul_params;
   std::vector<AccumScalar> bias_data;
+  std::vector<float> lhs_scales_data;
+  std::vector<std::int8_t> lhs_zero_points_data;
   std::vector<std::unique_ptr<TestResultType>> results;
 
   std::vector<Path> paths;
@@ -592,6 +623,9 @@ struct TestSet final {
   bool benchmark = false;
   bool perchannel = false;
   int max_num_threads = 0;
+  // Only used when max_num_threads is set or when benchmarking. Otherwise,
+  // the block scheduling is picked randomly along with the number of threads.
+  BlockScheduling block_scheduling = BlockScheduling::kSharedCounter;
 
   bool cache_lhs = false;
   bool cache_rhs = false;
@@ -639,10 +673,21 @@ void TestSet<LhsScalar, RhsScalar, SpecType>::EvalRuy(TestResultType* result) {
   GlobalContext().set_explicit_tuning(result->tuning);
   if (max_num_threads) {
     GlobalContext().set_max_num_threads(max_num_threads);
+    GlobalContext().set_block_scheduling(block_scheduling);
   } else if (benchmark) {
     GlobalContext().set_max_num_threads(1);
+    GlobalContext().set_block_scheduling(block_scheduling);
   } else {
     GlobalContext().set_max_num_threads(1 + global_random_engine()() % 8);
+    // Cycle through the block schedulings rather than drawing one from
+    // global_random_engine(), which would shift the random values seen by all
+    // subsequent tests.
+    static constexpr BlockScheduling kBlockSchedulings[] = {
+        BlockScheduling::kSharedCounter, BlockScheduling::kWorkStealing,
+        BlockScheduling::kTapered};
+    static unsigned block_scheduling_index = 0;
+    GlobalContext().set_block_scheduling(
+        kBlockSchedulings[block_scheduling_index++ % 3]);
   }
   get_ctx(&GlobalContext())->SetRuntimeEnabledPaths(result->path);
   if (expected_outcome == ExpectedOutcome::kSuccess) {
@@ -664,6 +709,7 @@ void TestSet<LhsScalar, RhsScalar, SpecType>::EvalRuy(TestResultType* result) {
   }
   GlobalContext().set_explicit_tuning(Tuning::kAuto);
   GlobalContext().set_max_num_threads(1);
+  GlobalContext().set_block_scheduling(BlockScheduling::kSharedCounter);
 }
 
 #ifdef RUY_TEST_EXTERNAL_PATHS
@@ -1272,9 +1318,26 @@ void EvalExternalPath(
   }
 }
 
+// Returns the largest magnitude of the entries of a matrix.
+template <typename Scalar>
+double MaxAbsEntry(const Matrix<Scalar>& matrix) {
+  double result = 0;
+  for (int row = 0; row < matrix.layout().rows(); row++) {
+    for (int col = 0; col < matrix.layout().cols(); col++) {
+      const float val = static_cast<float>(Element(matrix, row, col));
+      result = std::max(result, std::abs(static_cast<double>(val)));
+    }
+  }
+  return result;
+}
+
+// For floating-point results, max_abs_term bounds the magnitude of the
+// products of LHS and RHS entries that make up each result: the rounding
+// errors of the summation scale with it, not with the result, which may
+// nearly cancel.
 template <typename Scalar>
 bool Agree(const Matrix<Scalar>& matrix1, const Matrix<Scalar>& matrix2,
-           int depth) {
+           int depth, double max_abs_term) {
   RUY_CHECK_EQ(matrix1.layout().rows(), matrix2.layout().rows());
   RUY_CHECK_EQ(matrix1.layout().cols(), matrix2.layout().cols());
   RUY_CHECK_EQ(matrix1.zero_point(), matrix2.zero_point());
@@ -1295,6 +1358,7 @@ bool Agree(const Matrix<Scalar>& matrix1, const Matrix<Scalar>& matrix2,
                      std::abs(static_cast<double>(Element(matrix2, row, col))));
       }
     }
+    max_abs_val = std::max(max_abs_val, max_abs_term);
     tolerated_max_diff = max_abs_val * std::numeric_limits<Scalar>::epsilon() *
                          64 * std::sqrt(static_cast<float>(depth));
     tolerated_mean_diff = tolerated_max_diff / std::sqrt(size);
@@ -1327,16 +1391,19 @@ bool Agree(const Matrix<Scalar>& matrix1, const Matrix<Scalar>& matrix2,
 
 template <typename Scalar>
 bool Agree(const StorageMatrix<Scalar>& storage_matrix1,
-           const StorageMatrix<Scalar>& storage_matrix2, int depth) {
+           const StorageMatrix<Scalar>& storage_matrix2, int depth,
+           double max_abs_term) {
   VerifyConsistentFields(storage_matrix1);
   VerifyConsistentFields(storage_matrix2);
-  return Agree(storage_matrix1.matrix, storage_matrix2.matrix, depth);
+  return Agree(storage_matrix1.matrix, storage_matrix2.matrix, depth,
+               max_abs_term);
 }
 
 template <typename Scalar>
 bool Agree(const TestResult<Scalar>& result1, const TestResult<Scalar>& result2,
-           int depth) {
-  return Agree(result1.storage_matrix, result2.storage_matrix, depth);
+           int depth, double max_abs_term) {
+  return Agree(result1.storage_matrix, result2.storage_matrix, depth,
+               max_abs_term);
 }
 
 struct Stats {
@@ -1515,6 +1582,60 @@ struct MakeSpecMultiplierFieldsImpl<TestSetType, false> {
   }
 };
 
+// Sets the MulParams::lhs_scales of an int8 LHS with float accumulators,
+// and the MulParams::lhs_zero_points of it or of an int4 LHS, randomly
+// choosing between none, one per row and one per group of depth levels, with
+// various group sizes. Per-group zero points replace the zero point of the
+// LHS matrix, which is then 0.
+template <typename TestSetType,
+          bool HasScales =
+              (std::is_same<typename TestSetType::AccumScalar, float>::value &&
+               std::is_same<typename TestSetType::LhsScalar,
+                            std::int8_t>::value),
+          bool HasZeroPoints =
+              (HasScales ||
+               std::is_same<typename TestSetType::LhsScalar, int4>::value)>
+struct MakeSpecLhsGroupsImpl {
+  static void Run(TestSetType*) {}
+};
+
+template <typename TestSetType, bool HasScales>
+struct MakeSpecLhsGroupsImpl<TestSetType, HasScales, true> {
+  static void Run(TestSetType* test_set) {
+    static constexpr int kGroupSizes[] = {0, 1, 4, 7, 32};
+    const int choice = global_random_engine()() % 6;
+    if (choice == 5) {
+      return;
+    }
+    const int group_size = kGroupSizes[choice];
+    const int rows = test_set->rows;
+    const int depth = test_set->depth;
+    const int num_groups =
+        group_size ? (depth + group_size - 1) / group_size : 1;
+    if (HasScales) {
+      std::uniform_real_distribution<float> scale_dist(0.25f, 2.f);
+      test_set->lhs_scales_data.resize(rows * num_groups);
+      for (auto& x : test_set->lhs_scales_data) {
+        x = scale_dist(global_random_engine());
+      }
+      test_set->mul_params.set_lhs_scales(test_set->lhs_scales_data.data());
+    }
+    if (!HasScales || (global_random_engine()() & 1)) {
+      using LhsScalar = typename TestSetType::LhsScalar;
+      UniformRandomDistribution<LhsScalar> zero_point_dist(
+          RandomRange::kReasonableSrcZeroPoint);
+      test_set->lhs_zero_points_data.resize(rows * num_groups);
+      for (auto& x : test_set->lhs_zero_points_data) {
+        x = zero_point_dist.Get();
+      }
+      test_set->mul_params.set_lhs_zero_points(
+          test_set->lhs_zero_points_data.data());
+      test_set->lhs.matrix.set_zero_point(0);
+    }
+    test_set->mul_params.set_lhs_group_size(group_size);
+  }
+};
+
 template <typename MulParamsType>
 void MakeSpecClampFields(MulParamsType* mul_params) {
   using AccumScalar = typename MulParamsType::AccumScalar;
@@ -1592,6 +1713,9 @@ void TestSet<LhsScalar, RhsScalar, SpecType>::MakeMulParams() {
     lhs.matrix.set_zero_point(lhs.matrix.zero_point() + 1);
   }
   MakeSpecMultiplierFieldsImpl<TestSet>::Run(this);
+  if (!benchmark) {
+    MakeSpecLhsGroupsImpl<TestSet>::Run(this);
+  }
   MakeSpecClampFields(&mul_params);
   life_stage = LifeStage::kHasMulParams;
 }
@@ -1760,6 +1884,9 @@ void TestSet<LhsScalar, RhsScalar, SpecType>::EvalResult(
 
 using f32 = float;
 using f64 = double;
+using bf16 = bfloat16;
+using f16 = float16;
+using i4 = int4;
 using u8 = std::uint8_t;
 using i8 = std::int8_t;
 using u16 = std::uint16_t;
@@ -1782,6 +1909,9 @@ const char* TypeName() {
 
 RUY_TYPENAME(f32)
 RUY_TYPENAME(f64)
+RUY_TYPENAME(bf16)
+RUY_TYPENAME(f16)
+RUY_TYPENAME(i4)
 RUY_TYPENAME(u8)
 RUY_TYPENAME(i8)
 RUY_TYPENAME(u16)
@@ -1804,7 +1934,7 @@ const char* SymmetryName(const Matrix<Scalar>& matrix) {
 
 template <typename Scalar>
 int StorageSize(const Matrix<Scalar>& matrix) {
-  return sizeof(Scalar) * FlatSize(matrix.layout());
+  return sizeof(Scalar) * StorageFlatSize<Scalar>(matrix.layout());
 }
 
 // Helper that replicates a buffer and gives out pointers to the replicas.
@@ -1861,7 +1991,8 @@ void TestSet<LhsScalar, RhsScalar, SpecType>::Benchmark(
     num_matmul_sets =
         (kWorkingSetSize + each_matmul_set_size - 1) / each_matmul_set_size;
 
-    cold_lhs.Init(lhs.matrix.data(), FlatSize(lhs.matrix.layout()),
+    cold_lhs.Init(lhs.matrix.data(),
+                  StorageFlatSize<LhsScalar>(lhs.matrix.layout()),
                   num_matmul_sets);
     cold_rhs.Init(rhs.matrix.data(), FlatSize(rhs.matrix.layout()),
                   num_matmul_sets);
@@ -2012,8 +2143,10 @@ std::string DumpRegion(const Matrix<Scalar>& matrix, int center_row,
 template <typename LhsScalar, typename RhsScalar, typename SpecType>
 void TestSet<LhsScalar, RhsScalar, SpecType>::VerifyTestResults() const {
   const int depth = lhs.matrix.layout().cols();
+  const double max_abs_term =
+      MaxAbsEntry(lhs.matrix) * MaxAbsEntry(rhs.matrix);
   for (int i = 0; i < static_cast<int>(results.size()) - 1; i++) {
-    if (!Agree(*results[i], *results[i + 1], depth)) {
+    if (!Agree(*results[i], *results[i + 1], depth, max_abs_term)) {
       std::string paths_in_agreement;
       paths_in_agreement.append(PathName(*results[0]));
       for (int j = 1; j <= i; j++) {
@@ -2093,6 +2226,25 @@ void TestRCC(int rows, int depth, int cols) {
   TestRCC<TestSetType>(rows, depth, cols, ExpectedOutcome::kSuccess);
 }
 
+// Variant of TestRCC running on the given number of threads with the given
+// block scheduling, for tests of the multi-threaded code paths.
+template <typename TestSetType>
+void TestRCCMultiThreaded(
+    int rows, int depth, int cols, int max_num_threads,
+    BlockScheduling block_scheduling = BlockScheduling::kSharedCounter) {
+  TestSetType test_set;
+  test_set.rows = rows;
+  test_set.depth = depth;
+  test_set.cols = cols;
+  test_set.lhs_order = Order::kRowMajor;
+  test_set.rhs_order = Order::kColMajor;
+  test_set.dst_order = Order::kColMajor;
+  test_set.layout_style = LayoutStyle::kUnstridedLinear;
+  test_set.max_num_threads = max_num_threads;
+  test_set.block_scheduling = block_scheduling;
+  test_set.Run();
+}
+
 template <typename TestSetType>
 void TestNonRCC(int rows, int depth, int cols,
                 ExpectedOutcome expected_outcome) {
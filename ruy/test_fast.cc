@@ -15,9 +15,22 @@ limitations under the License.
 
 // This test contains cheap test cases, completes in a few seconds.
 
+#include <algorithm>
 #include <vector>
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "ruy/block_scheduling.h"
+#include "ruy/context.h"
+#include "ruy/context_get_ctx.h"
+#include "ruy/cpu_topology.h"
+#include "ruy/ctx.h"
 #include "ruy/test.h"
+#include "ruy/thread_pool.h"
+#include "ruy/time.h"
+#include "ruy/warm_up.h"
 
 namespace ruy {
 
@@ -74,6 +87,211 @@ TEST(RuyTest, TestMiscMuls) {
   }
 }
 
+TEST(RuyTest, TestLargerMulsAllOrders) {
+  // Large enough to span multiple blocks, and multiple of the tiles used by
+  // optimized kernels to store to a row-major destination.
+  const int shapes[][3] = {
+      {130, 70, 150}, {67, 129, 201}, {200, 33, 65}, {64, 64, 128}};
+  for (const auto& shape : shapes) {
+    TestLinearAllOrders<TestSetType>(shape[0], shape[1], shape[2]);
+  }
+}
+
+TEST(RuyTest, TestBlockSchedulings) {
+  // The last shape is large enough for BlockScheduling::kTapered to hand out
+  // blocks of several sizes.
+  const int shapes[][3] = {
+      {300, 100, 200}, {513, 64, 77}, {96, 300, 1000}, {600, 32, 520}};
+  for (const auto& shape : shapes) {
+    for (BlockScheduling block_scheduling :
+         {BlockScheduling::kSharedCounter, BlockScheduling::kWorkStealing,
+          BlockScheduling::kTapered}) {
+      for (int max_num_threads : {2, 5, 16}) {
+        TestRCCMultiThreaded<TestSetType>(shape[0], shape[1], shape[2],
+                                          max_num_threads, block_scheduling);
+      }
+    }
+  }
+}
+
+TEST(RuyTest, TestNonPotBlockGrids) {
+  const int shapes[][3] = {{300, 100, 200}, {1000, 64, 96}, {64, 80, 700}};
+  Ctx* ctx = get_ctx(&GlobalContext());
+  for (bool non_pot_block_grids : {false, true}) {
+    ctx->set_non_pot_block_grids(non_pot_block_grids);
+    for (const auto& shape : shapes) {
+      for (int max_num_threads : {3, 6, 12}) {
+        TestRCCMultiThreaded<TestSetType>(shape[0], shape[1], shape[2],
+                                          max_num_threads);
+      }
+    }
+  }
+  ctx->set_non_pot_block_grids(true);
+}
+
+TEST(RuyTest, TestWarmUp) {
+  // Multiplications must work the same whether or not the arenas they
+  // allocate from were sized up front, whatever the size. The random engine
+  // is restored afterwards, so that the random data of the tests that follow
+  // does not depend on this one.
+  const std::default_random_engine saved_random_engine =
+      global_random_engine();
+  Context* context = &GlobalContext();
+  for (bool prefault : {false, true}) {
+    for (int max_num_threads : {1, 4}) {
+      context->set_max_num_threads(max_num_threads);
+      WarmUpParams warm_up_params;
+      warm_up_params.max_rows = 300;
+      warm_up_params.max_depth = 200;
+      warm_up_params.max_cols = 250;
+      warm_up_params.prefault_arenas = prefault;
+      context->WarmUp(warm_up_params);
+      for (int size : {10, 300, 500}) {
+        TestRCCMultiThreaded<TestSetType>(size, 200, 250, max_num_threads);
+      }
+    }
+  }
+  global_random_engine() = saved_random_engine;
+}
+
+TEST(RuyTest, TestIdleTimes) {
+  // Records how long each thread waits at the end of each TrMul for the
+  // others to finish. How that compares across block schedulings depends on
+  // the machine, so only the bookkeeping itself is checked here. See
+  // thread_pool_test for idle times under a known imbalance,
+  // block_map_test for how tapered blocks reduce it, and the benchmark's
+  // scaling mode for comparing the schedulings on an actual machine.
+  ThreadPool* thread_pool = get_ctx(&GlobalContext())->mutable_thread_pool();
+  thread_pool->set_record_idle_times(true);
+  for (BlockScheduling block_scheduling :
+       {BlockScheduling::kSharedCounter, BlockScheduling::kWorkStealing,
+        BlockScheduling::kTapered}) {
+    for (int max_num_threads : {2, 3, 4}) {
+      TestRCCMultiThreaded<TestSetType>(300, 200, 250, max_num_threads,
+                                        block_scheduling);
+      const std::vector<Duration>& idle_times =
+          thread_pool->last_idle_times();
+      EXPECT_EQ(static_cast<int>(idle_times.size()), max_num_threads);
+      // The thread that finished last did not wait at all.
+      Duration min_idle_time = Duration::max();
+      for (const Duration& idle_time : idle_times) {
+        EXPECT_GE(idle_time, Duration::zero());
+        min_idle_time = std::min(min_idle_time, idle_time);
+      }
+      EXPECT_EQ(min_idle_time, Duration::zero());
+    }
+  }
+  thread_pool->set_record_idle_times(false);
+}
+
+#ifdef __linux__
+// Returns a CpuTopology simulating num_nodes NUMA nodes of cpus_per_node CPUs
+// each, made of the CPUs that this process may run on, reusing them if there
+// are too few. Pinning threads to CPUs that the process may not run on would
+// silently do nothing, see ThreadPool::set_cpu_affinity.
+CpuTopology MakeSimulatedCpuTopologyFromAllowedCpus(int num_nodes,
+                                                    int cpus_per_node) {
+  cpu_set_t cpu_set;
+  RUY_CHECK_EQ(sched_getaffinity(0, sizeof(cpu_set), &cpu_set), 0);
+  std::vector<int> allowed_cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &cpu_set)) {
+      allowed_cpus.push_back(cpu);
+    }
+  }
+  RUY_CHECK(!allowed_cpus.empty());
+  CpuTopology topology;
+  topology.node_cpus.resize(num_nodes);
+  for (int node = 0; node < num_nodes; node++) {
+    for (int i = 0; i < cpus_per_node; i++) {
+      const int index = node * cpus_per_node + i;
+      topology.node_cpus[node].push_back(
+          allowed_cpus[index % allowed_cpus.size()]);
+    }
+  }
+  return topology;
+}
+
+// Task recording the CPU that it ran on.
+struct GetCpuTask final : Task {
+  void Run() override { cpu = sched_getcpu(); }
+  int cpu = -1;
+};
+
+// Checks that the worker threads of the thread pool run on the CPUs given by
+// the topology, which must be that of the Ctx, with pinning enabled.
+void ExpectThreadsPinned(Ctx* ctx, const CpuTopology& topology,
+                         int thread_count) {
+  std::vector<GetCpuTask> tasks(thread_count);
+  ctx->mutable_thread_pool()->Execute(thread_count, tasks.data());
+  // Task 0 runs on the calling thread, which is never pinned.
+  for (int i = 1; i < thread_count; i++) {
+    EXPECT_EQ(tasks[i].cpu, CpuForThread(topology, i)) << "thread " << i;
+  }
+}
+#endif  // __linux__
+
+TEST(RuyTest, TestSimulatedNuma) {
+  // Wide and tall shapes, so that the work is split along either side.
+  const int shapes[][3] = {{100, 150, 500}, {600, 80, 120}, {33, 200, 17}};
+  Ctx* ctx = get_ctx(&GlobalContext());
+  ctx->set_numa_aware(true);
+  ctx->set_pin_threads(true);
+  for (int num_nodes : {2, 3}) {
+#ifdef __linux__
+    const CpuTopology topology =
+        MakeSimulatedCpuTopologyFromAllowedCpus(num_nodes, 2);
+#else
+    const CpuTopology topology = MakeSimulatedCpuTopology(num_nodes, 2);
+#endif
+    ctx->SetCpuTopology(topology);
+    for (const auto& shape : shapes) {
+      for (BlockScheduling block_scheduling :
+           {BlockScheduling::kSharedCounter, BlockScheduling::kWorkStealing,
+            BlockScheduling::kTapered}) {
+        for (int max_num_threads : {2, 3, 7}) {
+          TestRCCMultiThreaded<TestSetType>(shape[0], shape[1], shape[2],
+                                            max_num_threads, block_scheduling);
+        }
+      }
+    }
+#ifdef __linux__
+    ExpectThreadsPinned(ctx, topology, 7);
+#endif
+  }
+  ctx->set_numa_aware(false);
+  ctx->set_pin_threads(false);
+  ctx->SetCpuTopology(DetectCpuTopology());
+#ifndef __linux__
+  GTEST_SKIP() << "Thread pinning is only implemented on Linux, so only the "
+                  "results were checked, not the pinning.";
+#endif
+}
+
+TEST(RuyTest, TestSplitDepth) {
+  // Destinations too small to give work to every thread, with enough depth to
+  // be split among threads instead.
+  const int shapes[][3] = {{64, 4096, 64}, {7, 2000, 3}, {33, 1500, 17}};
+  for (const auto& shape : shapes) {
+    for (int max_num_threads : {2, 5, 8}) {
+      TestRCCMultiThreaded<TestSetType>(shape[0], shape[1], shape[2],
+                                        max_num_threads);
+    }
+  }
+}
+
+TEST(RuyTest, TestDepthBlocking) {
+  // With a small local data cache, the LHS and RHS data of blocks overflow it
+  // at moderate depths, so that their depth is tiled into slabs.
+  Ctx* ctx = get_ctx(&GlobalContext());
+  ctx->set_depth_blocking(true);
+  ctx->SetDataCacheSizes(1 << 16, 1 << 18);
+  TestLinearAllOrders<TestSetType>(100, 3000, 70);
+  TestLinearAllOrders<TestSetType>(64, 2049, 130);
+  ctx->SetDataCacheSizes(0, 0);
+  ctx->set_depth_blocking(false);
+}
+
 TEST(RuyTest, TestDeepMuls) {
   // TODO(b/137649322): clarify what's the max allowed matrix size.
   TestRCC<TestSetType>(1, 32767, 1);
@@ -107,4 +325,31 @@ TEST(RuyTest, TestGEMV) {
   TestLinearAllOrders<TestSetType>(8193, 17, 1);
 }
 
+TEST(RuyTest, TestMultiThreadedGEMV) {
+  // Enough rows and depth for the rows to be split among threads, with a
+  // packed LHS that is either cached or packed by the threads themselves, and
+  // an RHS vector that is either read directly or copied.
+  const int shapes[][2] = {{1000, 700}, {4099, 133}, {37, 4000}};
+  for (const auto& shape : shapes) {
+    for (int max_num_threads : {2, 5, 8}) {
+      for (bool cache_lhs : {false, true}) {
+        for (LayoutStyle layout_style :
+             {LayoutStyle::kUnstridedLinear, LayoutStyle::kLinear}) {
+          TestSetType test_set;
+          test_set.rows = shape[0];
+          test_set.depth = shape[1];
+          test_set.cols = 1;
+          test_set.lhs_order = Order::kRowMajor;
+          test_set.rhs_order = Order::kRowMajor;
+          test_set.dst_order = Order::kColMajor;
+          test_set.layout_style = layout_style;
+          test_set.max_num_threads = max_num_threads;
+          test_set.cache_lhs = cache_lhs;
+          test_set.Run();
+        }
+      }
+    }
+  }
+}
+
 }  // namespace ruy
@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "ruy/thread_pool.h"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>              // NOLINT(build/c++11)
 #include <condition_variable>  // NOLINT(build/c++11)
@@ -23,10 +24,15 @@ limitations under the License.
 #include <memory>
 #include <mutex>               // NOLINT(build/c++11)
 #include <thread>              // NOLINT(build/c++11)
+#include <utility>
 
 #include "ruy/check_macros.h"
 #include "ruy/wait.h"
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 namespace ruy {
 
 // A worker thread.
@@ -44,7 +50,8 @@ class Thread {
       : task_(nullptr),
         state_(State::Startup),
         counter_to_decrement_when_ready_(counter_to_decrement_when_ready),
-        spin_duration_(spin_duration) {
+        spin_duration_(spin_duration),
+        requested_cpu_(-1) {
     thread_.reset(new std::thread(ThreadFunc, this));
   }
 
@@ -84,6 +91,9 @@ class Thread {
           // Doing work is part of reverting to 'ready' state.
           task_->Run();
           task_ = nullptr;
+          if (record_end_time_) {
+            task_end_time_ = Now();
+          }
         }
         break;
       case State::HasWork:
@@ -103,12 +113,50 @@ class Thread {
 
   static void ThreadFunc(Thread* arg) { arg->ThreadFuncImpl(); }
 
-  // Called by the master thead to give this thread work to do.
-  void StartWork(Task* task) { ChangeState(State::HasWork, task); }
+  // Called by the master thead to give this thread work to do. If
+  // record_end_time, the time at which the task completes is then available
+  // as task_end_time().
+  void StartWork(Task* task, bool record_end_time) {
+    record_end_time_ = record_end_time;
+    ChangeState(State::HasWork, task);
+  }
+
+  // Only to be called by the master thread once the task given by StartWork
+  // has completed.
+  TimePoint task_end_time() const { return task_end_time_; }
+
+  // Called by the master thread. The new affinity is applied by this thread
+  // itself, before it runs its next task. A negative cpu means unpinned.
+  void RequestCpuAffinity(int cpu) {
+    requested_cpu_.store(cpu, std::memory_order_relaxed);
+  }
 
  private:
+  void UpdateCpuAffinity() {
+    const int cpu = requested_cpu_.load(std::memory_order_relaxed);
+    if (cpu == current_cpu_) {
+      return;
+    }
+    current_cpu_ = cpu;
+#ifdef __linux__
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(cpu, &cpu_set);
+      // Failure, e.g. for a CPU that does not exist, leaves the affinity
+      // unchanged, which is fine.
+      sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
+    } else {
+      sched_setaffinity(0, sizeof(initial_cpu_set_), &initial_cpu_set_);
+    }
+#endif
+  }
+
   // Thread entry point.
   void ThreadFuncImpl() {
+#ifdef __linux__
+    sched_getaffinity(0, sizeof(initial_cpu_set_), &initial_cpu_set_);
+#endif
     ChangeState(State::Ready);
 
     // Thread main loop
@@ -123,6 +171,7 @@ class Thread {
       // Act on new state.
       switch (state_.load(std::memory_order_acquire)) {
         case State::HasWork:
+          UpdateCpuAffinity();
           // Got work to do! So do it, and then revert to 'Ready' state.
           ChangeState(State::Ready);
           break;
@@ -140,6 +189,11 @@ class Thread {
   // The task to be worked on.
   Task* task_;
 
+  // See StartWork. Set by the master thread while this thread is in the
+  // 'Ready' state, read by this thread after running a task.
+  bool record_end_time_ = false;
+  TimePoint task_end_time_;
+
   // The condition variable and mutex guarding state changes.
   std::condition_variable state_cond_;
   std::mutex state_mutex_;
@@ -156,6 +210,15 @@ class Thread {
 
   // See ThreadPool::spin_duration_.
   const Duration spin_duration_;
+
+  // The CPU this thread should be pinned to, as set by the master thread, and
+  // the CPU it is currently pinned to, only accessed by this thread.
+  std::atomic<int> requested_cpu_;
+  int current_cpu_ = -1;
+#ifdef __linux__
+  // The affinity inherited at creation, restored when unpinning.
+  cpu_set_t initial_cpu_set_;
+#endif
 };
 
 void ThreadPool::ExecuteImpl(int task_count, int stride, Task* tasks) {
@@ -164,6 +227,9 @@ void ThreadPool::ExecuteImpl(int task_count, int stride, Task* tasks) {
   // Case of 1 thread: just run the single task on the current thread.
   if (task_count == 1) {
     (tasks + 0)->Run();
+    if (record_idle_times_) {
+      last_idle_times_.assign(1, Duration::zero());
+    }
     return;
   }
 
@@ -172,14 +238,32 @@ void ThreadPool::ExecuteImpl(int task_count, int stride, Task* tasks) {
   counter_to_decrement_when_ready_.Reset(task_count - 1);
   for (int i = 1; i < task_count; i++) {
     auto task_address = reinterpret_cast<std::uintptr_t>(tasks) + i * stride;
-    threads_[i - 1]->StartWork(reinterpret_cast<Task*>(task_address));
+    threads_[i - 1]->StartWork(reinterpret_cast<Task*>(task_address),
+                               record_idle_times_);
   }
 
   // Execute task #0 immediately on the current thread.
   (tasks + 0)->Run();
+  const TimePoint main_task_end_time =
+      record_idle_times_ ? Now() : TimePoint();
 
   // Wait for the threads submitted above to finish.
   counter_to_decrement_when_ready_.Wait(spin_duration_);
+
+  if (record_idle_times_) {
+    // Each thread is idle from the end of its own task to the end of the
+    // last task to complete. This does not allocate: CreateThreads has
+    // reserved room for task_count entries in last_idle_times_.
+    TimePoint last_end_time = main_task_end_time;
+    for (int i = 1; i < task_count; i++) {
+      last_end_time = std::max(last_end_time, threads_[i - 1]->task_end_time());
+    }
+    last_idle_times_.resize(task_count);
+    last_idle_times_[0] = last_end_time - main_task_end_time;
+    for (int i = 1; i < task_count; i++) {
+      last_idle_times_[i] = last_end_time - threads_[i - 1]->task_end_time();
+    }
+  }
 }
 
 // Ensures that the pool has at least the given count of threads.
@@ -195,8 +279,19 @@ void ThreadPool::CreateThreads(int threads_count) {
   while (threads_.size() < unsigned_threads_count) {
     threads_.push_back(
         new Thread(&counter_to_decrement_when_ready_, spin_duration_));
+    if (cpu_for_task_) {
+      threads_.back()->RequestCpuAffinity(cpu_for_task_(threads_.size()));
+    }
   }
   counter_to_decrement_when_ready_.Wait(spin_duration_);
+  last_idle_times_.reserve(threads_.size() + 1);
+}
+
+void ThreadPool::set_cpu_affinity(std::function<int(int)> cpu_for_task) {
+  cpu_for_task_ = std::move(cpu_for_task);
+  for (int i = 0; i < static_cast<int>(threads_.size()); i++) {
+    threads_[i]->RequestCpuAffinity(cpu_for_task_ ? cpu_for_task_(i + 1) : -1);
+  }
 }
 
 ThreadPool::~ThreadPool() {
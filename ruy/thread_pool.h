@@ -19,6 +19,7 @@ limitations under the License.
 #ifndef RUY_RUY_THREAD_POOL_H_
 #define RUY_RUY_THREAD_POOL_H_
 
+#include <functional>
 #include <vector>
 
 #include "ruy/blocking_counter.h"
@@ -85,6 +86,28 @@ class ThreadPool {
     return ToFloatMilliseconds(spin_duration_);
   }
 
+  // Pins the worker threads to CPUs: the thread running task i of Execute,
+  // for i >= 1, is pinned to the CPU cpu_for_task(i), or left unpinned if
+  // that is negative. An empty function, the default, unpins all threads.
+  // Task 0 runs on the caller's thread, which is never pinned.
+  //
+  // Takes effect the next time each thread is given work. Pinning is only
+  // implemented on Linux, and silently does nothing for CPUs that do not
+  // exist or that the process may not run on.
+  void set_cpu_affinity(std::function<int(int)> cpu_for_task);
+
+  // For measuring load imbalance: when enabled, each Execute records, for
+  // each task, how long its thread then waited for the last task to complete.
+  // Off by default, since it reads the clock once per task.
+  void set_record_idle_times(bool value) { record_idle_times_ = value; }
+  bool record_idle_times() const { return record_idle_times_; }
+
+  // The idle times recorded by the last Execute while record_idle_times was
+  // enabled, indexed like its tasks.
+  const std::vector<Duration>& last_idle_times() const {
+    return last_idle_times_;
+  }
+
  private:
   // Ensures that the pool has at least the given count of threads.
   // If any new thread has to be created, this function waits for it to
@@ -102,6 +125,13 @@ class ThreadPool {
   // the pool creates threads and destroys them in its destructor.
   std::vector<Thread*> threads_;
 
+  // See set_cpu_affinity.
+  std::function<int(int)> cpu_for_task_;
+
+  // See set_record_idle_times and last_idle_times.
+  bool record_idle_times_ = false;
+  std::vector<Duration> last_idle_times_;
+
   // The BlockingCounter used to wait for the threads.
   BlockingCounter counter_to_decrement_when_ready_;
 
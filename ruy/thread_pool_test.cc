@@ -0,0 +1,74 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "ruy/thread_pool.h"
+
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "ruy/gtest_wrapper.h"
+#include "ruy/time.h"
+
+namespace ruy {
+namespace {
+
+// Task sleeping for the given duration.
+struct SleepTask final : Task {
+  void Run() override { std::this_thread::sleep_for(duration); }
+  Duration duration;
+};
+
+TEST(ThreadPoolTest, IdleTimesMeasureImbalance) {
+  static constexpr int kTaskCount = 4;
+  static constexpr int kSlowTask = 2;
+  const Duration slow_duration = DurationFromMilliseconds(200);
+  ThreadPool thread_pool;
+  thread_pool.set_record_idle_times(true);
+  SleepTask tasks[kTaskCount];
+  for (int i = 0; i < kTaskCount; i++) {
+    tasks[i].duration =
+        i == kSlowTask ? slow_duration : DurationFromMilliseconds(0);
+  }
+  thread_pool.Execute(kTaskCount, tasks);
+  const std::vector<Duration>& idle_times = thread_pool.last_idle_times();
+  ASSERT_EQ(static_cast<int>(idle_times.size()), kTaskCount);
+  // The other threads wait for the slow task for about slow_duration, give
+  // or take how late each thread started its task.
+  for (int i = 0; i < kTaskCount; i++) {
+    if (i == kSlowTask) {
+      EXPECT_EQ(idle_times[i], Duration::zero());
+    } else {
+      EXPECT_GT(idle_times[i], slow_duration / 2);
+      EXPECT_LT(idle_times[i], slow_duration * 2);
+    }
+  }
+
+  // Executing again, with the same or fewer tasks, reuses the same storage.
+  const Duration* idle_times_data = idle_times.data();
+  for (int task_count : {kTaskCount, 2, 1}) {
+    thread_pool.Execute(task_count, tasks);
+    EXPECT_EQ(static_cast<int>(thread_pool.last_idle_times().size()),
+              task_count);
+    EXPECT_EQ(thread_pool.last_idle_times().data(), idle_times_data);
+  }
+}
+
+}  // namespace
+}  // namespace ruy
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -17,15 +17,19 @@ limitations under the License.
 
 #include <algorithm>
 #include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <vector>
 
 #include "ruy/allocator.h"
 #include "ruy/block_map.h"
+#include "ruy/block_scheduling.h"
 #include "ruy/check_macros.h"
 #include "ruy/common.h"
+#include "ruy/cpu_topology.h"
 #include "ruy/ctx.h"
 #include "ruy/mat.h"
 #include "ruy/matrix.h"
@@ -34,8 +38,10 @@ limitations under the License.
 #include "ruy/profiler/instrumentation.h"
 #include "ruy/side_pair.h"
 #include "ruy/size_util.h"
+#include "ruy/system_aligned_alloc.h"
 #include "ruy/thread_pool.h"
 #include "ruy/tune.h"
+#include "ruy/tuned_plans.h"
 
 namespace ruy {
 
@@ -43,36 +49,143 @@ namespace {
 
 enum class PackingStatus : std::uint8_t { kNotStarted, kInProgress, kFinished };
 
+// A range [begin, end) of block ids for BlockScheduling::kWorkStealing, packed
+// into a single 64-bit atomic so that the owner thread, taking blocks from the
+// front, and stealing threads, taking blocks from the back, can both update it
+// with a compare-exchange. Each range sits alone in its cache line.
+struct alignas(64) BlockRange {
+  std::atomic<std::uint64_t> bounds;
+};
+
+std::uint64_t PackBlockRange(int begin, int end) {
+  return static_cast<std::uint32_t>(begin) |
+         (static_cast<std::uint64_t>(end) << 32);
+}
+
+void InitBlockRange(int begin, int end, BlockRange* range) {
+  range->bounds.store(PackBlockRange(begin, end), std::memory_order_relaxed);
+}
+
+// Takes a block from the front (if from_front) or the back of the range.
+// Returns false if the range is empty.
+bool TakeBlockFromRange(bool from_front, BlockRange* range, int* block_id) {
+  // Relaxed memory order is enough, as in the kSharedCounter case: this only
+  // hands out block ids. Synchronization of packed data is done separately by
+  // packing_status.
+  std::uint64_t bounds = range->bounds.load(std::memory_order_relaxed);
+  while (true) {
+    const int begin = static_cast<std::uint32_t>(bounds);
+    const int end = static_cast<std::uint32_t>(bounds >> 32);
+    if (begin >= end) {
+      return false;
+    }
+    const std::uint64_t new_bounds = from_front
+                                         ? PackBlockRange(begin + 1, end)
+                                         : PackBlockRange(begin, end - 1);
+    if (range->bounds.compare_exchange_weak(bounds, new_bounds,
+                                            std::memory_order_relaxed)) {
+      *block_id = from_front ? begin : end - 1;
+      return true;
+    }
+  }
+}
+
+// For BlockScheduling::kTapered: log2 of the factor by which blocks are made
+// smaller along each side, see BlockMapOverrides::subdivision_log2. Chunks of
+// up to 4^kTaperedSubdivisionLog2 of these blocks are handed out as one block,
+// so the block sizes taper over 3 steps.
+constexpr int kTaperedSubdivisionLog2 = 2;
+
+// Takes the next chunk of consecutive blocks [*begin, *end) of a
+// BlockScheduling::kTapered traversal of num_blocks blocks of block_map, see
+// GetTaperedChunkSize, where *num_taken counts the blocks taken so far.
+// Returns false if no blocks are left.
+bool TakeTaperedChunk(const BlockMap& block_map, int num_blocks,
+                      int thread_count, std::atomic<int>* num_taken,
+                      int* begin, int* end) {
+  // Relaxed memory order is enough, as in TakeBlockFromRange.
+  int taken = num_taken->load(std::memory_order_relaxed);
+  while (taken < num_blocks) {
+    const int size =
+        GetTaperedChunkSize(block_map, taken, num_blocks, thread_count);
+    if (num_taken->compare_exchange_weak(taken, taken + size,
+                                         std::memory_order_relaxed)) {
+      *begin = taken;
+      *end = taken + size;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns true if the blocks of block_map are to be handled by tiling their
+// depth into slabs, see BlockMap::depth_block_size.
+bool UsesDepthBlocking(const TrMulParams& params, const BlockMap& block_map) {
+  return params.run_accum_kernel && params.batch_size == 1 &&
+         block_map.depth_block_size < params.src[Side::kLhs].layout.rows;
+}
+
 struct TrMulTask final : Task {
   TrMulTask(TrMulParams* params_, const BlockMap& block_map_,
-            std::atomic<int>* atomic_block_id_, int thread_id_,
+            const SidePair<int>& block_offset_,
+            std::atomic<int>* atomic_block_id_, BlockRange* block_ranges_,
+            bool tapered_, int thread_id_, int thread_count_,
             bool need_atomics_,
             SidePair<std::atomic<PackingStatus>*> packing_status_,
             TuningResolver* tuning_resolver_, Allocator* local_allocator_)
       : params(params_),
         block_map(block_map_),
+        block_offset(block_offset_),
         atomic_block_id(atomic_block_id_),
+        block_ranges(block_ranges_),
+        tapered(tapered_),
         thread_id(thread_id_),
+        thread_count(thread_count_),
         need_atomics(need_atomics_),
         packing_status(packing_status_),
         tuning_resolver(tuning_resolver_),
         local_allocator(local_allocator_),
-        local_packed{nullptr, nullptr} {}
+        local_packed{nullptr, nullptr},
+        depth_block_accum(nullptr) {}
 
   void Run() override {
     for (Side side : {Side::kLhs, Side::kRhs}) {
       if (!params->is_prepacked[side]) {
-        const int size = NumBlocksPerSide(side, block_map);
+        const int size = NumPackedBlocks(side);
         local_allocator->Allocate(size, &local_packed[side]);
         memset(local_packed[side], 0, size * sizeof(bool));
       }
     }
+    if (UsesDepthBlocking(*params, block_map)) {
+      const std::ptrdiff_t max_block_size =
+          static_cast<std::ptrdiff_t>(
+              block_map.small_block_dims[Side::kLhs] +
+              block_map.kernel_dims[Side::kLhs]) *
+          (block_map.small_block_dims[Side::kRhs] +
+           block_map.kernel_dims[Side::kRhs]);
+      depth_block_accum = local_allocator->AllocateBytes(
+          max_block_size * params->accum_type.size);
+    }
 
     const Tuning tuning = tuning_resolver->Resolve();
-    const int num_blocks = NumBlocks(block_map);
-    SidePair<int> block;
-    SidePair<int> start;
-    SidePair<int> end;
+    if (block_ranges) {
+      RunWorkStealing(tuning);
+    } else if (tapered) {
+      RunTapered(tuning);
+    } else {
+      RunSharedCounter(tuning);
+    }
+
+    local_allocator->FreeAll();
+  }
+
+ private:
+  // Block loop for BlockScheduling::kSharedCounter.
+  void RunSharedCounter(Tuning tuning) {
+    // In a strided batch, the block ids of successive batch items follow
+    // each other, so that a single atomic counter hands out the blocks of
+    // all batch items.
+    const int num_blocks = NumBlocks(block_map) * params->batch_size;
 
     // Each thread starts by initially reserving the block whose id
     // is the thread id.
@@ -85,32 +198,176 @@ struct TrMulTask final : Task {
       // immediately depending on the `next_n` result.
       const int next_block_id =
           atomic_block_id->fetch_add(1, std::memory_order_relaxed);
-      // Get coordinates of the current block to handle, in "block space".
-      GetBlockByIndex(block_map, block_id, &block);
-      // Get coordinates of the current block to handle, in matrix space.
-      GetBlockMatrixCoords(block_map, block, &start, &end);
-      // Maybe pack the current LHS/RHS block, if not already packed.
-      EnsurePacked(block, start, end, tuning);
-      // Actually do matrix multiplication work
-      params->RunKernel(tuning, start, end);
+      HandleBlock(block_id, tuning);
       // Move on to the next block as obtained by the atomic increment
       // at the start of this while loop iteration.
       block_id = next_block_id;
     }
+  }
 
-    local_allocator->FreeAll();
+  // Block loop for BlockScheduling::kWorkStealing.
+  void RunWorkStealing(Tuning tuning) {
+    int block_id;
+    // First handle our own range, front to back.
+    while (TakeBlockFromRange(true, &block_ranges[thread_id], &block_id)) {
+      HandleBlock(block_id, tuning);
+    }
+    // Then steal from the back of the other threads' ranges. Ranges only ever
+    // shrink, so one pass over them is enough to guarantee that all blocks
+    // have been taken. Draining one victim before moving on to the next one
+    // keeps the stolen blocks neighbors of each other.
+    for (int i = 1; i < thread_count; i++) {
+      BlockRange* victim = &block_ranges[(thread_id + i) % thread_count];
+      while (TakeBlockFromRange(false, victim, &block_id)) {
+        HandleBlock(block_id, tuning);
+      }
+    }
+  }
+
+  // Block loop for BlockScheduling::kTapered. Here atomic_block_id counts
+  // the blocks taken so far.
+  void RunTapered(Tuning tuning) {
+    const int num_blocks = NumBlocks(block_map) * params->batch_size;
+    int begin, end;
+    while (TakeTaperedChunk(block_map, num_blocks, thread_count,
+                            atomic_block_id, &begin, &end)) {
+      if (end - begin == 1 || depth_block_accum) {
+        // depth_block_accum only has room for a single block.
+        for (int block_id = begin; block_id < end; block_id++) {
+          HandleBlock(block_id, tuning);
+        }
+      } else {
+        HandleMergedBlocks(begin, end, tuning);
+      }
+    }
+  }
+
+  // Gets the batch item, the coordinates in "block space" and the matrix-space
+  // coordinates of the block of the given id.
+  void GetBlock(int block_id, int* batch_item, SidePair<int>* block,
+                SidePair<int>* start, SidePair<int>* end) const {
+    const int num_blocks_per_item = NumBlocks(block_map);
+    *batch_item = block_id / num_blocks_per_item;
+    GetBlockByIndex(block_map, block_id - *batch_item * num_blocks_per_item,
+                    block);
+    GetBlockMatrixCoords(block_map, *block, start, end);
+    for (Side side : {Side::kLhs, Side::kRhs}) {
+      (*start)[side] += block_offset[side];
+      (*end)[side] += block_offset[side];
+    }
+  }
+
+  // Handles the blocks [begin, end), which form a rectangle, see
+  // GetTaperedChunkSize, as one larger block: their LHS and RHS blocks are
+  // packed as usual, then the kernel runs once over the whole rectangle.
+  void HandleMergedBlocks(int begin, int end, Tuning tuning) {
+    int batch_item = 0;
+    SidePair<int> merged_start(std::numeric_limits<int>::max(),
+                               std::numeric_limits<int>::max());
+    SidePair<int> merged_end(0, 0);
+    // Sum of the areas of the blocks, to check that they form a rectangle.
+    std::int64_t area = 0;
+    for (int block_id = begin; block_id < end; block_id++) {
+      int block_batch_item;
+      SidePair<int> block;
+      SidePair<int> start;
+      SidePair<int> end;
+      GetBlock(block_id, &block_batch_item, &block, &start, &end);
+      RUY_DCHECK(block_id == begin || block_batch_item == batch_item);
+      batch_item = block_batch_item;
+      EnsurePacked(batch_item, block, start, end, tuning);
+      for (Side side : {Side::kLhs, Side::kRhs}) {
+        merged_start[side] = std::min(merged_start[side], start[side]);
+        merged_end[side] = std::max(merged_end[side], end[side]);
+      }
+      area += static_cast<std::int64_t>(end[Side::kLhs] - start[Side::kLhs]) *
+              (end[Side::kRhs] - start[Side::kRhs]);
+    }
+    const SidePair<int> merged_dims(
+        merged_end[Side::kLhs] - merged_start[Side::kLhs],
+        merged_end[Side::kRhs] - merged_start[Side::kRhs]);
+    RUY_DCHECK_EQ(area, static_cast<std::int64_t>(merged_dims[Side::kLhs]) *
+                            merged_dims[Side::kRhs]);
+    params->RunKernel(tuning, merged_start, merged_end, batch_item);
+  }
+
+  void HandleBlock(int block_id, Tuning tuning) {
+    int batch_item;
+    SidePair<int> block;
+    SidePair<int> start;
+    SidePair<int> end;
+    GetBlock(block_id, &batch_item, &block, &start, &end);
+    // Maybe pack the current LHS/RHS block, if not already packed.
+    EnsurePacked(batch_item, block, start, end, tuning);
+    // Actually do matrix multiplication work
+    if (depth_block_accum) {
+      RunKernelDepthBlocked(tuning, start, end);
+    } else {
+      params->RunKernel(tuning, start, end, batch_item);
+    }
+  }
+
+  // Handles a block by tiling its depth into slabs of
+  // block_map.depth_block_size: the raw accumulators are carried over from
+  // one slab to the next in depth_block_accum, so that the LHS and RHS data
+  // of each slab stays in the local data cache while the kernel goes over
+  // the whole block. The epilogue is applied once the last slab is done.
+  void RunKernelDepthBlocked(Tuning tuning, const SidePair<int>& start,
+                             const SidePair<int>& end) {
+    const int packed_depth = params->packed[Side::kLhs].layout.rows;
+    const int depth_block_size = block_map.depth_block_size;
+    RUY_DCHECK_EQ(depth_block_size % kDepthBlockGranularity, 0);
+    // The accumulators buffer holds just this block, but is addressed with
+    // destination coordinates, like the destination matrix itself.
+    EMat accum;
+    accum.data_type = params->accum_type;
+    accum.layout.rows = params->dst.layout.rows;
+    accum.layout.cols = params->dst.layout.cols;
+    accum.layout.stride = end[Side::kLhs] - start[Side::kLhs];
+    accum.layout.order = Order::kColMajor;
+    accum.layout.origin_row = start[Side::kLhs];
+    accum.layout.origin_col = start[Side::kRhs];
+    accum.data = depth_block_accum;
+    for (int d = 0; d < packed_depth; d += depth_block_size) {
+      const int end_depth = std::min(d + depth_block_size, packed_depth);
+      SidePair<PEMat> slab;
+      for (Side side : {Side::kLhs, Side::kRhs}) {
+        slab[side] = PackedDepthSlice(params->packed[side], d, end_depth);
+        // The zero points are taken into account by the epilogue.
+        slab[side].zero_point = 0;
+      }
+      params->run_accum_kernel(tuning, slab, start, end, d > 0, &accum);
+    }
+    const void* partial = accum.data;
+    const SidePair<int> clamped_end(
+        std::min(end[Side::kLhs], params->dst.layout.rows),
+        std::min(end[Side::kRhs], params->dst.layout.cols));
+    params->run_split_depth_epilogue(params->packed, params->mul_params,
+                                     &partial, 1, accum.layout, start,
+                                     clamped_end, &params->dst);
+  }
+
+  // Number of packed blocks on the given side: the RHS is packed separately
+  // for each item of a strided batch, while the LHS is shared.
+  int NumPackedBlocks(Side side) const {
+    const int num_blocks = NumBlocksPerSide(side, block_map);
+    return side == Side::kRhs ? num_blocks * params->batch_size : num_blocks;
   }
 
- private:
   // Tries to pack a block, without blocking.
   // If the block was already packed, returns true.
   // If the block was not started packing, packs it and returns true.
   // If the block was being packed by another thread, returns false.
-  bool TryPack(Side side, int block, int start, int end, Tuning tuning) {
+  bool TryPack(Side side, int batch_item, int block, int start, int end,
+               Tuning tuning) {
     if (params->is_prepacked[side]) {
       return true;
     }
-    if (!local_packed[side][block]) {
+    const int index =
+        side == Side::kRhs
+            ? batch_item * NumBlocksPerSide(Side::kRhs, block_map) + block
+            : block;
+    if (!local_packed[side][index]) {
       if (need_atomics) {
         // Explanation of this compare_exchange_strong operation:
         // This atomically performs all of the following:
@@ -147,14 +404,14 @@ struct TrMulTask final : Task {
         // such a problem. But we don't really know for sure, that would be
         // interesting to experiment more with.
         PackingStatus exchanged_status = PackingStatus::kNotStarted;
-        std::atomic<PackingStatus>& status = packing_status[side][block];
+        std::atomic<PackingStatus>& status = packing_status[side][index];
         if (status.compare_exchange_strong(
                 exchanged_status, PackingStatus::kInProgress,
                 std::memory_order_acq_rel, std::memory_order_acquire)) {
           // In this branch, the status was kNotStarted and we just atomically
           // changed it to kInProgress as we are about to handle the packing
           // ourselves.
-          params->RunPack(side, tuning, start, end);
+          params->RunPack(side, tuning, start, end, batch_item);
           status.store(PackingStatus::kFinished, std::memory_order_release);
         } else if (exchanged_status == PackingStatus::kInProgress) {
           // Another thread is currently packing this block.
@@ -165,9 +422,9 @@ struct TrMulTask final : Task {
       } else {
         // Single-threaded case: no need for expensive atomics, local_packed
         // is the truth already.
-        params->RunPack(side, tuning, start, end);
+        params->RunPack(side, tuning, start, end, batch_item);
       }
-      local_packed[side][block] = true;
+      local_packed[side][index] = true;
     }
     return true;
   }
@@ -176,8 +433,9 @@ struct TrMulTask final : Task {
   // are packed. In the event that they are already being packed on another
   // threads, this function may perform the packing of some other block while
   // waiting for that other thread to finish packing the requested block.
-  void EnsurePacked(const SidePair<int>& block, const SidePair<int>& start,
-                    const SidePair<int>& end, Tuning tuning) {
+  void EnsurePacked(int batch_item, const SidePair<int>& block,
+                    const SidePair<int>& start, const SidePair<int>& end,
+                    Tuning tuning) {
 #if RUY_OPT(PACK_AHEAD)
     SidePair<int> next_runahead_block{block[Side::kLhs] + 1,
                                       block[Side::kRhs] + 1};
@@ -186,8 +444,8 @@ struct TrMulTask final : Task {
     while (true) {
       bool both_sides_packed = true;
       for (Side side : {Side::kLhs, Side::kRhs}) {
-        both_sides_packed &=
-            TryPack(side, block[side], start[side], end[side], tuning);
+        both_sides_packed &= TryPack(side, batch_item, block[side],
+                                     start[side], end[side], tuning);
       }
       if (both_sides_packed) {
         break;
@@ -203,8 +461,9 @@ struct TrMulTask final : Task {
       int runahead_block_start, runahead_block_end;
       GetBlockMatrixCoords(runahead_side, block_map, runahead_block,
                            &runahead_block_start, &runahead_block_end);
-      TryPack(runahead_side, runahead_block, runahead_block_start,
-              runahead_block_end, tuning);
+      TryPack(runahead_side, batch_item, runahead_block,
+              runahead_block_start + block_offset[runahead_side],
+              runahead_block_end + block_offset[runahead_side], tuning);
       next_runahead_block[runahead_side] = runahead_block + 1;
 #endif
     }
@@ -212,8 +471,16 @@ struct TrMulTask final : Task {
 
   TrMulParams* params;
   const BlockMap& block_map;
+  // Offset of the matrix-space coordinates of blocks of block_map. Only
+  // nonzero when block_map covers a NUMA node's share of the work.
+  SidePair<int> block_offset;
   std::atomic<int>* atomic_block_id;
+  // Only used with BlockScheduling::kWorkStealing, otherwise null.
+  BlockRange* block_ranges;
+  // Whether BlockScheduling::kTapered is used.
+  bool tapered;
   int thread_id;
+  int thread_count;
   bool need_atomics;
   SidePair<std::atomic<PackingStatus>*> packing_status;
   TuningResolver* tuning_resolver;
@@ -221,27 +488,146 @@ struct TrMulTask final : Task {
 
   // Local indicators of packedness to avoid the overhead of atomic ops.
   SidePair<bool*> local_packed;
+  // Accumulators of the current block, when using depth blocking. Null
+  // otherwise.
+  void* depth_block_accum;
 };
 
 void AllocatePMatrix(Allocator* allocator, PEMat* packed) {
   packed->data = allocator->AllocateBytes(DataBytes(*packed));
   packed->sums = allocator->AllocateBytes(SumsBytes(*packed));
+  if (packed->has_scales) {
+    allocator->Allocate(packed->layout.cols, &packed->scales);
+  }
 }
 
-int GetThreadCount(Ctx* ctx, int rows, int cols, int depth) {
+// Allocates and initializes the atomic values tracking the packing status of
+// the blocks of block_map, for the sides that are not prepacked.
+void AllocatePackingStatus(
+    const TrMulParams& params, const BlockMap& block_map,
+    Allocator* allocator,
+    SidePair<std::atomic<PackingStatus>*>* packing_status) {
+  for (Side side : {Side::kLhs, Side::kRhs}) {
+    if (!params.is_prepacked[side]) {
+      const int num_blocks = NumBlocksPerSide(side, block_map);
+      const int size =
+          side == Side::kRhs ? num_blocks * params.batch_size : num_blocks;
+      allocator->Allocate(size, &(*packing_status)[side]);
+      for (int i = 0; i < size; i++) {
+        (*packing_status)[side][i].store(PackingStatus::kNotStarted,
+                                         std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+// For BlockScheduling::kWorkStealing: splits the traversal order of num_blocks
+// blocks into contiguous ranges, one per thread.
+BlockRange* AllocateBlockRanges(int num_blocks, int thread_count,
+                                Allocator* allocator) {
+  BlockRange* block_ranges;
+  allocator->Allocate(thread_count, &block_ranges);
+  for (int i = 0; i < thread_count; i++) {
+    InitBlockRange(static_cast<std::int64_t>(num_blocks) * i / thread_count,
+                   static_cast<std::int64_t>(num_blocks) * (i + 1) /
+                       thread_count,
+                   &block_ranges[i]);
+  }
+  return block_ranges;
+}
+
+// Empirically determined rule for reasonable number of threads to use:
+// one thread per 2^kThreadCountDivisorLog2 multiply-add operations.
+constexpr int kThreadCountDivisorLog2 = 15;
+
+int GetThreadCount(Ctx* ctx, int rows, int cols, int depth,
+                   int batch_size = 1) {
 #if RUY_PLATFORM_EMSCRIPTEN
   // b/139927184, std::thread constructor raises exception
   return 1;
 #endif
-  // Empirically determined rule for reasonable number of
-  // threads to use. This is proportional to the number of arithmetic ops
-  // in this Mul (product of the 3 sizes).
-  static constexpr int kDivisorLog2 = 15;
-  const int guess_log2 = std::max(
-      0, ceil_log2(rows) + ceil_log2(cols) + ceil_log2(depth) - kDivisorLog2);
+  // This is proportional to the number of arithmetic ops
+  // in this Mul (product of the 3 sizes, times the strided batch size).
+  const int guess_log2 =
+      std::max(0, ceil_log2(rows) + ceil_log2(cols) + ceil_log2(depth) +
+                      ceil_log2(batch_size) - kThreadCountDivisorLog2);
   return std::min(1 << guess_log2, ctx->max_num_threads());
 }
 
+// Same rule as GetThreadCount, applied to the total number of arithmetic ops
+// of a batch of independent TrMuls, each of which is handled by one thread.
+int GetBatchThreadCount(Ctx* ctx, std::int64_t total_ops, int batch_size) {
+#if RUY_PLATFORM_EMSCRIPTEN
+  // b/139927184, std::thread constructor raises exception
+  return 1;
+#endif
+  const std::int64_t guess = 1 + ((total_ops - 1) >> kThreadCountDivisorLog2);
+  return static_cast<int>(std::min<std::int64_t>(
+      {guess, batch_size, ctx->max_num_threads()}));
+}
+
+// Runs the whole TrMul as a single-threaded simple loop: packs the entire
+// LHS and RHS (unless prepacked) then runs the kernel over the entire
+// destination, for each item of a strided batch in turn. The packed matrices
+// must already be allocated.
+void RunSimpleLoop(TrMulParams* params, Tuning tuning) {
+  const SidePair<int> origin{0, 0};
+  const SidePair<int> rounded_dims{params->packed[Side::kLhs].layout.cols,
+                                   params->packed[Side::kRhs].layout.cols};
+  if (!params->is_prepacked[Side::kLhs]) {
+    params->RunPack(Side::kLhs, tuning, origin[Side::kLhs],
+                    rounded_dims[Side::kLhs]);
+  }
+  for (int batch_item = 0; batch_item < params->batch_size; batch_item++) {
+    if (!params->is_prepacked[Side::kRhs]) {
+      params->RunPack(Side::kRhs, tuning, origin[Side::kRhs],
+                      rounded_dims[Side::kRhs], batch_item);
+    }
+    params->RunKernel(tuning, origin, rounded_dims, batch_item);
+  }
+}
+
+// Task running whole TrMuls out of a batch. Like TrMulTask, each thread
+// starts with the item whose index is its thread id, and then reserves
+// further items through a shared atomic counter.
+struct TrMulBatchTask final : Task {
+  TrMulBatchTask(TrMulParams* params_, int item_count_,
+                 std::atomic<int>* atomic_item_id_, int thread_id_,
+                 TuningResolver* tuning_resolver_, Allocator* local_allocator_)
+      : params(params_),
+        item_count(item_count_),
+        atomic_item_id(atomic_item_id_),
+        thread_id(thread_id_),
+        tuning_resolver(tuning_resolver_),
+        local_allocator(local_allocator_) {}
+
+  void Run() override {
+    const Tuning tuning = tuning_resolver->Resolve();
+    int item_id = thread_id;
+    while (item_id < item_count) {
+      const int next_item_id =
+          atomic_item_id->fetch_add(1, std::memory_order_relaxed);
+      TrMulParams* item_params = params + item_id;
+      for (Side side : {Side::kLhs, Side::kRhs}) {
+        if (!item_params->is_prepacked[side]) {
+          AllocatePMatrix(local_allocator, &item_params->packed[side]);
+        }
+      }
+      RunSimpleLoop(item_params, tuning);
+      local_allocator->FreeAll();
+      item_id = next_item_id;
+    }
+  }
+
+ private:
+  TrMulParams* params;
+  int item_count;
+  std::atomic<int>* atomic_item_id;
+  int thread_id;
+  TuningResolver* tuning_resolver;
+  Allocator* local_allocator;
+};
+
 LoopStructure GetLoopStructure(int tentative_thread_count, int rows, int cols,
                                int depth, int lhs_scalar_size,
                                int rhs_scalar_size, int local_data_cache_size,
@@ -259,34 +645,829 @@ LoopStructure GetLoopStructure(int tentative_thread_count, int rows, int cols,
   return LoopStructure::kGeneral;
 }
 
+// Returns the Context's tuned plan for the given params, see tuned_plans.h,
+// or nullptr if there is none.
+const TunedPlan* FindTunedPlan(const TrMulParams& params, Ctx* ctx) {
+  const TunedPlans* tuned_plans = ctx->tuned_plans();
+  if (!tuned_plans) {
+    return nullptr;
+  }
+  TunedPlans::Key key;
+  key.path = params.path;
+  key.rows = params.src[Side::kLhs].layout.cols;
+  key.depth = params.src[Side::kLhs].layout.rows;
+  key.cols = params.src[Side::kRhs].layout.cols;
+  key.lhs_scalar_size = params.src[Side::kLhs].data_type.size;
+  key.rhs_scalar_size = params.src[Side::kRhs].data_type.size;
+  return tuned_plans->Find(key);
+}
+
+// Returns the thread count of the given tuned plan, if any, capped by the
+// Context's max_num_threads, otherwise that of GetThreadCount.
+int GetThreadCount(const TunedPlan* tuned_plan, Ctx* ctx, int rows, int cols,
+                   int depth, int batch_size) {
+  if (tuned_plan && tuned_plan->thread_count) {
+    return std::min(tuned_plan->thread_count, ctx->max_num_threads());
+  }
+  return GetThreadCount(ctx, rows, cols, depth, batch_size);
+}
+
+// The shape-dependent decisions that TrMul makes before packing anything: how
+// many threads to use, the loop structure and, for LoopStructure::kGeneral,
+// the block map.
+struct TrMulPlan {
+  // See GetThreadCount.
+  int tentative_thread_count;
+  LoopStructure loop_structure;
+  // Only valid if loop_structure is LoopStructure::kGeneral.
+  BlockMap block_map;
+};
+
+// Computes the TrMulPlan for the given params. This only reads shapes and
+// types from params.
+void MakeTrMulPlan(const TrMulParams& params, Ctx* ctx, TrMulPlan* plan) {
+  const EMat& lhs = params.src[Side::kLhs];
+  const EMat& rhs = params.src[Side::kRhs];
+  const PEMat& packed_lhs = params.packed[Side::kLhs];
+  const PEMat& packed_rhs = params.packed[Side::kRhs];
+  const int rows = lhs.layout.cols;
+  const int cols = rhs.layout.cols;
+  const int depth = lhs.layout.rows;
+  const int batch_size = params.batch_size;
+  const TunedPlan* tuned_plan =
+      batch_size == 1 ? FindTunedPlan(params, ctx) : nullptr;
+  plan->tentative_thread_count =
+      GetThreadCount(tuned_plan, ctx, rows, cols, depth, batch_size);
+  plan->loop_structure = GetLoopStructure(
+      plan->tentative_thread_count, rows, cols, depth, lhs.data_type.size,
+      rhs.data_type.size, params.local_data_cache_size,
+      params.shared_data_cache_size);
+  if (plan->loop_structure != LoopStructure::kGeneral) {
+    return;
+  }
+  // In a strided batch, the block map describes the blocks of one batch item.
+  // The batch items provide additional parallelism, so the block map is sized
+  // according to the thread count for a single item.
+  BlockMapOverrides overrides;
+  if (tuned_plan) {
+    overrides = tuned_plan->block_map;
+  }
+  overrides.allow_non_pot_grid = ctx->non_pot_block_grids();
+  if (ctx->block_scheduling() == BlockScheduling::kTapered &&
+      plan->tentative_thread_count > 1) {
+    overrides.subdivision_log2 = kTaperedSubdivisionLog2;
+    // Tapering balances the load by itself, and only merges blocks in
+    // power-of-two grids, see GetTaperedChunkSize.
+    overrides.allow_non_pot_grid = false;
+  }
+  overrides.allow_depth_blocking = ctx->depth_blocking();
+  MakeBlockMap(packed_lhs.layout.cols, packed_rhs.layout.cols, depth,
+               packed_lhs.layout.kernel.cols, packed_rhs.layout.kernel.cols,
+               packed_lhs.data_type.size, packed_rhs.data_type.size,
+               batch_size == 1 ? plan->tentative_thread_count
+                               : GetThreadCount(ctx, rows, cols, depth),
+               params.local_data_cache_size, params.shared_data_cache_size,
+               overrides, &plan->block_map);
+}
+
+// Returns the number of threads that are assigned to the given NUMA node, out
+// of thread_count threads assigned round-robin, see NumaNodeForThread.
+int NumaNodeThreadCount(int thread_count, int num_nodes, int node) {
+  return (thread_count - node + num_nodes - 1) / num_nodes;
+}
+
+// Splits the columns [0, packed_cols) of the packed matrix on the split side
+// of a NUMA-aware TrMul into one contiguous share per node, in proportion to
+// the number of threads of each node and aligned to kernel_cols. Node n gets
+// columns [node_starts[n], node_starts[n + 1]). Returns false if some node
+// would get an empty share.
+bool GetNumaNodeShares(int packed_cols, int kernel_cols, int thread_count,
+                       int num_nodes, int* node_starts) {
+  const int units = packed_cols / kernel_cols;
+  int threads_before = 0;
+  node_starts[0] = 0;
+  for (int node = 0; node < num_nodes; node++) {
+    threads_before += NumaNodeThreadCount(thread_count, num_nodes, node);
+    node_starts[node + 1] = kernel_cols * static_cast<int>(
+        static_cast<std::int64_t>(units) * threads_before / thread_count);
+    if (node_starts[node + 1] == node_starts[node]) {
+      return false;
+    }
+  }
+  RUY_DCHECK_EQ(node_starts[num_nodes], packed_cols);
+  return true;
+}
+
+// The share of the work of a NUMA-aware TrMul handled by the threads of one
+// node.
+struct NumaNodeWork {
+  // Copy of the TrMulParams, with packed matrices local to this node.
+  TrMulParams params;
+  // Block map of this node's share of the destination matrix, whose
+  // matrix-space coordinates start at block_offset.
+  BlockMap block_map;
+  SidePair<int> block_offset;
+  int thread_count;
+  SidePair<std::atomic<PackingStatus>*> packing_status;
+  std::atomic<int>* atomic_block_id;
+  BlockRange* block_ranges;
+};
+
+// Multi-threaded TrMul on a machine with several NUMA nodes. The destination
+// matrix is split along the split side into one share per node (see
+// GetNumaNodeShares), and each node's threads only handle blocks of their own
+// share. Each node packs its columns of the split side, and its own copy of
+// the other side, into buffers from its own allocator: since the node's
+// threads are the first to touch these buffers, the OS places them in memory
+// local to the node, and they are never read by threads of other nodes.
+// Sides that are prepacked are shared by all nodes.
+//
+// Threads are assigned to nodes round-robin, matching the CPU pinning done by
+// Ctx::set_pin_threads. Thread 0 is the calling thread, which is not pinned,
+// so its share ends up wherever the OS runs it.
+void TrMulNuma(TrMulParams* params, Ctx* ctx, int thread_count, int num_nodes,
+               Side split_side, const int* node_starts) {
+  profiler::ScopeLabel label("TrMulImpl, NUMA-aware (%d nodes)", num_nodes);
+  RUY_DCHECK_EQ(params->batch_size, 1);
+  Allocator* allocator = ctx->GetMainAllocator();
+  const int depth = params->src[Side::kLhs].layout.rows;
+  const BlockScheduling block_scheduling = ctx->block_scheduling();
+  const bool tapered = block_scheduling == BlockScheduling::kTapered;
+
+  NumaNodeWork* nodes;
+  allocator->Allocate(num_nodes, &nodes);
+  for (int n = 0; n < num_nodes; n++) {
+    NumaNodeWork* node = new (nodes + n) NumaNodeWork;
+    node->params = *params;
+    node->thread_count = NumaNodeThreadCount(thread_count, num_nodes, n);
+    node->block_offset = SidePair<int>(0, 0);
+    node->block_offset[split_side] = node_starts[n];
+    SidePair<int> dims(params->packed[Side::kLhs].layout.cols,
+                       params->packed[Side::kRhs].layout.cols);
+    dims[split_side] = node_starts[n + 1] - node_starts[n];
+
+    Allocator* node_allocator = ctx->GetNumaNodeAllocator(n);
+    for (Side side : {Side::kLhs, Side::kRhs}) {
+      if (params->is_prepacked[side]) {
+        continue;
+      }
+      // The packed matrix of the split side is allocated whole, as the
+      // packing code and the kernels address it with the column indices of
+      // the whole matrix, but this node only ever writes and reads its own
+      // columns of it, so only the pages holding those are touched, and
+      // placed in this node's memory.
+      AllocatePMatrix(node_allocator, &node->params.packed[side]);
+    }
+
+    const PEMat& packed_lhs = params->packed[Side::kLhs];
+    const PEMat& packed_rhs = params->packed[Side::kRhs];
+    BlockMapOverrides overrides;
+    overrides.allow_non_pot_grid = ctx->non_pot_block_grids();
+    if (tapered && node->thread_count > 1) {
+      overrides.subdivision_log2 = kTaperedSubdivisionLog2;
+      overrides.allow_non_pot_grid = false;
+    }
+    overrides.allow_depth_blocking = ctx->depth_blocking();
+    MakeBlockMap(dims[Side::kLhs], dims[Side::kRhs], depth,
+                 packed_lhs.layout.kernel.cols, packed_rhs.layout.kernel.cols,
+                 packed_lhs.data_type.size, packed_rhs.data_type.size,
+                 node->thread_count, params->local_data_cache_size,
+                 params->shared_data_cache_size, overrides, &node->block_map);
+
+    node->packing_status = SidePair<std::atomic<PackingStatus>*>(nullptr,
+                                                                 nullptr);
+    node->block_ranges = nullptr;
+    if (node->thread_count > 1) {
+      AllocatePackingStatus(node->params, node->block_map, allocator,
+                            &node->packing_status);
+      if (block_scheduling == BlockScheduling::kWorkStealing) {
+        node->block_ranges = AllocateBlockRanges(
+            NumBlocks(node->block_map), node->thread_count, allocator);
+      }
+    }
+    allocator->Allocate(1, &node->atomic_block_id);
+    node->atomic_block_id->store(tapered ? 0 : node->thread_count);
+  }
+
+  ctx->EnsureThreadSpecificResources(thread_count);
+  TrMulTask* tasks;
+  allocator->Allocate(thread_count, &tasks);
+  for (int i = 0; i < thread_count; i++) {
+    NumaNodeWork* node = &nodes[i % num_nodes];
+    auto* tuning_resolver = ctx->GetThreadSpecificTuningResolver(i);
+    tuning_resolver->SetTuning(ctx->explicit_tuning());
+    new (tasks + i) TrMulTask(
+        &node->params, node->block_map, node->block_offset,
+        node->atomic_block_id, node->block_ranges, tapered, i / num_nodes,
+        node->thread_count, node->thread_count > 1, node->packing_status,
+        tuning_resolver, ctx->GetThreadSpecificAllocator(i));
+  }
+
+  ctx->mutable_thread_pool()->Execute(thread_count, tasks);
+
+  for (int i = 0; i < thread_count; i++) {
+    tasks[i].~TrMulTask();
+  }
+  for (int n = 0; n < num_nodes; n++) {
+    nodes[n].~NumaNodeWork();
+    ctx->GetNumaNodeAllocator(n)->FreeAll();
+  }
+  allocator->FreeAll();
+}
+
+// Depth slices of a split-depth TrMul start at multiples of this, which must
+// be a multiple of the kernel layouts' depth granularity. Slices thus also
+// start at cache line boundaries in the packed matrices.
+constexpr int kSplitDepthGranularity = 64;
+
+// Minimum depth of a slice of a split-depth TrMul, below which the cost of
+// reducing its partial accumulators isn't worth it.
+constexpr int kSplitDepthMinSliceDepth = 256;
+
+// Returns the number of depth slices that a multi-threaded TrMul should be
+// split into (see TrMulSplitDepth), or 1 if it should not be split. That is,
+// unless the destination matrix is too small for block_map to give work to
+// every one of thread_count threads, and the depth is large enough for
+// slices to give work to more threads than blocks do.
+int GetSplitDepthSliceCount(const TrMulParams& params, Ctx* ctx,
+                            const BlockMap& block_map, int thread_count) {
+  if (!ctx->split_depth() || !params.run_accum_kernel ||
+      params.batch_size != 1) {
+    return 1;
+  }
+  const int num_blocks = NumBlocks(block_map);
+  if (num_blocks >= thread_count) {
+    return 1;
+  }
+  const int packed_depth = params.packed[Side::kLhs].layout.rows;
+  const int num_slices =
+      std::min(thread_count, packed_depth / kSplitDepthMinSliceDepth);
+  return num_slices > num_blocks ? num_slices : 1;
+}
+
+// Task handling one depth slice [start_depth, end_depth) of a split-depth
+// TrMul: packs that slice of the LHS and RHS, unless prepacked, then runs the
+// kernel computing raw accumulators over the whole destination, into a buffer
+// from the thread's local allocator, returned in *partial.
+struct SplitDepthSliceTask final : Task {
+  SplitDepthSliceTask(TrMulParams* params_, int start_depth_, int end_depth_,
+                      const SidePair<void*>& slice_sums_, void** partial_,
+                      TuningResolver* tuning_resolver_,
+                      Allocator* local_allocator_)
+      : params(params_),
+        start_depth(start_depth_),
+        end_depth(end_depth_),
+        slice_sums(slice_sums_),
+        partial(partial_),
+        tuning_resolver(tuning_resolver_),
+        local_allocator(local_allocator_) {}
+
+  void Run() override {
+    const Tuning tuning = tuning_resolver->Resolve();
+    SidePair<PEMat> packed_slice;
+    for (Side side : {Side::kLhs, Side::kRhs}) {
+      const PEMat& packed = params->packed[side];
+      PEMat* slice = &packed_slice[side];
+      *slice = PackedDepthSlice(packed, start_depth, end_depth);
+      if (!params->is_prepacked[side]) {
+        const EMat& src = params->src[side];
+        EMat src_slice = src;
+        const int src_depth_stride =
+            IsColMajor(src.layout) ? 1 : src.layout.stride;
+        const std::ptrdiff_t start_offset =
+            static_cast<std::ptrdiff_t>(start_depth) * src_depth_stride;
+        src_slice.data = static_cast<char*>(src.data) +
+                         src.data_type.OffsetBytes(start_offset);
+        src_slice.layout.rows =
+            std::min(end_depth, src.layout.rows) - start_depth;
+        src_slice.group_row_offset = src.group_row_offset + start_depth;
+        slice->sums = slice_sums[side];
+        params->run_pack[side](tuning, src_slice, slice, 0,
+                               slice->layout.cols);
+      }
+      // The zero points are taken into account by the epilogue, using the
+      // sums over the whole depth.
+      slice->zero_point = 0;
+    }
+
+    EMat accum;
+    accum.data_type = params->accum_type;
+    accum.layout.rows = params->dst.layout.rows;
+    accum.layout.cols = params->dst.layout.cols;
+    accum.layout.stride = accum.layout.rows;
+    accum.layout.order = Order::kColMajor;
+    accum.data = local_allocator->AllocateBytes(
+        static_cast<std::ptrdiff_t>(accum.layout.rows) * accum.layout.cols *
+        accum.data_type.size);
+    *partial = accum.data;
+    const SidePair<int> start(0, 0);
+    const SidePair<int> end(packed_slice[Side::kLhs].layout.cols,
+                            packed_slice[Side::kRhs].layout.cols);
+    params->run_accum_kernel(tuning, packed_slice, start, end, false, &accum);
+  }
+
+ private:
+  TrMulParams* params;
+  int start_depth;
+  int end_depth;
+  SidePair<void*> slice_sums;
+  void** partial;
+  TuningResolver* tuning_resolver;
+  Allocator* local_allocator;
+};
+
+// Task reducing the partial accumulators of a split-depth TrMul and applying
+// the epilogue, for the destination entries in [start, end).
+struct SplitDepthEpilogueTask final : Task {
+  SplitDepthEpilogueTask(TrMulParams* params_, const void* const* partials_,
+                         int num_partials_, const SidePair<int>& start_,
+                         const SidePair<int>& end_)
+      : params(params_),
+        partials(partials_),
+        num_partials(num_partials_),
+        start(start_),
+        end(end_) {}
+
+  void Run() override {
+    // See SplitDepthSliceTask.
+    MatLayout partial_layout;
+    partial_layout.rows = params->dst.layout.rows;
+    partial_layout.cols = params->dst.layout.cols;
+    partial_layout.stride = partial_layout.rows;
+    partial_layout.order = Order::kColMajor;
+    params->run_split_depth_epilogue(params->packed, params->mul_params,
+                                     partials, num_partials, partial_layout,
+                                     start, end, &params->dst);
+  }
+
+ private:
+  TrMulParams* params;
+  const void* const* partials;
+  int num_partials;
+  SidePair<int> start;
+  SidePair<int> end;
+};
+
+// Multi-threaded TrMul split along the depth dimension, for destination
+// matrices too small to give work to every thread, see
+// GetSplitDepthSliceCount. Each thread packs one depth slice of the LHS and
+// RHS, into the packed matrices, which must already be allocated, and
+// accumulates the products over that slice for the whole destination into
+// its own buffer. The sums of the packed matrices, computed per slice, are
+// then added up, and finally the threads split the destination among
+// themselves to add up the partial accumulators and apply the epilogue.
+void TrMulSplitDepth(TrMulParams* params, Ctx* ctx, int num_slices) {
+  Allocator* allocator = ctx->GetMainAllocator();
+  const int packed_depth = params->packed[Side::kLhs].layout.rows;
+  RUY_DCHECK_EQ(params->packed[Side::kRhs].layout.rows, packed_depth);
+  for (Side side : {Side::kLhs, Side::kRhs}) {
+    RUY_DCHECK_EQ(
+        kSplitDepthGranularity % params->packed[side].layout.kernel.rows, 0);
+  }
+  const int slice_depth = round_up_pot(
+      (packed_depth + num_slices - 1) / num_slices, kSplitDepthGranularity);
+  num_slices = (packed_depth + slice_depth - 1) / slice_depth;
+  profiler::ScopeLabel label("TrMulImpl, split depth (%d slices)", num_slices);
+
+  // Each slice packs its own sums, into slice_sums[side] + slice * SumsBytes.
+  SidePair<char*> slice_sums(nullptr, nullptr);
+  for (Side side : {Side::kLhs, Side::kRhs}) {
+    if (!params->is_prepacked[side] && params->packed[side].sums) {
+      slice_sums[side] = static_cast<char*>(allocator->AllocateBytes(
+          num_slices * SumsBytes(params->packed[side])));
+    }
+  }
+  void** partials;
+  allocator->Allocate(num_slices, &partials);
+
+  ctx->EnsureThreadSpecificResources(num_slices);
+  SplitDepthSliceTask* slice_tasks;
+  allocator->Allocate(num_slices, &slice_tasks);
+  for (int i = 0; i < num_slices; i++) {
+    auto* tuning_resolver = ctx->GetThreadSpecificTuningResolver(i);
+    tuning_resolver->SetTuning(ctx->explicit_tuning());
+    SidePair<void*> sums(nullptr, nullptr);
+    for (Side side : {Side::kLhs, Side::kRhs}) {
+      if (slice_sums[side]) {
+        sums[side] = slice_sums[side] + i * SumsBytes(params->packed[side]);
+      }
+    }
+    new (slice_tasks + i) SplitDepthSliceTask(
+        params, i * slice_depth, std::min(packed_depth, (i + 1) * slice_depth),
+        sums, partials + i, tuning_resolver,
+        ctx->GetThreadSpecificAllocator(i));
+  }
+  ctx->mutable_thread_pool()->Execute(num_slices, slice_tasks);
+  for (int i = 0; i < num_slices; i++) {
+    slice_tasks[i].~SplitDepthSliceTask();
+  }
+
+  // Add up the sums of the slices. Sums are only used with a nonzero zero
+  // point on the other side, which only happens in quantized multiplications,
+  // whose sums are int32.
+  for (Side side : {Side::kLhs, Side::kRhs}) {
+    PEMat& packed = params->packed[side];
+    if (!slice_sums[side] || !params->packed[Other(side)].zero_point) {
+      continue;
+    }
+    packed.sums_type.AssertIs<std::int32_t>();
+    std::int32_t* sums = static_cast<std::int32_t*>(packed.sums);
+    const std::int32_t* first_slice_sums =
+        reinterpret_cast<const std::int32_t*>(slice_sums[side]);
+    const int cols = packed.layout.cols;
+    std::copy(first_slice_sums, first_slice_sums + cols, sums);
+    for (int i = 1; i < num_slices; i++) {
+      const std::int32_t* this_slice_sums = first_slice_sums + i * cols;
+      for (int col = 0; col < cols; col++) {
+        sums[col] += this_slice_sums[col];
+      }
+    }
+  }
+
+  // The epilogue is split along the larger dimension of the destination.
+  const int dst_rows = params->dst.layout.rows;
+  const int dst_cols = params->dst.layout.cols;
+  const Side split_side = dst_cols >= dst_rows ? Side::kRhs : Side::kLhs;
+  const int split_size = split_side == Side::kRhs ? dst_cols : dst_rows;
+  const int epilogue_thread_count = std::min(num_slices, split_size);
+  SplitDepthEpilogueTask* epilogue_tasks;
+  allocator->Allocate(epilogue_thread_count, &epilogue_tasks);
+  for (int i = 0; i < epilogue_thread_count; i++) {
+    SidePair<int> start(0, 0);
+    SidePair<int> end(dst_rows, dst_cols);
+    start[split_side] = split_size * i / epilogue_thread_count;
+    end[split_side] = split_size * (i + 1) / epilogue_thread_count;
+    new (epilogue_tasks + i)
+        SplitDepthEpilogueTask(params, partials, num_slices, start, end);
+  }
+  ctx->mutable_thread_pool()->Execute(epilogue_thread_count, epilogue_tasks);
+  for (int i = 0; i < epilogue_thread_count; i++) {
+    epilogue_tasks[i].~SplitDepthEpilogueTask();
+  }
+
+  // The partial accumulators could only be freed once all threads were done
+  // reading them.
+  for (int i = 0; i < num_slices; i++) {
+    ctx->GetThreadSpecificAllocator(i)->FreeAll();
+  }
+}
+
+// Returns a view of the columns of src from start_col on, as a matrix of its
+// own, see Mat::group_col_offset.
+EMat SrcColumnsFrom(const EMat& src, int start_col) {
+  RUY_DCHECK_LE(start_col, src.layout.cols);
+  const int src_col_stride = IsColMajor(src.layout) ? src.layout.stride : 1;
+  const std::ptrdiff_t start_offset =
+      static_cast<std::ptrdiff_t>(start_col) * src_col_stride;
+  EMat slice = src;
+  slice.data = static_cast<char*>(src.data) +
+               src.data_type.OffsetBytes(start_offset);
+  slice.layout.cols = src.layout.cols - start_col;
+  slice.group_col_offset = src.group_col_offset + start_col;
+  return slice;
+}
+
+// Task handling the destination rows [start_row, end_row) of a GEMV, see
+// TrMulGemv: computes the destination entries of those rows. Unless the LHS
+// is prepacked, its columns for those rows are packed chunk_rows at a time
+// into a buffer from the thread's local allocator, each chunk being read by
+// the GEMV while it is still in cache. The packed LHS is only ever read once,
+// so nothing is gained by packing more of it at once, and dequantizing or
+// expanding packing would otherwise write out a whole float or int8 copy of
+// the LHS, larger than its source, only to read it back from memory.
+struct GemvTask final : Task {
+  GemvTask(TrMulParams* params_, int start_row_, int end_row_, int chunk_rows_,
+           TuningResolver* tuning_resolver_, Allocator* local_allocator_)
+      : params(params_),
+        start_row(start_row_),
+        end_row(end_row_),
+        chunk_rows(chunk_rows_),
+        tuning_resolver(tuning_resolver_),
+        local_allocator(local_allocator_) {}
+
+  void Run() override {
+    const Tuning tuning = tuning_resolver->Resolve();
+    if (params->is_prepacked[Side::kLhs]) {
+      params->run_gemv(tuning, params->packed, params->mul_params, start_row,
+                       end_row, &params->dst);
+      return;
+    }
+    SidePair<PEMat> packed = params->packed;
+    PEMat* chunk = &packed[Side::kLhs];
+    chunk->layout.cols = std::min(chunk_rows, end_row - start_row);
+    AllocatePMatrix(local_allocator, chunk);
+    for (int row = start_row; row < end_row; row += chunk_rows) {
+      const int chunk_end_row = std::min(row + chunk_rows, end_row);
+      // The chunk is packed from the columns of the source LHS from row on,
+      // with chunk-relative column indices, and then read by the GEMV with
+      // the row indices of the whole destination, see PEMat::origin_col.
+      chunk->origin_col = 0;
+      params->run_pack[Side::kLhs](
+          tuning, SrcColumnsFrom(params->src[Side::kLhs], row), chunk, 0,
+          chunk_end_row - row);
+      chunk->origin_col = row;
+      params->run_gemv(tuning, packed, params->mul_params, row, chunk_end_row,
+                       &params->dst);
+    }
+    local_allocator->FreeAll();
+  }
+
+ private:
+  TrMulParams* params;
+  int start_row;
+  int end_row;
+  int chunk_rows;
+  TuningResolver* tuning_resolver;
+  Allocator* local_allocator;
+};
+
+// Matrix*vector product, see gemv.h. The RHS vector is not packed: it is
+// read directly by the GEMV implementation, after conversion to the packed
+// type if needed. Each thread handles one contiguous range of rows, aligned
+// to the LHS kernel width, packing and reading only its own columns of the
+// packed LHS, so there is no synchronization between threads.
+void TrMulGemv(TrMulParams* params, Ctx* ctx) {
+  PEMat& packed_lhs = params->packed[Side::kLhs];
+  PEMat& packed_rhs = params->packed[Side::kRhs];
+  const int rows = params->src[Side::kLhs].layout.cols;
+  const int depth = params->src[Side::kLhs].layout.rows;
+  RUY_DCHECK_EQ(packed_rhs.layout.rows, packed_lhs.layout.rows);
+  const int kernel_cols = packed_lhs.layout.kernel.cols;
+  const int units = packed_lhs.layout.cols / kernel_cols;
+  const int thread_count = std::min(
+      GetThreadCount(FindTunedPlan(*params, ctx), ctx, rows, 1, depth, 1),
+      units);
+  profiler::ScopeLabel label("TrMulImpl, GEMV (%d threads)", thread_count);
+  // Each chunk of the packed LHS packed by a GemvTask takes up to half of
+  // the local data cache, leaving room for the RHS vector. The depth, and so
+  // the size of a unit, may be 0.
+  const std::ptrdiff_t unit_bytes = std::max<std::ptrdiff_t>(
+      1, static_cast<std::ptrdiff_t>(kernel_cols) * packed_lhs.layout.stride *
+             packed_lhs.data_type.size);
+  const int chunk_rows =
+      kernel_cols *
+      static_cast<int>(std::max<std::ptrdiff_t>(
+          1, params->local_data_cache_size / 2 / unit_bytes));
+
+  Allocator* allocator = ctx->GetMainAllocator();
+  void* rhs_buffer = allocator->AllocateBytes(
+      static_cast<std::ptrdiff_t>(packed_rhs.layout.rows) *
+      packed_rhs.data_type.size);
+  // The RHS sums are only needed with a nonzero LHS zero point.
+  packed_rhs.sums = packed_lhs.zero_point
+                        ? allocator->AllocateBytes(SumsPerCol(packed_rhs) *
+                                                   packed_rhs.sums_type.size)
+                        : nullptr;
+  if (packed_rhs.has_scales) {
+    allocator->Allocate(1, &packed_rhs.scales);
+  }
+  params->prepare_gemv_rhs(params->src[Side::kRhs], rhs_buffer, &packed_rhs);
+
+  ctx->EnsureThreadSpecificResources(thread_count);
+  GemvTask* tasks;
+  allocator->Allocate(thread_count, &tasks);
+  for (int i = 0; i < thread_count; i++) {
+    auto* tuning_resolver = ctx->GetThreadSpecificTuningResolver(i);
+    tuning_resolver->SetTuning(ctx->explicit_tuning());
+    const int start_row = kernel_cols * static_cast<int>(
+        static_cast<std::int64_t>(units) * i / thread_count);
+    const int end_row = kernel_cols * static_cast<int>(
+        static_cast<std::int64_t>(units) * (i + 1) / thread_count);
+    new (tasks + i)
+        GemvTask(params, start_row, end_row, chunk_rows, tuning_resolver,
+                 ctx->GetThreadSpecificAllocator(i));
+  }
+  ctx->mutable_thread_pool()->Execute(thread_count, tasks);
+  for (int i = 0; i < thread_count; i++) {
+    tasks[i].~GemvTask();
+  }
+  allocator->FreeAll();
+}
+
+// Log2 of the amount of packed data, in bytes, in each range of columns that
+// PackMatrices hands out to a thread. Smaller ranges would balance the work
+// better but cost more atomic increments, and each one makes the packing code
+// start from cold caches.
+constexpr int kPackChunkBytesLog2 = 16;
+
+// A range of columns of one of the matrices packed by PackMatrices.
+struct PackChunk {
+  int item;
+  int start;
+  int end;
+};
+
+// Task packing ranges of columns out of a list of PackChunk's. Like
+// TrMulBatchTask, each thread starts with the chunk whose index is its thread
+// id, and then reserves further chunks through a shared atomic counter.
+struct PackTask final : Task {
+  PackTask(TrMulParams* params_, Side side_, const PackChunk* chunks_,
+           int chunk_count_, std::atomic<int>* atomic_chunk_id_,
+           int thread_id_, TuningResolver* tuning_resolver_)
+      : params(params_),
+        side(side_),
+        chunks(chunks_),
+        chunk_count(chunk_count_),
+        atomic_chunk_id(atomic_chunk_id_),
+        thread_id(thread_id_),
+        tuning_resolver(tuning_resolver_) {}
+
+  void Run() override {
+    const Tuning tuning = tuning_resolver->Resolve();
+    int chunk_id = thread_id;
+    while (chunk_id < chunk_count) {
+      const int next_chunk_id =
+          atomic_chunk_id->fetch_add(1, std::memory_order_relaxed);
+      const PackChunk& chunk = chunks[chunk_id];
+      params[chunk.item].RunPack(side, tuning, chunk.start, chunk.end);
+      chunk_id = next_chunk_id;
+    }
+  }
+
+ private:
+  TrMulParams* params;
+  Side side;
+  const PackChunk* chunks;
+  int chunk_count;
+  std::atomic<int>* atomic_chunk_id;
+  int thread_id;
+  TuningResolver* tuning_resolver;
+};
+
+// Returns the number of PackChunk's that PackMatrices splits the given packed
+// matrix into.
+int GetPackChunkCount(const PEMat& packed) {
+  const std::int64_t bytes = static_cast<std::int64_t>(packed.layout.rows) *
+                             packed.layout.cols * packed.data_type.size;
+  const int max_chunk_count = packed.layout.cols / packed.layout.kernel.cols;
+  return static_cast<int>(std::max<std::int64_t>(
+      1, std::min<std::int64_t>(bytes >> kPackChunkBytesLog2,
+                                max_chunk_count)));
+}
+
 }  // namespace
 
+bool UsesSimpleLoop(const TrMulParams& params, Ctx* ctx) {
+  // Same as the start of MakeTrMulPlan, without making the block map.
+  const EMat& lhs = params.src[Side::kLhs];
+  const EMat& rhs = params.src[Side::kRhs];
+  const int rows = lhs.layout.cols;
+  const int cols = rhs.layout.cols;
+  const int depth = lhs.layout.rows;
+  const TunedPlan* tuned_plan =
+      params.batch_size == 1 ? FindTunedPlan(params, ctx) : nullptr;
+  return GetLoopStructure(
+             GetThreadCount(tuned_plan, ctx, rows, cols, depth,
+                            params.batch_size),
+             rows, cols, depth, lhs.data_type.size, rhs.data_type.size,
+             params.local_data_cache_size, params.shared_data_cache_size) ==
+         LoopStructure::kSimple;
+}
+
+void PackMatrices(TrMulParams* params, int count, Side side, Ctx* ctx) {
+  profiler::ScopeLabel label("PackMatrices (count=%d, max_num_threads=%d)",
+                             count, ctx->max_num_threads());
+  int chunk_count = 0;
+  for (int i = 0; i < count; i++) {
+    chunk_count += GetPackChunkCount(params[i].packed[side]);
+  }
+#if RUY_PLATFORM_EMSCRIPTEN
+  // b/139927184, std::thread constructor raises exception
+  const int thread_count = 1;
+#else
+  const int thread_count = std::min(ctx->max_num_threads(), chunk_count);
+#endif
+  if (thread_count <= 1) {
+    const Tuning tuning = ctx->GetMainThreadTuning();
+    for (int i = 0; i < count; i++) {
+      params[i].RunPack(side, tuning, 0, params[i].packed[side].layout.cols);
+    }
+    return;
+  }
+
+  // Split each matrix into ranges of whole kernel-width groups of columns.
+  // These allocations come from the allocator of thread 0, i.e. of the
+  // calling thread, which is otherwise only used from within ThreadPool
+  // tasks, rather than from the main allocator, which DispatchBatchMul may be
+  // holding TrMulParams in.
+  ctx->EnsureThreadSpecificResources(thread_count);
+  Allocator* allocator = ctx->GetThreadSpecificAllocator(0);
+  PackChunk* chunks;
+  allocator->Allocate(chunk_count, &chunks);
+  int chunk_id = 0;
+  for (int i = 0; i < count; i++) {
+    const PEMat& packed = params[i].packed[side];
+    const int item_chunk_count = GetPackChunkCount(packed);
+    const int kernel_cols = packed.layout.kernel.cols;
+    const int units = packed.layout.cols / kernel_cols;
+    for (int c = 0; c < item_chunk_count; c++) {
+      PackChunk& chunk = chunks[chunk_id++];
+      chunk.item = i;
+      chunk.start = kernel_cols * static_cast<int>(
+          static_cast<std::int64_t>(units) * c / item_chunk_count);
+      chunk.end = c == item_chunk_count - 1
+                      ? packed.layout.cols
+                      : kernel_cols * static_cast<int>(
+                            static_cast<std::int64_t>(units) * (c + 1) /
+                            item_chunk_count);
+    }
+  }
+  RUY_DCHECK_EQ(chunk_id, chunk_count);
+
+  std::atomic<int>* atomic_chunk_id;
+  allocator->Allocate(1, &atomic_chunk_id);
+  atomic_chunk_id->store(thread_count);
+  PackTask* tasks;
+  allocator->Allocate(thread_count, &tasks);
+  for (int i = 0; i < thread_count; i++) {
+    auto* tuning_resolver = ctx->GetThreadSpecificTuningResolver(i);
+    tuning_resolver->SetTuning(ctx->explicit_tuning());
+    new (tasks + i) PackTask(params, side, chunks, chunk_count,
+                             atomic_chunk_id, i, tuning_resolver);
+  }
+  ctx->mutable_thread_pool()->Execute(thread_count, tasks);
+  for (int i = 0; i < thread_count; i++) {
+    tasks[i].~PackTask();
+  }
+  allocator->FreeAll();
+}
+
 void TrMul(TrMulParams* params, Ctx* ctx) {
   profiler::ScopeLabel label(
-      "TrMul (Path=0x%x, max_num_threads=%d, is_prepacked=(%d,%d))",
+      "TrMul (Path=0x%x, max_num_threads=%d, is_prepacked=(%d,%d), "
+      "batch_size=%d)",
       static_cast<int>(params->path), ctx->max_num_threads(),
-      params->is_prepacked[Side::kLhs], params->is_prepacked[Side::kRhs]);
+      params->is_prepacked[Side::kLhs], params->is_prepacked[Side::kRhs],
+      params->batch_size);
+  RUY_DCHECK_GE(params->batch_size, 1);
 
   PEMat& packed_lhs = params->packed[Side::kLhs];
   PEMat& packed_rhs = params->packed[Side::kRhs];
-  EMat& lhs = params->src[Side::kLhs];
-  EMat& rhs = params->src[Side::kRhs];
+  const int cols = params->src[Side::kRhs].layout.cols;
+  const int batch_size = params->batch_size;
 
-  const int rows = lhs.layout.cols;
-  const int cols = rhs.layout.cols;
-  const int depth = lhs.layout.rows;
+  // Matrix*vector case, see TrMulGemv. A prepacked RHS was packed for the
+  // kernel, so it goes through the general case.
+  if (cols == 1 && batch_size == 1 && params->run_gemv &&
+      !params->is_prepacked[Side::kRhs]) {
+    TrMulGemv(params, ctx);
+    return;
+  }
+
+  // The shape-dependent decisions, see TrMulPlan.
+  TrMulPlan plan;
+  MakeTrMulPlan(*params, ctx, &plan);
+  const int tentative_thread_count = plan.tentative_thread_count;
+  const auto loop_structure = plan.loop_structure;
+
+  // NUMA-aware case, see TrMulNuma. The work is split along whichever side
+  // has more columns to split.
+  if (ctx->numa_aware() && batch_size == 1 &&
+      loop_structure == LoopStructure::kGeneral) {
+    const int num_nodes = std::min(ctx->GetCpuTopology().num_nodes(),
+                                   tentative_thread_count);
+    const Side split_side =
+        packed_rhs.layout.cols >= packed_lhs.layout.cols ? Side::kRhs
+                                                         : Side::kLhs;
+    static constexpr int kMaxNumaNodes = 64;
+    int node_starts[kMaxNumaNodes + 1];
+    if (num_nodes > 1 && num_nodes <= kMaxNumaNodes &&
+        GetNumaNodeShares(params->packed[split_side].layout.cols,
+                          params->packed[split_side].layout.kernel.cols,
+                          tentative_thread_count, num_nodes, node_starts)) {
+      TrMulNuma(params, ctx, tentative_thread_count, num_nodes, split_side,
+                node_starts);
+      return;
+    }
+  }
 
-  const int tentative_thread_count = GetThreadCount(ctx, rows, cols, depth);
-  const auto loop_structure = GetLoopStructure(
-      tentative_thread_count, rows, cols, depth, lhs.data_type.size,
-      rhs.data_type.size, params->local_data_cache_size,
-      params->shared_data_cache_size);
   Allocator* allocator = ctx->GetMainAllocator();
 
   // Allocate packed matrices
-  for (Side side : {Side::kLhs, Side::kRhs}) {
-    if (!params->is_prepacked[side]) {
-      AllocatePMatrix(allocator, &params->packed[side]);
+  if (!params->is_prepacked[Side::kLhs]) {
+    AllocatePMatrix(allocator, &packed_lhs);
+  }
+  if (!params->is_prepacked[Side::kRhs]) {
+    if (batch_size == 1 || loop_structure == LoopStructure::kSimple) {
+      // The simple loop handles the items of a strided batch one after the
+      // other, so they can all share the same packed RHS buffer.
+      AllocatePMatrix(allocator, &packed_rhs);
+    } else {
+      const std::ptrdiff_t data_stride =
+          round_up_pot(DataBytes(packed_rhs), detail::kMinimumBlockAlignment);
+      const std::ptrdiff_t sums_stride =
+          round_up_pot(SumsBytes(packed_rhs), detail::kMinimumBlockAlignment);
+      const std::ptrdiff_t scales_stride = round_up_pot(
+          ScalesBytes(packed_rhs), detail::kMinimumBlockAlignment);
+      packed_rhs.data = allocator->AllocateBytes(batch_size * data_stride);
+      packed_rhs.sums = allocator->AllocateBytes(batch_size * sums_stride);
+      if (packed_rhs.has_scales) {
+        packed_rhs.scales = static_cast<float*>(
+            allocator->AllocateBytes(batch_size * scales_stride));
+      }
+      params->packed_rhs_data_batch_stride = data_stride;
+      params->packed_rhs_sums_batch_stride = sums_stride;
+      params->packed_rhs_scales_batch_stride = scales_stride;
     }
   }
 
@@ -296,34 +1477,31 @@ void TrMul(TrMulParams* params, Ctx* ctx) {
   // version of that.
   if (loop_structure == LoopStructure::kSimple) {
     profiler::ScopeLabel label_simple("TrMulImpl, simple loop");
-    Tuning tuning = ctx->GetMainThreadTuning();
+    RunSimpleLoop(params, ctx->GetMainThreadTuning());
 
-    const SidePair<int> origin{0, 0};
-    const SidePair<int> rounded_dims{packed_lhs.layout.cols,
-                                     packed_rhs.layout.cols};
-    for (Side side : {Side::kLhs, Side::kRhs}) {
-      if (!params->is_prepacked[side]) {
-        params->RunPack(side, tuning, origin[side], rounded_dims[side]);
-      }
-    }
-    params->RunKernel(tuning, origin, rounded_dims);
+    allocator->FreeAll();
+    return;
+  }
+
+  const BlockMap& block_map = plan.block_map;
 
+  // Case of a destination matrix too small for the block map to give work to
+  // every thread, see TrMulSplitDepth.
+  const int num_depth_slices = GetSplitDepthSliceCount(
+      *params, ctx, block_map, tentative_thread_count);
+  if (num_depth_slices > 1) {
+    TrMulSplitDepth(params, ctx, num_depth_slices);
     allocator->FreeAll();
     return;
   }
 
   profiler::ScopeLabel label_general("TrMulImpl, general case");
 
-  // Initialize block map.
-  BlockMap block_map;
-  MakeBlockMap(packed_lhs.layout.cols, packed_rhs.layout.cols, depth,
-               packed_lhs.layout.kernel.cols, packed_rhs.layout.kernel.cols,
-               packed_lhs.data_type.size, packed_rhs.data_type.size,
-               tentative_thread_count, params->local_data_cache_size,
-               params->shared_data_cache_size, &block_map);
-
   // Initialize per-thread state.
-  const int thread_count = block_map.thread_count;
+  const int thread_count =
+      batch_size == 1
+          ? block_map.thread_count
+          : std::min(tentative_thread_count, NumBlocks(block_map) * batch_size);
   const bool need_atomics = thread_count > 1;
   ctx->EnsureThreadSpecificResources(thread_count);
   for (int i = 0; i < thread_count; i++) {
@@ -334,16 +1512,7 @@ void TrMul(TrMulParams* params, Ctx* ctx) {
   // the packing status of blocks.
   SidePair<std::atomic<PackingStatus>*> packing_status{nullptr, nullptr};
   if (need_atomics) {
-    for (Side side : {Side::kLhs, Side::kRhs}) {
-      if (!params->is_prepacked[side]) {
-        const int size = NumBlocksPerSide(side, block_map);
-        allocator->Allocate(size, &packing_status[side]);
-        for (int i = 0; i < size; i++) {
-          packing_status[side][i].store(PackingStatus::kNotStarted,
-                                        std::memory_order_relaxed);
-        }
-      }
-    }
+    AllocatePackingStatus(*params, block_map, allocator, &packing_status);
   }
 
   // Create the atomic block id, allocate it using Allocator so that
@@ -356,14 +1525,27 @@ void TrMul(TrMulParams* params, Ctx* ctx) {
   TrMulTask* tasks;
   allocator->Allocate(thread_count, &tasks);
 
-  atomic_block_id->store(thread_count);
+  // With BlockScheduling::kTapered, the atomic block id counts the blocks
+  // taken so far, see RunTapered.
+  const bool tapered = ctx->block_scheduling() == BlockScheduling::kTapered;
+  atomic_block_id->store(tapered ? 0 : thread_count);
+
+  // With BlockScheduling::kWorkStealing, split the traversal order into
+  // contiguous ranges of blocks, one per thread.
+  BlockRange* block_ranges = nullptr;
+  if (need_atomics &&
+      ctx->block_scheduling() == BlockScheduling::kWorkStealing) {
+    block_ranges = AllocateBlockRanges(NumBlocks(block_map) * batch_size,
+                                       thread_count, allocator);
+  }
 
   for (int i = 0; i < thread_count; i++) {
     auto* allocator = ctx->GetThreadSpecificAllocator(i);
     auto* tuning_resolver = ctx->GetThreadSpecificTuningResolver(i);
-    new (tasks + i)
-        TrMulTask(params, block_map, atomic_block_id, i, need_atomics,
-                  packing_status, tuning_resolver, allocator);
+    new (tasks + i) TrMulTask(params, block_map, SidePair<int>(0, 0),
+                              atomic_block_id, block_ranges, tapered, i,
+                              thread_count, need_atomics, packing_status,
+                              tuning_resolver, allocator);
   }
 
   // Do the computation.
@@ -377,4 +1559,47 @@ void TrMul(TrMulParams* params, Ctx* ctx) {
   allocator->FreeAll();
 }
 
+void TrMulBatch(TrMulParams* params, int batch_size, Ctx* ctx) {
+  profiler::ScopeLabel label(
+      "TrMulBatch (Path=0x%x, max_num_threads=%d, batch_size=%d)",
+      static_cast<int>(params->path),
+      ctx->max_num_threads(), batch_size);
+  RUY_DCHECK_GE(batch_size, 1);
+
+  // Each item is handled entirely by one thread as a simple loop, and they
+  // are spread over the thread pool in a single Execute call.
+  std::int64_t total_ops = 0;
+  for (int i = 0; i < batch_size; i++) {
+    RUY_DCHECK(UsesSimpleLoop(params[i], ctx));
+    total_ops += static_cast<std::int64_t>(params[i].dst.layout.rows) *
+                 params[i].dst.layout.cols *
+                 params[i].src[Side::kLhs].layout.rows;
+  }
+
+  const int thread_count = GetBatchThreadCount(ctx, total_ops, batch_size);
+  ctx->EnsureThreadSpecificResources(thread_count);
+  for (int i = 0; i < thread_count; i++) {
+    ctx->GetThreadSpecificTuningResolver(i)->SetTuning(ctx->explicit_tuning());
+  }
+
+  Allocator* allocator = ctx->GetMainAllocator();
+  std::atomic<int>* atomic_item_id;
+  allocator->Allocate(1, &atomic_item_id);
+  atomic_item_id->store(thread_count);
+
+  TrMulBatchTask* tasks;
+  allocator->Allocate(thread_count, &tasks);
+  for (int i = 0; i < thread_count; i++) {
+    new (tasks + i) TrMulBatchTask(params, batch_size, atomic_item_id, i,
+                                   ctx->GetThreadSpecificTuningResolver(i),
+                                   ctx->GetThreadSpecificAllocator(i));
+  }
+
+  ctx->mutable_thread_pool()->Execute(thread_count, tasks);
+
+  for (int i = 0; i < thread_count; i++) {
+    tasks[i].~TrMulBatchTask();
+  }
+}
+
 }  // namespace ruy
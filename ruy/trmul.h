@@ -34,6 +34,25 @@ namespace ruy {
 struct ContextInternal;
 void TrMul(TrMulParams* params, Ctx* ctx);
 
+// Returns true if TrMul would run the given TrMul as a simple loop on a single
+// thread, rather than blocking or multi-threading it.
+bool UsesSimpleLoop(const TrMulParams& params, Ctx* ctx);
+
+// Performs the independent TrMuls described by params[0 .. batch_size-1],
+// which must all be UsesSimpleLoop. Each is run by a single thread, all of them
+// being spread over the thread pool at once, so that a batch of many small
+// TrMuls costs a single thread pool round-trip. Unlike TrMul, this does not
+// free the main allocator, which `params` may have been allocated from.
+void TrMulBatch(TrMulParams* params, int batch_size, Ctx* ctx);
+
+// Packs the given side of each of params[0 .. count-1] in its entirety into
+// its already allocated packed matrix, as is done when inserting into the
+// prepacked cache or when prepacking ahead of time. The columns of all these
+// matrices are split into ranges that are spread over the thread pool, so
+// that a single large matrix, as well as many smaller ones, is packed in
+// parallel.
+void PackMatrices(TrMulParams* params, int count, Side side, Ctx* ctx);
+
 }  // namespace ruy
 
 #endif  // RUY_RUY_TRMUL_H_
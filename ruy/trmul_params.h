@@ -16,6 +16,9 @@ limitations under the License.
 #ifndef RUY_RUY_TRMUL_PARAMS_H_
 #define RUY_RUY_TRMUL_PARAMS_H_
 
+#include <cstddef>
+#include <memory>
+
 #include "ruy/mat.h"
 #include "ruy/side_pair.h"
 #include "ruy/tune.h"
@@ -27,6 +30,19 @@ using RunKernelFn = void(Tuning, const SidePair<PEMat>&, void*,
 
 using RunPackFn = void(Tuning, const EMat&, PEMat*, int, int);
 
+using RunAccumKernelFn = void(Tuning, const SidePair<PEMat>&,
+                              const SidePair<int>&, const SidePair<int>&,
+                              bool, EMat*);
+
+using RunSplitDepthEpilogueFn = void(const SidePair<PEMat>&, void*,
+                                     const void* const*, int,
+                                     const MatLayout&, const SidePair<int>&,
+                                     const SidePair<int>&, EMat*);
+
+using RunGemvFn = void(Tuning, const SidePair<PEMat>&, void*, int, int, EMat*);
+
+using PrepareGemvRhsFn = void(const EMat&, void*, PEMat*);
+
 // Type-erased data needed for implementing TrMul.
 struct TrMulParams {
   TrMulParams() : run_pack{nullptr, nullptr}, is_prepacked{false, false} {}
@@ -38,28 +54,97 @@ struct TrMulParams {
                  const SidePair<int>& end) {
     run_kernel(tuning, packed, mul_params, start, end, &dst);
   }
+  // Variants of the above operating on the given item of a strided batch
+  // (see batch_size below). The LHS is shared by all batch items.
+  void RunPack(Side side, Tuning tuning, int start, int end, int batch_item) {
+    if (side == Side::kLhs || batch_item == 0) {
+      RunPack(side, tuning, start, end);
+      return;
+    }
+    EMat item_src = src[side];
+    item_src.data = Offset(item_src.data, batch_item * rhs_batch_stride);
+    PEMat item_packed = packed[side];
+    OffsetPackedRhs(batch_item, &item_packed);
+    run_pack[side](tuning, item_src, &item_packed, start, end);
+  }
+  void RunKernel(Tuning tuning, const SidePair<int>& start,
+                 const SidePair<int>& end, int batch_item) {
+    if (batch_item == 0) {
+      RunKernel(tuning, start, end);
+      return;
+    }
+    SidePair<PEMat> item_packed = packed;
+    OffsetPackedRhs(batch_item, &item_packed[Side::kRhs]);
+    EMat item_dst = dst;
+    item_dst.data = Offset(item_dst.data, batch_item * dst_batch_stride);
+    run_kernel(tuning, item_packed, mul_params, start, end, &item_dst);
+  }
 
   // path id, can be useful info for some fine-tuning, e.g. to guess reasonable
   // cache sizes when not runtime-detectable.
   Path path;
 
-  // See MulParamsType::local_data_cache_size().
+  // See MulParamsType::local_data_cache_size() and
+  // Ctx::GetLocalDataCacheSize().
   int local_data_cache_size = 0;
-  // See MulParamsType::shared_data_cache_size().
+  // See MulParamsType::shared_data_cache_size() and
+  // Ctx::GetSharedDataCacheSize().
   int shared_data_cache_size = 0;
 
   // Function pointers to type-erased entry points for kernels and packers.
   SidePair<RunPackFn*> run_pack;
   RunKernelFn* run_kernel = nullptr;
+  // Entry points for split-depth TrMul and depth blocking, see RunAccumKernel
+  // and RunSplitDepthEpilogue. Null if this multiplication can't be split
+  // along the depth dimension. The raw accumulators are of type accum_type.
+  RunAccumKernelFn* run_accum_kernel = nullptr;
+  RunSplitDepthEpilogueFn* run_split_depth_epilogue = nullptr;
+  Type accum_type;
+  // Entry points for matrix*vector products, see gemv.h. Null if there is no
+  // GEMV implementation for this path and these types.
+  RunGemvFn* run_gemv = nullptr;
+  PrepareGemvRhsFn* prepare_gemv_rhs = nullptr;
 
   // Matrices and packed matrices.
   SidePair<EMat> src;
   EMat dst;
   SidePair<PEMat> packed;
   SidePair<bool> is_prepacked;
+  // When a prepacked matrix comes from a SharedPrepackedCache, reference to
+  // the cache entry keeping it alive until we are done with it.
+  SidePair<std::shared_ptr<const void>> prepacked_cache_entry;
 
   // Type-erased MulParamsType.
   void* mul_params = nullptr;
+
+  // Number of items in a strided batch sharing the same LHS: item i has its
+  // RHS, packed RHS and destination data at the respective data pointers
+  // above plus i times the respective batch strides below, in bytes.
+  int batch_size = 1;
+  std::ptrdiff_t rhs_batch_stride = 0;
+  std::ptrdiff_t dst_batch_stride = 0;
+  // Set by TrMul when allocating the packed RHS. May be 0 when TrMul runs
+  // batch items one after the other, reusing the same packed RHS buffer.
+  std::ptrdiff_t packed_rhs_data_batch_stride = 0;
+  std::ptrdiff_t packed_rhs_sums_batch_stride = 0;
+  std::ptrdiff_t packed_rhs_scales_batch_stride = 0;
+
+ private:
+  static void* Offset(void* ptr, std::ptrdiff_t bytes) {
+    return static_cast<char*>(ptr) + bytes;
+  }
+  void OffsetPackedRhs(int batch_item, PEMat* item_packed) const {
+    item_packed->data = Offset(item_packed->data,
+                               batch_item * packed_rhs_data_batch_stride);
+    if (item_packed->sums) {
+      item_packed->sums = Offset(item_packed->sums,
+                                 batch_item * packed_rhs_sums_batch_stride);
+    }
+    if (item_packed->scales) {
+      item_packed->scales = static_cast<float*>(Offset(
+          item_packed->scales, batch_item * packed_rhs_scales_batch_stride));
+    }
+  }
 };
 
 }  // namespace ruy
@@ -15,12 +15,44 @@ limitations under the License.
 
 // Self-contained tool used to tune the tune code --- see the
 // threshold ratios used in tune.cc.
+//
+// When the SHAPES environment variable is set, it is instead an autotuner for
+// the number of threads and the blocking of multiplications of the given
+// shapes, see tuned_plans.h. For each shape, it benchmarks candidate thread
+// counts, then candidate block sizes with the best thread count, then
+// candidate traversal orders with the best of both, and writes the winners to
+// a file that Context::LoadTunedPlans loads. Environment variables:
+//   SHAPES    Comma-separated list of shapes rows x depth x cols, as in
+//             "1024x1024x16,512x2048x1".
+//   OUTPUT    The tuned plans file to write. Tuned plans that it already
+//             contains for other shapes or types are kept.
+//   TYPE      The type of the matrices: f32 (default), i8 or u8.
+//   THREADS   The maximum number of threads. Defaults to the number of
+//             hardware threads.
+//   MIN_SECS  Benchmarking time of each candidate, in seconds. Defaults to
+//             0.1.
 
+#include <algorithm>
 #include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <string>
 #include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
+#include "ruy/block_map.h"
+#include "ruy/context.h"
+#include "ruy/context_get_ctx.h"
+#include "ruy/ctx.h"
+#include "ruy/matrix.h"
+#include "ruy/mul_params.h"
+#include "ruy/path.h"
+#include "ruy/ruy.h"
+#include "ruy/size_util.h"
+#include "ruy/time.h"
 #include "ruy/tune.h"
+#include "ruy/tuned_plans.h"
 
 #ifdef _WIN32
 #define getpid() 0
@@ -39,9 +71,238 @@ class TuneTool {
   }
 };
 
+namespace {
+
+struct Shape {
+  int rows;
+  int depth;
+  int cols;
+};
+
+// Parses a comma-separated list of shapes such as "64x1024x64,1000x1000x1".
+bool ParseShapes(const char* str, std::vector<Shape>* shapes) {
+  const char* ptr = str;
+  while (*ptr) {
+    Shape shape;
+    int chars;
+    if (sscanf(ptr, "%dx%dx%d%n", &shape.rows, &shape.depth, &shape.cols,
+               &chars) != 3 ||
+        shape.rows <= 0 || shape.depth <= 0 || shape.cols <= 0) {
+      return false;
+    }
+    shapes->push_back(shape);
+    ptr += chars;
+    if (*ptr == ',') {
+      ptr++;
+    }
+  }
+  return !shapes->empty();
+}
+
+// Benchmarks multiplications of one shape and types with candidate tuned
+// plans, on a Context of its own.
+template <typename LhsScalar, typename RhsScalar, typename AccumScalar,
+          typename DstScalar>
+class ShapeTuner {
+ public:
+  ShapeTuner(const Shape& shape, int max_num_threads, float min_secs)
+      : lhs_data_(shape.rows * shape.depth, 1),
+        rhs_data_(shape.depth * shape.cols, 1),
+        dst_data_(shape.rows * shape.cols),
+        min_secs_(min_secs) {
+    MakeSimpleLayout(shape.rows, shape.depth, Order::kRowMajor,
+                     lhs_.mutable_layout());
+    lhs_.set_data(lhs_data_.data());
+    MakeSimpleLayout(shape.depth, shape.cols, Order::kColMajor,
+                     rhs_.mutable_layout());
+    rhs_.set_data(rhs_data_.data());
+    MakeSimpleLayout(shape.rows, shape.cols, Order::kColMajor,
+                     dst_.mutable_layout());
+    dst_.set_data(dst_data_.data());
+    context_.set_max_num_threads(max_num_threads);
+    // The Path is only known after a first multiplication.
+    Mul(lhs_, rhs_, mul_params_, &context_, &dst_);
+    key_.path = context_.last_used_path();
+    key_.rows = shape.rows;
+    key_.depth = shape.depth;
+    key_.cols = shape.cols;
+    key_.lhs_scalar_size = sizeof(LhsScalar);
+    key_.rhs_scalar_size = sizeof(RhsScalar);
+  }
+
+  const TunedPlans::Key& key() const { return key_; }
+
+  // Returns the latency in seconds of a multiplication with the given plan.
+  float Measure(const TunedPlan& plan) {
+    TunedPlans plans;
+    plans.Set(key_, plan);
+    get_ctx(&context_)->SetTunedPlans(plans);
+    // Best of a few runs, to reject interference from other processes.
+    static constexpr int kRuns = 3;
+    float best_latency = 0;
+    for (int run = 0; run < kRuns; run++) {
+      Mul(lhs_, rhs_, mul_params_, &context_, &dst_);
+      const TimePoint start = Now();
+      int iters = 0;
+      float elapsed;
+      do {
+        Mul(lhs_, rhs_, mul_params_, &context_, &dst_);
+        iters++;
+        elapsed = ToFloatSeconds(Now() - start);
+      } while (elapsed < min_secs_ / kRuns);
+      const float latency = elapsed / iters;
+      if (run == 0 || latency < best_latency) {
+        best_latency = latency;
+      }
+    }
+    return best_latency;
+  }
+
+ private:
+  std::vector<LhsScalar> lhs_data_;
+  std::vector<RhsScalar> rhs_data_;
+  std::vector<DstScalar> dst_data_;
+  Matrix<LhsScalar> lhs_;
+  Matrix<RhsScalar> rhs_;
+  Matrix<DstScalar> dst_;
+  MulParams<AccumScalar, DstScalar> mul_params_;
+  Context context_;
+  TunedPlans::Key key_;
+  const float min_secs_;
+};
+
+// Searches for the best plan for the given shape, one decision at a time,
+// starting from the default heuristics. Returns the latency of the best plan
+// in *latency and that with the default heuristics in *default_latency.
+template <typename LhsScalar, typename RhsScalar, typename AccumScalar,
+          typename DstScalar>
+TunedPlan Tune(const Shape& shape, int max_num_threads, float min_secs,
+               TunedPlans::Key* key, float* latency, float* default_latency) {
+  ShapeTuner<LhsScalar, RhsScalar, AccumScalar, DstScalar> tuner(
+      shape, max_num_threads, min_secs);
+  *key = tuner.key();
+  TunedPlan best;
+  float best_latency = tuner.Measure(best);
+  *default_latency = best_latency;
+  const auto try_candidate = [&](const TunedPlan& candidate) {
+    const float candidate_latency = tuner.Measure(candidate);
+    // Only override the heuristics for a clear win, not for noise.
+    static constexpr float kMinSpeedup = 1.03f;
+    if (candidate_latency * kMinSpeedup < best_latency) {
+      best = candidate;
+      best_latency = candidate_latency;
+    }
+  };
+  for (int thread_count = 1;; thread_count = std::min(2 * thread_count,
+                                                      max_num_threads)) {
+    TunedPlan candidate = best;
+    candidate.thread_count = thread_count;
+    try_candidate(candidate);
+    if (thread_count == max_num_threads) {
+      break;
+    }
+  }
+  // Matrix*vector products are not blocked, see gemv.h.
+  if (shape.cols > 1) {
+    // MakeBlockMap clamps block_size_log2 to the range it supports.
+    static constexpr int kMinBlockSizeLog2 = 2;
+    const int max_block_size_log2 = std::max(
+        kMinBlockSizeLog2, floor_log2(std::min(shape.rows, shape.cols)));
+    for (int block_size_log2 = kMinBlockSizeLog2;
+         block_size_log2 <= max_block_size_log2; block_size_log2++) {
+      TunedPlan candidate = best;
+      candidate.block_map.block_size_log2 = block_size_log2;
+      try_candidate(candidate);
+    }
+    for (BlockMapTraversalOrder traversal_order :
+         {BlockMapTraversalOrder::kLinear, BlockMapTraversalOrder::kFractalZ,
+          BlockMapTraversalOrder::kFractalU,
+          BlockMapTraversalOrder::kFractalHilbert}) {
+      TunedPlan candidate = best;
+      candidate.block_map.has_traversal_order = true;
+      candidate.block_map.traversal_order = traversal_order;
+      try_candidate(candidate);
+    }
+  }
+  *latency = best_latency;
+  return best;
+}
+
+int Autotune(const char* shapes_env) {
+  std::vector<Shape> shapes;
+  if (!ParseShapes(shapes_env, &shapes)) {
+    fprintf(stderr, "SHAPES must be a list of shapes such as 64x256x64.\n");
+    return EXIT_FAILURE;
+  }
+  const char* output = getenv("OUTPUT");
+  if (!output) {
+    fprintf(stderr, "OUTPUT must name the tuned plans file to write.\n");
+    return EXIT_FAILURE;
+  }
+  const char* type_env = getenv("TYPE");
+  const std::string type = type_env ? type_env : "f32";
+  if (type != "f32" && type != "i8" && type != "u8") {
+    fprintf(stderr, "TYPE must be f32, i8 or u8.\n");
+    return EXIT_FAILURE;
+  }
+  const char* threads_env = getenv("THREADS");
+  const int max_num_threads =
+      threads_env ? std::max(1, atoi(threads_env))
+                  : std::max(1u, std::thread::hardware_concurrency());
+  const char* min_secs_env = getenv("MIN_SECS");
+  const float min_secs = min_secs_env ? atof(min_secs_env) : 0.1f;
+
+  TunedPlans plans;
+  FILE* existing = fopen(output, "r");
+  if (existing) {
+    fclose(existing);
+    if (!plans.Load(output)) {
+      fprintf(stderr, "%s is not a valid tuned plans file.\n", output);
+      return EXIT_FAILURE;
+    }
+  }
+  for (const Shape& shape : shapes) {
+    TunedPlans::Key key;
+    float latency, default_latency;
+    TunedPlan plan;
+    if (type == "f32") {
+      plan = Tune<float, float, float, float>(shape, max_num_threads, min_secs,
+                                              &key, &latency, &default_latency);
+    } else if (type == "i8") {
+      plan = Tune<std::int8_t, std::int8_t, std::int32_t, std::int8_t>(
+          shape, max_num_threads, min_secs, &key, &latency, &default_latency);
+    } else {
+      plan = Tune<std::uint8_t, std::uint8_t, std::int32_t, std::uint8_t>(
+          shape, max_num_threads, min_secs, &key, &latency, &default_latency);
+    }
+    plans.Set(key, plan);
+    printf(
+        "%dx%dx%d: thread_count=%d block_size_log2=%d traversal_order=%d, "
+        "%.4g us (default: %.4g us)\n",
+        shape.rows, shape.depth, shape.cols, plan.thread_count,
+        plan.block_map.block_size_log2,
+        plan.block_map.has_traversal_order
+            ? static_cast<int>(plan.block_map.traversal_order)
+            : -1,
+        1e6f * latency, 1e6f * default_latency);
+    fflush(stdout);
+  }
+  if (!plans.Save(output)) {
+    fprintf(stderr, "Failed to write %s.\n", output);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+
 }  // namespace ruy
 
 int main() {
+  const char* shapes_env = getenv("SHAPES");
+  if (shapes_env) {
+    return ruy::Autotune(shapes_env);
+  }
   // Infinite loop: the user can hit Ctrl-C
   while (true) {
     float eval;
@@ -0,0 +1,129 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "ruy/tuned_plans.h"
+
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+namespace ruy {
+
+namespace {
+
+constexpr int kMaxTraversalOrder =
+    static_cast<int>(BlockMapTraversalOrder::kFractalHilbert);
+
+// Parses one line of a tuned plans file. Returns false if it is malformed.
+bool ParseLine(const char* line, TunedPlans::Key* key, TunedPlan* plan) {
+  int path, traversal_order, chars;
+  if (sscanf(line, "%i %d %d %d %d %d %d %d %d %n", &path, &key->rows,
+             &key->depth, &key->cols, &key->lhs_scalar_size,
+             &key->rhs_scalar_size, &plan->thread_count,
+             &plan->block_map.block_size_log2, &traversal_order,
+             &chars) != 9 ||
+      line[chars] != '\0') {
+    return false;
+  }
+  // The path must be a single Path bit.
+  if (path <= 0 || path > 0xff || (path & (path - 1)) || key->rows <= 0 ||
+      key->depth <= 0 || key->cols <= 0 || key->lhs_scalar_size <= 0 ||
+      key->rhs_scalar_size <= 0 || plan->thread_count < 0 ||
+      plan->block_map.block_size_log2 < -1 || traversal_order < -1 ||
+      traversal_order > kMaxTraversalOrder) {
+    return false;
+  }
+  key->path = static_cast<Path>(path);
+  plan->block_map.has_traversal_order = traversal_order >= 0;
+  plan->block_map.traversal_order =
+      plan->block_map.has_traversal_order
+          ? static_cast<BlockMapTraversalOrder>(traversal_order)
+          : BlockMapTraversalOrder::kLinear;
+  return true;
+}
+
+}  // namespace
+
+std::size_t TunedPlans::KeyHash::operator()(const TunedPlans::Key& key) const {
+  // Same approach as PrepackedCache::KeyHash.
+  return static_cast<int>(key.path) + key.rows * 3 + key.depth * 5 +
+         key.cols * 7 + key.lhs_scalar_size * 11 + key.rhs_scalar_size * 13;
+}
+
+const TunedPlan* TunedPlans::Find(const Key& key) const {
+  const auto itr = plans_.find(key);
+  return itr == plans_.end() ? nullptr : &itr->second;
+}
+
+void TunedPlans::Set(const Key& key, const TunedPlan& plan) {
+  plans_[key] = plan;
+}
+
+bool TunedPlans::Load(const std::string& filename) {
+  FILE* f = fopen(filename.c_str(), "r");
+  if (!f) {
+    return false;
+  }
+  std::vector<std::pair<Key, TunedPlan>> loaded;
+  char line[256];
+  bool success = true;
+  while (success && fgets(line, sizeof(line), f)) {
+    const char* ptr = line;
+    while (*ptr == ' ' || *ptr == '\t') {
+      ptr++;
+    }
+    if (*ptr == '#' || *ptr == '\n' || *ptr == '\r' || *ptr == '\0') {
+      continue;
+    }
+    Key key;
+    TunedPlan plan;
+    success = ParseLine(ptr, &key, &plan);
+    loaded.emplace_back(key, plan);
+  }
+  success = success && !ferror(f);
+  fclose(f);
+  if (!success) {
+    return false;
+  }
+  for (const auto& entry : loaded) {
+    Set(entry.first, entry.second);
+  }
+  return true;
+}
+
+bool TunedPlans::Save(const std::string& filename) const {
+  FILE* f = fopen(filename.c_str(), "w");
+  if (!f) {
+    return false;
+  }
+  fprintf(f,
+          "# ruy tuned plans, see tuned_plans.h.\n"
+          "# path rows depth cols lhs_scalar_size rhs_scalar_size "
+          "thread_count block_size_log2 traversal_order\n");
+  for (const auto& entry : plans_) {
+    const Key& key = entry.first;
+    const TunedPlan& plan = entry.second;
+    fprintf(f, "0x%x %d %d %d %d %d %d %d %d\n", static_cast<int>(key.path),
+            key.rows, key.depth, key.cols, key.lhs_scalar_size,
+            key.rhs_scalar_size, plan.thread_count,
+            plan.block_map.block_size_log2,
+            plan.block_map.has_traversal_order
+                ? static_cast<int>(plan.block_map.traversal_order)
+                : -1);
+  }
+  return fclose(f) == 0;
+}
+
+}  // namespace ruy
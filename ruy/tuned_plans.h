@@ -0,0 +1,103 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Per-shape decisions found by benchmarking, overriding the heuristics that
+// TrMul otherwise uses to pick a number of threads (GetThreadCount in
+// trmul.cc) and to tile the destination into blocks (MakeBlockMap). They are
+// produced by tune_tool, which benchmarks candidates for a list of shapes on
+// the target hardware and saves the winners to a file, which a Context then
+// loads, see Context::LoadTunedPlans.
+//
+// # File format
+//
+// A text file with one tuned plan per line, as whitespace-separated integers:
+//   path rows depth cols lhs_scalar_size rhs_scalar_size
+//       thread_count block_size_log2 traversal_order
+// where path is the numerical value of the Path, e.g. 0x10 for kAvx512, the
+// scalar sizes are those of the LHS and RHS source matrices, in bytes, and
+// the last three fields are those of TunedPlan, with -1 standing for "not
+// overridden" (0 for thread_count). traversal_order is the numerical value of
+// a BlockMapTraversalOrder. Empty lines and lines starting with '#' are
+// ignored.
+
+#ifndef RUY_RUY_TUNED_PLANS_H_
+#define RUY_RUY_TUNED_PLANS_H_
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+#include "ruy/block_map.h"
+#include "ruy/path.h"
+
+namespace ruy {
+
+// The overrides for one shape.
+struct TunedPlan {
+  // The number of threads, capped by Context::max_num_threads, or 0 to let
+  // GetThreadCount choose.
+  int thread_count = 0;
+  // See MakeBlockMap.
+  BlockMapOverrides block_map;
+};
+
+// A set of TunedPlan's, keyed by Path, shape and types.
+class TunedPlans final {
+ public:
+  // Tuned plans apply to multiplications, other than strided batches, of the
+  // given shape and source scalar sizes, running on the given Path.
+  struct Key {
+    Path path;
+    int rows;
+    int depth;
+    int cols;
+    int lhs_scalar_size;
+    int rhs_scalar_size;
+  };
+
+  friend bool operator==(const Key& a, const Key& b) {
+    return a.path == b.path && a.rows == b.rows && a.depth == b.depth &&
+           a.cols == b.cols && a.lhs_scalar_size == b.lhs_scalar_size &&
+           a.rhs_scalar_size == b.rhs_scalar_size;
+  }
+
+  struct KeyHash {
+    std::size_t operator()(const Key&) const;
+  };
+
+  // Returns the number of tuned plans.
+  int PlanCount() const { return plans_.size(); }
+
+  // Returns the tuned plan for the given key, or nullptr if there is none.
+  const TunedPlan* Find(const Key& key) const;
+
+  // Sets the tuned plan for the given key, replacing any existing one.
+  void Set(const Key& key, const TunedPlan& plan);
+
+  // Adds the tuned plans from the given file, see the file format above,
+  // replacing existing ones with the same keys. Returns false if the file
+  // can't be read or is malformed, in which case this is left unchanged.
+  bool Load(const std::string& filename);
+
+  // Writes all tuned plans to the given file. Returns false on failure.
+  bool Save(const std::string& filename) const;
+
+ private:
+  std::unordered_map<Key, TunedPlan, KeyHash> plans_;
+};
+
+}  // namespace ruy
+
+#endif  // RUY_RUY_TUNED_PLANS_H_
@@ -0,0 +1,201 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "ruy/tuned_plans.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "ruy/block_map.h"
+#include "ruy/context.h"
+#include "ruy/context_get_ctx.h"
+#include "ruy/ctx.h"
+#include "ruy/gtest_wrapper.h"
+#include "ruy/matrix.h"
+#include "ruy/mul_params.h"
+#include "ruy/path.h"
+#include "ruy/ruy.h"
+
+namespace ruy {
+namespace {
+
+std::string TempFilename(const char* name) {
+  const char* tmpdir = getenv("TEST_TMPDIR");
+  return std::string(tmpdir ? tmpdir : "/tmp") + "/" + name;
+}
+
+void WriteFile(const std::string& path, const char* contents) {
+  FILE* f = fopen(path.c_str(), "w");
+  ASSERT_NE(f, nullptr);
+  fputs(contents, f);
+  fclose(f);
+}
+
+TunedPlans::Key MakeKey(Path path, int rows, int depth, int cols) {
+  TunedPlans::Key key;
+  key.path = path;
+  key.rows = rows;
+  key.depth = depth;
+  key.cols = cols;
+  key.lhs_scalar_size = 4;
+  key.rhs_scalar_size = 4;
+  return key;
+}
+
+TEST(TunedPlansTest, SaveAndLoad) {
+  TunedPlans plans;
+  TunedPlan plan1;
+  plan1.thread_count = 3;
+  TunedPlan plan2;
+  plan2.block_map.block_size_log2 = 5;
+  plan2.block_map.has_traversal_order = true;
+  plan2.block_map.traversal_order = BlockMapTraversalOrder::kFractalU;
+  plans.Set(MakeKey(Path::kStandardCpp, 100, 200, 300), plan1);
+  plans.Set(MakeKey(Path::kStandardCpp, 300, 200, 100), plan2);
+  EXPECT_EQ(plans.PlanCount(), 2);
+  const std::string filename = TempFilename("ruy_tuned_plans_save_and_load");
+  ASSERT_TRUE(plans.Save(filename));
+
+  TunedPlans loaded;
+  ASSERT_TRUE(loaded.Load(filename));
+  EXPECT_EQ(loaded.PlanCount(), 2);
+  EXPECT_EQ(loaded.Find(MakeKey(Path::kStandardCpp, 100, 200, 301)), nullptr);
+  EXPECT_EQ(loaded.Find(MakeKey(Path::kNone, 100, 200, 300)), nullptr);
+  const TunedPlan* loaded1 =
+      loaded.Find(MakeKey(Path::kStandardCpp, 100, 200, 300));
+  ASSERT_NE(loaded1, nullptr);
+  EXPECT_EQ(loaded1->thread_count, 3);
+  EXPECT_EQ(loaded1->block_map.block_size_log2, -1);
+  EXPECT_FALSE(loaded1->block_map.has_traversal_order);
+  const TunedPlan* loaded2 =
+      loaded.Find(MakeKey(Path::kStandardCpp, 300, 200, 100));
+  ASSERT_NE(loaded2, nullptr);
+  EXPECT_EQ(loaded2->thread_count, 0);
+  EXPECT_EQ(loaded2->block_map.block_size_log2, 5);
+  EXPECT_TRUE(loaded2->block_map.has_traversal_order);
+  EXPECT_EQ(loaded2->block_map.traversal_order,
+            BlockMapTraversalOrder::kFractalU);
+  remove(filename.c_str());
+}
+
+TEST(TunedPlansTest, LoadMalformed) {
+  const std::string filename = TempFilename("ruy_tuned_plans_malformed");
+  TunedPlans plans;
+  EXPECT_FALSE(plans.Load(filename + "_nonexistent"));
+  WriteFile(filename,
+            "# comment\n"
+            "\n"
+            "0x2 10 20 30 4 4 2 -1 -1\n");
+  EXPECT_TRUE(plans.Load(filename));
+  EXPECT_EQ(plans.PlanCount(), 1);
+  // Each of these lines is malformed: a missing field, an extra field, a
+  // value that is not a single Path bit, an invalid traversal order.
+  for (const char* line :
+       {"0x2 11 20 30 4 4 2 -1\n", "0x2 11 20 30 4 4 2 -1 -1 7\n",
+        "0x3 11 20 30 4 4 2 -1 -1\n", "0x2 11 20 30 4 4 2 -1 4\n"}) {
+    WriteFile(filename, (std::string("0x2 12 20 30 4 4 2 -1 -1\n") + line)
+                            .c_str());
+    EXPECT_FALSE(plans.Load(filename)) << line;
+    // Nothing was loaded, not even the valid first line.
+    EXPECT_EQ(plans.PlanCount(), 1);
+  }
+  remove(filename.c_str());
+}
+
+// Runs a float Mul of the given shape, with all entries of the LHS and RHS
+// equal to 1, and checks the result.
+void TestMul(int rows, int depth, int cols, Context* context) {
+  std::vector<float> lhs_data(rows * depth, 1.0f);
+  std::vector<float> rhs_data(depth * cols, 1.0f);
+  std::vector<float> dst_data(rows * cols);
+  Matrix<float> lhs;
+  MakeSimpleLayout(rows, depth, Order::kRowMajor, lhs.mutable_layout());
+  lhs.set_data(lhs_data.data());
+  Matrix<float> rhs;
+  MakeSimpleLayout(depth, cols, Order::kColMajor, rhs.mutable_layout());
+  rhs.set_data(rhs_data.data());
+  Matrix<float> dst;
+  MakeSimpleLayout(rows, cols, Order::kColMajor, dst.mutable_layout());
+  dst.set_data(dst_data.data());
+  MulParams<float, float> mul_params;
+  Mul(lhs, rhs, mul_params, context, &dst);
+  for (float value : dst_data) {
+    EXPECT_EQ(value, depth);
+  }
+}
+
+// Checks that multiplications give correct results with any tuned plan,
+// including block sizes out of the range that MakeBlockMap supports.
+TEST(TunedPlansTest, MulWithTunedPlans) {
+  Context context;
+  context.set_max_num_threads(4);
+  // Rows, depth and cols of each shape. The second one is a matrix*vector
+  // product, which only uses the thread count.
+  const int shapes[][3] = {{150, 70, 90}, {33, 500, 1}, {17, 5, 300}};
+  for (const auto& shape : shapes) {
+    const int rows = shape[0];
+    const int depth = shape[1];
+    const int cols = shape[2];
+    // Find out the Path.
+    TestMul(rows, depth, cols, &context);
+    const Path path = context.last_used_path();
+    for (int thread_count : {0, 1, 3, 8}) {
+      for (int block_size_log2 : {-1, 0, 3, 5, 20}) {
+        for (int traversal_order = -1; traversal_order <= 3;
+             traversal_order++) {
+          TunedPlan plan;
+          plan.thread_count = thread_count;
+          plan.block_map.block_size_log2 = block_size_log2;
+          plan.block_map.has_traversal_order = traversal_order >= 0;
+          if (traversal_order >= 0) {
+            plan.block_map.traversal_order =
+                static_cast<BlockMapTraversalOrder>(traversal_order);
+          }
+          TunedPlans plans;
+          plans.Set(MakeKey(path, rows, depth, cols), plan);
+          get_ctx(&context)->SetTunedPlans(plans);
+          TestMul(rows, depth, cols, &context);
+        }
+      }
+    }
+  }
+}
+
+TEST(TunedPlansTest, ContextLoadTunedPlans) {
+  Context context;
+  const std::string filename = TempFilename("ruy_tuned_plans_context");
+  EXPECT_FALSE(context.LoadTunedPlans(filename + "_nonexistent"));
+  EXPECT_EQ(get_ctx(&context)->tuned_plans(), nullptr);
+  WriteFile(filename, "0x2 10 20 30 4 4 2 -1 -1\n");
+  EXPECT_TRUE(context.LoadTunedPlans(filename));
+  WriteFile(filename, "0x2 10 20 31 4 4 2 -1 -1\n");
+  EXPECT_TRUE(context.LoadTunedPlans(filename));
+  // The second file was merged into the first.
+  ASSERT_NE(get_ctx(&context)->tuned_plans(), nullptr);
+  EXPECT_EQ(get_ctx(&context)->tuned_plans()->PlanCount(), 2);
+  context.ClearTunedPlans();
+  EXPECT_EQ(get_ctx(&context)->tuned_plans(), nullptr);
+  remove(filename.c_str());
+}
+
+}  // namespace
+}  // namespace ruy
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,54 @@
+/* Copyright 2020 Google LLC. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef RUY_RUY_WARM_UP_H_
+#define RUY_RUY_WARM_UP_H_
+
+#include <cstddef>
+
+namespace ruy {
+
+// Describes the work that Context::WarmUp should prepare for. The first
+// multiplication on a fresh Context is much slower than the following ones:
+// it spawns the worker threads, detects the CPU features, cache sizes and
+// topology, grows the internal arenas from empty through system allocations,
+// and takes a page fault on every page of them on first write. WarmUp does
+// all of that up front, sizing the arenas for the largest multiplication
+// described here.
+//
+// The arena sizes are the maximum of the explicit byte budgets and of the
+// estimates derived from the shape fields, so either may be left at 0.
+struct WarmUpParams final {
+  // The largest shape of multiplication expected, as the number of rows of
+  // the LHS, the depth, and the number of columns of the RHS.
+  int max_rows = 0;
+  int max_depth = 0;
+  int max_cols = 0;
+  // The size in bytes of the LHS and RHS scalars: 4 for float, 1 for 8-bit.
+  int scalar_size = 4;
+  // Explicit budgets for the arena used by the calling thread, which holds
+  // packed matrices, and for the arena of each worker thread, which holds
+  // the accumulators of split-depth and depth-blocked multiplications.
+  std::ptrdiff_t main_arena_bytes = 0;
+  std::ptrdiff_t thread_arena_bytes = 0;
+  // Whether to also write to every page of the arenas, so that their page
+  // faults happen now. Each worker thread touches its own arena, which
+  // places it on that thread's NUMA node.
+  bool prefault_arenas = false;
+};
+
+}  // namespace ruy
+
+#endif  // RUY_RUY_WARM_UP_H_